@@ -0,0 +1,143 @@
+// Throughput of the line-emitting execute stages (head, nl, grep -n).
+//
+// Generates a text input in memory and feeds it through each stage the way a run
+// does: line-bounded chunks, output appended to one buffer that is drained after every
+// chunk. Reports input MB/s (best of several passes) so changes to the emit paths can
+// be compared without the file reader, the paging sink or the API in the way.
+//
+//   make bench                     # builds and runs with the defaults
+//   src/aicli_bench [MB] [PASSES]  # input size (default 64) and passes (default 5)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buf.h"
+#include "execute/pipeline_stages.h"
+
+#define CHUNK_BYTES (256 * 1024)
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Log-like lines of varying length; about one in eight contains "ERROR".
+static char *generate_input(size_t bytes, size_t *out_len)
+{
+	static const char *const words[] = {"alpha", "bravo", "charlie", "delta", "echo",
+	                                    "foxtrot", "golf", "hotel", "india", "juliet"};
+	char *data = (char *)malloc(bytes + 256);
+	if (!data)
+		return NULL;
+	size_t len = 0;
+	unsigned long x = 2463534242UL;
+	for (unsigned long line = 1; len < bytes; line++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		len += (size_t)sprintf(data + len, "%08lu %s ", line, (x & 7) == 0 ? "ERROR" : "INFO");
+		for (unsigned long w = 0; w < 3 + (x >> 8) % 10; w++)
+			len += (size_t)sprintf(data + len, "%s ", words[(x >> (w + 3)) % 10]);
+		data[len - 1] = '\n';
+	}
+	*out_len = len;
+	return data;
+}
+
+// One pass of st over data. Returns the output size, or (size_t)-1 on a stage error.
+static size_t run_pass(aicli_stage_t *st, const char *data, size_t len, aicli_buf_t *out)
+{
+	size_t produced = 0;
+	size_t pos = 0;
+	aicli_stage_reset(st);
+	while (pos < len) {
+		size_t n = len - pos < CHUNK_BYTES ? len - pos : CHUNK_BYTES;
+		// Every chunk but the last ends on a line boundary (the stage contract).
+		if (pos + n < len) {
+			size_t cut = n;
+			while (cut > 0 && data[pos + cut - 1] != '\n')
+				cut--;
+			if (cut > 0)
+				n = cut;
+		}
+		out->len = 0;
+		aicli_stage_status_t s = aicli_stage_feed(st, data + pos, n, false, out);
+		produced += out->len;
+		pos += n;
+		if (s == AICLI_STAGE_DONE)
+			return produced;
+		if (s != AICLI_STAGE_CONTINUE)
+			return (size_t)-1;
+	}
+	for (;;) {
+		out->len = 0;
+		aicli_stage_status_t s = aicli_stage_feed(st, NULL, 0, true, out);
+		produced += out->len;
+		if (s == AICLI_STAGE_MORE)
+			continue;
+		return s == AICLI_STAGE_ERROR || s == AICLI_STAGE_TOO_LARGE ? (size_t)-1 : produced;
+	}
+}
+
+static int bench(const char *label, aicli_stage_t *st, const char *data, size_t len, int passes)
+{
+	if (!st) {
+		fprintf(stderr, "%s: cannot create stage\n", label);
+		return 1;
+	}
+	aicli_buf_t out;
+	if (!aicli_buf_init(&out, CHUNK_BYTES * 2)) {
+		aicli_stage_free(st);
+		return 1;
+	}
+	double best = 0;
+	size_t produced = 0;
+	for (int i = 0; i < passes; i++) {
+		double t0 = now_seconds();
+		produced = run_pass(st, data, len, &out);
+		double dt = now_seconds() - t0;
+		if (produced == (size_t)-1) {
+			fprintf(stderr, "%s: stage failed\n", label);
+			aicli_buf_free(&out);
+			aicli_stage_free(st);
+			return 1;
+		}
+		if (i == 0 || dt < best)
+			best = dt;
+	}
+	printf("%-12s %9.1f MB/s  (%.1f MB in, %.1f MB out, best of %d)\n", label,
+	       (double)len / (1024.0 * 1024.0) / best, (double)len / (1024.0 * 1024.0),
+	       (double)produced / (1024.0 * 1024.0), passes);
+	aicli_buf_free(&out);
+	aicli_stage_free(st);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long mb = argc > 1 ? strtol(argv[1], NULL, 10) : 64;
+	long passes = argc > 2 ? strtol(argv[2], NULL, 10) : 5;
+	if (mb <= 0 || mb > 4096 || passes <= 0 || passes > 1000) {
+		fprintf(stderr, "usage: %s [MB (1..4096)] [PASSES (1..1000)]\n", argv[0]);
+		return 2;
+	}
+
+	size_t len = 0;
+	char *data = generate_input((size_t)mb * 1024 * 1024, &len);
+	if (!data) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	int rc = 0;
+	rc |= bench("head -n", aicli_stage_head_new((size_t)-1), data, len, (int)passes);
+	rc |= bench("nl", aicli_stage_nl_new(), data, len, (int)passes);
+	rc |= bench("grep -n", aicli_stage_grep_new("ERROR", false, false, true), data, len,
+	            (int)passes);
+	free(data);
+	return rc;
+}
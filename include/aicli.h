@@ -3,7 +3,16 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+// Page of a tool call made outside a tool-loop run (aicli _exec, ...); also the smallest
+// page the run's output budget hands out (see tool_budget.h).
 #define AICLI_MAX_TOOL_BYTES 4096
+// Largest page of one tool call.
+#define AICLI_MAX_TOOL_PAGE_BYTES (256 * 1024)
+// Default output budget of a run: per turn and in total (AICLI_TOOL_OUTPUT_BUDGET,
+// AICLI_TOOL_OUTPUT_TOTAL).
+#define AICLI_DEFAULT_TOOL_OUTPUT_TURN (64 * 1024)
+#define AICLI_DEFAULT_TOOL_OUTPUT_RUN (512 * 1024)
+#define AICLI_DEFAULT_TOOL_TIMEOUT_MS 60000
 
 typedef enum {
 	AICLI_SEARCH_PROVIDER_GOOGLE_CSE = 0,
@@ -19,6 +28,15 @@ typedef struct {
 	bool model_owned;
 	int debug_api;
 	int debug_function_call;
+	// Request server-sent events and print output text as it arrives (run --stream).
+	bool stream;
+	// Time budget for the tool calls of one turn, in ms (run --tool-timeout); 0 = none.
+	// Calls still running when it expires are cancelled and answered with a timeout.
+	long tool_timeout_ms;
+	// Tool output budget in bytes, per turn and for the whole run (see tool_budget.h);
+	// 0 = default.
+	size_t tool_output_turn_bytes;
+	size_t tool_output_run_bytes;
 	aicli_search_provider_t search_provider;
 
 	// Google Programmable Search Engine / Custom Search JSON API
@@ -44,6 +62,7 @@ typedef struct {
 	const char *stderr_text;
 	int exit_code;
 	size_t total_bytes;
+	bool total_bytes_lower_bound; // output was cut short once the page was full
 	bool truncated;
 	bool cache_hit;
 	bool has_next_start;
@@ -70,4 +89,5 @@ typedef struct {
 	const char *idempotency; // optional
 	size_t start;
 	size_t size;
+	size_t max_size; // page cap; 0: AICLI_MAX_TOOL_BYTES
 } aicli_execute_request_t;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "aicli.h"
+
+// Batch mode (aicli batch).
+//
+// Reads one JSON object per line and runs each as an independent tool-loop conversation
+// (aicli_openai_run_with_tools), up to `concurrency` at a time on a pool of conversation
+// threads. Each of those threads keeps its curl handle, so its API connection stays open
+// from one conversation to the next; the tool pool, the paging cache and the compiled
+// pipelines are shared by all conversations.
+//
+// Input line:  {"prompt": "...", "files": ["PATH", ...], "id": <any JSON>}
+//   prompt is required. files is that conversation's allowlist (relative paths are
+//   resolved against the working directory). id is echoed back unchanged.
+// Output line, written as soon as its conversation ends (completion order):
+//   {"index":N,"id":...,"ok":true,"text":"...","response_id":"..."}
+//   {"index":N,"id":...,"ok":false,"error":"..."}
+// index is the 0-based input line number; blank lines are skipped but counted.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AICLI_BATCH_DEFAULT_CONCURRENCY 4
+#define AICLI_BATCH_MAX_CONCURRENCY 256
+
+typedef struct {
+	size_t concurrency;             // conversations in flight; 0: AICLI_BATCH_DEFAULT_CONCURRENCY
+	size_t max_turns;               // as for aicli run (0: its default)
+	size_t max_tool_calls_per_turn; // as for aicli run (0: its default)
+	size_t tool_threads;            // workers of the shared tool pool; 0: concurrency
+	const char *tool_choice;        // NULL: let the model decide
+} aicli_batch_opts_t;
+
+// Returns 0 if every request succeeded, 1 if some failed (their lines say why), 2 if the
+// input could not be read or the batch could not start (message on stderr).
+int aicli_batch_run(const aicli_config_t *cfg, const aicli_batch_opts_t *opts, FILE *in,
+                    FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,3 +13,15 @@ bool aicli_buf_init(aicli_buf_t *b, size_t initial_cap);
 void aicli_buf_free(aicli_buf_t *b);
 bool aicli_buf_append(aicli_buf_t *b, const void *data, size_t n);
 bool aicli_buf_append_str(aicli_buf_t *b, const char *s);
+
+// Makes room for n more bytes and returns where they go (data + len), or NULL on
+// allocation failure. The caller fills up to n bytes and adds what it wrote to len, so
+// a record built from several pieces costs one capacity check.
+char *aicli_buf_reserve(aicli_buf_t *b, size_t n);
+
+// Room aicli_buf_put_ulong() needs at most, for widths up to this.
+#define AICLI_BUF_ULONG_MAX 20
+
+// Writes v in decimal, right-aligned in `width` columns (padded with spaces, 0: no
+// padding), to dst and returns the number of bytes written.
+size_t aicli_buf_put_ulong(char *dst, unsigned long v, unsigned width);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cooperative cancellation for tool jobs.
+//
+// A token is cancelled explicitly or by passing its deadline. Long-running code polls
+// it at natural boundaries (a chunk of a pipeline, the curl progress callback); nothing
+// is interrupted preemptively.
+//
+// The thread pool publishes the token of the job it is running as the thread's current
+// token, so code deep inside a job can poll aicli_cancel_current() without the token
+// being threaded through every signature.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	atomic_bool cancelled;
+	int64_t deadline_ms; // aicli_monotonic_ms() clock; 0 = none
+} aicli_cancel_t;
+
+int64_t aicli_monotonic_ms(void);
+
+// deadline_ms: absolute aicli_monotonic_ms() time, or 0 for no deadline.
+void aicli_cancel_init(aicli_cancel_t *c, int64_t deadline_ms);
+void aicli_cancel_request(aicli_cancel_t *c);
+// True once cancelled or past the deadline. NULL is never cancelled.
+bool aicli_cancel_requested(const aicli_cancel_t *c);
+
+// Token of the job running on this thread (NULL outside pool jobs).
+const aicli_cancel_t *aicli_cancel_current(void);
+// Returns the previous token so callers can restore it.
+const aicli_cancel_t *aicli_cancel_set_current(const aicli_cancel_t *c);
+
+#ifdef __cplusplus
+}
+#endif
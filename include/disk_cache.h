@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+// Persistent response cache shared by all aicli processes of a user.
+//
+// Opt-in: enabled only when AICLI_DISK_CACHE=1. Entries live under
+// $XDG_CACHE_HOME/aicli (or ~/.cache/aicli), one file per key, named by a 128-bit hash
+// of the key; the full key is stored in the entry and checked on lookup.
+//
+// - Writes are atomic (private temp file + rename), so readers in other processes
+//   see either the old or the new entry, never a partial one.
+// - Reads mmap the entry; the body is served straight from the mapping.
+// - Each entry carries its own expiry plus optional HTTP validators (ETag,
+//   Last-Modified) so a stale entry can be revalidated instead of refetched.
+// - The directory is capped in bytes; on insert the least recently used entries
+//   (file mtime, bumped on every hit) are removed until it fits again.
+//
+// Tunables (environment):
+//   AICLI_DISK_CACHE=1               enable
+//   AICLI_DISK_CACHE_TTL=SECONDS     freshness lifetime and maximum entry age (default 3600)
+//   AICLI_DISK_CACHE_MAX_MB=N        size cap for the directory (default 256)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AICLI_DISK_CACHE_DEFAULT_TTL 3600
+#define AICLI_DISK_CACHE_DEFAULT_MAX_BYTES ((size_t)256 * 1024 * 1024)
+#define AICLI_DISK_CACHE_VALIDATOR_MAX 256
+
+typedef struct aicli_disk_cache aicli_disk_cache_t;
+
+typedef struct {
+	const char *body; // points into the mapping; valid until _entry_release
+	size_t body_len;
+	int http_status;
+	time_t stored_at;
+	time_t expires_at;
+	bool fresh;       // before expires_at and younger than the cache's TTL
+	char etag[AICLI_DISK_CACHE_VALIDATOR_MAX];          // "" if none
+	char last_modified[AICLI_DISK_CACHE_VALIDATOR_MAX]; // "" if none
+	char content_type[AICLI_DISK_CACHE_VALIDATOR_MAX];  // "" if none
+
+	// private
+	void *map;
+	size_t map_len;
+} aicli_disk_cache_entry_t;
+
+typedef struct {
+	int http_status;           // 0 if not an HTTP response
+	const char *content_type;  // may be NULL
+	const char *etag;          // may be NULL
+	const char *last_modified; // may be NULL
+	long ttl_seconds;          // < 0 selects the cache's default TTL
+} aicli_disk_cache_meta_t;
+
+// Process-wide cache configured from the environment as it is now (one cache is kept
+// per distinct configuration). Returns NULL when the cache is disabled or its directory cannot be created.
+aicli_disk_cache_t *aicli_disk_cache_default(void);
+
+// Opens a cache rooted at dir (created 0700 if missing). max_bytes == 0 and
+// default_ttl < 0 select the defaults.
+aicli_disk_cache_t *aicli_disk_cache_open(const char *dir, size_t max_bytes, long default_ttl);
+void aicli_disk_cache_close(aicli_disk_cache_t *c);
+
+// Maps the entry for key. Returns false if it is missing, corrupt or belongs to a
+// colliding key. Stale entries are returned too (fresh == false) so the caller can
+// revalidate them. Release with aicli_disk_cache_entry_release().
+bool aicli_disk_cache_lookup(aicli_disk_cache_t *c, const char *key,
+                             aicli_disk_cache_entry_t *out);
+void aicli_disk_cache_entry_release(aicli_disk_cache_entry_t *e);
+
+// Stores body under key, replacing any previous entry, then trims the directory to
+// the size cap. Returns false on I/O errors or if the entry alone exceeds the cap.
+bool aicli_disk_cache_store(aicli_disk_cache_t *c, const char *key, const char *body,
+                            size_t body_len, const aicli_disk_cache_meta_t *meta);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,10 +1,14 @@
 #pragma once
 
-#include <stdbool.h>
-#include <stddef.h>
-
-#include "buf.h"
+#include "execute/pipeline_stages.h"
 #include "execute_dsl.h"
 
-bool aicli_execute_apply_stage(const aicli_dsl_stage_t *stg, const char *in, size_t in_len,
-                              aicli_buf_t *out);
+// Builds the streaming stage for a parsed DSL stage.
+// Returns NULL when the command or its arguments are not supported.
+aicli_stage_t *aicli_execute_open_stage(const aicli_dsl_stage_t *stg);
+
+// Opens the stages after `cat` (pipe->stages[1..]) into out[8], fusing every run of
+// adjacent fusable stages into one (aicli_stage_fused_new()). Returns the number of
+// stages in out, or -1 if one is unsupported or on allocation failure (nothing is left
+// open then).
+int aicli_execute_open_stages(const aicli_dsl_pipeline_t *pipe, aicli_stage_t **out);
@@ -1,10 +1,51 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <sys/stat.h>
 
-// Reads up to max_bytes from path starting at start.
-// - Allocates *out_buf (null-terminated) which caller must free.
-// - Writes *out_len (bytes read, excluding '\0') and *out_total (file size).
-// Returns 0 on success, -1 on failure (errno is set by stdio functions).
-int aicli_read_file_range(const char *path, size_t start, size_t max_bytes, char **out_buf,
-                          size_t *out_len, size_t *out_total);
+// Reads a file as line-bounded chunks for the streaming pipeline stages.
+//
+// Every chunk except the last one ends with '\n'; the last one (at_eof) holds whatever
+// follows the final newline and may be empty. A consumer that stops early never
+// touches the rest of the file.
+//
+// Regular files are mapped read-only and chunks are views into the mapping, so the
+// stages read the page cache directly (no copy, no extra RSS beyond touched pages).
+// Anything that cannot be mapped (pipes, procfs, empty files) falls back to read();
+// then memory use is one read block plus the longest line.
+typedef struct {
+	int fd;
+	struct stat st; // fstat() of the open file: identifies the exact contents being read
+	const char *map; // whole-file mapping, or NULL when using read()
+	size_t map_len;
+	size_t map_pos;      // start of bytes not yet handed out
+	size_t map_released; // pages below this offset were dropped with MADV_DONTNEED
+	char *buf;
+	size_t cap;
+	size_t len;   // valid bytes in buf
+	size_t pos;   // start of bytes not yet handed out
+	size_t block; // bytes requested per read()
+	bool eof;
+} aicli_line_reader_t;
+
+#define AICLI_LINE_READER_BLOCK (64 * 1024)
+
+// Returns 0 on success, -1 on failure (errno is set).
+int aicli_line_reader_open(aicli_line_reader_t *r, const char *path);
+
+// Sets *out_chunk/*out_len to the next chunk, valid until the next call.
+// *out_at_eof is true for the last chunk. Returns 0 on success, -1 on read errors.
+int aicli_line_reader_next(aicli_line_reader_t *r, const char **out_chunk, size_t *out_len,
+                           bool *out_at_eof);
+
+// If the file is mapped, returns true and exposes the whole contents without reading
+// anything. Lets callers with no stages page through a file touching only the window.
+bool aicli_line_reader_view(const aicli_line_reader_t *r, const char **out_data, size_t *out_len);
+
+// Mapped files only, before the first chunk: makes reading start at `offset`, which
+// must be a line start. The skipped pages are never touched. Returns false if the file
+// is not mapped or offset is past the end.
+bool aicli_line_reader_seek(aicli_line_reader_t *r, size_t offset);
+
+void aicli_line_reader_close(aicli_line_reader_t *r);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Sparse line-offset index of a mapped file.
+//
+// Records where every AICLI_LINE_INDEX_STRIDE-th line starts; any other line is found
+// from the nearest sample with at most STRIDE - 1 memchr() steps. The newline scan
+// that builds it is vectorized (AVX2/SSE2, picked at runtime) and incremental: it only
+// goes as far into the file as the deepest line asked for so far, so `sed -n 1,20p`
+// never scans a large file while `tail` scans it once.
+//
+// Indexes are shared process-wide in a small LRU keyed by the file's identity
+// (dev/inode/size/mtime, as for the execute output cache), so walking a big file with
+// successive `sed -n N,Mp` windows costs O(window) per call instead of O(N).
+
+#define AICLI_LINE_INDEX_STRIDE 1024
+#define AICLI_LINE_INDEX_CACHE_MAX 16
+
+typedef struct aicli_line_index aicli_line_index_t;
+
+// Returns a reference to the index of the file with identity st (creating an empty
+// one if needed), or NULL on allocation failure. Release with aicli_line_index_release().
+aicli_line_index_t *aicli_line_index_get(const struct stat *st);
+void aicli_line_index_release(aicli_line_index_t *ix);
+
+// The caller passes the file's contents (its own mapping) on every call; the index
+// only stores offsets. Both return false on allocation failure.
+
+// Sets *out_off to where 1-based line *line_no starts. If the file has fewer lines,
+// *line_no is lowered to the last one (the text after the final '\n', possibly empty).
+bool aicli_line_index_offset(aicli_line_index_t *ix, const char *data, size_t len,
+                             unsigned long *line_no, size_t *out_off);
+
+// Sets *out to the number of '\n' bytes in the file.
+bool aicli_line_index_newlines(aicli_line_index_t *ix, const char *data, size_t len,
+                               size_t *out);
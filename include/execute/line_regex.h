@@ -0,0 +1,38 @@
+#pragma once
+
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buf.h"
+#include "execute/memsearch.h"
+
+// A POSIX BRE compiled once and matched against (ptr, len) line slices.
+//
+// Lines are handed to regexec() in place through REG_STARTEND; only libcs without it
+// get a NUL-terminated copy (into a buffer reused for every line). At compile time
+// the longest literal that every match must contain is pulled out of the pattern,
+// and lines without it are rejected by the SIMD fixed-string search before the
+// regex engine ever runs.
+typedef struct {
+	regex_t rx;
+	char *lit; // required literal, or NULL when the pattern has none
+	size_t lit_len;
+	aicli_memsearch_t pre; // searcher for lit
+#ifndef REG_STARTEND
+	aicli_buf_t scratch;
+#endif
+} aicli_line_regex_t;
+
+// Returns 0 on success, else the regcomp() error (r is then left freed).
+int aicli_line_regex_compile(aicli_line_regex_t *r, const char *pattern);
+void aicli_line_regex_free(aicli_line_regex_t *r);
+
+// Searcher for the required literal (NULL if none). A text without a hit for it
+// contains no match, so callers may use it to skip whole chunks.
+const aicli_memsearch_t *aicli_line_regex_prefilter(const aicli_line_regex_t *r);
+
+// Like regexec() on line[0..len) as if it were a NUL-terminated string. m (may be
+// NULL) receives the whole-match offsets relative to line.
+// Returns 0 on match, REG_NOMATCH, or another regexec() error.
+int aicli_line_regex_exec(aicli_line_regex_t *r, const char *line, size_t len, regmatch_t *m);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+// Fixed-string search over large buffers (grep -F).
+//
+// The needle is reduced to its two rarest bytes (by a static byte-frequency ranking)
+// and the haystack is scanned for positions where both appear at the right distance,
+// 16 or 32 candidates per step; only those candidates are compared in full. The
+// kernel (AVX2, SSE2 or scalar) is picked once at runtime from the CPU's features.
+typedef struct {
+	const char *needle; // borrowed; must outlive the searcher
+	size_t len;
+	size_t i1, i2; // offsets of the rare bytes in the needle (i1 != i2 unless len == 1)
+	unsigned char b1, b2;
+} aicli_memsearch_t;
+
+// needle_len must be > 0.
+void aicli_memsearch_init(aicli_memsearch_t *s, const char *needle, size_t needle_len);
+
+// First occurrence of the needle in hay[0..hay_len), or NULL.
+const char *aicli_memsearch_find(const aicli_memsearch_t *s, const char *hay, size_t hay_len);
+
+// Name of the selected kernel ("avx2", "sse2", "scalar"), for diagnostics and benches.
+const char *aicli_memsearch_kernel(void);
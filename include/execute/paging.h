@@ -1,8 +1,42 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#include "buf.h"
 #include "execute_tool.h"
 
-void aicli_apply_paging(const char *data, size_t total, size_t start, size_t size,
-                        aicli_tool_result_t *out);
+// Output sink for the execute pipeline.
+// Counts every byte written but keeps only the [start, start+size) window, so the
+// memory used for stdout is bounded by the page size, not by the output size.
+typedef struct {
+	size_t start;
+	size_t size;
+	size_t total; // bytes written so far
+	aicli_buf_t window;
+	aicli_buf_t full;       // whole output, when capturing (see below)
+	size_t capture_limit;   // 0: not capturing
+	bool capture_overflow;  // output grew past capture_limit and was dropped
+	bool stopped;           // the run ended at aicli_paging_sink_full(): total is a lower bound
+} aicli_paging_sink_t;
+
+bool aicli_paging_sink_init(aicli_paging_sink_t *sink, size_t start, size_t size);
+
+// Also keeps the whole output (up to limit bytes) so it can be cached and paged later.
+// Past the limit the copy is dropped and the sink keeps working on the window only.
+void aicli_paging_sink_capture(aicli_paging_sink_t *sink, size_t limit);
+
+bool aicli_paging_sink_write(aicli_paging_sink_t *sink, const char *data, size_t len);
+
+// True once the window and at least one byte after it have been written (truncated and
+// next_start are settled) and the whole output is not being captured, so more output
+// would only be counted. The caller may then stop the run and set `stopped`.
+bool aicli_paging_sink_full(const aicli_paging_sink_t *sink);
+
+// Returns true and the whole output if capturing was enabled and did not overflow.
+bool aicli_paging_sink_captured(const aicli_paging_sink_t *sink, const char **out_data,
+                                size_t *out_len);
+
+// Moves the window into out->stdout_text and fills the paging fields of `out`.
+void aicli_paging_sink_finish(aicli_paging_sink_t *sink, aicli_tool_result_t *out);
+void aicli_paging_sink_free(aicli_paging_sink_t *sink);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "execute/pipeline_stages.h"
+#include "execute_dsl.h"
+
+// Compiled execute pipelines, reused across calls with the same command string.
+//
+// The model typically re-issues one command many times with a different `start`; with
+// this cache those calls skip tokenizing, file-input normalization, stage argument
+// parsing and regcomp(). Entries are kept in a process-wide LRU keyed by the exact
+// command string.
+//
+// An entry is checked out for the duration of one run, so its stages (which carry
+// per-run state) are never shared between threads: a concurrent call with the same
+// command simply compiles its own copy, and the spare one is dropped on release.
+
+#define AICLI_PIPELINE_CACHE_MAX 32
+
+typedef struct aicli_compiled_pipeline {
+	char *command;
+	aicli_dsl_pipeline_t parsed; // as tokenized; owns every argv string
+	// Normalized to `cat FILE | ...` (argv borrowed from `parsed`); only meaningful
+	// when file_input is true.
+	aicli_dsl_pipeline_t pipe;
+	bool file_input;
+	// Stages after `cat` as planned by aicli_execute_open_stages() (adjacent line-wise
+	// stages fused into one), opened on first use and reset after every run.
+	// stage_count is the number of DSL stages after `cat` until they are opened.
+	aicli_stage_t *stages[8];
+	int stage_count;
+	bool opened;
+
+	// private
+	struct aicli_compiled_pipeline *prev;
+	struct aicli_compiled_pipeline *next;
+} aicli_compiled_pipeline_t;
+
+// Returns the compiled pipeline for command, from the cache or freshly parsed, for the
+// caller's exclusive use until aicli_pipeline_cache_release(). On a DSL parse error
+// *out is NULL and the status says why.
+aicli_dsl_status_t aicli_pipeline_cache_acquire(const char *command,
+                                                aicli_compiled_pipeline_t **out);
+
+// Opens the stages unless they are open already. Returns false if one is unsupported.
+bool aicli_compiled_pipeline_open_stages(aicli_compiled_pipeline_t *cp);
+
+// Resets the pipeline's stages and puts it back at the head of the LRU, evicting the
+// least recently used entry beyond AICLI_PIPELINE_CACHE_MAX. Safe to call with NULL.
+void aicli_pipeline_cache_release(aicli_compiled_pipeline_t *cp);
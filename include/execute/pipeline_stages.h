@@ -4,38 +4,114 @@
 #include <stddef.h>
 
 #include "buf.h"
+#include "execute/sort_engine.h"
 #include "execute_dsl.h"
 
-// Text stages
-bool aicli_stage_nl(const char *in, size_t in_len, aicli_buf_t *out);
-bool aicli_stage_head(const char *in, size_t in_len, size_t nlines, aicli_buf_t *out);
-bool aicli_stage_tail(const char *in, size_t in_len, size_t nlines, aicli_buf_t *out);
-bool aicli_stage_wc(const char *in, size_t in_len, char mode, aicli_buf_t *out);
-bool aicli_stage_sort_lines(const char *in, size_t in_len, bool reverse, aicli_buf_t *out);
-bool aicli_stage_grep_fixed(const char *in, size_t in_len, const char *needle,
-                            bool with_line_numbers, aicli_buf_t *out);
-bool aicli_stage_grep_bre(const char *in, size_t in_len, const char *pattern,
-                          bool with_line_numbers, aicli_buf_t *out);
-
-bool aicli_stage_grep_fixed_invert(const char *in, size_t in_len, const char *needle,
-					 bool with_line_numbers, aicli_buf_t *out);
-bool aicli_stage_grep_bre_invert(const char *in, size_t in_len, const char *pattern,
-					bool with_line_numbers, aicli_buf_t *out);
-bool aicli_stage_sed_n_addr(const char *in, size_t in_len, size_t start_addr, size_t end_addr,
-                            char cmd, aicli_buf_t *out);
-
-bool aicli_stage_sed_n_re_addr(const char *in, size_t in_len, const char *re1, size_t re1_len,
-                               const char *re2, size_t re2_len, char cmd, aicli_buf_t *out);
+// Streaming text stages.
+//
+// A stage consumes line-bounded chunks: every chunk passed to aicli_stage_feed() ends
+// with '\n' except the final one (at_eof == true), which may end with a partial line
+// or be empty. Stages append their output to `out` and keep the same contract, so
+// stages can be chained without ever holding the whole input.
+//
+// Each stage keeps only its own running state (line number, a window of lines for
+// tail, ...), so input size is unbounded. State that grows with the input is held to
+// aicli_stage_memory_budget(): sort spills sorted runs to temp files beyond it (see
+// sort_engine.h) and hands its output out in parts (AICLI_STAGE_MORE); tail keeps only
+// as many of its last lines as fit and says so (aicli_stage_limit_note()).
+//
+// Line-oriented stages poll aicli_cancel_current() every AICLI_STAGE_CANCEL_LINES lines,
+// so a slow pattern over a large chunk still honours the job's deadline.
 
+#define AICLI_STAGE_CANCEL_LINES 1024
+#define AICLI_STAGE_DEFAULT_MEMORY (64 * 1024 * 1024)
+
+typedef enum {
+	AICLI_STAGE_CONTINUE = 0, // wants more input
+	AICLI_STAGE_DONE,         // all output emitted; further input would be ignored
+	AICLI_STAGE_ERROR,        // invalid input for this stage, or oom
+	AICLI_STAGE_TOO_LARGE,    // input exceeds the stage's memory bound
+	AICLI_STAGE_CANCELLED,    // the running job's cancel token fired (see cancel.h)
+	AICLI_STAGE_MORE,         // only at EOF: `out` is a line-bounded part of the output;
+	                          // pass it on and feed again (no input, at_eof) for the rest
+} aicli_stage_status_t;
+
+typedef struct aicli_stage aicli_stage_t;
+
+// Bytes a stage may hold for state that grows with its input: AICLI_EXECUTE_MEMORY
+// (a byte count with an optional K/M/G suffix) or AICLI_STAGE_DEFAULT_MEMORY.
+size_t aicli_stage_memory_budget(void);
+
+aicli_stage_t *aicli_stage_nl_new(void);
+aicli_stage_t *aicli_stage_head_new(size_t nlines);
+aicli_stage_t *aicli_stage_tail_new(size_t nlines);
+aicli_stage_t *aicli_stage_wc_new(char mode);
+aicli_stage_t *aicli_stage_sort_new(const aicli_sort_opts_t *opts);
+// pattern is copied. Returns NULL if the BRE does not compile.
+aicli_stage_t *aicli_stage_grep_new(const char *pattern, bool fixed, bool invert,
+                                    bool with_line_numbers);
+aicli_stage_t *aicli_stage_sed_n_addr_new(size_t start_addr, size_t end_addr, char cmd);
+// Takes ownership of re1/re2 (as returned by aicli_parse_sed_re_args), also on failure.
+aicli_stage_t *aicli_stage_sed_n_re_addr_new(const char *re1, size_t re1_len, const char *re2,
+                                             size_t re2_len, char cmd);
 // sed -n 's/RE/REPL/[gp]'
-bool aicli_stage_sed_n_subst(const char *in, size_t in_len, const char *pattern, const char *repl,
-                             bool global, bool print_on_match, aicli_buf_t *out);
+// Takes ownership of pattern/repl (as returned by aicli_parse_sed_subst_args), also on failure.
+aicli_stage_t *aicli_stage_sed_n_subst_new(const char *pattern, const char *repl, bool global,
+                                           bool print_on_match);
+
+// Fusion: adjacent line-wise stages (nl, head, grep, sed -n) run as one stage that
+// takes each line through all of them in a single pass, with the same output as the
+// chain. aicli_execute_open_stages() (dispatch.h) plans this for a pipeline.
+#define AICLI_STAGE_FUSE_MAX 8
+bool aicli_stage_fusable(const aicli_stage_t *st);
+// parts: 2..AICLI_STAGE_FUSE_MAX fusable stages in pipeline order. Takes ownership of
+// them, also on failure (NULL).
+aicli_stage_t *aicli_stage_fused_new(aicli_stage_t *const *parts, int n);
+
+aicli_stage_status_t aicli_stage_feed(aicli_stage_t *st, const char *in, size_t in_len,
+                                      bool at_eof, aicli_buf_t *out);
+// Skip-ahead hints for seekable input. A run may start feeding from a later line when
+// the stages before the first windowed stage are line mappings.
+// True if input line i becomes output line i and nothing else (nl).
+bool aicli_stage_is_line_mapping(const aicli_stage_t *st);
+// True if the stage ignores every input line before a known one: either *first_line
+// (sed -n 'N,Mp') or, relative to the end of the input, the last *last_lines complete
+// lines (tail -n K).
+bool aicli_stage_line_window(const aicli_stage_t *st, unsigned long *first_line,
+                             size_t *last_lines);
+// Continues as if `lines` lines (`bytes` bytes) of input had already been fed.
+void aicli_stage_skip_input(aicli_stage_t *st, unsigned long lines, size_t bytes);
+
+// Data-parallel execution over line-aligned chunks of one input.
+typedef enum {
+	AICLI_STAGE_SEQUENTIAL = 0, // must see the whole input in order on one instance
+	AICLI_STAGE_PER_LINE,       // each line on its own: chunks may run on separate
+	                            // instances and their outputs be concatenated in order
+	AICLI_STAGE_COUNTING,       // wc: run per chunk (never fed EOF) and summed with
+	                            // aicli_stage_merge()
+} aicli_stage_parallelism_t;
+
+// *uses_line_no (may be NULL) is set when the output depends on input line numbers
+// (nl, grep -n); such an instance must first be told where its chunk starts with
+// aicli_stage_skip_input().
+aicli_stage_parallelism_t aicli_stage_parallelism(const aicli_stage_t *st, bool *uses_line_no);
+// Adds what the counting stage `part` has seen to `into`. False if they do not match.
+bool aicli_stage_merge(aicli_stage_t *into, const aicli_stage_t *part);
+
+// Why the output of the last run is incomplete (a window cut down to the memory
+// budget), or NULL if it is not.
+const char *aicli_stage_limit_note(const aicli_stage_t *st);
+
+// Returns a stage to its freshly created state so it can run over new input; its
+// arguments and compiled patterns are kept.
+void aicli_stage_reset(aicli_stage_t *st);
+void aicli_stage_free(aicli_stage_t *st);
 
 // Stage-arg parsing helpers
 size_t aicli_parse_head_n(const aicli_dsl_stage_t *st, bool *ok);
 size_t aicli_parse_tail_n(const aicli_dsl_stage_t *st, bool *ok);
 bool aicli_parse_wc_mode(const aicli_dsl_stage_t *st, char *out_mode);
-bool aicli_parse_sort_reverse(const aicli_dsl_stage_t *st, bool *out_reverse);
+bool aicli_parse_sort_args(const aicli_dsl_stage_t *st, aicli_sort_opts_t *out);
 bool aicli_parse_grep_args(const aicli_dsl_stage_t *st, const char **out_pattern, bool *out_n,
                            bool *out_fixed, bool *out_invert);
 bool aicli_parse_sed_args(const aicli_dsl_stage_t *st, size_t *out_start, size_t *out_end,
@@ -1,12 +1,24 @@
 #pragma once
 
+#include "execute/pipeline_cache.h"
 #include "execute_tool.h"
 
-// Executes an already-parsed pipeline that starts with `cat <FILE>`.
+// Largest pipeline output kept in the execute cache. Bigger outputs are still paged
+// correctly but re-run the pipeline for every page.
+#define AICLI_EXECUTE_CACHE_MAX_BYTES (2 * 1024 * 1024)
+
+// Mapped inputs with at least this much left to read run their leading per-line stages
+// on AICLI_EXECUTE_PARALLEL_CHUNK-sized pieces across the compute pool.
+#define AICLI_EXECUTE_PARALLEL_CHUNK (1024 * 1024)
+#define AICLI_EXECUTE_PARALLEL_MIN_BYTES (4 * AICLI_EXECUTE_PARALLEL_CHUNK)
+
+// Executes a compiled pipeline (see pipeline_cache.h). Its stages are opened on first use
+// and left with per-run state; the caller releases cp afterwards, which resets them.
 // On success, returns 0 and sets `out`.
 // On invalid request, returns 0 with an appropriate `out->exit_code`.
 // On internal parameter errors, returns -1.
 int aicli_execute_run_pipeline_from_file(const aicli_allowlist_t *allow,
-                                        const aicli_dsl_pipeline_t *pipe,
+                                        aicli_paging_cache_t *cache,
+                                        aicli_compiled_pipeline_t *cp,
                                         const aicli_execute_request_t *req,
                                         aicli_tool_result_t *out);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buf.h"
+
+// Line sort for the sort stage, bounded in memory.
+//
+// Input is buffered up to a memory budget (the sort stage's is
+// aicli_stage_memory_budget(); the line records count against it too). A full buffer
+// is sorted and written to an unlinked temp file in $TMPDIR as a sorted run; at the
+// end the runs and the last buffer are k-way merged. Runs are collapsed into one whenever
+// AICLI_SORT_MERGE_MAX of them exist, so the number of open files stays bounded.
+//
+// A buffer is sorted on the compute pool (threadpool.h): it is split into one slice
+// per thread, each slice is LSD radix sorted on an 8-byte key prefix (the first key
+// bytes, or an order-preserving encoding of the number for -n) and only lines with
+// equal prefixes are compared in full. The slices are merged like runs.
+//
+// Order is the C locale's, as GNU sort with LC_ALL=C: keys compare bytewise (or
+// numerically), ties fall back to comparing whole lines, -r reverses both. -u keeps
+// the first input line of every set of equal keys.
+
+// Smaller budgets are raised to this; larger ones are capped at UINT32_MAX.
+#define AICLI_SORT_MIN_MEMORY (64 * 1024)
+#define AICLI_SORT_MERGE_MAX 32
+// Output is handed out in pieces of about this size (see aicli_sort_emit()).
+#define AICLI_SORT_EMIT_BYTES (256 * 1024)
+
+typedef struct {
+	bool reverse; // -r
+	bool unique;  // -u
+	bool numeric; // -n: leading blanks, optional '-', digits, optional '.' and digits
+	char sep;     // -t C; 0: a field is a run of blanks followed by non-blanks
+	unsigned key_start; // -k N[,M]: 1-based fields N through M (0: to the end of the
+	unsigned key_end;   // line); key_start == 0: the whole line is the key
+} aicli_sort_opts_t;
+
+typedef struct aicli_sort aicli_sort_t;
+
+// `memory` is the buffer budget in bytes. Returns NULL on allocation failure.
+aicli_sort_t *aicli_sort_new(const aicli_sort_opts_t *opts, size_t memory);
+
+// Adds a line-bounded chunk; at EOF a final partial line counts as a line. False if a
+// run could not be written (no temp space) or on allocation failure.
+bool aicli_sort_add(aicli_sort_t *s, const char *in, size_t in_len);
+
+// Appends the next part of the sorted output (about AICLI_SORT_EMIT_BYTES, whole
+// '\n'-terminated lines) to out; the first call ends the input. Sets *done once all
+// of it has been handed out. False on allocation or read failure.
+bool aicli_sort_emit(aicli_sort_t *s, aicli_buf_t *out, bool *done);
+
+// Drops all input, runs and output so far; the options are kept.
+void aicli_sort_reset(aicli_sort_t *s);
+void aicli_sort_free(aicli_sort_t *s);
@@ -39,6 +39,9 @@ typedef struct {
 // No redirects, no subshell, no env-vars, no command substitution.
 // Quotes are minimally supported for single/double quoted strings.
 
+// On success and on failure, the argv strings in `out` are heap copies; release them
+// with aicli_dsl_pipeline_free().
 aicli_dsl_status_t aicli_dsl_parse_pipeline(const char *command, aicli_dsl_pipeline_t *out);
+void aicli_dsl_pipeline_free(aicli_dsl_pipeline_t *p);
 
 const char *aicli_dsl_status_str(aicli_dsl_status_t st);
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include "aicli.h"
 #include "execute_dsl.h"
+#include "paging_cache.h"
 
 typedef struct {
 	aicli_allowed_file_t *files;
@@ -16,6 +17,10 @@ char *aicli_realpath_dup(const char *path);
 bool aicli_get_file_size(const char *path, size_t *out_size);
 
 // Executes restricted pipeline and returns paged stdout.
+// cache is optional. When given, the full pipeline output is cached (keyed by the
+// canonical pipeline, the file's identity and req->idempotency) so later pages are
+// served from memory without re-reading the file.
 int aicli_execute_run(const aicli_allowlist_t *allow,
+				 aicli_paging_cache_t *cache,
 				 const aicli_execute_request_t *req,
 				 aicli_tool_result_t *out);
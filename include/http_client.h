@@ -0,0 +1,46 @@
+#pragma once
+
+#include <curl/curl.h>
+
+// Process-wide HTTP client layer.
+//
+// Every thread gets one reusable easy handle. Handles keep their own connection
+// cache alive between requests, and all of them are attached to a single curl share
+// handle that holds the DNS cache and TLS session cache. A long `aicli run` then pays
+// the TCP+TLS handshake once per host instead of once per request.
+//
+// Note: libcurl does not support sharing live connections between concurrently
+// running threads, so the connection cache stays per handle (per thread). TLS
+// session resumption still makes new connections from other threads cheaper.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	unsigned long requests;           // transfers performed via aicli_http_perform()
+	unsigned long connections_opened; // new connections created for those transfers
+	unsigned long connections_reused; // transfers served over an already open connection
+} aicli_http_stats_t;
+
+// Returns the calling thread's easy handle, reset to default options and attached to
+// the shared DNS/TLS caches. Returns NULL on failure, and when called from inside a
+// transfer of that handle (a write or progress callback): resetting it mid-transfer
+// is undefined behavior in libcurl.
+// The handle is owned by the HTTP layer: never call curl_easy_cleanup() on it.
+CURL *aicli_http_easy_acquire(void);
+
+// curl_easy_perform() plus connection reuse accounting. When the calling thread has a
+// current cancellation token (see cancel.h), the transfer aborts with
+// CURLE_ABORTED_BY_CALLBACK once it is cancelled.
+CURLcode aicli_http_perform(CURL *curl);
+
+void aicli_http_stats_get(aicli_http_stats_t *out);
+
+// Frees the calling thread's handle and the share handle.
+// Call once at process exit, after all worker threads are gone.
+void aicli_http_global_cleanup(void);
+
+#ifdef __cplusplus
+}
+#endif
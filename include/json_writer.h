@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buf.h"
+
+// Streaming JSON output into an aicli_buf_t. Callers write the structure (braces,
+// keys, commas) as literals and values with the helpers below; JSON that is already
+// serialized (the tools array, function_call_output items) is appended as it is, so
+// building a request is one pass over its bytes without a DOM.
+
+// Appends s[0, n) as a JSON string, quotes included. Valid UTF-8 is copied verbatim;
+// only '"', '\\' and control characters are escaped, as yyjson_mut_write() does.
+// False on allocation failure or invalid UTF-8 (which yyjson refuses to write too).
+bool aicli_json_append_str(aicli_buf_t *b, const char *s, size_t n);
+
+// Appends s[0, n) as JSON string content, without quotes, escaped `depth` times (1..3):
+// 1 for a string value, 2 for a string inside JSON that is itself carried as a string
+// (the tool result in a function_call_output item's "output"). Only what JSON requires
+// is escaped; valid UTF-8 passes through verbatim and each byte of an invalid sequence
+// becomes U+FFFD, so arbitrary file content yields valid JSON. False only on allocation
+// failure.
+bool aicli_json_append_escaped(aicli_buf_t *b, const char *s, size_t n, int depth);
+
+// As aicli_json_append_str() for a NUL-terminated string.
+bool aicli_json_append_cstr(aicli_buf_t *b, const char *s);
+
+// Appends `,"key":` (the comma unless `first`) followed by the string value.
+bool aicli_json_append_member_str(aicli_buf_t *b, bool first, const char *key, const char *value);
@@ -33,4 +33,19 @@ int aicli_openai_responses_post_raw_json(const char *api_key, const char *base_u
 				     const char *json_payload,
 				     aicli_openai_http_response_t *out);
 
+// Receives one server-sent event of a streamed response.
+// event: the SSE "event:" name ("" if absent); data: the raw JSON payload (NUL-terminated).
+typedef void (*aicli_openai_stream_event_fn)(const char *event, const char *data, size_t data_len,
+					     void *user);
+
+// Low-level: POST /v1/responses with a pre-built JSON payload containing "stream": true.
+// Events are passed to on_event as they arrive. On HTTP 200, out->body holds the final
+// response object taken from response.completed (or .incomplete/.failed), so callers can
+// handle it like a non-streamed body. Other statuses leave the raw error body in out->body.
+// Returns 0 on successful HTTP request (even if status != 200).
+int aicli_openai_responses_stream_raw_json(const char *api_key, const char *base_url,
+					const char *json_payload,
+					aicli_openai_stream_event_fn on_event, void *user,
+					aicli_openai_http_response_t *out);
+
 void aicli_openai_http_response_free(aicli_openai_http_response_t *res);
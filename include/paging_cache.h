@@ -6,6 +6,11 @@
 // Simple in-memory paging cache.
 // Keyed by an arbitrary UTF-8 key string (caller-provided).
 // Stores an owned byte buffer plus total_bytes and paging metadata.
+//
+// Thread-safe: keys are hashed onto a fixed number of shards, each with its own
+// lock, hash index and LRU list, so tool jobs on different pool threads rarely
+// contend. Eviction is LRU within a shard and bounded both by entry count and by
+// total bytes held.
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,23 +25,57 @@ typedef struct {
 	size_t next_start;
 } aicli_paging_cache_value_t;
 
+typedef struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long insertions;
+	unsigned long evictions; // entries dropped to make room (not replacements)
+	size_t entries;
+	size_t bytes;            // bytes currently held (values + keys)
+} aicli_paging_cache_stats_t;
+
 typedef struct aicli_paging_cache aicli_paging_cache_t;
 
-// Creates a cache of up to max_entries. If max_entries==0, defaults to 64.
-aicli_paging_cache_t *aicli_paging_cache_create(size_t max_entries);
+#define AICLI_PAGING_CACHE_DEFAULT_ENTRIES 64
+#define AICLI_PAGING_CACHE_DEFAULT_BYTES (32 * 1024 * 1024)
+
+// Creates a cache of up to max_entries entries and max_bytes bytes.
+// 0 selects AICLI_PAGING_CACHE_DEFAULT_ENTRIES / AICLI_PAGING_CACHE_DEFAULT_BYTES.
+aicli_paging_cache_t *aicli_paging_cache_create(size_t max_entries, size_t max_bytes);
 
 void aicli_paging_cache_destroy(aicli_paging_cache_t *c);
 
-// Returns true and fills out_value with pointers owned by cache (do not free)
-// if key is found. Returns false if not found.
-bool aicli_paging_cache_get(const aicli_paging_cache_t *c, const char *key,
-                           aicli_paging_cache_value_t *out_value);
+// A long-lived process (aicli serve) installs one cache for all of its commands, so
+// execute pages survive from one invocation to the next. Entries never expire, so only
+// values keyed by what they depend on (a file's identity) belong there; web results
+// go through a per-command cache and the disk cache. It is never destroyed; install it
+// before any command runs.
+void aicli_paging_cache_set_process(aicli_paging_cache_t *c);
+// The installed process cache, or NULL.
+aicli_paging_cache_t *aicli_paging_cache_process(void);
+
+// Cache for one command: the process cache if one is installed, else a new cache
+// (NULL on allocation failure). Release it with aicli_paging_cache_close().
+aicli_paging_cache_t *aicli_paging_cache_open(void);
 
-// Stores a copy of value in cache (deep-copies bytes). May evict LRU.
-// Returns true on success.
+// Destroys c unless it is the process cache.
+void aicli_paging_cache_close(aicli_paging_cache_t *c);
+
+// Copies bytes [start, start+size) of the cached value for key into a new
+// NUL-terminated buffer (*out_buf, caller frees). start is clamped to the value length.
+// Sets *out_total to the value's total_bytes. Returns false if key is not cached.
+// The copy is taken under the shard lock, so it stays valid after eviction.
+bool aicli_paging_cache_copy_range(aicli_paging_cache_t *c, const char *key, size_t start,
+                                   size_t size, char **out_buf, size_t *out_len,
+                                   size_t *out_total);
+
+// Stores a copy of value in cache (deep-copies bytes). May evict LRU entries.
+// Returns false if the value alone exceeds the cache's per-shard byte budget.
 bool aicli_paging_cache_put(aicli_paging_cache_t *c, const char *key,
                            const aicli_paging_cache_value_t *value);
 
+void aicli_paging_cache_stats_get(aicli_paging_cache_t *c, aicli_paging_cache_stats_t *out);
+
 #ifdef __cplusplus
 }
 #endif
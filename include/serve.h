@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Local daemon mode (aicli serve).
+//
+// The daemon listens on a Unix stream socket. A client connects, passes its stdin,
+// stdout and stderr (SCM_RIGHTS) together with its working directory, environment,
+// session id and argv, and waits for the exit code. The daemon runs the command in its
+// own process on those descriptors, in the client's directory and environment, so the
+// command resolves the same config as it would in the client while the HTTP connections
+// and TLS sessions, the parsed config files, the paging cache, the compiled pipelines
+// and the thread pools stay warm from one invocation to the next.
+//
+// Commands write to the process-wide stdout/stderr, which point at the client's
+// descriptors while its command runs, so requests are served one at a time in the
+// order they connect. Only clients running as the daemon's user are served. A client
+// that goes away cancels the API requests of its command.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Upper bound on the argv, environment and working directory of one request.
+#define AICLI_SERVE_MAX_REQUEST (16 * 1024 * 1024)
+
+typedef struct {
+	int argc;
+	char **argv;     // argv[0] is the client's program name; argv[argc] == NULL
+	const char *cwd; // already the daemon's working directory while the handler runs
+	char **envp;     // the client's environment; it is `environ` while the handler runs
+	long sid;        // the client's getsid(0)
+} aicli_serve_request_t;
+
+// Runs one request and returns its exit code.
+typedef int (*aicli_serve_handler_fn)(const aicli_serve_request_t *req, void *arg);
+
+// Serves requests on socket_path until SIGINT or SIGTERM, then removes the socket.
+// A stale socket left by a dead daemon is replaced; a live one is an error.
+// Returns 0 after a clean stop, 2 if the socket cannot be set up (message on stderr).
+int aicli_serve(const char *socket_path, aicli_serve_handler_fn fn, void *arg);
+
+// Hands argv to the daemon on socket_path and waits for the command to finish.
+// Returns false, having done nothing, if no daemon accepts the request; the caller
+// then runs the command itself. Otherwise stores the command's exit code in *out_rc
+// (2 if the daemon went away before answering).
+bool aicli_serve_forward(const char *socket_path, int argc, char **argv, int *out_rc);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,25 +1,117 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "cancel.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Fixed-size work-stealing thread pool.
+//
+// Every worker owns a bounded deque of preallocated job slots (no allocation per
+// submit). Jobs submitted from outside the pool are spread over the deques round-robin;
+// a worker runs its own jobs newest-first and, when it runs dry, steals the oldest job
+// of another worker, so one slow job never holds back the jobs queued behind it.
+//
+// A job may carry a cancellation token: it is skipped if already cancelled when a
+// worker picks it up, and is the thread's aicli_cancel_current() while it runs.
+
 typedef struct aicli_threadpool aicli_threadpool_t;
 
 typedef void (*aicli_threadpool_job_fn)(void *arg);
 
+// Completion flag for one job. Owned by the caller; must stay valid until done.
+typedef struct {
+	atomic_bool done;
+} aicli_threadpool_future_t;
+
+typedef struct {
+	aicli_threadpool_job_fn fn;
+	void *arg;
+	aicli_threadpool_future_t *future; // may be NULL
+	const aicli_cancel_t *cancel;      // may be NULL; must outlive the job
+} aicli_threadpool_task_t;
+
+// Job slots per worker deque.
+#define AICLI_THREADPOOL_DEQUE_CAP 64
+
 // Creates a fixed-size thread pool. Returns NULL on failure.
 // threads==0 is treated as 1.
 aicli_threadpool_t *aicli_threadpool_create(size_t threads);
 
-// Stops all workers and frees resources. Safe to call with NULL.
+// Process-wide pool with `threads` workers (0 is treated as 1), created on first use and
+// reused by every later caller asking for the same size. Pools are never destroyed;
+// past a small number of distinct sizes the nearest existing pool is returned.
+// Returns NULL on failure.
+aicli_threadpool_t *aicli_threadpool_shared(size_t threads);
+
+// Upper bound on the workers of the compute pool and on parallel_for helpers.
+#define AICLI_THREADPOOL_COMPUTE_MAX 64
+
+// Process-wide pool for CPU-bound data-parallel work (one worker per online CPU but
+// one, or AICLI_COMPUTE_THREADS - 1), kept apart from the tool pool so it neither waits
+// behind network-bound tool jobs nor takes their slots. NULL on single-CPU machines or
+// on failure.
+aicli_threadpool_t *aicli_threadpool_compute(void);
+
+// Number of worker threads (0 for NULL).
+size_t aicli_threadpool_size(const aicli_threadpool_t *p);
+
+// Stops all workers and frees resources. Jobs still queued are dropped (their futures
+// never complete). Safe to call with NULL.
 void aicli_threadpool_destroy(aicli_threadpool_t *p);
 
-// Enqueue a job. Returns 0 on success.
+// Enqueue a job. Returns 0 on success, 1 if every deque is full, 3 if stopping.
 int aicli_threadpool_submit(aicli_threadpool_t *p, aicli_threadpool_job_fn fn, void *arg);
 
+// Enqueue a job that completes `f` (which is reset first). If the job cannot be queued
+// (p == NULL, deques full, pool stopping) it runs on the calling thread before this
+// returns; f is completed either way. Returns 2 on invalid arguments, else 0.
+int aicli_threadpool_submit_future(aicli_threadpool_t *p, aicli_threadpool_job_fn fn, void *arg,
+                                   aicli_threadpool_future_t *f);
+
+// Enqueues one task, never running it on the calling thread. Returns 0 if it was queued
+// (its future reset first), 1 if every deque is full, 2 on invalid arguments or p == NULL,
+// 3 if stopping; the task has not run then and its future is left as it was. For callers
+// that must not block, such as a transfer's write callback.
+int aicli_threadpool_try_submit(aicli_threadpool_t *p, const aicli_threadpool_task_t *task);
+
+// Enqueues n tasks with one wakeup. Tasks that do not fit run on the calling thread
+// after the others are queued. Futures behave as for aicli_threadpool_submit_future.
+int aicli_threadpool_submit_batch(aicli_threadpool_t *p, const aicli_threadpool_task_t *tasks,
+                                  size_t n);
+
+bool aicli_threadpool_future_ready(aicli_threadpool_future_t *f);
+
+// Blocks until f is complete.
+void aicli_threadpool_future_wait(aicli_threadpool_t *p, aicli_threadpool_future_t *f);
+
+// Blocks until at least one of fs[0..n) is complete and returns the lowest such index
+// (n if n == 0).
+size_t aicli_threadpool_future_wait_any(aicli_threadpool_t *p, aicli_threadpool_future_t *const *fs,
+                                        size_t n);
+
+// Like aicli_threadpool_future_wait_any(), but gives up at deadline_ms
+// (aicli_monotonic_ms() clock; 0 = never) and then returns n.
+size_t aicli_threadpool_future_wait_any_until(aicli_threadpool_t *p,
+                                              aicli_threadpool_future_t *const *fs, size_t n,
+                                              int64_t deadline_ms);
+
+typedef void (*aicli_threadpool_for_fn)(void *arg, size_t i);
+
+// Calls fn(arg, i) for every i in [0, n), spread over the calling thread and up to one
+// helper job per worker, and returns once all n calls are complete. The caller works
+// through the indices too, so this is safe from inside a pool job and never stalls on
+// a busy pool (p == NULL runs everything on the caller). The caller's
+// aicli_cancel_current() is current in the helpers as well.
+void aicli_threadpool_parallel_for(aicli_threadpool_t *p, size_t n, aicli_threadpool_for_fn fn,
+                                   void *arg);
+
 // Wait until all queued + running jobs finish.
 void aicli_threadpool_drain(aicli_threadpool_t *p);
 
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// Output budget of a tool-loop run: how many bytes of output each tool call may return.
+//
+// Each turn may add up to `turn_bytes` of tool output to the conversation, shared by
+// the calls of the turn, and the whole run up to `run_bytes`. A turn gets at most half
+// of what is left of the run, so pages shrink step by step as the conversation grows.
+// A page is never smaller than AICLI_MAX_TOOL_BYTES (the fixed page of tools used
+// outside a run) nor larger than AICLI_MAX_TOOL_PAGE_BYTES.
+typedef struct {
+	size_t turn_bytes;
+	size_t run_bytes;
+	size_t used;      // tool output added to the conversation so far
+	size_t turn_left; // what the current turn can still hand out
+} aicli_tool_budget_t;
+
+// 0 selects the defaults (AICLI_DEFAULT_TOOL_OUTPUT_TURN/RUN).
+void aicli_tool_budget_init(aicli_tool_budget_t *b, size_t turn_bytes, size_t run_bytes);
+
+void aicli_tool_budget_begin_turn(aicli_tool_budget_t *b);
+
+// Takes the page of the next call from the turn, when `calls` calls (this one included)
+// are expected to share what is left of it.
+size_t aicli_tool_budget_page(aicli_tool_budget_t *b, size_t calls);
+
+// Records tool output added to the conversation.
+void aicli_tool_budget_consume(aicli_tool_budget_t *b, size_t bytes);
+
+// Page size of a tool request: `size` (0: as large as allowed) capped at `max_size`
+// (0: AICLI_MAX_TOOL_BYTES).
+size_t aicli_tool_page_size(size_t size, size_t max_size);
+
+// Length of a page of n bytes that more output follows, cut back so the page does not
+// end inside a UTF-8 sequence: the character is left whole to the next page (whose
+// next_start is the returned length past this page's start) instead of reaching the
+// model as replacement characters. A page holding nothing but that partial sequence
+// is returned as is, so paging always makes progress.
+size_t aicli_tool_page_trim(const char *page, size_t n);
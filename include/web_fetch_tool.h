@@ -16,6 +16,7 @@ typedef struct {
 	size_t allowed_prefix_count;
 	size_t start;
 	size_t size;
+	size_t max_size; // page cap; 0: AICLI_MAX_TOOL_BYTES
 	size_t max_body_bytes;
 	long timeout_seconds;
 	long connect_timeout_seconds;
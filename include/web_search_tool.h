@@ -16,6 +16,7 @@ typedef struct {
 	bool raw;
 	size_t start;
 	size_t size;
+	size_t max_size; // page cap; 0: AICLI_MAX_TOOL_BYTES
 	const char *idempotency;
 } aicli_web_search_tool_request_t;
 
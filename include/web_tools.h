@@ -31,6 +31,7 @@ typedef struct {
 	// Paging for returned output
 	size_t start;
 	size_t size;
+	size_t max_size; // page cap; 0: AICLI_MAX_TOOL_BYTES
 	// Optional cache key component
 	const char *idempotency;
 } aicli_web_search_request_t;
@@ -58,6 +59,7 @@ typedef struct {
 	// Paging for returned output
 	size_t start;
 	size_t size;
+	size_t max_size; // page cap; 0: AICLI_MAX_TOOL_BYTES
 	// Optional cache key component
 	const char *idempotency;
 } aicli_web_fetch_request_t;
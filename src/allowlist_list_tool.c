@@ -7,74 +7,17 @@
 #include <string.h>
 
 #include "buf.h"
+#include "json_writer.h"
 
 static const char *safe_str(const char *s) { return s ? s : ""; }
 
 static bool is_empty(const char *s) { return !s || !s[0]; }
 
-static bool buf_append_json_hex2(aicli_buf_t *b, unsigned char v)
-{
-	static const char hex[] = "0123456789abcdef";
-	char tmp[2];
-	tmp[0] = hex[(v >> 4) & 0xF];
-	tmp[1] = hex[v & 0xF];
-	return aicli_buf_append(b, tmp, sizeof(tmp));
-}
-
-static bool buf_append_json_string_escaped_bytes(aicli_buf_t *b, const unsigned char *s, size_t n)
-{
-	for (size_t i = 0; i < n; i++) {
-		unsigned char c = s[i];
-		switch (c) {
-		case '"':
-			if (!aicli_buf_append_str(b, "\\\""))
-				return false;
-			break;
-		case '\\':
-			if (!aicli_buf_append_str(b, "\\\\"))
-				return false;
-			break;
-		case '\b':
-			if (!aicli_buf_append_str(b, "\\b"))
-				return false;
-			break;
-		case '\f':
-			if (!aicli_buf_append_str(b, "\\f"))
-				return false;
-			break;
-		case '\n':
-			if (!aicli_buf_append_str(b, "\\n"))
-				return false;
-			break;
-		case '\r':
-			if (!aicli_buf_append_str(b, "\\r"))
-				return false;
-			break;
-		case '\t':
-			if (!aicli_buf_append_str(b, "\\t"))
-				return false;
-			break;
-		default:
-			if (c < 0x20 || c >= 0x80) {
-				if (!aicli_buf_append_str(b, "\\u00"))
-					return false;
-				if (!buf_append_json_hex2(b, c))
-					return false;
-			} else {
-				if (!aicli_buf_append(b, &c, 1))
-					return false;
-			}
-			break;
-		}
-	}
-	return true;
-}
-
 static bool buf_append_json_string_escaped_cstr(aicli_buf_t *b, const char *s)
 {
 	if (!s)
 		return true;
-	return buf_append_json_string_escaped_bytes(b, (const unsigned char *)s, strlen(s));
+	return aicli_json_append_escaped(b, s, strlen(s), 1);
 }
 
 static int contains_case_insensitive(const char *haystack, const char *needle)
@@ -0,0 +1,305 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <yyjson.h>
+
+#include "buf.h"
+#include "execute_tool.h"
+#include "json_writer.h"
+#include "openai_tool_loop.h"
+#include "paging_cache.h"
+#include "threadpool.h"
+
+// One conversation in flight. The job owns everything but `done`, which the main thread
+// waits on; the main thread reads `out` once the job is complete.
+typedef struct {
+	const aicli_config_t *cfg;
+	const aicli_batch_opts_t *opts;
+	size_t index;
+	char *line;
+	size_t line_len;
+	aicli_buf_t out; // the output line, '\n' included
+	bool ok;
+	bool busy;
+	aicli_threadpool_future_t done;
+} batch_slot_t;
+
+static bool append_head(aicli_buf_t *b, size_t index, yyjson_val *id)
+{
+	char num[AICLI_BUF_ULONG_MAX];
+	size_t n = aicli_buf_put_ulong(num, (unsigned long)index, 0);
+	bool ok = aicli_buf_append_str(b, "{\"index\":") && aicli_buf_append(b, num, n);
+	if (ok && id) {
+		size_t id_len = 0;
+		char *raw = yyjson_val_write(id, 0, &id_len);
+		ok = raw && aicli_buf_append_str(b, ",\"id\":") && aicli_buf_append(b, raw, id_len);
+		free(raw);
+	}
+	return ok;
+}
+
+static bool format_error(batch_slot_t *s, yyjson_val *id, const char *error)
+{
+	s->ok = false;
+	s->out.len = 0;
+	// The message may embed a path cut short mid-character: escape it leniently too.
+	bool ok = append_head(&s->out, s->index, id) &&
+	          aicli_buf_append_str(&s->out, ",\"ok\":false,\"error\":\"") &&
+	          aicli_json_append_escaped(&s->out, error, strlen(error), 1) &&
+	          aicli_buf_append_str(&s->out, "\"}\n");
+	if (!ok)
+		s->out.len = 0; // never a partial line (slot_flush reports the empty one)
+	return ok;
+}
+
+static bool format_result(batch_slot_t *s, yyjson_val *id, const char *text,
+                          const char *response_json)
+{
+	char rid[256];
+	rid[0] = '\0';
+	if (response_json)
+		(void)aicli_openai_extract_response_id(response_json, strlen(response_json), rid,
+		                                       sizeof(rid));
+	s->ok = true;
+	s->out.len = 0;
+	// The text is the model's: escape it leniently so one bad byte cannot lose the answer.
+	bool ok = append_head(&s->out, s->index, id) &&
+	          aicli_buf_append_str(&s->out, ",\"ok\":true,\"text\":\"") &&
+	          aicli_json_append_escaped(&s->out, text, strlen(text), 1) &&
+	          aicli_buf_append_str(&s->out, "\"") &&
+	          (!rid[0] || aicli_json_append_member_str(&s->out, false, "response_id", rid)) &&
+	          aicli_buf_append_str(&s->out, "}\n");
+	if (!ok)
+		s->out.len = 0;
+	return ok;
+}
+
+static void run_conversation(batch_slot_t *s, yyjson_val *root)
+{
+	yyjson_val *id = yyjson_obj_get(root, "id");
+	yyjson_val *prompt = yyjson_obj_get(root, "prompt");
+	if (!yyjson_is_str(prompt) || yyjson_get_len(prompt) == 0) {
+		(void)format_error(s, id, "missing prompt");
+		return;
+	}
+	yyjson_val *files = yyjson_obj_get(root, "files");
+	if (files && !yyjson_is_arr(files)) {
+		(void)format_error(s, id, "files must be an array of paths");
+		return;
+	}
+
+	size_t file_count = yyjson_arr_size(files);
+	aicli_allowed_file_t *allowed =
+	    (aicli_allowed_file_t *)calloc(file_count ? file_count : 1, sizeof(*allowed));
+	if (!allowed) {
+		(void)format_error(s, id, "out of memory");
+		return;
+	}
+	size_t n = 0;
+	bool ok = true;
+	size_t idx, max;
+	yyjson_val *f;
+	yyjson_arr_foreach(files, idx, max, f)
+	{
+		const char *name = yyjson_get_str(f);
+		char *rp = name ? aicli_realpath_dup(name) : NULL;
+		if (!rp) {
+			char msg[512];
+			snprintf(msg, sizeof(msg), "invalid file: %s", name ? name : "(not a string)");
+			(void)format_error(s, id, msg);
+			ok = false;
+			break;
+		}
+		allowed[n].path = rp;
+		allowed[n].name = name;
+		(void)aicli_get_file_size(rp, &allowed[n].size_bytes);
+		n++;
+	}
+
+	if (ok) {
+		aicli_allowlist_t allow = {.files = allowed, .file_count = (int)n};
+		char *text = NULL;
+		char *response_json = NULL;
+		int rc = aicli_openai_run_with_tools(
+		    s->cfg, &allow, yyjson_get_str(prompt), NULL, s->opts->max_turns,
+		    s->opts->max_tool_calls_per_turn, s->opts->tool_threads, s->opts->tool_choice,
+		    &text, &response_json);
+		if (rc != 0)
+			(void)format_error(s, id, "openai request failed");
+		else if (!text || !text[0])
+			(void)format_error(s, id, "openai response had no output_text");
+		else if (!format_result(s, id, text, response_json))
+			(void)format_error(s, id, "out of memory");
+		free(text);
+		free(response_json);
+	}
+	for (size_t i = 0; i < n; i++)
+		free((void *)allowed[i].path);
+	free(allowed);
+}
+
+static void conversation_job(void *arg)
+{
+	batch_slot_t *s = (batch_slot_t *)arg;
+	yyjson_read_err err;
+	yyjson_doc *doc = yyjson_read_opts(s->line, s->line_len, 0, NULL, &err);
+	yyjson_val *root = doc ? yyjson_doc_get_root(doc) : NULL;
+	if (!yyjson_is_obj(root)) {
+		char msg[256];
+		snprintf(msg, sizeof(msg), "invalid request line: %s",
+		         doc ? "not a JSON object" : err.msg);
+		(void)format_error(s, NULL, msg);
+	} else {
+		run_conversation(s, root);
+	}
+	yyjson_doc_free(doc);
+	free(s->line);
+	s->line = NULL;
+}
+
+// Writes a finished slot's line and frees the slot. False if the output failed.
+static bool slot_flush(batch_slot_t *s, FILE *out, bool *all_ok)
+{
+	s->busy = false;
+	if (!s->ok)
+		*all_ok = false;
+	if (s->out.len == 0) {
+		// Only an allocation failure leaves no line behind.
+		*all_ok = false;
+		fprintf(stderr, "batch: out of memory formatting the result of line %zu\n", s->index);
+		return true;
+	}
+	bool written = fwrite(s->out.data, 1, s->out.len, out) == s->out.len && fflush(out) == 0;
+	// Results can be long; do not keep the largest one per slot for the whole batch.
+	aicli_buf_free(&s->out);
+	return written;
+}
+
+// Waits until some busy slot is done and writes it. Returns its index, or n if none is busy.
+static size_t wait_one(aicli_threadpool_t *pool, batch_slot_t *slots, size_t n,
+                       aicli_threadpool_future_t **fs, size_t *map, FILE *out, bool *all_ok,
+                       bool *out_ok)
+{
+	size_t busy = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (slots[i].busy) {
+			fs[busy] = &slots[i].done;
+			map[busy++] = i;
+		}
+	}
+	if (busy == 0)
+		return n;
+	size_t k = aicli_threadpool_future_wait_any(pool, fs, busy);
+	size_t i = map[k];
+	if (!slot_flush(&slots[i], out, all_ok))
+		*out_ok = false;
+	return i;
+}
+
+int aicli_batch_run(const aicli_config_t *cfg, const aicli_batch_opts_t *opts, FILE *in,
+                    FILE *out)
+{
+	if (!cfg || !opts || !in || !out)
+		return 2;
+	aicli_batch_opts_t o = *opts;
+	if (o.concurrency == 0)
+		o.concurrency = AICLI_BATCH_DEFAULT_CONCURRENCY;
+	if (o.concurrency > AICLI_BATCH_MAX_CONCURRENCY)
+		o.concurrency = AICLI_BATCH_MAX_CONCURRENCY;
+	if (o.tool_threads == 0)
+		o.tool_threads = o.concurrency;
+
+	// Conversations get a pool of their own: they block on their tool calls, which run
+	// on the shared tool pool (created here, so with this batch's size).
+	aicli_threadpool_t *pool = aicli_threadpool_create(o.concurrency);
+	batch_slot_t *slots = (batch_slot_t *)calloc(o.concurrency, sizeof(*slots));
+	aicli_threadpool_future_t **fs =
+	    (aicli_threadpool_future_t **)calloc(o.concurrency, sizeof(*fs));
+	size_t *map = (size_t *)calloc(o.concurrency, sizeof(*map));
+	if (!pool || !slots || !fs || !map || !aicli_threadpool_shared(o.tool_threads)) {
+		fprintf(stderr, "batch: failed to start\n");
+		aicli_threadpool_destroy(pool);
+		free(slots);
+		free(fs);
+		free(map);
+		return 2;
+	}
+	// execute pages are shared across conversations, as under aicli serve.
+	aicli_paging_cache_t *cache = NULL;
+	if (!aicli_paging_cache_process()) {
+		cache = aicli_paging_cache_create(0, 0);
+		aicli_paging_cache_set_process(cache);
+	}
+
+	bool all_ok = true;
+	bool out_ok = true;
+	int read_errno = 0;
+	char *line = NULL;
+	size_t line_cap = 0;
+	for (size_t index = 0; out_ok; index++) {
+		errno = 0;
+		ssize_t len = getline(&line, &line_cap, in);
+		if (len < 0) {
+			if (ferror(in))
+				read_errno = errno ? errno : EIO;
+			break;
+		}
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		size_t skip = strspn(line, " \t");
+		if ((size_t)len == skip)
+			continue;
+
+		size_t i = 0;
+		while (i < o.concurrency && slots[i].busy)
+			i++;
+		if (i == o.concurrency)
+			i = wait_one(pool, slots, o.concurrency, fs, map, out, &all_ok, &out_ok);
+		batch_slot_t *s = &slots[i];
+		s->cfg = cfg;
+		s->opts = &o;
+		s->index = index;
+		s->line_len = (size_t)len - skip;
+		s->line = strndup(line + skip, s->line_len);
+		s->ok = false;
+		if (!s->line || !aicli_buf_init(&s->out, 256)) {
+			free(s->line);
+			s->line = NULL;
+			all_ok = false;
+			fprintf(stderr, "batch: out of memory at line %zu\n", index);
+			continue;
+		}
+		s->busy = true;
+		// Runs on this thread if the pool cannot take it; done is completed either way.
+		(void)aicli_threadpool_submit_future(pool, conversation_job, s, &s->done);
+	}
+	free(line);
+
+	while (wait_one(pool, slots, o.concurrency, fs, map, out, &all_ok, &out_ok) < o.concurrency)
+		;
+
+	aicli_threadpool_destroy(pool);
+	free(slots);
+	free(fs);
+	free(map);
+	// Every run has waited for its tool jobs, so nothing uses the cache any more.
+	if (cache) {
+		aicli_paging_cache_set_process(NULL);
+		aicli_paging_cache_destroy(cache);
+	}
+
+	if (read_errno) {
+		fprintf(stderr, "batch: failed to read input: %s\n", strerror(read_errno));
+		return 2;
+	}
+	if (!out_ok) {
+		fprintf(stderr, "batch: failed to write output\n");
+		return 2;
+	}
+	return all_ok ? 0 : 1;
+}
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "http_client.h"
+
 typedef struct {
 	char *data;
 	size_t len;
@@ -83,7 +85,7 @@ int aicli_brave_web_search(const char *api_key, const char *query, int count,
 	if (count > 20)
 		count = 20;
 
-	CURL *curl = curl_easy_init();
+	CURL *curl = aicli_http_easy_acquire();
 	if (!curl) {
 		set_err(out->error, "curl_easy_init failed");
 		return 2;
@@ -91,6 +93,7 @@ int aicli_brave_web_search(const char *api_key, const char *query, int count,
 
 	int rc = 0;
 	mem_buf_t buf = {0};
+	struct curl_slist *headers = NULL;
 
 	char *q = curl_easy_escape(curl, query, 0);
 	if (!q) {
@@ -128,7 +131,6 @@ int aicli_brave_web_search(const char *api_key, const char *query, int count,
 		}
 	}
 
-	struct curl_slist *headers = NULL;
 	char auth[512];
 	snprintf(auth, sizeof(auth), "X-Subscription-Token: %s", api_key);
 	headers = curl_slist_append(headers, auth);
@@ -145,7 +147,7 @@ int aicli_brave_web_search(const char *api_key, const char *query, int count,
 	// Hard cap: if server sends too much, abort via write_cb returning 0.
 	// (mem_buf_reserve caps at 16 MiB)
 
-	CURLcode cc = curl_easy_perform(curl);
+	CURLcode cc = aicli_http_perform(curl);
 	if (cc != CURLE_OK) {
 		set_err(out->error, curl_easy_strerror(cc));
 		rc = 2;
@@ -165,7 +167,6 @@ done:
 	mem_buf_free(&buf);
 	if (headers)
 		curl_slist_free_all(headers);
-	curl_easy_cleanup(curl);
 	return rc;
 }
 
@@ -64,3 +64,25 @@ bool aicli_buf_append_str(aicli_buf_t *b, const char *s)
 		return true;
 	return aicli_buf_append(b, s, strlen(s));
 }
+
+char *aicli_buf_reserve(aicli_buf_t *b, size_t n)
+{
+	if (!b || b->len + n < b->len || !ensure_cap(b, b->len + n))
+		return NULL;
+	return b->data + b->len;
+}
+
+size_t aicli_buf_put_ulong(char *dst, unsigned long v, unsigned width)
+{
+	char tmp[AICLI_BUF_ULONG_MAX];
+	size_t n = 0;
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v > 0);
+	size_t pad = width > n ? width - n : 0;
+	memset(dst, ' ', pad);
+	for (size_t i = 0; i < n; i++)
+		dst[pad + i] = tmp[n - 1 - i];
+	return pad + n;
+}
@@ -0,0 +1,48 @@
+#include "cancel.h"
+
+#include <stddef.h>
+#include <time.h>
+
+static _Thread_local const aicli_cancel_t *tls_current;
+
+int64_t aicli_monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void aicli_cancel_init(aicli_cancel_t *c, int64_t deadline_ms)
+{
+	if (!c)
+		return;
+	atomic_init(&c->cancelled, false);
+	c->deadline_ms = deadline_ms;
+}
+
+void aicli_cancel_request(aicli_cancel_t *c)
+{
+	if (c)
+		atomic_store(&c->cancelled, true);
+}
+
+bool aicli_cancel_requested(const aicli_cancel_t *c)
+{
+	if (!c)
+		return false;
+	if (atomic_load(&c->cancelled))
+		return true;
+	return c->deadline_ms != 0 && aicli_monotonic_ms() >= c->deadline_ms;
+}
+
+const aicli_cancel_t *aicli_cancel_current(void)
+{
+	return tls_current;
+}
+
+const aicli_cancel_t *aicli_cancel_set_current(const aicli_cancel_t *c)
+{
+	const aicli_cancel_t *prev = tls_current;
+	tls_current = c;
+	return prev;
+}
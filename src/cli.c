@@ -14,11 +14,14 @@
 #include "aicli_config.h"
 #include "aicli_config_file.h"
 #include "auto_search.h"
+#include "batch.h"
 #include "brave_search.h"
 #include "google_search.h"
+#include "http_client.h"
 #include "execute_tool.h"
 #include "openai_tool_loop.h"
 #include "paging_cache.h"
+#include "serve.h"
 #include "web_search_tool.h"
 #include "web_fetch_tool.h"
 
@@ -366,12 +369,6 @@ static int cmd_exec_local(int argc, char **argv)
 			if (r == 0)
 				break;
 			total += (size_t)r;
-			if (total > (1024 * 1024)) {
-				close(fd);
-				unlink(stdin_tmp_path);
-				fprintf(stderr, "stdin_too_large\n");
-				return 4;
-			}
 			ssize_t off = 0;
 			while (off < r) {
 				ssize_t w = write(fd, buf + off, (size_t)(r - off));
@@ -454,8 +451,10 @@ static int cmd_exec_local(int argc, char **argv)
 	    .size = size,
 	};
 
+	// A one-shot _exec has no use for a cache (and would give up stopping early to fill
+	// one); under aicli serve the next invocation may ask for the following page.
 	aicli_tool_result_t res;
-	aicli_execute_run(&allow, &req, &res);
+	aicli_execute_run(&allow, aicli_paging_cache_process(), &req, &res);
 	// For execute: keep errors on stderr, but also allow tools to return
 	// error text via stdout (e.g., grep: <regex error>) while failing.
 	if (res.stderr_text && res.stderr_text[0])
@@ -471,11 +470,12 @@ static int cmd_exec_local(int argc, char **argv)
 	if (stdin_tmp_path[0])
 		unlink(stdin_tmp_path);
 
+	const char *total_op = res.total_bytes_lower_bound ? ">=" : "=";
 	if (res.has_next_start) {
-		fprintf(stderr, "\n[total_bytes=%zu next_start=%zu]\n", res.total_bytes,
+		fprintf(stderr, "\n[total_bytes%s%zu next_start=%zu]\n", total_op, res.total_bytes,
 		        res.next_start);
 	} else {
-		fprintf(stderr, "\n[total_bytes=%zu]\n", res.total_bytes);
+		fprintf(stderr, "\n[total_bytes%s%zu]\n", total_op, res.total_bytes);
 	}
 	return res.exit_code;
 }
@@ -494,11 +494,15 @@ const char *aicli_cli_usage_string(void)
 	       "  aicli web search <query> [--count N] [--lang xx] [--freshness day|week|month] [--max-title N] [--max-url N] [--max-snippet N] [--width N] [--raw]\n"
 	       "                    (note: --start/--size are available only with --raw)\n"
 	       "  aicli web fetch <url> [--start N] [--size N]\n"
-	       "  aicli run [--file PATH ...] [--file - | --stdin] [--turns N] [--max-tool-calls N] [--tool-threads N]\n"
+	       "  aicli run [--file PATH ...] [--file - | --stdin] [--turns N] [--max-tool-calls N] [--tool-threads N] [--stream]\n"
+	       "           [--tool-timeout SEC]\n"
 	       "           [--continue[=auto|both|after|next][=THREAD]]\n"
 	       "           [--disable-all-tools] [--available-tools TOOL[,TOOL...]] [--force-tool TOOL]\n"
 	       "           [--config PATH] [--no-config]\n"
 	       "           [--debug-all[=LEVEL]] [--debug-api[=LEVEL]] [--debug-function-call[=LEVEL]] [--auto-search] <prompt>\n"
+	       "  aicli batch [--input PATH|-] [--concurrency N] [--turns N] [--max-tool-calls N] [--tool-threads N]\n"
+	       "             [--tool-timeout SEC] [--disable-all-tools]   (JSONL in, JSONL out in completion order)\n"
+	       "  aicli serve [--socket PATH]\n"
 	       "  aicli --list-tools\n"
 	       "\n"
 	       "Config (highest priority wins):\n"
@@ -516,6 +520,8 @@ const char *aicli_cli_usage_string(void)
 	       "  OPENAI_API_KEY=... (or AICLI_OPENAI_API_KEY)\n"
 	       "  AICLI_SEARCH_PROVIDER=google_cse|google|brave (default: google_cse)\n"
 	       "  AICLI_WEB_FETCH_PREFIXES=prefix1,prefix2,... (enables web fetch allowlist)\n"
+	       "  AICLI_TOOL_TIMEOUT=SEC (per-turn tool time budget for run, 0 = none; default: 60)\n"
+	       "  AICLI_SOCKET=PATH (run/chat/_exec/web go to the aicli serve daemon on PATH when it is up)\n"
 	       "  GOOGLE_API_KEY=...\n"
 	       "  GOOGLE_CSE_CX=...\n"
 	       "  BRAVE_API_KEY=... (when provider=brave)\n";
@@ -681,6 +687,9 @@ static int cmd_list_tools(void)
 
 static int cmd_run(int argc, char **argv, const aicli_config_t *cfg);
 
+// Session of the client whose command runs under aicli serve (0: this process's own).
+static long g_client_sid;
+
 static int cmd_chat(int argc, char **argv, const aicli_config_t *cfg)
 {
 	// aicli chat <prompt>
@@ -782,9 +791,11 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 	int disable_all_tools = 0;
 	int debug_api = 0;
 	int debug_function_call = 0;
+	bool stream = false;
 	size_t turns = 4;
 	size_t max_tool_calls = 8;
 	size_t tool_threads = 1;
+	long tool_timeout_ms = cfg->tool_timeout_ms;
 	aicli_continue_opt_t cont = {0};
 	bool want_continue = false;
 	char prev_id[256];
@@ -886,6 +897,18 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 			i += 2;
 			continue;
 		}
+		if (strcmp(argv[i], "--tool-timeout") == 0 && i + 1 < argc) {
+			errno = 0;
+			char *end = NULL;
+			unsigned long long v = strtoull(argv[i + 1], &end, 10);
+			if (errno != 0 || !end || *end != '\0' || v > 3600) {
+				fprintf(stderr, "invalid --tool-timeout (0..3600 seconds)\n");
+				return 2;
+			}
+			tool_timeout_ms = (long)v * 1000;
+			i += 2;
+			continue;
+		}
 		if (strcmp(argv[i], "--disable-all-tools") == 0) {
 			disable_all_tools = 1;
 			i += 1;
@@ -952,6 +975,11 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 			i += 1;
 			continue;
 		}
+		if (strcmp(argv[i], "--stream") == 0) {
+			stream = true;
+			i += 1;
+			continue;
+		}
 		fprintf(stderr, "unknown option: %s\n", argv[i]);
 		return 2;
 	}
@@ -964,7 +992,7 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 
 	const char *previous_response_id = NULL;
 	if (want_continue) {
-		long sid = (long)getsid(0);
+		long sid = g_client_sid ? g_client_sid : (long)getsid(0);
 		if (sid <= 0) {
 			fprintf(stderr, "failed to get session id for --continue\n");
 			return 2;
@@ -1015,12 +1043,6 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 			if (r == 0)
 				break;
 			total += (size_t)r;
-			if (total > (1024 * 1024)) {
-				close(fd);
-				unlink(stdin_tmp_path);
-				fprintf(stderr, "stdin_too_large\n");
-				return 4;
-			}
 			ssize_t off = 0;
 			while (off < r) {
 				ssize_t w = write(fd, buf + off, (size_t)(r - off));
@@ -1289,9 +1311,17 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 	memcpy(&cfg_local, cfg, sizeof(cfg_local));
 	cfg_local.debug_api = debug_api;
 	cfg_local.debug_function_call = debug_function_call;
+	cfg_local.stream = stream;
+	cfg_local.tool_timeout_ms = tool_timeout_ms;
 	int rc = aicli_openai_run_with_tools(&cfg_local, &allow, to_send, previous_response_id, turns,
 	                                   (size_t)max_tool_calls, tool_threads,
 	                                   tool_choice, &final_text, &final_response_json);
+	if (debug_api > 0) {
+		aicli_http_stats_t hs;
+		aicli_http_stats_get(&hs);
+		fprintf(stderr, "[debug:api] http requests=%lu connections_opened=%lu connections_reused=%lu\n",
+		        hs.requests, hs.connections_opened, hs.connections_reused);
+	}
 	if (want_continue) {
 			bool should_write = false;
 			if (cont.mode == AICLI_CONTINUE_BOTH)
@@ -1335,7 +1365,9 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 	}
 
 	if (final_text && final_text[0]) {
-		fputs(final_text, stdout);
+		// With --stream the text has already been written as it arrived.
+		if (!stream)
+			fputs(final_text, stdout);
 		fputc('\n', stdout);
 		free(final_text);
 		free(final_response_json);
@@ -1349,6 +1381,94 @@ static int cmd_run(int argc, char **argv, const aicli_config_t *cfg)
 	return 2;
 }
 
+static int cmd_batch(int argc, char **argv, int argi, const aicli_config_t *cfg)
+{
+	// aicli batch [--input PATH|-] [--concurrency N] [--turns N] [--max-tool-calls N]
+	//             [--tool-threads N] [--tool-timeout SEC] [--disable-all-tools]
+	if (!cfg || !cfg->openai_api_key || !cfg->openai_api_key[0]) {
+		fprintf(stderr, "OPENAI_API_KEY (or AICLI_OPENAI_API_KEY, or config openai_api_key) is required\n");
+		return 2;
+	}
+
+	const char *input = "-";
+	aicli_batch_opts_t opts = {0};
+	long tool_timeout_ms = cfg->tool_timeout_ms;
+	for (int i = argi + 1; i < argc; i++) {
+		const char *opt = argv[i];
+		bool has_value = i + 1 < argc;
+		if (strcmp(opt, "--input") == 0 && has_value) {
+			input = argv[++i];
+			continue;
+		}
+		if (strcmp(opt, "--disable-all-tools") == 0) {
+			opts.tool_choice = "none";
+			continue;
+		}
+		// Already applied by load_config_with_precedence().
+		if (strcmp(opt, "--no-config") == 0)
+			continue;
+		if (strcmp(opt, "--config") == 0 && has_value) {
+			i++;
+			continue;
+		}
+		unsigned long long max = 0;
+		size_t *dst = NULL;
+		if (strcmp(opt, "--concurrency") == 0) {
+			max = AICLI_BATCH_MAX_CONCURRENCY;
+			dst = &opts.concurrency;
+		} else if (strcmp(opt, "--turns") == 0) {
+			max = 32;
+			dst = &opts.max_turns;
+		} else if (strcmp(opt, "--max-tool-calls") == 0) {
+			max = 64;
+			dst = &opts.max_tool_calls_per_turn;
+		} else if (strcmp(opt, "--tool-threads") == 0) {
+			max = 64;
+			dst = &opts.tool_threads;
+		} else if (strcmp(opt, "--tool-timeout") != 0) {
+			fprintf(stderr, "unknown batch option: %s\n", opt);
+			return 2;
+		}
+		if (!has_value) {
+			fprintf(stderr, "missing value for %s\n", opt);
+			return 2;
+		}
+		errno = 0;
+		char *end = NULL;
+		unsigned long long v = strtoull(argv[++i], &end, 10);
+		if (!dst) {
+			if (errno != 0 || !end || *end != '\0' || v > 3600) {
+				fprintf(stderr, "invalid --tool-timeout (0..3600 seconds)\n");
+				return 2;
+			}
+			tool_timeout_ms = (long)v * 1000;
+			continue;
+		}
+		if (errno != 0 || !end || *end != '\0' || v == 0 || v > max) {
+			fprintf(stderr, "invalid %s (1..%llu)\n", opt, max);
+			return 2;
+		}
+		*dst = (size_t)v;
+	}
+
+	FILE *in = stdin;
+	if (strcmp(input, "-") != 0) {
+		in = fopen(input, "r");
+		if (!in) {
+			fprintf(stderr, "cannot open %s: %s\n", input, strerror(errno));
+			return 2;
+		}
+	}
+	aicli_config_t cfg_local;
+	memcpy(&cfg_local, cfg, sizeof(cfg_local));
+	cfg_local.stream = false;
+	cfg_local.tool_timeout_ms = tool_timeout_ms;
+	int rc = aicli_batch_run(&cfg_local, &opts, in, stdout);
+	if (in != stdin)
+		fclose(in);
+	return rc;
+}
+
 static int cmd_web_search(int argc, char **argv, const aicli_config_t *cfg)
 {
 	if (argc < 4) {
@@ -1648,7 +1768,8 @@ static int cmd_web_search(int argc, char **argv, const aicli_config_t *cfg)
 	}
 
 	// --raw: tool 経由でページング/キャッシュ
-	aicli_paging_cache_t *cache = aicli_paging_cache_create(64);
+	// Not the process cache: a daemon would keep web results past their disk-cache TTL.
+	aicli_paging_cache_t *cache = aicli_paging_cache_create(0, 0);
 	if (!cache) {
 		fprintf(stderr, "out of memory\n");
 		return 2;
@@ -1755,7 +1876,8 @@ static int cmd_web_fetch(int argc, char **argv, const aicli_config_t *cfg)
 		}
 	}
 
-	aicli_paging_cache_t *cache = aicli_paging_cache_create(64);
+	// Not the process cache: a daemon would keep web results past their disk-cache TTL.
+	aicli_paging_cache_t *cache = aicli_paging_cache_create(0, 0);
 	if (!cache) {
 		fprintf(stderr, "out of memory\n");
 		free(prefixes_buf);
@@ -1805,6 +1927,108 @@ static int cmd_web_fetch(int argc, char **argv, const aicli_config_t *cfg)
 	return 0;
 }
 
+// Runs the subcommand at argv[argi] with the config resolved from .aicli.json and the
+// environment. Under aicli serve those are the client's working directory and
+// environment, so a forwarded command gets the config it would get locally.
+static int dispatch_command(int argc, char **argv, int argi)
+{
+	if (strcmp(argv[argi], "_exec") == 0) {
+		// Pass argv starting at program name so cmd_exec_local sees the expected layout:
+		// aicli _exec --file PATH "cat PATH"
+		return cmd_exec_local(argc - (argi - 1), argv + (argi - 1));
+	}
+
+	aicli_config_t loaded;
+	if (!load_config_with_precedence(&loaded, argc, argv)) {
+		fprintf(stderr, "failed to load config\n");
+		return 2;
+	}
+	const aicli_config_t *cfg = &loaded;
+
+	int rc = 2;
+	if (strcmp(argv[argi], "web") == 0) {
+		if (argc >= 3 && strcmp(argv[2], "search") == 0)
+			rc = cmd_web_search(argc, argv, cfg);
+		else if (argc >= 3 && strcmp(argv[2], "fetch") == 0)
+			rc = cmd_web_fetch(argc, argv, cfg);
+		else
+			fprintf(stderr, "unknown web subcommand\n");
+	} else if (strcmp(argv[argi], "chat") == 0) {
+		rc = cmd_chat(argc, argv, cfg);
+	} else if (strcmp(argv[argi], "run") == 0) {
+		rc = cmd_run(argc, argv, cfg);
+	} else if (strcmp(argv[argi], "batch") == 0) {
+		rc = cmd_batch(argc, argv, argi, cfg);
+	} else {
+		fprintf(stderr, "unknown subcommand: %s\n", argv[argi]);
+		usage(stderr);
+	}
+	aicli_config_free(&loaded);
+	return rc;
+}
+
+// With AICLI_SOCKET set, commands go to the daemon listening there (aicli serve).
+// Without a daemon they run here as usual.
+static bool forward_to_daemon(int argc, char **argv, int argi, int *out_rc)
+{
+	const char *path = getenv("AICLI_SOCKET");
+	if (!path || !path[0])
+		return false;
+	const char *cmd = argv[argi];
+	if (strcmp(cmd, "run") != 0 && strcmp(cmd, "chat") != 0 && strcmp(cmd, "_exec") != 0 &&
+	    strcmp(cmd, "web") != 0)
+		return false;
+	return aicli_serve_forward(path, argc, argv, out_rc);
+}
+
+static int serve_handle(const aicli_serve_request_t *req, void *arg)
+{
+	(void)arg;
+	int argi = 1;
+	while (argi < req->argc) {
+		if (strcmp(req->argv[argi], "--no-config") == 0)
+			argi++;
+		else if (strcmp(req->argv[argi], "--config") == 0 && argi + 1 < req->argc)
+			argi += 2;
+		else
+			break;
+	}
+	if (argi >= req->argc) {
+		fprintf(stderr, "missing subcommand\n");
+		return 2;
+	}
+	g_client_sid = req->sid;
+	int rc = dispatch_command(req->argc, req->argv, argi);
+	g_client_sid = 0;
+	return rc;
+}
+
+static int cmd_serve(int argc, char **argv, int argi)
+{
+	// aicli serve [--socket PATH]
+	const char *path = getenv("AICLI_SOCKET");
+	for (int i = argi + 1; i < argc; i++) {
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			path = argv[++i];
+			continue;
+		}
+		fprintf(stderr, "unknown serve option: %s\n", argv[i]);
+		return 2;
+	}
+	if (!path || !path[0]) {
+		fprintf(stderr, "missing --socket PATH\n");
+		return 2;
+	}
+
+	aicli_paging_cache_t *cache = aicli_paging_cache_create(0, 0);
+	if (!cache) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	aicli_paging_cache_set_process(cache);
+	return aicli_serve(path, serve_handle, NULL);
+}
+
 int aicli_cli_main(int argc, char **argv)
 {
 	if (argc < 2) {
@@ -1867,50 +2091,11 @@ int aicli_cli_main(int argc, char **argv)
 		return 2;
 	}
 
-	if (argi < argc && strcmp(argv[argi], "_exec") == 0) {
-		// Pass argv starting at program name so cmd_exec_local sees the expected layout:
-		// aicli _exec --file PATH "cat PATH"
-		return cmd_exec_local(argc - (argi - 1), argv + (argi - 1));
-	}
-
-	aicli_config_t cfg;
-	if (!load_config_with_precedence(&cfg, argc, argv)) {
-		fprintf(stderr, "failed to load config\n");
-		return 2;
-	}
+	if (strcmp(argv[argi], "serve") == 0)
+		return cmd_serve(argc, argv, argi);
 
 	int rc = 0;
-
-	if (strcmp(argv[argi], "web") == 0) {
-		if (argc >= 3 && strcmp(argv[2], "search") == 0) {
-			rc = cmd_web_search(argc, argv, &cfg);
-			aicli_config_free(&cfg);
-			return rc;
-		}
-		if (argc >= 3 && strcmp(argv[2], "fetch") == 0) {
-			rc = cmd_web_fetch(argc, argv, &cfg);
-			aicli_config_free(&cfg);
-			return rc;
-		}
-		fprintf(stderr, "unknown web subcommand\n");
-		aicli_config_free(&cfg);
-		return 2;
-	}
-
-	if (strcmp(argv[argi], "chat") == 0) {
-		rc = cmd_chat(argc, argv, &cfg);
-		aicli_config_free(&cfg);
-		return rc;
-	}
-
-	if (strcmp(argv[argi], "run") == 0) {
-		rc = cmd_run(argc, argv, &cfg);
-		aicli_config_free(&cfg);
+	if (forward_to_daemon(argc, argv, argi, &rc))
 		return rc;
-	}
-
-	fprintf(stderr, "unknown subcommand: %s\n", argv[argi]);
-	usage(stderr);
-	aicli_config_free(&cfg);
-	return 2;
+	return dispatch_command(argc, argv, argi);
 }
@@ -1,9 +1,39 @@
 #include "aicli.h"
 #include "aicli_config.h"
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Byte count from the environment: digits with an optional K/M/G suffix. 0 if unset or
+// invalid (the caller's default then applies).
+static size_t env_bytes(const char *name)
+{
+	const char *v = getenv(name);
+	if (!v || !v[0])
+		return 0;
+	char *end = NULL;
+	errno = 0;
+	unsigned long long x = strtoull(v, &end, 10);
+	if (errno != 0 || end == v)
+		return 0;
+	unsigned shift = 0;
+	if (*end == 'K' || *end == 'k')
+		shift = 10;
+	else if (*end == 'M' || *end == 'm')
+		shift = 20;
+	else if (*end == 'G' || *end == 'g')
+		shift = 30;
+	else if (*end != '\0')
+		return 0;
+	if (shift && end[1] != '\0')
+		return 0;
+	if (x > (SIZE_MAX >> shift))
+		return SIZE_MAX;
+	return (size_t)(x << shift);
+}
+
 void aicli_config_free(aicli_config_t *cfg)
 {
 	if (!cfg)
@@ -40,6 +70,22 @@ bool aicli_config_load_from_env(aicli_config_t *out)
 	out->model_owned = false;
 	out->debug_api = 0;
 	out->debug_function_call = 0;
+	out->stream = false;
+	out->tool_timeout_ms = AICLI_DEFAULT_TOOL_TIMEOUT_MS;
+	{
+		// Seconds; 0 disables the budget.
+		const char *v = getenv("AICLI_TOOL_TIMEOUT");
+		if (v && v[0]) {
+			char *end = NULL;
+			long sec = strtol(v, &end, 10);
+			if (end && *end == '\0' && sec >= 0 && sec <= 3600)
+				out->tool_timeout_ms = sec * 1000;
+		}
+	}
+
+	// Tool output budget (bytes per turn / per run); unset keeps the defaults.
+	out->tool_output_turn_bytes = env_bytes("AICLI_TOOL_OUTPUT_BUDGET");
+	out->tool_output_run_bytes = env_bytes("AICLI_TOOL_OUTPUT_TOTAL");
 
 	// Search provider (default: Google CSE)
 	out->search_provider = AICLI_SEARCH_PROVIDER_GOOGLE_CSE;
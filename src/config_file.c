@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -200,42 +201,104 @@ static void apply_str_if_present(const char **dst, yyjson_val *obj, const char *
 		*dst = yyjson_get_str(v);
 }
 
-bool aicli_config_load_from_file(aicli_config_t *cfg, const aicli_config_file_t *cf)
+// Parsed config files, keyed by path and stat identity. A long-lived process (aicli serve)
+// resolves the config for every request; an unchanged file is not read and parsed again.
+#define PARSED_CACHE_MAX 8
+
+typedef struct {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	yyjson_doc *doc;
+} parsed_entry_t;
+
+static pthread_mutex_t g_parsed_mu = PTHREAD_MUTEX_INITIALIZER;
+static parsed_entry_t g_parsed[PARSED_CACHE_MAX];
+static size_t g_parsed_next; // slot replaced next once all are taken
+
+static bool parsed_matches(const parsed_entry_t *e, const char *path, const struct stat *st)
 {
-	if (!cfg || !cf || !cf->path)
-		return false;
+	return e->path && strcmp(e->path, path) == 0 && e->dev == st->st_dev &&
+	       e->ino == st->st_ino && e->size == st->st_size &&
+	       e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
 
-	FILE *fp = fopen(cf->path, "rb");
+static yyjson_doc *read_config_doc(FILE *fp, off_t size)
+{
+	if (size < 0 || size > (1024 * 1024))
+		return NULL;
+	char *buf = (char *)malloc((size_t)size + 1);
+	if (!buf)
+		return NULL;
+	size_t got = fread(buf, 1, (size_t)size, fp);
+	buf[got] = '\0';
+	yyjson_doc *doc = yyjson_read(buf, got, 0);
+	free(buf);
+	return doc;
+}
+
+// Returns the parsed file, with g_parsed_mu held on success (the entry may be replaced
+// as soon as it is released).
+static yyjson_doc *parsed_lookup_locked(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
 	if (!fp)
-		return false;
-	if (fseek(fp, 0, SEEK_END) != 0) {
-		fclose(fp);
-		return false;
-	}
-	long n = ftell(fp);
-	if (n < 0 || n > (1024 * 1024)) {
+		return NULL;
+	struct stat st;
+	if (fstat(fileno(fp), &st) != 0) {
 		fclose(fp);
-		return false;
+		return NULL;
 	}
-	rewind(fp);
 
-	char *buf = (char *)malloc((size_t)n + 1);
-	if (!buf) {
-		fclose(fp);
-		return false;
+	pthread_mutex_lock(&g_parsed_mu);
+	parsed_entry_t *slot = NULL;
+	for (size_t i = 0; i < PARSED_CACHE_MAX; i++) {
+		parsed_entry_t *e = &g_parsed[i];
+		if (parsed_matches(e, path, &st)) {
+			fclose(fp);
+			return e->doc;
+		}
+		if (!slot && (!e->path || strcmp(e->path, path) == 0))
+			slot = e;
 	}
-	size_t got = fread(buf, 1, (size_t)n, fp);
+	if (!slot) {
+		slot = &g_parsed[g_parsed_next];
+		g_parsed_next = (g_parsed_next + 1) % PARSED_CACHE_MAX;
+	}
+
+	yyjson_doc *doc = read_config_doc(fp, st.st_size);
 	fclose(fp);
-	buf[got] = '\0';
+	char *key = doc ? dup_cstr(path) : NULL;
+	if (!key) {
+		yyjson_doc_free(doc);
+		pthread_mutex_unlock(&g_parsed_mu);
+		return NULL;
+	}
+	free(slot->path);
+	yyjson_doc_free(slot->doc);
+	slot->path = key;
+	slot->dev = st.st_dev;
+	slot->ino = st.st_ino;
+	slot->size = st.st_size;
+	slot->mtime = st.st_mtim;
+	slot->doc = doc;
+	return doc;
+}
 
-	yyjson_doc *doc = yyjson_read(buf, got, 0);
-	free(buf);
+bool aicli_config_load_from_file(aicli_config_t *cfg, const aicli_config_file_t *cf)
+{
+	if (!cfg || !cf || !cf->path)
+		return false;
+
+	yyjson_doc *doc = parsed_lookup_locked(cf->path);
 	if (!doc)
 		return false;
 
 	yyjson_val *root = yyjson_doc_get_root(doc);
 	if (!root || !yyjson_is_obj(root)) {
-		yyjson_doc_free(doc);
+		pthread_mutex_unlock(&g_parsed_mu);
 		return false;
 	}
 
@@ -311,6 +374,6 @@ bool aicli_config_load_from_file(aicli_config_t *cfg, const aicli_config_file_t
 			cfg->search_provider = AICLI_SEARCH_PROVIDER_BRAVE;
 	}
 
-	yyjson_doc_free(doc);
+	pthread_mutex_unlock(&g_parsed_mu);
 	return true;
 }
@@ -0,0 +1,421 @@
+#include "disk_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ENTRY_SUFFIX ".dc"
+#define TMP_PREFIX ".tmp."
+// Leftover temp files (crashed writers) older than this are removed while trimming.
+#define TMP_STALE_SECONDS 3600
+
+static const char k_magic[8] = { 'A', 'I', 'C', 'L', 'I', 'D', 'C', '1' };
+
+// On-disk layout: header | key | etag | last_modified | content_type | body
+typedef struct {
+	char magic[8];
+	uint32_t key_len;
+	uint32_t etag_len;
+	uint32_t last_modified_len;
+	uint32_t content_type_len;
+	uint64_t body_len;
+	int64_t stored_at;
+	int64_t expires_at;
+	int32_t http_status;
+	uint32_t reserved;
+} entry_header_t;
+
+struct aicli_disk_cache {
+	char dir[PATH_MAX];
+	size_t max_bytes;
+	long default_ttl;
+	pthread_mutex_t trim_mu; // one trimming pass at a time within this process
+};
+
+static int mkdir_p_0700(const char *path)
+{
+	char tmp[PATH_MAX];
+	size_t n = strlen(path);
+	if (n == 0 || n >= sizeof(tmp))
+		return -1;
+	memcpy(tmp, path, n + 1);
+	for (char *p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(tmp, 0700) != 0 && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	if (mkdir(tmp, 0700) != 0 && errno != EEXIST)
+		return -1;
+	struct stat st;
+	if (stat(tmp, &st) != 0 || !S_ISDIR(st.st_mode))
+		return -1;
+	return 0;
+}
+
+static uint64_t fnv1a64(const char *s)
+{
+	uint64_t h = 1469598103934665603ULL;
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint64_t fnv1_64(const char *s)
+{
+	uint64_t h = 1469598103934665603ULL;
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		h *= 1099511628211ULL;
+		h ^= *p;
+	}
+	return h;
+}
+
+static int entry_path(const aicli_disk_cache_t *c, const char *key, char *out, size_t cap)
+{
+	// FNV-1a and FNV-1 side by side -> 128-bit name. Collisions are still harmless:
+	// the stored key is compared on lookup.
+	int n = snprintf(out, cap, "%s/%016llx%016llx" ENTRY_SUFFIX, c->dir,
+	                 (unsigned long long)fnv1a64(key), (unsigned long long)fnv1_64(key));
+	return (n > 0 && (size_t)n < cap) ? 0 : -1;
+}
+
+static long env_long(const char *name, long def)
+{
+	const char *v = getenv(name);
+	if (!v || !v[0])
+		return def;
+	char *end = NULL;
+	errno = 0;
+	long x = strtol(v, &end, 10);
+	if (errno != 0 || !end || *end != '\0' || x < 0)
+		return def;
+	return x;
+}
+
+aicli_disk_cache_t *aicli_disk_cache_open(const char *dir, size_t max_bytes, long default_ttl)
+{
+	if (!dir || !dir[0] || strlen(dir) >= PATH_MAX - 64)
+		return NULL;
+	if (mkdir_p_0700(dir) != 0)
+		return NULL;
+	aicli_disk_cache_t *c = (aicli_disk_cache_t *)calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	if (pthread_mutex_init(&c->trim_mu, NULL) != 0) {
+		free(c);
+		return NULL;
+	}
+	snprintf(c->dir, sizeof(c->dir), "%s", dir);
+	c->max_bytes = max_bytes ? max_bytes : AICLI_DISK_CACHE_DEFAULT_MAX_BYTES;
+	c->default_ttl = default_ttl >= 0 ? default_ttl : AICLI_DISK_CACHE_DEFAULT_TTL;
+	return c;
+}
+
+void aicli_disk_cache_close(aicli_disk_cache_t *c)
+{
+	if (!c)
+		return;
+	pthread_mutex_destroy(&c->trim_mu);
+	free(c);
+}
+
+// Caches opened for the environment settings seen so far. A long-lived process (aicli
+// serve) runs each request under its client's environment, so the settings are read on
+// every call; the caches themselves are kept for the life of the process.
+#define DEFAULT_CACHES_MAX 8
+
+static pthread_mutex_t g_default_mu = PTHREAD_MUTEX_INITIALIZER;
+static aicli_disk_cache_t *g_defaults[DEFAULT_CACHES_MAX];
+static size_t g_default_count;
+
+aicli_disk_cache_t *aicli_disk_cache_default(void)
+{
+	const char *on = getenv("AICLI_DISK_CACHE");
+	if (!on || strcmp(on, "1") != 0)
+		return NULL;
+	char dir[PATH_MAX];
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+	if (xdg && xdg[0] == '/')
+		n = snprintf(dir, sizeof(dir), "%s/aicli", xdg);
+	else if (home && home[0])
+		n = snprintf(dir, sizeof(dir), "%s/.cache/aicli", home);
+	else
+		return NULL;
+	if (n <= 0 || (size_t)n >= sizeof(dir))
+		return NULL;
+	long mb = env_long("AICLI_DISK_CACHE_MAX_MB", 0);
+	size_t max_bytes = mb > 0 ? (size_t)mb * 1024 * 1024 : AICLI_DISK_CACHE_DEFAULT_MAX_BYTES;
+	long ttl = env_long("AICLI_DISK_CACHE_TTL", AICLI_DISK_CACHE_DEFAULT_TTL);
+
+	aicli_disk_cache_t *c = NULL;
+	pthread_mutex_lock(&g_default_mu);
+	for (size_t i = 0; i < g_default_count && !c; i++) {
+		aicli_disk_cache_t *d = g_defaults[i];
+		if (d->max_bytes == max_bytes && d->default_ttl == ttl && strcmp(d->dir, dir) == 0)
+			c = d;
+	}
+	// Callers may still hold the caches already handed out, so none is ever closed;
+	// past the limit new settings simply go uncached.
+	if (!c && g_default_count < DEFAULT_CACHES_MAX) {
+		c = aicli_disk_cache_open(dir, max_bytes, ttl);
+		if (c)
+			g_defaults[g_default_count++] = c;
+	}
+	pthread_mutex_unlock(&g_default_mu);
+	return c;
+}
+
+static void copy_field(char *dst, const char *src, uint32_t len)
+{
+	if (len >= AICLI_DISK_CACHE_VALIDATOR_MAX)
+		len = 0; // never stored that long; treat as absent
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+bool aicli_disk_cache_lookup(aicli_disk_cache_t *c, const char *key,
+                             aicli_disk_cache_entry_t *out)
+{
+	if (!out)
+		return false;
+	memset(out, 0, sizeof(*out));
+	if (!c || !key || !key[0])
+		return false;
+	char path[PATH_MAX];
+	if (entry_path(c, key, path, sizeof(path)) != 0)
+		return false;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(entry_header_t))
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	// Bump mtime: it is the LRU clock used when trimming.
+	const struct timespec times[2] = { { 0, UTIME_OMIT }, { 0, UTIME_NOW } };
+	(void)futimens(fd, times);
+	close(fd);
+
+	size_t map_len = (size_t)st.st_size;
+	entry_header_t h;
+	memcpy(&h, map, sizeof(h));
+	uint64_t need = (uint64_t)sizeof(h) + h.key_len + h.etag_len + h.last_modified_len +
+	                h.content_type_len + h.body_len;
+	size_t key_len = strlen(key);
+	const char *p = (const char *)map + sizeof(h);
+	if (memcmp(h.magic, k_magic, sizeof(k_magic)) != 0 || need != map_len ||
+	    h.key_len != key_len || memcmp(p, key, key_len) != 0) {
+		munmap(map, map_len);
+		return false;
+	}
+	p += h.key_len;
+	copy_field(out->etag, p, h.etag_len);
+	p += h.etag_len;
+	copy_field(out->last_modified, p, h.last_modified_len);
+	p += h.last_modified_len;
+	copy_field(out->content_type, p, h.content_type_len);
+	p += h.content_type_len;
+
+	out->body = p;
+	out->body_len = (size_t)h.body_len;
+	out->http_status = (int)h.http_status;
+	out->stored_at = (time_t)h.stored_at;
+	out->expires_at = (time_t)h.expires_at;
+	// The configured TTL also caps entries stored with a longer lifetime, so lowering
+	// it takes effect for what is already on disk.
+	time_t now = time(NULL);
+	out->fresh = now < out->expires_at && now - out->stored_at < c->default_ttl;
+	out->map = map;
+	out->map_len = map_len;
+	return true;
+}
+
+void aicli_disk_cache_entry_release(aicli_disk_cache_entry_t *e)
+{
+	if (!e)
+		return;
+	if (e->map)
+		munmap(e->map, e->map_len);
+	memset(e, 0, sizeof(*e));
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+typedef struct {
+	char name[64];
+	size_t bytes;
+	struct timespec mtime;
+} trim_item_t;
+
+static int trim_item_cmp(const void *a, const void *b)
+{
+	const trim_item_t *x = (const trim_item_t *)a;
+	const trim_item_t *y = (const trim_item_t *)b;
+	if (x->mtime.tv_sec != y->mtime.tv_sec)
+		return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+	if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+		return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+static bool has_suffix(const char *s, const char *suffix)
+{
+	size_t n = strlen(s);
+	size_t m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static void trim_to_cap(aicli_disk_cache_t *c)
+{
+	// Other processes may trim concurrently; unlink races only cost an ENOENT.
+	pthread_mutex_lock(&c->trim_mu);
+	DIR *d = opendir(c->dir);
+	if (!d) {
+		pthread_mutex_unlock(&c->trim_mu);
+		return;
+	}
+	int dfd = dirfd(d);
+	trim_item_t *items = NULL;
+	size_t count = 0;
+	size_t cap = 0;
+	size_t total = 0;
+	time_t now = time(NULL);
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+		bool is_tmp = strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0;
+		if (!is_tmp && !has_suffix(de->d_name, ENTRY_SUFFIX))
+			continue;
+		if (strlen(de->d_name) >= sizeof(items[0].name))
+			continue;
+		if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (is_tmp) {
+			if (now - st.st_mtime > TMP_STALE_SECONDS)
+				(void)unlinkat(dfd, de->d_name, 0);
+			continue;
+		}
+		if (count == cap) {
+			size_t ncap = cap ? cap * 2 : 64;
+			trim_item_t *n = (trim_item_t *)realloc(items, ncap * sizeof(*items));
+			if (!n)
+				break;
+			items = n;
+			cap = ncap;
+		}
+		memcpy(items[count].name, de->d_name, strlen(de->d_name) + 1);
+		items[count].bytes = (size_t)st.st_size;
+		items[count].mtime = st.st_mtim;
+		total += (size_t)st.st_size;
+		count++;
+	}
+
+	if (total > c->max_bytes) {
+		qsort(items, count, sizeof(*items), trim_item_cmp);
+		// Trim a little below the cap so the next few stores do not each rescan and evict.
+		size_t target = c->max_bytes - c->max_bytes / 8;
+		for (size_t i = 0; i < count && total > target; i++) {
+			if (unlinkat(dfd, items[i].name, 0) == 0 || errno == ENOENT)
+				total -= items[i].bytes;
+		}
+	}
+	free(items);
+	closedir(d);
+	pthread_mutex_unlock(&c->trim_mu);
+}
+
+static uint32_t field_len(const char *s)
+{
+	size_t n = s ? strlen(s) : 0;
+	return n < AICLI_DISK_CACHE_VALIDATOR_MAX ? (uint32_t)n : 0;
+}
+
+bool aicli_disk_cache_store(aicli_disk_cache_t *c, const char *key, const char *body,
+                            size_t body_len, const aicli_disk_cache_meta_t *meta)
+{
+	if (!c || !key || !key[0] || (!body && body_len))
+		return false;
+	size_t key_len = strlen(key);
+	if (key_len > UINT32_MAX)
+		return false;
+	const char *etag = meta ? meta->etag : NULL;
+	const char *last_modified = meta ? meta->last_modified : NULL;
+	const char *content_type = meta ? meta->content_type : NULL;
+
+	entry_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, k_magic, sizeof(k_magic));
+	h.key_len = (uint32_t)key_len;
+	h.etag_len = field_len(etag);
+	h.last_modified_len = field_len(last_modified);
+	h.content_type_len = field_len(content_type);
+	h.body_len = body_len;
+	h.stored_at = (int64_t)time(NULL);
+	long ttl = (meta && meta->ttl_seconds >= 0) ? meta->ttl_seconds : c->default_ttl;
+	h.expires_at = h.stored_at + ttl;
+	h.http_status = meta ? meta->http_status : 0;
+
+	size_t total = sizeof(h) + key_len + h.etag_len + h.last_modified_len + h.content_type_len +
+	               body_len;
+	if (total > c->max_bytes)
+		return false;
+
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	if (entry_path(c, key, path, sizeof(path)) != 0)
+		return false;
+	int n = snprintf(tmp, sizeof(tmp), "%s/" TMP_PREFIX "XXXXXX", c->dir);
+	if (n <= 0 || (size_t)n >= sizeof(tmp))
+		return false;
+	int fd = mkstemp(tmp); // 0600
+	if (fd < 0)
+		return false;
+
+	bool ok = write_all(fd, &h, sizeof(h)) && write_all(fd, key, key_len) &&
+	          write_all(fd, etag, h.etag_len) && write_all(fd, last_modified, h.last_modified_len) &&
+	          write_all(fd, content_type, h.content_type_len) && write_all(fd, body, body_len);
+	// No fsync: a cache entry lost in a crash is just a miss, and a torn one fails
+	// the length check on lookup.
+	if (close(fd) != 0)
+		ok = false;
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return false;
+	}
+	trim_to_cap(c);
+	return true;
+}
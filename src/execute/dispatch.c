@@ -6,73 +6,65 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef bool (*aicli_stage_apply_fn)(const aicli_dsl_stage_t *stg, const char *in, size_t in_len,
-                                    aicli_buf_t *out);
+typedef aicli_stage_t *(*aicli_stage_open_fn)(const aicli_dsl_stage_t *stg);
 
 typedef struct aicli_stage_dispatch {
 	aicli_cmd_kind_t kind;
-	aicli_stage_apply_fn apply;
+	aicli_stage_open_fn open;
 } aicli_stage_dispatch_t;
 
-static bool apply_nl(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_nl(const aicli_dsl_stage_t *stg)
 {
 	// Accept minimal compatibility flags like: nl -ba
 	if (stg && stg->argc > 1) {
 		if (!(stg->argc == 2 && strcmp(stg->argv[1], "-ba") == 0))
-			return false;
+			return NULL;
 	}
-	return aicli_stage_nl(in, in_len, out);
+	return aicli_stage_nl_new();
 }
 
-static bool apply_head(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_head(const aicli_dsl_stage_t *stg)
 {
 	bool ok = true;
 	size_t nlines = aicli_parse_head_n(stg, &ok);
-	return ok && aicli_stage_head(in, in_len, nlines, out);
+	return ok ? aicli_stage_head_new(nlines) : NULL;
 }
 
-static bool apply_tail(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_tail(const aicli_dsl_stage_t *stg)
 {
 	bool ok = true;
 	size_t nlines = aicli_parse_tail_n(stg, &ok);
-	return ok && aicli_stage_tail(in, in_len, nlines, out);
+	return ok ? aicli_stage_tail_new(nlines) : NULL;
 }
 
-static bool apply_wc(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_wc(const aicli_dsl_stage_t *stg)
 {
 	char mode = 0;
 	if (!aicli_parse_wc_mode(stg, &mode))
-		return false;
-	return aicli_stage_wc(in, in_len, mode, out);
+		return NULL;
+	return aicli_stage_wc_new(mode);
 }
 
-static bool apply_sort(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_sort(const aicli_dsl_stage_t *stg)
 {
-	bool reverse = false;
-	if (!aicli_parse_sort_reverse(stg, &reverse))
-		return false;
-	return aicli_stage_sort_lines(in, in_len, reverse, out);
+	aicli_sort_opts_t opts;
+	if (!aicli_parse_sort_args(stg, &opts))
+		return NULL;
+	return aicli_stage_sort_new(&opts);
 }
 
-static bool apply_grep(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_grep(const aicli_dsl_stage_t *stg)
 {
 	const char *pattern = NULL;
 	bool with_n = false;
 	bool fixed = false;
 	bool invert = false;
 	if (!aicli_parse_grep_args(stg, &pattern, &with_n, &fixed, &invert))
-		return false;
-	if (fixed) {
-		if (invert)
-			return aicli_stage_grep_fixed_invert(in, in_len, pattern, with_n, out);
-		return aicli_stage_grep_fixed(in, in_len, pattern, with_n, out);
-	}
-	if (invert)
-		return aicli_stage_grep_bre_invert(in, in_len, pattern, with_n, out);
-	return aicli_stage_grep_bre(in, in_len, pattern, with_n, out);
+		return NULL;
+	return aicli_stage_grep_new(pattern, fixed, invert, with_n);
 }
 
-static bool apply_sed(const aicli_dsl_stage_t *stg, const char *in, size_t in_len, aicli_buf_t *out)
+static aicli_stage_t *open_sed(const aicli_dsl_stage_t *stg)
 {
 	// Prefer sed -n address scripts, then substitution scripts.
 	char cmd = 0;
@@ -81,14 +73,14 @@ static bool apply_sed(const aicli_dsl_stage_t *stg, const char *in, size_t in_le
 	const char *re2 = NULL;
 	size_t re2_len = 0;
 	if (aicli_parse_sed_re_args(stg, &re1, &re1_len, &re2, &re2_len, &cmd)) {
-		return aicli_stage_sed_n_re_addr(in, in_len, re1, re1_len, re2, re2_len, cmd, out);
+		return aicli_stage_sed_n_re_addr_new(re1, re1_len, re2, re2_len, cmd);
 	}
 
 	size_t start_addr = 0;
 	size_t end_addr = 0;
 	cmd = 0;
 	if (aicli_parse_sed_args(stg, &start_addr, &end_addr, &cmd)) {
-		return aicli_stage_sed_n_addr(in, in_len, start_addr, end_addr, cmd, out);
+		return aicli_stage_sed_n_addr_new(start_addr, end_addr, cmd);
 	}
 
 	const char *pattern = NULL;
@@ -96,32 +88,83 @@ static bool apply_sed(const aicli_dsl_stage_t *stg, const char *in, size_t in_le
 	bool global = false;
 	bool print_on_match = false;
 	if (!aicli_parse_sed_subst_args(stg, &pattern, &repl, &global, &print_on_match)) {
-		return false;
+		return NULL;
 	}
-	return aicli_stage_sed_n_subst(in, in_len, pattern, repl, global, print_on_match, out);
+	return aicli_stage_sed_n_subst_new(pattern, repl, global, print_on_match);
 }
 
 static const aicli_stage_dispatch_t k_dispatch[] = {
-	{ AICLI_CMD_NL, apply_nl },        { AICLI_CMD_HEAD, apply_head },
-	{ AICLI_CMD_TAIL, apply_tail },    { AICLI_CMD_WC, apply_wc },
-	{ AICLI_CMD_SORT, apply_sort },    { AICLI_CMD_GREP, apply_grep },
-	{ AICLI_CMD_SED, apply_sed },
+	{ AICLI_CMD_NL, open_nl },        { AICLI_CMD_HEAD, open_head },
+	{ AICLI_CMD_TAIL, open_tail },    { AICLI_CMD_WC, open_wc },
+	{ AICLI_CMD_SORT, open_sort },    { AICLI_CMD_GREP, open_grep },
+	{ AICLI_CMD_SED, open_sed },
 };
 
-static aicli_stage_apply_fn dispatch_find(aicli_cmd_kind_t kind)
+static aicli_stage_open_fn dispatch_find(aicli_cmd_kind_t kind)
 {
 	for (size_t i = 0; i < (sizeof(k_dispatch) / sizeof(k_dispatch[0])); i++) {
 		if (k_dispatch[i].kind == kind)
-			return k_dispatch[i].apply;
+			return k_dispatch[i].open;
 	}
 	return NULL;
 }
 
-bool aicli_execute_apply_stage(const aicli_dsl_stage_t *stg, const char *in, size_t in_len,
-                              aicli_buf_t *out)
+aicli_stage_t *aicli_execute_open_stage(const aicli_dsl_stage_t *stg)
+{
+	aicli_stage_open_fn open = dispatch_find(stg->kind);
+	if (!open)
+		return NULL;
+	return open(stg);
+}
+
+int aicli_execute_open_stages(const aicli_dsl_pipeline_t *pipe, aicli_stage_t **out)
 {
-	aicli_stage_apply_fn apply = dispatch_find(stg->kind);
-	if (!apply)
-		return false;
-	return apply(stg, in, in_len, out);
+	aicli_stage_t *opened[8];
+	int count = pipe->stage_count - 1;
+	for (int i = 0; i < count; i++) {
+		opened[i] = aicli_execute_open_stage(&pipe->stages[i + 1]);
+		if (!opened[i]) {
+			while (i-- > 0)
+				aicli_stage_free(opened[i]);
+			return -1;
+		}
+	}
+
+	// The leading stages that handle every line on their own may run chunk-parallel
+	// (run_from_file.c). A run among them is not extended by a stage that would make it
+	// sequential (head, sed -n 'N,Mp', nl or grep -n after the first stage); that stage
+	// starts the next run instead.
+	bool lead = true;
+	int n = 0;
+	for (int i = 0; i < count;) {
+		int run = 0;
+		bool per_line = lead;
+		while (i + run < count && aicli_stage_fusable(opened[i + run])) {
+			bool numbered = false;
+			bool part_per_line =
+			    aicli_stage_parallelism(opened[i + run], &numbered) == AICLI_STAGE_PER_LINE &&
+			    (!numbered || (n == 0 && run == 0));
+			if (run > 0 && per_line && !part_per_line)
+				break;
+			per_line = per_line && part_per_line;
+			run++;
+		}
+		// The stages that cannot be fused (tail, wc, sort) do not go per line either.
+		lead = run > 0 && per_line;
+		if (run < 2) {
+			out[n++] = opened[i++];
+			continue;
+		}
+		aicli_stage_t *fused = aicli_stage_fused_new(&opened[i], run);
+		i += run;
+		if (!fused) {
+			while (n > 0)
+				aicli_stage_free(out[--n]);
+			while (i < count)
+				aicli_stage_free(opened[i++]);
+			return -1;
+		}
+		out[n++] = fused;
+	}
+	return n;
 }
@@ -1,47 +1,199 @@
 #include "execute/file_reader.h"
 
-#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-int aicli_read_file_range(const char *path, size_t start, size_t max_bytes, char **out_buf,
-                          size_t *out_len, size_t *out_total)
+int aicli_line_reader_open(aicli_line_reader_t *r, const char *path)
 {
-	FILE *fp = fopen(path, "rb");
-	if (!fp)
+	if (!r || !path) {
+		errno = EINVAL;
 		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0)
+		return -1;
+	r->block = AICLI_LINE_READER_BLOCK;
 
-	if (fseek(fp, 0, SEEK_END) != 0) {
-		fclose(fp);
+	if (fstat(r->fd, &r->st) != 0) {
+		int saved = errno;
+		close(r->fd);
+		r->fd = -1;
+		errno = saved;
 		return -1;
 	}
-	long total = ftell(fp);
-	if (total < 0) {
-		fclose(fp);
-		return -1;
+	if (S_ISREG(r->st.st_mode) && r->st.st_size > 0) {
+		void *p = mmap(NULL, (size_t)r->st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+		if (p != MAP_FAILED) {
+			r->map = (const char *)p;
+			r->map_len = (size_t)r->st.st_size;
+			(void)madvise(p, r->map_len, MADV_SEQUENTIAL);
+		}
 	}
-	*out_total = (size_t)total;
+	return 0;
+}
 
-	if ((long)start > total)
-		start = (size_t)total;
-	if (fseek(fp, (long)start, SEEK_SET) != 0) {
-		fclose(fp);
-		return -1;
+static void map_prefetch(aicli_line_reader_t *r, size_t from)
+{
+	// Ask the kernel to start reading the next block while the stages work on this one.
+	if (from >= r->map_len)
+		return;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = from & ~(page - 1);
+	size_t len = r->block + (from - start);
+	if (start + len > r->map_len)
+		len = r->map_len - start;
+	(void)madvise((void *)(r->map + start), len, MADV_WILLNEED);
+}
+
+static int map_next(aicli_line_reader_t *r, const char **out_chunk, size_t *out_len,
+                    bool *out_at_eof)
+{
+	// The previous chunk is no longer in use: drop its pages from our page tables so a
+	// single pass over a large file keeps RSS flat (the page cache still holds them).
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t done = r->map_pos & ~(page - 1);
+	if (done > r->map_released) {
+		(void)madvise((void *)(r->map + r->map_released), done - r->map_released, MADV_DONTNEED);
+		r->map_released = done;
 	}
 
-	size_t to_read = max_bytes;
-	if (start + to_read > (size_t)total)
-		to_read = (size_t)total - start;
+	const char *base = r->map + r->map_pos;
+	size_t remain = r->map_len - r->map_pos;
+	size_t want = remain < r->block ? remain : r->block;
 
-	char *buf = (char *)malloc(to_read + 1);
-	if (!buf) {
-		fclose(fp);
-		return -1;
+	// Cut after the last newline of the block; a line longer than the block extends
+	// the chunk up to its own newline. No newline at all: the rest is the last chunk.
+	size_t cut = 0;
+	for (size_t i = want; i > 0; i--) {
+		if (base[i - 1] == '\n') {
+			cut = i;
+			break;
+		}
+	}
+	if (cut == 0 && want < remain) {
+		const char *nl = (const char *)memchr(base + want, '\n', remain - want);
+		if (nl)
+			cut = (size_t)(nl - base) + 1;
 	}
-	size_t n = fread(buf, 1, to_read, fp);
-	buf[n] = '\0';
-	fclose(fp);
 
-	*out_buf = buf;
-	*out_len = n;
+	*out_chunk = base;
+	if (cut == 0) {
+		*out_len = remain;
+		*out_at_eof = true;
+		r->map_pos = r->map_len;
+		return 0;
+	}
+	*out_len = cut;
+	*out_at_eof = false;
+	r->map_pos += cut;
+	map_prefetch(r, r->map_pos);
 	return 0;
 }
+
+static bool reserve(aicli_line_reader_t *r, size_t need)
+{
+	if (need <= r->cap)
+		return true;
+	size_t cap = r->cap ? r->cap : r->block;
+	while (cap < need)
+		cap *= 2;
+	char *p = (char *)realloc(r->buf, cap);
+	if (!p)
+		return false;
+	r->buf = p;
+	r->cap = cap;
+	return true;
+}
+
+int aicli_line_reader_next(aicli_line_reader_t *r, const char **out_chunk, size_t *out_len,
+                           bool *out_at_eof)
+{
+	if (r->map)
+		return map_next(r, out_chunk, out_len, out_at_eof);
+
+	// Carry the partial line left over from the previous chunk to the front.
+	if (r->pos > 0) {
+		memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+		r->len -= r->pos;
+		r->pos = 0;
+	}
+
+	for (;;) {
+		if (r->eof) {
+			*out_chunk = r->buf ? r->buf : "";
+			*out_len = r->len;
+			*out_at_eof = true;
+			r->pos = r->len;
+			return 0;
+		}
+
+		if (!reserve(r, r->len + r->block)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ssize_t n = read(r->fd, r->buf + r->len, r->block);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			r->eof = true;
+			continue;
+		}
+
+		size_t scanned = r->len;
+		r->len += (size_t)n;
+		for (size_t i = r->len; i > scanned; i--) {
+			if (r->buf[i - 1] == '\n') {
+				*out_chunk = r->buf;
+				*out_len = i;
+				*out_at_eof = false;
+				r->pos = i;
+				return 0;
+			}
+		}
+		// No newline yet: the current line is longer than what we have, read more.
+	}
+}
+
+bool aicli_line_reader_view(const aicli_line_reader_t *r, const char **out_data, size_t *out_len)
+{
+	if (!r || !r->map)
+		return false;
+	*out_data = r->map;
+	*out_len = r->map_len;
+	return true;
+}
+
+bool aicli_line_reader_seek(aicli_line_reader_t *r, size_t offset)
+{
+	if (!r || !r->map || offset > r->map_len)
+		return false;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	r->map_pos = offset;
+	// Nothing below the new position was mapped in, so there is nothing to release.
+	if ((offset & ~(page - 1)) > r->map_released)
+		r->map_released = offset & ~(page - 1);
+	map_prefetch(r, offset);
+	return true;
+}
+
+void aicli_line_reader_close(aicli_line_reader_t *r)
+{
+	if (!r)
+		return;
+	if (r->map)
+		munmap((void *)r->map, r->map_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->buf);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
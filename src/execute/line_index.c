@@ -0,0 +1,278 @@
+#include "execute/line_index.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AICLI_LINE_INDEX_X86 1
+#include <immintrin.h>
+#endif
+
+// Bytes scanned per step while extending towards a target line.
+#define SCAN_STEP ((size_t)1 << 20)
+
+struct aicli_line_index {
+	// identity
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	size_t refs; // guarded by g_mu; the LRU holds one reference
+
+	pthread_mutex_t mu; // guards everything below
+	size_t *samples;    // samples[k]: start of line k * STRIDE + 1
+	size_t nsamples;
+	size_t cap;
+	size_t scanned;  // [0, scanned) is indexed
+	size_t newlines; // '\n' bytes in [0, scanned)
+	bool oom;
+
+	struct aicli_line_index *prev;
+	struct aicli_line_index *next;
+};
+
+typedef void (*scan_fn)(aicli_line_index_t *ix, const char *data, size_t from, size_t to);
+
+static bool push_sample(aicli_line_index_t *ix, size_t off)
+{
+	if (ix->nsamples == ix->cap) {
+		size_t cap = ix->cap ? ix->cap * 2 : 64;
+		size_t *p = (size_t *)realloc(ix->samples, cap * sizeof(*p));
+		if (!p) {
+			ix->oom = true;
+			return false;
+		}
+		ix->samples = p;
+		ix->cap = cap;
+	}
+	ix->samples[ix->nsamples++] = off;
+	return true;
+}
+
+// Accounts for the newlines flagged in `mask` (bit i = data[base + i]).
+static inline void take_mask(aicli_line_index_t *ix, size_t base, uint64_t mask)
+{
+	size_t next = ix->nsamples * AICLI_LINE_INDEX_STRIDE; // newlines before the next sample
+	size_t c = (size_t)__builtin_popcountll(mask);
+	if (ix->newlines + c < next) {
+		ix->newlines += c;
+		return;
+	}
+	while (mask) {
+		size_t bit = (size_t)__builtin_ctzll(mask);
+		if (++ix->newlines == next) {
+			if (!push_sample(ix, base + bit + 1))
+				return;
+			next += AICLI_LINE_INDEX_STRIDE;
+		}
+		mask &= mask - 1;
+	}
+}
+
+static void scan_scalar(aicli_line_index_t *ix, const char *data, size_t from, size_t to)
+{
+	for (size_t i = from; i < to && !ix->oom;) {
+		size_t n = to - i < 64 ? to - i : 64;
+		uint64_t mask = 0;
+		for (size_t j = 0; j < n; j++)
+			mask |= (uint64_t)(data[i + j] == '\n') << j;
+		take_mask(ix, i, mask);
+		i += n;
+	}
+}
+
+#ifdef AICLI_LINE_INDEX_X86
+__attribute__((target("sse2"))) static void scan_sse2(aicli_line_index_t *ix, const char *data,
+                                                       size_t from, size_t to)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	size_t i = from;
+	for (; i + 64 <= to && !ix->oom; i += 64) {
+		uint64_t mask = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i + 16 * k));
+			mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * k);
+		}
+		take_mask(ix, i, mask);
+	}
+	scan_scalar(ix, data, i, to);
+}
+
+__attribute__((target("avx2"))) static void scan_avx2(aicli_line_index_t *ix, const char *data,
+                                                       size_t from, size_t to)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	size_t i = from;
+	for (; i + 64 <= to && !ix->oom; i += 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(const void *)(data + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(const void *)(data + i + 32));
+		uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl));
+		uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl));
+		take_mask(ix, i, lo | (hi << 32));
+	}
+	scan_scalar(ix, data, i, to);
+}
+#endif
+
+static scan_fn g_scan = scan_scalar;
+static pthread_once_t g_scan_once = PTHREAD_ONCE_INIT;
+
+static void select_scan(void)
+{
+#ifdef AICLI_LINE_INDEX_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		g_scan = scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		g_scan = scan_sse2;
+#endif
+}
+
+// Scans on until at least `want` newlines are indexed or the file ends.
+// Caller holds ix->mu.
+static bool extend(aicli_line_index_t *ix, const char *data, size_t len, size_t want)
+{
+	pthread_once(&g_scan_once, select_scan);
+	while (ix->newlines < want && ix->scanned < len && !ix->oom) {
+		size_t to = len - ix->scanned < SCAN_STEP ? len : ix->scanned + SCAN_STEP;
+		g_scan(ix, data, ix->scanned, to);
+		ix->scanned = to;
+	}
+	return !ix->oom;
+}
+
+bool aicli_line_index_offset(aicli_line_index_t *ix, const char *data, size_t len,
+                             unsigned long *line_no, size_t *out_off)
+{
+	if (!ix || !line_no || !out_off || (!data && len > 0))
+		return false;
+	size_t want = *line_no > 1 ? (size_t)*line_no - 1 : 0; // newlines before the line
+	pthread_mutex_lock(&ix->mu);
+	bool ok = extend(ix, data, len, want);
+	if (ok && ix->newlines < want) {
+		*line_no = (unsigned long)ix->newlines + 1;
+		*out_off = len;
+	} else if (ok) {
+		size_t off = ix->samples[want / AICLI_LINE_INDEX_STRIDE];
+		for (size_t r = want % AICLI_LINE_INDEX_STRIDE; r > 0; r--) {
+			const char *nl = (const char *)memchr(data + off, '\n', len - off);
+			off = (size_t)(nl - data) + 1;
+		}
+		*out_off = off;
+	}
+	pthread_mutex_unlock(&ix->mu);
+	return ok;
+}
+
+bool aicli_line_index_newlines(aicli_line_index_t *ix, const char *data, size_t len, size_t *out)
+{
+	if (!ix || !out || (!data && len > 0))
+		return false;
+	pthread_mutex_lock(&ix->mu);
+	bool ok = extend(ix, data, len, SIZE_MAX);
+	*out = ix->newlines;
+	pthread_mutex_unlock(&ix->mu);
+	return ok;
+}
+
+// Most recently used first.
+static pthread_mutex_t g_mu = PTHREAD_MUTEX_INITIALIZER;
+static aicli_line_index_t *g_head;
+static aicli_line_index_t *g_tail;
+static size_t g_count;
+
+static void index_free(aicli_line_index_t *ix)
+{
+	pthread_mutex_destroy(&ix->mu);
+	free(ix->samples);
+	free(ix);
+}
+
+static void lru_unlink(aicli_line_index_t *ix)
+{
+	if (ix->prev)
+		ix->prev->next = ix->next;
+	else
+		g_head = ix->next;
+	if (ix->next)
+		ix->next->prev = ix->prev;
+	else
+		g_tail = ix->prev;
+	ix->prev = NULL;
+	ix->next = NULL;
+	g_count--;
+}
+
+static void lru_push_front(aicli_line_index_t *ix)
+{
+	ix->prev = NULL;
+	ix->next = g_head;
+	if (g_head)
+		g_head->prev = ix;
+	else
+		g_tail = ix;
+	g_head = ix;
+	g_count++;
+}
+
+static bool same_file(const aicli_line_index_t *ix, const struct stat *st)
+{
+	return ix->dev == st->st_dev && ix->ino == st->st_ino && ix->size == st->st_size &&
+	       ix->mtime.tv_sec == st->st_mtim.tv_sec && ix->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+aicli_line_index_t *aicli_line_index_get(const struct stat *st)
+{
+	if (!st)
+		return NULL;
+	aicli_line_index_t *evict = NULL;
+	pthread_mutex_lock(&g_mu);
+	aicli_line_index_t *ix = g_head;
+	while (ix && !same_file(ix, st))
+		ix = ix->next;
+	if (ix) {
+		lru_unlink(ix);
+	} else {
+		ix = (aicli_line_index_t *)calloc(1, sizeof(*ix));
+		if (ix && !push_sample(ix, 0)) {
+			free(ix);
+			ix = NULL;
+		}
+		if (ix) {
+			ix->dev = st->st_dev;
+			ix->ino = st->st_ino;
+			ix->size = st->st_size;
+			ix->mtime = st->st_mtim;
+			ix->refs = 1; // the LRU's
+			pthread_mutex_init(&ix->mu, NULL);
+		}
+	}
+	if (ix) {
+		ix->refs++;
+		lru_push_front(ix);
+		if (g_count > AICLI_LINE_INDEX_CACHE_MAX) {
+			evict = g_tail;
+			lru_unlink(evict);
+			if (--evict->refs > 0)
+				evict = NULL;
+		}
+	}
+	pthread_mutex_unlock(&g_mu);
+	if (evict)
+		index_free(evict);
+	return ix;
+}
+
+void aicli_line_index_release(aicli_line_index_t *ix)
+{
+	if (!ix)
+		return;
+	pthread_mutex_lock(&g_mu);
+	bool last = --ix->refs == 0;
+	pthread_mutex_unlock(&g_mu);
+	if (last)
+		index_free(ix);
+}
@@ -0,0 +1,182 @@
+#include "execute/line_regex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Finds the longest run of plain characters that every match of the BRE `p` must
+// contain. Conservative: groups, brackets, '.', back-references and GNU escapes end
+// a run; a quantified character is dropped from it; alternation disables the
+// prefilter altogether. Patterns are compiled in the C locale, so quantifiers apply
+// to single bytes.
+static void extract_literal(const char *p, char **out, size_t *out_len)
+{
+	size_t n = strlen(p);
+	char *run = (char *)malloc(n + 1);
+	char *best = (char *)malloc(n + 1);
+	size_t run_len = 0;
+	size_t best_len = 0;
+	int depth = 0;
+	*out = NULL;
+	*out_len = 0;
+	if (!run || !best)
+		goto done;
+
+#define FLUSH()                                     \
+	do {                                        \
+		if (run_len > best_len) {           \
+			memcpy(best, run, run_len); \
+			best_len = run_len;         \
+		}                                   \
+		run_len = 0;                        \
+	} while (0)
+
+	for (size_t i = 0; i < n; i++) {
+		char c = p[i];
+		bool quant = false;
+		if (c == '\\') {
+			if (i + 1 >= n)
+				break;
+			char e = p[++i];
+			if (e == '|') {
+				best_len = 0;
+				goto done;
+			} else if (e == '(') {
+				FLUSH();
+				depth++;
+				continue;
+			} else if (e == ')') {
+				FLUSH();
+				depth--;
+				continue;
+			} else if (e == '{') {
+				const char *close = strstr(p + i, "\\}");
+				if (!close) {
+					best_len = 0;
+					goto done;
+				}
+				i = (size_t)(close - p) + 1;
+				quant = true;
+			} else if (e == '?' || e == '+') {
+				quant = true;
+			} else if (strchr(".[]*^$\\/", e)) {
+				c = e;
+			} else {
+				// back-references, \w, \<, \b, ...
+				FLUSH();
+				continue;
+			}
+		} else if (c == '[') {
+			FLUSH();
+			size_t j = i + 1;
+			if (j < n && p[j] == '^')
+				j++;
+			if (j < n && p[j] == ']')
+				j++;
+			while (j < n && p[j] != ']') {
+				if (p[j] == '[' && j + 1 < n &&
+				    (p[j + 1] == ':' || p[j + 1] == '=' || p[j + 1] == '.')) {
+					const char term[3] = {p[j + 1], ']', '\0'};
+					const char *close = strstr(p + j + 2, term);
+					if (!close)
+						break;
+					j = (size_t)(close - p) + 2;
+					continue;
+				}
+				j++;
+			}
+			if (j >= n) {
+				best_len = 0;
+				goto done;
+			}
+			i = j;
+			continue;
+		} else if (c == '*') {
+			// Literal at the start of the pattern, a quantifier everywhere else.
+			if (!(i == 0 || (i == 1 && p[0] == '^')))
+				quant = true;
+		} else if (c == '^' && i == 0) {
+			continue;
+		} else if (c == '$' && i + 1 == n) {
+			continue;
+		} else if (c == '.' || c == '^' || c == '$') {
+			FLUSH();
+			continue;
+		}
+
+		if (quant) {
+			// The run ends with the quantified atom whenever it is non-empty.
+			if (run_len > 0)
+				run_len--;
+			FLUSH();
+			continue;
+		}
+		if (depth > 0 || c == '\n') {
+			FLUSH();
+			continue;
+		}
+		run[run_len++] = c;
+	}
+	FLUSH();
+#undef FLUSH
+
+done:
+	free(run);
+	if (best_len == 0) {
+		free(best);
+		return;
+	}
+	best[best_len] = '\0';
+	*out = best;
+	*out_len = best_len;
+}
+
+int aicli_line_regex_compile(aicli_line_regex_t *r, const char *pattern)
+{
+	memset(r, 0, sizeof(*r));
+	int rc = regcomp(&r->rx, pattern, 0);
+	if (rc != 0)
+		return rc;
+	extract_literal(pattern, &r->lit, &r->lit_len);
+	if (r->lit)
+		aicli_memsearch_init(&r->pre, r->lit, r->lit_len);
+	return 0;
+}
+
+void aicli_line_regex_free(aicli_line_regex_t *r)
+{
+	if (!r)
+		return;
+	regfree(&r->rx);
+	free(r->lit);
+	r->lit = NULL;
+#ifndef REG_STARTEND
+	aicli_buf_free(&r->scratch);
+#endif
+}
+
+const aicli_memsearch_t *aicli_line_regex_prefilter(const aicli_line_regex_t *r)
+{
+	return (r && r->lit) ? &r->pre : NULL;
+}
+
+int aicli_line_regex_exec(aicli_line_regex_t *r, const char *line, size_t len, regmatch_t *m)
+{
+	if (r->lit && !aicli_memsearch_find(&r->pre, line, len))
+		return REG_NOMATCH;
+#ifdef REG_STARTEND
+	// With REG_STARTEND, regexec() reads the bounds from pmatch[0] even when nmatch is
+	// 0, and reports offsets relative to `line`.
+	regmatch_t pm[1];
+	pm[0].rm_so = 0;
+	pm[0].rm_eo = (regoff_t)len;
+	int er = regexec(&r->rx, line, m ? 1 : 0, pm, REG_STARTEND);
+	if (er == 0 && m)
+		*m = pm[0];
+	return er;
+#else
+	r->scratch.len = 0;
+	if (!aicli_buf_append(&r->scratch, line, len) || !aicli_buf_append(&r->scratch, "", 1))
+		return REG_ESPACE;
+	return regexec(&r->rx, r->scratch.data, m ? 1 : 0, m, 0);
+#endif
+}
@@ -0,0 +1,176 @@
+#include "execute/memsearch.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AICLI_MEMSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const aicli_memsearch_t *s, const char *hay, size_t n);
+
+// Rough frequency of a byte in logs, source code and prose; higher is more common.
+// Only the order matters: the two lowest-ranked bytes of the needle are the ones the
+// kernels look for, so they should be the ones least likely to produce false hits.
+static int byte_rank(unsigned char c)
+{
+	static const char lower[] = "etaoinsrhldcumfpgwybvkxjqz";
+	static const char punct[] = ".,:;-_/=\"'()[]{}<>";
+	if (c == ' ')
+		return 255;
+	if (c >= 'a' && c <= 'z')
+		return 250 - 3 * (int)(strchr(lower, c) - lower);
+	if (c == '\n' || c == '\t')
+		return 200;
+	if (c >= '0' && c <= '9')
+		return 170;
+	if (c >= 'A' && c <= 'Z')
+		return 130 - 2 * (int)(strchr(lower, c - 'A' + 'a') - lower);
+	if (c != '\0' && strchr(punct, c))
+		return 140;
+	if (c > ' ' && c < 0x7f)
+		return 60;
+	if (c >= 0x80)
+		return 40;
+	return 10;
+}
+
+void aicli_memsearch_init(aicli_memsearch_t *s, const char *needle, size_t needle_len)
+{
+	memset(s, 0, sizeof(*s));
+	s->needle = needle;
+	s->len = needle_len;
+	if (needle_len == 0)
+		return;
+	size_t i1 = 0;
+	for (size_t i = 1; i < needle_len; i++) {
+		if (byte_rank((unsigned char)needle[i]) < byte_rank((unsigned char)needle[i1]))
+			i1 = i;
+	}
+	size_t i2 = i1;
+	for (size_t i = 0; i < needle_len; i++) {
+		if (i == i1)
+			continue;
+		if (i2 == i1 || byte_rank((unsigned char)needle[i]) < byte_rank((unsigned char)needle[i2]))
+			i2 = i;
+	}
+	s->i1 = i1;
+	s->i2 = i2;
+	s->b1 = (unsigned char)needle[i1];
+	s->b2 = (unsigned char)needle[i2];
+}
+
+// Candidate starts from `i` on, one memchr() per occurrence of the rarest byte.
+static const char *find_scalar_from(const aicli_memsearch_t *s, const char *hay, size_t n,
+                                    size_t i)
+{
+	if (n < s->len)
+		return NULL;
+	const size_t last = n - s->len; // last possible start
+	while (i <= last) {
+		const char *p = (const char *)memchr(hay + i + s->i1, s->b1, last - i + 1);
+		if (!p)
+			return NULL;
+		size_t c = (size_t)(p - hay) - s->i1;
+		if ((unsigned char)hay[c + s->i2] == s->b2 && memcmp(hay + c, s->needle, s->len) == 0)
+			return hay + c;
+		i = c + 1;
+	}
+	return NULL;
+}
+
+static const char *find_scalar(const aicli_memsearch_t *s, const char *hay, size_t n)
+{
+	return find_scalar_from(s, hay, n, 0);
+}
+
+#ifdef AICLI_MEMSEARCH_X86
+// Both kernels test a block of candidate starts [i, i + W) at once: the bytes at
+// i + i1 and i + i2 are compared against b1/b2 and only starts where both match are
+// verified with memcmp(). The loads stay in bounds because i1, i2 < len and the loop
+// only runs while the whole block is <= n - len; the rest goes to the scalar path.
+
+__attribute__((target("sse2"))) static const char *find_sse2(const aicli_memsearch_t *s,
+                                                              const char *hay, size_t n)
+{
+	if (n < s->len)
+		return NULL;
+	const size_t end = n - s->len + 1; // one past the last possible start
+	const __m128i v1 = _mm_set1_epi8((char)s->b1);
+	const __m128i v2 = _mm_set1_epi8((char)s->b2);
+	size_t i = 0;
+	for (; i + 16 <= end; i += 16) {
+		__m128i c1 = _mm_loadu_si128((const __m128i *)(const void *)(hay + i + s->i1));
+		__m128i c2 = _mm_loadu_si128((const __m128i *)(const void *)(hay + i + s->i2));
+		unsigned mask = (unsigned)_mm_movemask_epi8(
+		    _mm_and_si128(_mm_cmpeq_epi8(c1, v1), _mm_cmpeq_epi8(c2, v2)));
+		while (mask) {
+			size_t c = i + (size_t)__builtin_ctz(mask);
+			if (memcmp(hay + c, s->needle, s->len) == 0)
+				return hay + c;
+			mask &= mask - 1;
+		}
+	}
+	return find_scalar_from(s, hay, n, i);
+}
+
+__attribute__((target("avx2"))) static const char *find_avx2(const aicli_memsearch_t *s,
+                                                              const char *hay, size_t n)
+{
+	if (n < s->len)
+		return NULL;
+	const size_t end = n - s->len + 1;
+	const __m256i v1 = _mm256_set1_epi8((char)s->b1);
+	const __m256i v2 = _mm256_set1_epi8((char)s->b2);
+	size_t i = 0;
+	for (; i + 32 <= end; i += 32) {
+		__m256i c1 = _mm256_loadu_si256((const __m256i *)(const void *)(hay + i + s->i1));
+		__m256i c2 = _mm256_loadu_si256((const __m256i *)(const void *)(hay + i + s->i2));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(
+		    _mm256_and_si256(_mm256_cmpeq_epi8(c1, v1), _mm256_cmpeq_epi8(c2, v2)));
+		while (mask) {
+			size_t c = i + (size_t)__builtin_ctz(mask);
+			if (memcmp(hay + c, s->needle, s->len) == 0)
+				return hay + c;
+			mask &= mask - 1;
+		}
+	}
+	return find_scalar_from(s, hay, n, i);
+}
+#endif
+
+static find_fn g_find = find_scalar;
+static const char *g_kernel = "scalar";
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void)
+{
+#ifdef AICLI_MEMSEARCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		g_find = find_avx2;
+		g_kernel = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		g_find = find_sse2;
+		g_kernel = "sse2";
+	}
+#endif
+}
+
+const char *aicli_memsearch_find(const aicli_memsearch_t *s, const char *hay, size_t hay_len)
+{
+	if (!s || s->len == 0 || !hay)
+		return NULL;
+	if (s->len == 1)
+		return (const char *)memchr(hay, s->b1, hay_len);
+	pthread_once(&g_once, select_kernel);
+	return g_find(s, hay, hay_len);
+}
+
+const char *aicli_memsearch_kernel(void)
+{
+	pthread_once(&g_once, select_kernel);
+	return g_kernel;
+}
@@ -1,30 +1,104 @@
 #include "execute/paging.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-void aicli_apply_paging(const char *data, size_t total, size_t start, size_t size,
-                        aicli_tool_result_t *out)
+#include "tool_budget.h"
+
+bool aicli_paging_sink_init(aicli_paging_sink_t *sink, size_t start, size_t size)
+{
+	if (!sink)
+		return false;
+	memset(sink, 0, sizeof(*sink));
+	sink->start = start;
+	sink->size = size;
+	return aicli_buf_init(&sink->window, size + 1);
+}
+
+void aicli_paging_sink_capture(aicli_paging_sink_t *sink, size_t limit)
+{
+	sink->capture_limit = limit;
+	sink->capture_overflow = false;
+}
+
+static void capture(aicli_paging_sink_t *sink, const char *data, size_t len)
+{
+	if (sink->capture_limit == 0 || sink->capture_overflow)
+		return;
+	if (sink->full.len + len > sink->capture_limit || !aicli_buf_append(&sink->full, data, len)) {
+		aicli_buf_free(&sink->full);
+		sink->capture_overflow = true;
+	}
+}
+
+bool aicli_paging_sink_write(aicli_paging_sink_t *sink, const char *data, size_t len)
+{
+	capture(sink, data, len);
+
+	size_t from = sink->total;
+	size_t to = sink->total + len;
+	sink->total = to;
+
+	size_t win_end = sink->start > SIZE_MAX - sink->size ? SIZE_MAX : sink->start + sink->size;
+	size_t lo = from > sink->start ? from : sink->start;
+	size_t hi = to < win_end ? to : win_end;
+	if (lo >= hi)
+		return true;
+	return aicli_buf_append(&sink->window, data + (lo - from), hi - lo);
+}
+
+bool aicli_paging_sink_full(const aicli_paging_sink_t *sink)
 {
-	if (start > total)
-		start = total;
-	size_t remain = total - start;
-	size_t n = remain < size ? remain : size;
+	if (sink->capture_limit != 0 && !sink->capture_overflow)
+		return false;
+	if (sink->start > SIZE_MAX - sink->size)
+		return false;
+	return sink->total > sink->start + sink->size;
+}
 
-	char *buf = (char *)malloc(n + 1);
-	if (!buf) {
+void aicli_paging_sink_finish(aicli_paging_sink_t *sink, aicli_tool_result_t *out)
+{
+	size_t total = sink->total;
+	size_t start = sink->start > total ? total : sink->start;
+	size_t n = sink->window.len;
+	if (start + n < total)
+		n = sink->window.len = aicli_tool_page_trim(sink->window.data, n);
+
+	if (!aicli_buf_append(&sink->window, "", 1)) {
 		out->stderr_text = "oom";
 		out->exit_code = 1;
 		return;
 	}
-	memcpy(buf, data + start, n);
-	buf[n] = '\0';
 
-	out->stdout_text = buf;
+	out->stdout_text = sink->window.data;
 	out->stdout_len = n;
 	out->exit_code = 0;
 	out->total_bytes = total;
+	out->total_bytes_lower_bound = sink->stopped;
 	out->truncated = (start + n) < total;
 	out->has_next_start = out->truncated;
 	out->next_start = start + n;
+
+	sink->window.data = NULL;
+	sink->window.len = 0;
+	sink->window.cap = 0;
+}
+
+bool aicli_paging_sink_captured(const aicli_paging_sink_t *sink, const char **out_data,
+                                size_t *out_len)
+{
+	if (sink->capture_limit == 0 || sink->capture_overflow)
+		return false;
+	*out_data = sink->full.data ? sink->full.data : "";
+	*out_len = sink->full.len;
+	return true;
+}
+
+void aicli_paging_sink_free(aicli_paging_sink_t *sink)
+{
+	if (!sink)
+		return;
+	aicli_buf_free(&sink->window);
+	aicli_buf_free(&sink->full);
 }
@@ -0,0 +1,272 @@
+#include "execute/pipeline_cache.h"
+
+#include "execute/dispatch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool stage_has_file_arg(aicli_cmd_kind_t kind)
+{
+	// Commands that can take a source FILE as their last argument.
+	// We normalize them into: cat FILE | <cmd ...without FILE>
+	switch (kind) {
+	case AICLI_CMD_HEAD:
+	case AICLI_CMD_TAIL:
+	case AICLI_CMD_NL:
+	case AICLI_CMD_SED:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool stage_is_file_sed_n_addr(const aicli_dsl_stage_t *st)
+{
+	// We only support a restricted sed form via pipeline stages:
+	//   sed -n '1,200p'   (script token only)
+	//   sed -n '/RE/p'    (script token only)
+	//   sed -n 's/RE/REPL/[gp]'
+	// When used as a file-input command, models often emit:
+	//   sed -n 1,200p FILE
+	// Normalize that shape into: cat FILE | sed -n 1,200p
+	if (!st)
+		return false;
+	if (st->kind != AICLI_CMD_SED)
+		return false;
+	if (st->argc != 4)
+		return false;
+	if (strcmp(st->argv[1], "-n") != 0)
+		return false;
+	// argv[2] is the script, argv[3] is the file
+	if (!st->argv[2] || !st->argv[2][0])
+		return false;
+	if (!st->argv[3] || !st->argv[3][0])
+		return false;
+	// Validate the script is one of the sed scripts we accept beyond numbers,
+	// so we don't accidentally treat unsupported sed forms as file-input shapes.
+	// Note: numeric N,M handling is covered elsewhere; here we only need to
+	// recognize /RE/ and s/RE/...
+	{
+		char cmd = 0;
+		aicli_dsl_stage_t tmp = *st;
+		tmp.argc = 3;
+		const char *re1 = NULL;
+		size_t re1_len = 0;
+		const char *re2 = NULL;
+		size_t re2_len = 0;
+		bool ok = aicli_parse_sed_re_args(&tmp, &re1, &re1_len, &re2, &re2_len, &cmd);
+		if (re1)
+			free((void *)re1);
+		if (re2)
+			free((void *)re2);
+		if (!ok) {
+			const char *pattern = NULL;
+			const char *repl = NULL;
+			bool global = false;
+			bool print_on_match = false;
+			ok = aicli_parse_sed_subst_args(&tmp, &pattern, &repl, &global, &print_on_match);
+			free((void *)pattern);
+			free((void *)repl);
+		}
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+static int normalize_file_input_pipeline(aicli_dsl_pipeline_t *pipe)
+{
+	// Ensures pipelines enter the executor as: cat FILE | ...
+	// Returns 0 on success; non-zero means unsupported shape.
+	if (!pipe || pipe->stage_count <= 0)
+		return -1;
+
+	// Already normalized.
+	if (pipe->stages[0].kind == AICLI_CMD_CAT && pipe->stages[0].argc == 2)
+		return 0;
+
+	// Also allow a single-stage direct file read: cat FILE
+	// (covered above) and reject other single-stage non-file commands.
+
+	// Support: <cmd ... FILE> | ...  ==>  cat FILE | <cmd ...> | ...
+	// Special-case: sed -n ADDR FILE (argc==4)
+	bool is_sed_file_form = stage_is_file_sed_n_addr(&pipe->stages[0]);
+	if (!is_sed_file_form && !stage_has_file_arg(pipe->stages[0].kind))
+		return -1;
+	if (pipe->stages[0].argc < 2)
+		return -1;
+
+	const char *file = NULL;
+	if (is_sed_file_form)
+		file = pipe->stages[0].argv[3];
+	else
+		file = pipe->stages[0].argv[pipe->stages[0].argc - 1];
+	if (!file || file[0] == '\0')
+		return -1;
+
+	// Shift stages right by 1.
+	if (pipe->stage_count >= 8)
+		return -1;
+	for (int i = pipe->stage_count; i > 0; i--) {
+		pipe->stages[i] = pipe->stages[i - 1];
+	}
+	pipe->stage_count++;
+
+	// New stage 0: cat FILE
+	pipe->stages[0].kind = AICLI_CMD_CAT;
+	pipe->stages[0].argc = 2;
+	pipe->stages[0].argv[0] = "cat";
+	pipe->stages[0].argv[1] = file;
+	for (int i = 2; i < 8; i++)
+		pipe->stages[0].argv[i] = NULL;
+
+	// Remove FILE from the original command stage (now stage 1)
+	if (is_sed_file_form) {
+		// Convert: sed -n ADDR FILE  (argc=4)
+		// into:    sed -n ADDR       (argc=3)
+		pipe->stages[1].argc = 3;
+		pipe->stages[1].argv[3] = NULL;
+	} else {
+		pipe->stages[1].argc -= 1;
+		pipe->stages[1].argv[pipe->stages[1].argc] = NULL;
+	}
+	return 0;
+}
+
+static void compiled_free(aicli_compiled_pipeline_t *cp)
+{
+	if (!cp)
+		return;
+	for (int si = 0; cp->opened && si < cp->stage_count; si++)
+		aicli_stage_free(cp->stages[si]);
+	aicli_dsl_pipeline_free(&cp->parsed);
+	free(cp->command);
+	free(cp);
+}
+
+static aicli_dsl_status_t compile(const char *command, aicli_compiled_pipeline_t **out)
+{
+	*out = NULL;
+	aicli_compiled_pipeline_t *cp = (aicli_compiled_pipeline_t *)calloc(1, sizeof(*cp));
+	if (!cp)
+		return AICLI_DSL_ERR_PARSE;
+	aicli_dsl_status_t st = aicli_dsl_parse_pipeline(command, &cp->parsed);
+	cp->command = strdup(command);
+	if (st == AICLI_DSL_OK && !cp->command)
+		st = AICLI_DSL_ERR_PARSE;
+	if (st != AICLI_DSL_OK) {
+		compiled_free(cp);
+		return st;
+	}
+	cp->pipe = cp->parsed;
+	cp->file_input = normalize_file_input_pipeline(&cp->pipe) == 0;
+	if (cp->file_input)
+		cp->stage_count = cp->pipe.stage_count - 1;
+	*out = cp;
+	return AICLI_DSL_OK;
+}
+
+// Most recently used first. Entries that are checked out are not on the list.
+static pthread_mutex_t g_mu = PTHREAD_MUTEX_INITIALIZER;
+static aicli_compiled_pipeline_t *g_head;
+static aicli_compiled_pipeline_t *g_tail;
+static size_t g_count;
+
+static void lru_unlink(aicli_compiled_pipeline_t *cp)
+{
+	if (cp->prev)
+		cp->prev->next = cp->next;
+	else
+		g_head = cp->next;
+	if (cp->next)
+		cp->next->prev = cp->prev;
+	else
+		g_tail = cp->prev;
+	cp->prev = NULL;
+	cp->next = NULL;
+	g_count--;
+}
+
+static void lru_push_front(aicli_compiled_pipeline_t *cp)
+{
+	cp->prev = NULL;
+	cp->next = g_head;
+	if (g_head)
+		g_head->prev = cp;
+	else
+		g_tail = cp;
+	g_head = cp;
+	g_count++;
+}
+
+aicli_dsl_status_t aicli_pipeline_cache_acquire(const char *command,
+                                                aicli_compiled_pipeline_t **out)
+{
+	if (!out)
+		return AICLI_DSL_ERR_PARSE;
+	*out = NULL;
+	if (!command)
+		return AICLI_DSL_ERR_EMPTY;
+
+	pthread_mutex_lock(&g_mu);
+	aicli_compiled_pipeline_t *cp = g_head;
+	while (cp && strcmp(cp->command, command) != 0)
+		cp = cp->next;
+	if (cp)
+		lru_unlink(cp);
+	pthread_mutex_unlock(&g_mu);
+
+	const char *dbg = getenv("AICLI_DEBUG_FUNCTION_CALL");
+	if (dbg && dbg[0] != '\0')
+		fprintf(stderr, "[debug:pipeline] %s command='%s'\n", cp ? "compiled_hit" : "compile",
+		        command);
+	if (cp) {
+		*out = cp;
+		return AICLI_DSL_OK;
+	}
+	return compile(command, out);
+}
+
+bool aicli_compiled_pipeline_open_stages(aicli_compiled_pipeline_t *cp)
+{
+	if (!cp || !cp->file_input)
+		return false;
+	if (cp->opened)
+		return true;
+	int n = aicli_execute_open_stages(&cp->pipe, cp->stages);
+	if (n < 0)
+		return false;
+	cp->stage_count = n;
+	cp->opened = true;
+	return true;
+}
+
+void aicli_pipeline_cache_release(aicli_compiled_pipeline_t *cp)
+{
+	if (!cp)
+		return;
+	for (int si = 0; cp->opened && si < cp->stage_count; si++)
+		aicli_stage_reset(cp->stages[si]);
+
+	aicli_compiled_pipeline_t *evict = NULL;
+	pthread_mutex_lock(&g_mu);
+	for (aicli_compiled_pipeline_t *e = g_head; e; e = e->next) {
+		if (strcmp(e->command, cp->command) == 0) {
+			// A concurrent run already returned its copy.
+			evict = cp;
+			cp = NULL;
+			break;
+		}
+	}
+	if (cp) {
+		lru_push_front(cp);
+		if (g_count > AICLI_PIPELINE_CACHE_MAX) {
+			evict = g_tail;
+			lru_unlink(evict);
+		}
+	}
+	pthread_mutex_unlock(&g_mu);
+	compiled_free(evict);
+}
@@ -1,7 +1,12 @@
 #include "execute/pipeline_stages.h"
 
+#include "cancel.h"
+#include "execute/line_regex.h"
+#include "execute/memsearch.h"
+
+#include <errno.h>
 #include <stdbool.h>
-#include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,453 +33,1312 @@ static void aicli_dsl_strip_double_dash(const aicli_dsl_stage_t *st, const char
 	*argc_out = n;
 }
 
-bool aicli_stage_nl(const char *in, size_t in_len, aicli_buf_t *out)
+typedef enum {
+	STAGE_NL,
+	STAGE_HEAD,
+	STAGE_TAIL,
+	STAGE_WC,
+	STAGE_SORT,
+	STAGE_GREP,
+	STAGE_SED_ADDR,
+	STAGE_SED_RE_ADDR,
+	STAGE_SED_SUBST,
+	STAGE_FUSED,
+} stage_kind_t;
+
+struct aicli_stage {
+	stage_kind_t kind;
+	unsigned long line_no; // 1-based number of the next input line
+	size_t in_offset;      // input bytes consumed so far
+	union {
+		struct {
+			size_t nlines;
+			size_t seen;
+		} head;
+		struct {
+			size_t nlines;
+			aicli_buf_t keep; // the last `nlines` complete lines, back to back
+			size_t *offs;     // start offset of every kept line in `keep`
+			size_t offs_len;
+			size_t offs_cap;
+			size_t first; // offs[first] is the oldest line still in the window
+			size_t budget;
+			bool clipped; // lines were dropped to keep the window within budget
+		} tail;
+		struct {
+			char mode;
+			bool in_word;
+			unsigned long long count;
+		} wc;
+		struct {
+			aicli_sort_t *engine;
+		} sort;
+		struct {
+			char *needle;
+			size_t needle_len;
+			bool fixed;
+			bool invert;
+			bool with_n;
+			bool empty; // empty pattern: emits nothing
+			aicli_memsearch_t search; // fixed: searches whole chunks, not line by line
+			aicli_line_regex_t rx;
+		} grep;
+		struct {
+			size_t start;
+			size_t end;
+			char cmd;
+		} sed_addr;
+		struct {
+			aicli_line_regex_t rx1;
+			aicli_line_regex_t rx2;
+			bool has_rx2;
+			bool in_range;
+			char cmd;
+		} sed_re;
+		struct {
+			char *pattern;
+			char *repl;
+			size_t repl_len;
+			bool global;
+			bool print_on_match;
+			aicli_line_regex_t rx;
+			aicli_buf_t line_out;
+		} subst;
+		struct {
+			aicli_stage_t *parts[AICLI_STAGE_FUSE_MAX];
+			aicli_buf_t lines[AICLI_STAGE_FUSE_MAX]; // output of parts[k] for one line
+			int n;
+			// grep parts: prefilter literal and its next hit in the chunk being fed
+			const aicli_memsearch_t *pre[AICLI_STAGE_FUSE_MAX];
+			const char *hit[AICLI_STAGE_FUSE_MAX];
+			const char *chunk;
+			size_t chunk_len;
+			// Output lines still in the chunk, back to back, not yet copied to out.
+			const char *run;
+			size_t run_len;
+		} fused;
+	} u;
+};
+
+typedef aicli_stage_status_t (*stage_line_fn)(aicli_stage_t *st, const char *line, size_t len,
+                                              bool last, aicli_buf_t *out);
+
+static aicli_stage_t *stage_alloc(stage_kind_t kind)
 {
-	// Simple line numbering: "     1\t..."
-	unsigned long line = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			char prefix[32];
-			int n = snprintf(prefix, sizeof(prefix), "%6lu\t", line);
-			if (n < 0)
-				return false;
-			if (!aicli_buf_append(out, prefix, (size_t)n))
-				return false;
-			if (!aicli_buf_append(out, in + line_start, i - line_start))
-				return false;
-			if (i < in_len) {
-				if (!aicli_buf_append(out, "\n", 1))
-					return false;
-			}
-			line++;
-			line_start = i + 1;
-		}
-		i++;
+	aicli_stage_t *st = (aicli_stage_t *)calloc(1, sizeof(*st));
+	if (!st)
+		return NULL;
+	st->kind = kind;
+	st->line_no = 1;
+	return st;
+}
+
+// Calls fn once per line of a line-bounded chunk. At EOF the text after the last '\n'
+// is passed as a final line (last == true) even when it is empty: the stages have
+// always treated input as '\n'-separated segments, so e.g. `nl` numbers the empty
+// segment after a trailing newline.
+static aicli_stage_status_t for_each_line(aicli_stage_t *st, const char *in, size_t in_len,
+                                          bool at_eof, aicli_buf_t *out, stage_line_fn fn)
+{
+	size_t pos = 0;
+	while (pos < in_len) {
+		const char *nl = (const char *)memchr(in + pos, '\n', in_len - pos);
+		if (!nl)
+			break;
+		size_t len = (size_t)(nl - (in + pos));
+		aicli_stage_status_t rc = fn(st, in + pos, len, false, out);
+		st->line_no++;
+		st->in_offset += len + 1;
+		if (rc != AICLI_STAGE_CONTINUE)
+			return rc;
+		pos += len + 1;
+		if (st->line_no % AICLI_STAGE_CANCEL_LINES == 0 &&
+		    aicli_cancel_requested(aicli_cancel_current()))
+			return AICLI_STAGE_CANCELLED;
+	}
+	if (!at_eof) {
+		// Chunks other than the last one must end on a line boundary.
+		return pos == in_len ? AICLI_STAGE_CONTINUE : AICLI_STAGE_ERROR;
 	}
+	aicli_stage_status_t rc = fn(st, in + pos, in_len - pos, true, out);
+	st->line_no++;
+	st->in_offset += in_len - pos;
+	return rc == AICLI_STAGE_ERROR ? rc : AICLI_STAGE_DONE;
+}
+
+// Appends prefix, line and '\n' (if newline) with one capacity check.
+static bool emit_line(aicli_buf_t *out, const char *prefix, size_t prefix_len, const char *line,
+                      size_t len, bool newline)
+{
+	char *p = aicli_buf_reserve(out, prefix_len + len + 1);
+	if (!p)
+		return false;
+	if (prefix_len > 0)
+		memcpy(p, prefix, prefix_len);
+	if (len > 0)
+		memcpy(p + prefix_len, line, len);
+	p[prefix_len + len] = '\n';
+	out->len += prefix_len + len + (newline ? 1 : 0);
 	return true;
 }
 
-bool aicli_stage_head(const char *in, size_t in_len, size_t nlines, aicli_buf_t *out)
+// As emit_line() with the line number as prefix: right-aligned in `width` columns and
+// followed by `sep` ("     1\t" for nl, "1:" for grep -n).
+static bool emit_numbered(aicli_buf_t *out, unsigned long no, unsigned width, char sep,
+                          const char *line, size_t len, bool newline)
 {
-	if (nlines == 0)
-		return true;
-	size_t lines = 0;
-	size_t i = 0;
-	while (i < in_len) {
-		if (!aicli_buf_append(out, &in[i], 1))
-			return false;
-		if (in[i] == '\n') {
-			lines++;
-			if (lines >= nlines)
-				break;
-		}
-		i++;
-	}
+	char *p = aicli_buf_reserve(out, AICLI_BUF_ULONG_MAX + 1 + len + 1);
+	if (!p)
+		return false;
+	size_t n = aicli_buf_put_ulong(p, no, width);
+	p[n++] = sep;
+	if (len > 0)
+		memcpy(p + n, line, len);
+	n += len;
+	p[n] = '\n';
+	out->len += n + (newline ? 1 : 0);
 	return true;
 }
 
-bool aicli_stage_tail(const char *in, size_t in_len, size_t nlines, aicli_buf_t *out)
+static aicli_stage_status_t nl_line(aicli_stage_t *st, const char *line, size_t len, bool last,
+                                    aicli_buf_t *out)
 {
-	if (nlines == 0)
-		return true;
-	// Find start position of the last N lines.
-	size_t lines = 0;
-	for (size_t i = in_len; i > 0; i--) {
-		if (in[i - 1] == '\n') {
-			lines++;
-			if (lines == nlines + 1) {
-				// start after this newline
-				size_t start = i;
-				return aicli_buf_append(out, in + start, in_len - start);
-			}
+	// Simple line numbering: "     1\t..."
+	if (!emit_numbered(out, st->line_no, 6, '\t', line, len, !last))
+		return AICLI_STAGE_ERROR;
+	return AICLI_STAGE_CONTINUE;
+}
+
+// head over a whole chunk: the byte-exact prefix of the input up to and including the
+// N-th newline. The lines it takes are only delimited with memchr and copied in one
+// piece; at EOF the final segment is passed on as it is.
+static aicli_stage_status_t head_feed(aicli_stage_t *st, const char *in, size_t in_len,
+                                      bool at_eof, aicli_buf_t *out)
+{
+	size_t pos = 0;
+	bool done = false;
+	while (!done && pos < in_len) {
+		const char *nl = (const char *)memchr(in + pos, '\n', in_len - pos);
+		if (!nl)
+			break;
+		pos = (size_t)(nl - in) + 1;
+		st->line_no++;
+		done = ++st->u.head.seen >= st->u.head.nlines;
+	}
+	if (!done && !at_eof && pos != in_len)
+		return AICLI_STAGE_ERROR; // chunks other than the last one end on a line boundary
+	if (!done && at_eof) {
+		pos = in_len;
+		st->line_no++;
+	}
+	if (pos > 0 && !aicli_buf_append(out, in, pos))
+		return AICLI_STAGE_ERROR;
+	st->in_offset += pos;
+	return done || at_eof ? AICLI_STAGE_DONE : AICLI_STAGE_CONTINUE;
+}
+
+static void tail_compact(aicli_stage_t *st)
+{
+	size_t base = st->u.tail.offs[st->u.tail.first];
+	size_t keep_n = st->u.tail.offs_len - st->u.tail.first;
+	memmove(st->u.tail.keep.data, st->u.tail.keep.data + base, st->u.tail.keep.len - base);
+	st->u.tail.keep.len -= base;
+	for (size_t i = 0; i < keep_n; i++)
+		st->u.tail.offs[i] = st->u.tail.offs[st->u.tail.first + i] - base;
+	st->u.tail.offs_len = keep_n;
+	st->u.tail.first = 0;
+}
+
+static aicli_stage_status_t tail_line(aicli_stage_t *st, const char *line, size_t len, bool last,
+                                      aicli_buf_t *out)
+{
+	// Output is the last N complete lines plus the trailing partial line, which is
+	// exactly "everything after the (N+1)-th newline from the end".
+	if (last) {
+		if (st->u.tail.first < st->u.tail.offs_len) {
+			size_t from = st->u.tail.offs[st->u.tail.first];
+			if (!aicli_buf_append(out, st->u.tail.keep.data + from, st->u.tail.keep.len - from))
+				return AICLI_STAGE_ERROR;
 		}
+		if (len > 0 && !aicli_buf_append(out, line, len))
+			return AICLI_STAGE_ERROR;
+		return AICLI_STAGE_DONE;
+	}
+
+	if (st->u.tail.offs_len == st->u.tail.offs_cap) {
+		size_t cap = st->u.tail.offs_cap ? st->u.tail.offs_cap * 2 : 64;
+		size_t *p = (size_t *)realloc(st->u.tail.offs, cap * sizeof(*p));
+		if (!p)
+			return AICLI_STAGE_ERROR;
+		st->u.tail.offs = p;
+		st->u.tail.offs_cap = cap;
+	}
+	st->u.tail.offs[st->u.tail.offs_len++] = st->u.tail.keep.len;
+	if (!emit_line(&st->u.tail.keep, NULL, 0, line, len, true))
+		return AICLI_STAGE_ERROR;
+	if (st->u.tail.offs_len - st->u.tail.first > st->u.tail.nlines)
+		st->u.tail.first++;
+	// Past the budget the window shrinks to the newest lines that fit (at least one).
+	while (st->u.tail.offs_len - st->u.tail.first > 1 &&
+	       st->u.tail.keep.len - st->u.tail.offs[st->u.tail.first] > st->u.tail.budget) {
+		st->u.tail.first++;
+		st->u.tail.clipped = true;
 	}
-	// Not enough newlines: return whole input
-	return aicli_buf_append(out, in, in_len);
+	// Drop evicted lines once they make up half of the buffer (amortized O(1) per byte).
+	if (st->u.tail.first > 0 &&
+	    st->u.tail.offs[st->u.tail.first] >= st->u.tail.keep.len / 2)
+		tail_compact(st);
+	return AICLI_STAGE_CONTINUE;
 }
 
-bool aicli_stage_wc(const char *in, size_t in_len, char mode, aicli_buf_t *out)
+static aicli_stage_status_t wc_feed(aicli_stage_t *st, const char *in, size_t in_len, bool at_eof,
+                                    aicli_buf_t *out)
 {
 	// mode: 'l' (lines) or 'c' (bytes) or 'w' (words)
-	unsigned long long v = 0;
-	if (mode == 'c') {
-		v = (unsigned long long)in_len;
-	} else if (mode == 'l') {
-		for (size_t i = 0; i < in_len; i++)
-			if (in[i] == '\n')
-				v++;
-	} else if (mode == 'w') {
+	if (st->u.wc.mode == 'c') {
+		st->u.wc.count += (unsigned long long)in_len;
+	} else if (st->u.wc.mode == 'l') {
+		for (const char *p = in, *end = in + in_len;
+		     (p = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+			st->u.wc.count++;
+	} else {
 		// POSIX-ish word count: transitions from whitespace to non-whitespace.
-		bool in_word = false;
 		for (size_t i = 0; i < in_len; i++) {
 			unsigned char ch = (unsigned char)in[i];
 			bool ws = (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f');
 			if (ws) {
-				in_word = false;
-			} else if (!in_word) {
-				v++;
-				in_word = true;
+				st->u.wc.in_word = false;
+			} else if (!st->u.wc.in_word) {
+				st->u.wc.count++;
+				st->u.wc.in_word = true;
 			}
 		}
-	} else {
-		return false;
 	}
+	if (!at_eof)
+		return AICLI_STAGE_CONTINUE;
+
 	char buf[64];
-	int n = snprintf(buf, sizeof(buf), "%llu\n", v);
-	if (n < 0)
-		return false;
-	return aicli_buf_append(out, buf, (size_t)n);
-}
-
-typedef struct aicli_line_view {
-	const char *s;
-	size_t len;
-} aicli_line_view_t;
-
-static int cmp_line_asc(const void *a, const void *b)
-{
-	const aicli_line_view_t *la = (const aicli_line_view_t *)a;
-	const aicli_line_view_t *lb = (const aicli_line_view_t *)b;
-	size_t min = la->len < lb->len ? la->len : lb->len;
-	int c = memcmp(la->s, lb->s, min);
-	if (c != 0)
-		return c;
-	if (la->len < lb->len)
-		return -1;
-	if (la->len > lb->len)
-		return 1;
-	return 0;
+	int n = snprintf(buf, sizeof(buf), "%llu\n", st->u.wc.count);
+	if (n < 0 || !aicli_buf_append(out, buf, (size_t)n))
+		return AICLI_STAGE_ERROR;
+	return AICLI_STAGE_DONE;
 }
 
-static int cmp_line_desc(const void *a, const void *b)
+static aicli_stage_status_t sort_feed(aicli_stage_t *st, const char *in, size_t in_len, bool at_eof,
+                                      aicli_buf_t *out)
 {
-	return -cmp_line_asc(a, b);
+	// The engine spills to temp files past its memory budget; failing that, the input
+	// is too large for this host.
+	if (!aicli_sort_add(st->u.sort.engine, in, in_len))
+		return AICLI_STAGE_TOO_LARGE;
+	if (aicli_cancel_requested(aicli_cancel_current()))
+		return AICLI_STAGE_CANCELLED;
+	if (!at_eof)
+		return AICLI_STAGE_CONTINUE;
+	bool done = false;
+	if (!aicli_sort_emit(st->u.sort.engine, out, &done))
+		return AICLI_STAGE_ERROR;
+	return done ? AICLI_STAGE_DONE : AICLI_STAGE_MORE;
 }
 
-bool aicli_stage_sort_lines(const char *in, size_t in_len, bool reverse, aicli_buf_t *out)
+static bool contains_fixed(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
 {
-	// Split into line views, sort lexicographically, join with '\n'.
-	// Always emits a trailing '\n' when input has at least one line.
-	if (in_len == 0)
-		return true;
+	if (needle_len > hay_len)
+		return false;
+	const char *end = hay + (hay_len - needle_len) + 1;
+	for (const char *p = hay; p < end; p++) {
+		p = (const char *)memchr(p, needle[0], (size_t)(end - p));
+		if (!p)
+			return false;
+		if (memcmp(p, needle, needle_len) == 0)
+			return true;
+	}
+	return false;
+}
 
-	size_t line_count = 0;
-	for (size_t i = 0; i < in_len; i++)
-		if (in[i] == '\n')
-			line_count++;
-	if (in[in_len - 1] != '\n')
-		line_count++;
-	if (line_count == 0)
-		return true;
+// 1 if grep selects the line (-v applied), 0 if not, -1 if the regex fails.
+static int grep_select(aicli_stage_t *st, const char *line, size_t len)
+{
+	bool match = false;
+	if (st->u.grep.fixed) {
+		match = contains_fixed(line, len, st->u.grep.needle, st->u.grep.needle_len);
+	} else {
+		int er = aicli_line_regex_exec(&st->u.grep.rx, line, len, NULL);
+		if (er != 0 && er != REG_NOMATCH)
+			return -1;
+		match = (er == 0);
+	}
+	return match != st->u.grep.invert;
+}
 
-	aicli_line_view_t *lines = (aicli_line_view_t *)calloc(line_count, sizeof(aicli_line_view_t));
-	if (!lines)
-		return false;
+static aicli_stage_status_t grep_line(aicli_stage_t *st, const char *line, size_t len, bool last,
+                                      aicli_buf_t *out)
+{
+	(void)last;
+	int sel = grep_select(st, line, len);
+	if (sel <= 0)
+		return sel < 0 ? AICLI_STAGE_ERROR : AICLI_STAGE_CONTINUE;
+
+	bool ok = st->u.grep.with_n ? emit_numbered(out, st->line_no, 0, ':', line, len, true)
+	                            : emit_line(out, NULL, 0, line, len, true);
+	return ok ? AICLI_STAGE_CONTINUE : AICLI_STAGE_ERROR;
+}
 
-	size_t idx = 0;
-	size_t start = 0;
-	for (size_t i = 0; i <= in_len; i++) {
-		if (i == in_len || in[i] == '\n') {
-			if (idx < line_count) {
-				lines[idx].s = in + start;
-				lines[idx].len = i - start;
-				idx++;
+// grep_line() over the whole lines [p, p + n) ('\n' included). Without -n, runs of
+// selected lines are copied in one piece.
+static aicli_stage_status_t grep_lines(aicli_stage_t *st, const char *p, size_t n,
+                                       aicli_buf_t *out)
+{
+	const char *end = p + n;
+	const char *run = p; // selected lines [run, p) not copied yet
+	while (p < end) {
+		const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+		size_t len = (size_t)(nl - p);
+		if (st->u.grep.with_n) {
+			if (grep_line(st, p, len, false, out) != AICLI_STAGE_CONTINUE)
+				return AICLI_STAGE_ERROR;
+		} else {
+			int sel = grep_select(st, p, len);
+			if (sel < 0)
+				return AICLI_STAGE_ERROR;
+			if (sel == 0) {
+				if (p > run && !aicli_buf_append(out, run, (size_t)(p - run)))
+					return AICLI_STAGE_ERROR;
+				run = nl + 1;
 			}
-			start = i + 1;
 		}
+		st->line_no++;
+		st->in_offset += len + 1;
+		p = nl + 1;
+		if (st->line_no % AICLI_STAGE_CANCEL_LINES == 0 &&
+		    aicli_cancel_requested(aicli_cancel_current()))
+			return AICLI_STAGE_CANCELLED;
 	}
+	if (!st->u.grep.with_n && p > run && !aicli_buf_append(out, run, (size_t)(p - run)))
+		return AICLI_STAGE_ERROR;
+	return AICLI_STAGE_CONTINUE;
+}
 
-	qsort(lines, line_count, sizeof(aicli_line_view_t), reverse ? cmp_line_desc : cmp_line_asc);
+// Lines [p, p + n) without a prefilter hit (n covers whole lines, '\n' included).
+// Without -n they are skipped or, for -v, copied in one piece; line numbers are only
+// tracked when they are printed.
+static aicli_stage_status_t grep_skip(aicli_stage_t *st, const char *p, size_t n,
+                                            aicli_buf_t *out)
+{
+	if (!st->u.grep.with_n) {
+		if (st->u.grep.invert && n > 0 && !aicli_buf_append(out, p, n))
+			return AICLI_STAGE_ERROR;
+		return AICLI_STAGE_CONTINUE;
+	}
+	const char *end = p + n;
+	while (p < end) {
+		const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+		size_t len = (size_t)(nl - p);
+		if (st->u.grep.invert && grep_line(st, p, len, false, out) != AICLI_STAGE_CONTINUE)
+			return AICLI_STAGE_ERROR;
+		st->line_no++;
+		p = nl + 1;
+	}
+	return AICLI_STAGE_CONTINUE;
+}
 
-	for (size_t i = 0; i < line_count; i++) {
-		if (lines[i].len > 0) {
-			if (!aicli_buf_append(out, lines[i].s, lines[i].len)) {
-				free(lines);
-				return false;
-			}
+// The final segment at EOF (possibly empty).
+static aicli_stage_status_t grep_final(aicli_stage_t *st, const char *line, size_t len,
+                                       aicli_buf_t *out)
+{
+	aicli_stage_status_t rc = grep_line(st, line, len, true, out);
+	st->line_no++;
+	st->in_offset += len;
+	return rc == AICLI_STAGE_ERROR ? rc : AICLI_STAGE_DONE;
+}
+
+// grep over a whole chunk: the fixed needle (-F) or the literal every regex match
+// must contain is searched across line boundaries first and a line is only delimited
+// around each hit, so text without hits is scanned once at memory speed instead of
+// being split into lines. Output is the same as grep_line() applied to every line.
+// Without such a literal (or with a needle containing '\n', which can never match
+// inside a line) the chunk takes the per-line path.
+static const aicli_memsearch_t *grep_prefilter(const aicli_stage_t *st)
+{
+	if (!st->u.grep.fixed)
+		return aicli_line_regex_prefilter(&st->u.grep.rx);
+	if (!memchr(st->u.grep.needle, '\n', st->u.grep.needle_len))
+		return &st->u.grep.search;
+	return NULL;
+}
+
+static aicli_stage_status_t grep_feed(aicli_stage_t *st, const char *in, size_t in_len,
+                                      bool at_eof, aicli_buf_t *out)
+{
+	// body: the complete lines of the chunk; at EOF the rest is a final line.
+	size_t body = in_len;
+	if (at_eof) {
+		while (body > 0 && in[body - 1] != '\n')
+			body--;
+	} else if (body > 0 && in[body - 1] != '\n') {
+		return AICLI_STAGE_ERROR;
+	}
+
+	const aicli_memsearch_t *pre = grep_prefilter(st);
+	if (!pre) {
+		aicli_stage_status_t rc = grep_lines(st, in, body, out);
+		if (rc != AICLI_STAGE_CONTINUE)
+			return rc;
+		return at_eof ? grep_final(st, in + body, in_len - body, out) : AICLI_STAGE_CONTINUE;
+	}
+
+	size_t pos = 0;
+	while (pos < body) {
+		const char *hit = aicli_memsearch_find(pre, in + pos, body - pos);
+		if (!hit) {
+			if (grep_skip(st, in + pos, body - pos, out) != AICLI_STAGE_CONTINUE)
+				return AICLI_STAGE_ERROR;
+			pos = body;
+			break;
 		}
-		if (!aicli_buf_append(out, "\n", 1)) {
-			free(lines);
-			return false;
+		size_t start = (size_t)(hit - in);
+		while (start > pos && in[start - 1] != '\n')
+			start--;
+		const char *nl = (const char *)memchr(hit, '\n', body - (size_t)(hit - in));
+		size_t len = (size_t)(nl - (in + start));
+		if (grep_skip(st, in + pos, start - pos, out) != AICLI_STAGE_CONTINUE)
+			return AICLI_STAGE_ERROR;
+		if (grep_line(st, in + start, len, false, out) != AICLI_STAGE_CONTINUE)
+			return AICLI_STAGE_ERROR;
+		st->line_no++;
+		pos = start + len + 1;
+	}
+	st->in_offset += body;
+	if (aicli_cancel_requested(aicli_cancel_current()))
+		return AICLI_STAGE_CANCELLED;
+	if (!at_eof)
+		return AICLI_STAGE_CONTINUE;
+	return grep_final(st, in + body, in_len - body, out);
+}
+
+// sed -n 'Np'/'Nd' and 'N,Mp'/'N,Md': sets *keep for the current line. DONE once 'p'
+// cannot select anything past the end address.
+static aicli_stage_status_t sed_addr_select(const aicli_stage_t *st, bool *keep)
+{
+	bool in_range = (st->line_no >= st->u.sed_addr.start && st->line_no <= st->u.sed_addr.end);
+	*keep = (st->u.sed_addr.cmd == 'p') ? in_range : !in_range;
+	if (st->u.sed_addr.cmd == 'p' && st->line_no >= st->u.sed_addr.end)
+		return AICLI_STAGE_DONE;
+	return AICLI_STAGE_CONTINUE;
+}
+
+static aicli_stage_status_t sed_addr_line(aicli_stage_t *st, const char *line, size_t len, bool last,
+                                          aicli_buf_t *out)
+{
+	(void)last;
+	bool keep = false;
+	aicli_stage_status_t rc = sed_addr_select(st, &keep);
+	if (keep && !emit_line(out, NULL, 0, line, len, true))
+		return AICLI_STAGE_ERROR;
+	// 'p' past the end address: stop reading.
+	return rc;
+}
+
+static bool sed_re_select(aicli_stage_t *st, const char *line, size_t len)
+{
+	bool m1 = (aicli_line_regex_exec(&st->u.sed_re.rx1, line, len, NULL) == 0);
+	bool selected = false;
+	if (!st->u.sed_re.has_rx2) {
+		selected = m1;
+	} else {
+		bool m2 = (aicli_line_regex_exec(&st->u.sed_re.rx2, line, len, NULL) == 0);
+		if (!st->u.sed_re.in_range && m1)
+			st->u.sed_re.in_range = true;
+		if (st->u.sed_re.in_range) {
+			selected = true;
+			if (m2)
+				st->u.sed_re.in_range = false;
 		}
 	}
+	return (st->u.sed_re.cmd == 'p') ? selected : !selected;
+}
 
-	free(lines);
-	return true;
+static aicli_stage_status_t sed_re_line(aicli_stage_t *st, const char *line, size_t len, bool last,
+                                        aicli_buf_t *out)
+{
+	(void)last;
+	if (sed_re_select(st, line, len) && !emit_line(out, NULL, 0, line, len, true))
+		return AICLI_STAGE_ERROR;
+	return AICLI_STAGE_CONTINUE;
 }
 
-bool aicli_stage_grep_fixed(const char *in, size_t in_len, const char *needle, bool with_line_numbers,
-			    aicli_buf_t *out)
+static aicli_stage_status_t sed_subst_line(aicli_stage_t *st, const char *line, size_t len,
+                                           bool last, aicli_buf_t *out)
 {
-	if (!needle || needle[0] == '\0')
-		return true;
-	const size_t needle_len = strlen(needle);
-
-	// If caller passed -F, this function is used for fixed substring search.
-	// (name kept for backward compatibility)
-
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
-
-			bool match = false;
-			if (needle_len <= line_len) {
-				for (size_t off = 0; off + needle_len <= line_len; off++) {
-					if (memcmp(line + off, needle, needle_len) == 0) {
-						match = true;
-						break;
-					}
-				}
-			}
+	(void)last;
+	const size_t k_max_line_len = 64 * 1024;
+	const size_t k_max_out_bytes_per_line = 256 * 1024;
+	const size_t k_max_subst_per_line = 4096;
 
-			if (match) {
-				if (with_line_numbers) {
-					char prefix[32];
-					int n = snprintf(prefix, sizeof(prefix), "%lu:", line_no);
-					if (n < 0)
-						return false;
-					if (!aicli_buf_append(out, prefix, (size_t)n))
-						return false;
-				}
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len))
-						return false;
-				}
-				if (!aicli_buf_append(out, "\n", 1))
-					return false;
-			}
+	if (len > k_max_line_len)
+		return AICLI_STAGE_ERROR;
+
+	aicli_buf_t *tmp = &st->u.subst.line_out;
+	tmp->len = 0;
+	bool matched_any = false;
+	size_t cursor = 0;
+	size_t subst_cnt = 0;
+	while (cursor <= len) {
+		// Matched in place against the rest of the line; offsets are relative to z.
+		const char *z = line + cursor;
+		regmatch_t m;
+		m.rm_so = -1;
+		m.rm_eo = -1;
+		int er = aicli_line_regex_exec(&st->u.subst.rx, z, len - cursor, &m);
+		if (er == REG_NOMATCH)
+			break;
+		if (er != 0)
+			return AICLI_STAGE_ERROR;
+		if (m.rm_so < 0 || m.rm_eo < 0 || m.rm_eo < m.rm_so)
+			break;
+		size_t so = (size_t)m.rm_so;
+		size_t eo = (size_t)m.rm_eo;
+
+		matched_any = true;
+		if (++subst_cnt > k_max_subst_per_line)
+			return AICLI_STAGE_ERROR;
+		if (so > 0 && !aicli_buf_append(tmp, z, so))
+			return AICLI_STAGE_ERROR;
+		if (!aicli_buf_append(tmp, st->u.subst.repl, st->u.subst.repl_len))
+			return AICLI_STAGE_ERROR;
+		if (tmp->len > k_max_out_bytes_per_line)
+			return AICLI_STAGE_ERROR;
+
+		cursor += eo;
+		if (!st->u.subst.global)
+			break;
+		if (eo == 0) {
+			if (cursor >= len)
+				break;
+			if (!aicli_buf_append(tmp, line + cursor, 1))
+				return AICLI_STAGE_ERROR;
+			cursor++;
+		}
+	}
+
+	if (matched_any && cursor < len) {
+		if (!aicli_buf_append(tmp, line + cursor, len - cursor))
+			return AICLI_STAGE_ERROR;
+	}
+
+	const char *dbg = getenv("AICLI_DEBUG_FUNCTION_CALL");
+	if (dbg && dbg[0] != '\0') {
+		fprintf(stderr,
+		        "[debug:sed] pat='%s' rep='%s' line_start=%zu line_len=%zu matched_any=%d global=%d p=%d tmp_len=%zu\n",
+		        st->u.subst.pattern, st->u.subst.repl, st->in_offset, len, matched_any ? 1 : 0,
+		        st->u.subst.global ? 1 : 0, st->u.subst.print_on_match ? 1 : 0, tmp->len);
+		if (matched_any)
+			fprintf(stderr, "[debug:sed] line='%.*s'\n", (int)len, line);
+	}
 
-			line_no++;
-			line_start = i + 1;
+	if (st->u.subst.print_on_match && matched_any) {
+		if (!emit_line(out, NULL, 0, tmp->data, tmp->len, true))
+			return AICLI_STAGE_ERROR;
+	}
+	return AICLI_STAGE_CONTINUE;
+}
+
+// Fused stages.
+//
+// A run of adjacent line-wise stages is executed as one pass: each input line goes
+// through all of them before the next is read, instead of every stage filling a chunk
+// buffer for the next one. Each part keeps its own line number and state, so output
+// is byte-identical to the chained stages. Filters (grep without -n, sed -n addresses)
+// and head pass the line itself on without copying it; only stages that rewrite a
+// line (nl, grep -n, s///) produce a new one, in a per-part scratch buffer or, for the
+// last part, straight into the output. A part that is done (head -n N, sed -n 'N,Mp'
+// past M) ends the whole pass on that line, so the reader stops right there.
+
+// Rewrites one line (nl, grep -n, s///) as the stage's line function.
+static aicli_stage_status_t part_rewrite(aicli_stage_t *p, const char *line, size_t len,
+                                         bool last, aicli_buf_t *out)
+{
+	switch (p->kind) {
+	case STAGE_NL:
+		return nl_line(p, line, len, last, out);
+	case STAGE_GREP:
+		return grep_line(p, line, len, last, out);
+	case STAGE_SED_SUBST:
+		return sed_subst_line(p, line, len, last, out);
+	default:
+		return AICLI_STAGE_ERROR;
+	}
+}
+
+// grep_select() for parts[k]. While the line is still a line of the chunk being fed
+// (`in_chunk`: every part before k kept it as is), the prefilter literal is searched
+// chunk-wide from one hit to the next rather than in every line, as grep_feed() does.
+static int fused_grep_select(aicli_stage_t *st, int k, const char *line, size_t len,
+                             bool in_chunk)
+{
+	aicli_stage_t *p = st->u.fused.parts[k];
+	const aicli_memsearch_t *pre = st->u.fused.pre[k];
+	if (pre && in_chunk) {
+		const char *end = st->u.fused.chunk + st->u.fused.chunk_len;
+		const char *h = st->u.fused.hit[k];
+		if (!h || h < line) {
+			h = aicli_memsearch_find(pre, line, (size_t)(end - line));
+			st->u.fused.hit[k] = h ? h : end;
 		}
-		i++;
+		// The literal has no '\n', so a hit at or past the line end is in a later line.
+		if (st->u.fused.hit[k] >= line + len)
+			return p->u.grep.invert;
 	}
-	return true;
+	return grep_select(p, line, len);
+}
+
+static bool fused_flush(aicli_stage_t *st, aicli_buf_t *out)
+{
+	size_t n = st->u.fused.run_len;
+	st->u.fused.run_len = 0;
+	return n == 0 || aicli_buf_append(out, st->u.fused.run, n);
 }
 
-bool aicli_stage_grep_fixed_invert(const char *in, size_t in_len, const char *needle,
-				   bool with_line_numbers, aicli_buf_t *out)
+// Appends one output line of the pass. Complete lines taken over from the chunk
+// unchanged are followed by their '\n' there and are collected into runs copied in one
+// piece.
+static bool fused_emit(aicli_stage_t *st, const char *line, size_t len, bool last, bool in_chunk,
+                       aicli_buf_t *out)
 {
-	if (!needle || needle[0] == '\0')
+	if (!in_chunk || last || line + len == st->u.fused.chunk + st->u.fused.chunk_len)
+		return fused_flush(st, out) && emit_line(out, NULL, 0, line, len, !last);
+	if (st->u.fused.run_len > 0 && st->u.fused.run + st->u.fused.run_len == line) {
+		st->u.fused.run_len += len + 1;
 		return true;
-	const size_t needle_len = strlen(needle);
-
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
-
-			bool match = false;
-			if (needle_len <= line_len) {
-				for (size_t off = 0; off + needle_len <= line_len; off++) {
-					if (memcmp(line + off, needle, needle_len) == 0) {
-						match = true;
-						break;
-					}
-				}
-			}
+	}
+	if (!fused_flush(st, out))
+		return false;
+	st->u.fused.run = line;
+	st->u.fused.run_len = len + 1;
+	return true;
+}
 
-			if (!match) {
-				if (with_line_numbers) {
-					char prefix[32];
-					int n = snprintf(prefix, sizeof(prefix), "%lu:", line_no);
-					if (n < 0)
-						return false;
-					if (!aicli_buf_append(out, prefix, (size_t)n))
-						return false;
-				}
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len))
-						return false;
-				}
-				if (!aicli_buf_append(out, "\n", 1))
-					return false;
+// Runs one segment (`last`: the final one) through parts[k, n). Each part hands its
+// output on the way the next one would have read it from a chunk: a '\n'-terminated
+// line as a line and, once the part is done, the text after its last newline (possibly
+// empty) as the final segment. Returns DONE once the pass has emitted all its output.
+static aicli_stage_status_t fused_pass(aicli_stage_t *st, int k, const char *line, size_t len,
+                                       bool last, bool in_chunk, aicli_buf_t *out)
+{
+	for (; k < st->u.fused.n; k++) {
+		aicli_stage_t *p = st->u.fused.parts[k];
+		aicli_stage_status_t rc = AICLI_STAGE_CONTINUE;
+		bool terminated = true; // output: line[0, len), then '\n' if terminated
+		switch (p->kind) {
+		case STAGE_GREP:
+			if (p->u.grep.with_n)
+				goto rewrite;
+			int sel = fused_grep_select(st, k, line, len, in_chunk);
+			if (sel < 0)
+				rc = AICLI_STAGE_ERROR;
+			terminated = sel > 0;
+			break;
+		case STAGE_SED_ADDR:
+			rc = sed_addr_select(p, &terminated);
+			break;
+		case STAGE_SED_RE_ADDR:
+			terminated = sed_re_select(p, line, len);
+			break;
+		case STAGE_HEAD:
+			// As head_feed(): the final segment is passed on as it is.
+			if (last)
+				terminated = false;
+			else if (++p->u.head.seen >= p->u.head.nlines)
+				rc = AICLI_STAGE_DONE;
+			break;
+		default:
+		rewrite:
+			if (k == st->u.fused.n - 1) {
+				// The last part writes its output where the pass's goes.
+				rc = fused_flush(st, out) ? part_rewrite(p, line, len, last, out)
+				                          : AICLI_STAGE_ERROR;
+				p->line_no++;
+				p->in_offset += len + (last ? 0 : 1);
+				if (rc == AICLI_STAGE_ERROR || last)
+					return rc == AICLI_STAGE_ERROR ? rc : AICLI_STAGE_DONE;
+				return rc;
 			}
+			// At most one line, '\n'-terminated unless it is the part's final segment.
+			aicli_buf_t *b = &st->u.fused.lines[k];
+			b->len = 0;
+			rc = part_rewrite(p, line, len, last, b);
+			p->line_no++;
+			p->in_offset += len + (last ? 0 : 1);
+			terminated = b->len > 0 && b->data[b->len - 1] == '\n';
+			line = b->len > 0 ? b->data : "";
+			len = terminated ? b->len - 1 : b->len;
+			in_chunk = false;
+			goto next;
+		}
+		p->line_no++;
+		p->in_offset += len + (last ? 0 : 1);
+		if (!terminated && p->kind != STAGE_HEAD) {
+			line = ""; // filtered out
+			len = 0;
+			in_chunk = false;
+		}
+	next:
+		if (rc == AICLI_STAGE_ERROR)
+			return rc;
+		bool end = last || rc == AICLI_STAGE_DONE;
+		if (!terminated) {
+			if (!end)
+				return AICLI_STAGE_CONTINUE;
+			last = true;
+			continue;
+		}
+		if (end) {
+			rc = fused_pass(st, k + 1, line, len, false, in_chunk, out);
+			if (rc != AICLI_STAGE_CONTINUE)
+				return rc;
+			line = "";
+			len = 0;
+			in_chunk = false;
+			last = true;
+		}
+	}
+	if (!fused_emit(st, line, len, last, in_chunk, out))
+		return AICLI_STAGE_ERROR;
+	return last ? AICLI_STAGE_DONE : AICLI_STAGE_CONTINUE;
+}
+
+// As for_each_line() over the fused parts. When the first part is grep without -v, the
+// chunk is scanned for its prefilter literal (as grep_feed() does) and only lines
+// around a hit enter the pass.
+static aicli_stage_status_t fused_scan(aicli_stage_t *st, const char *in, size_t in_len,
+                                       bool at_eof, aicli_buf_t *out)
+{
+	aicli_stage_t *first = st->u.fused.parts[0];
+	const aicli_memsearch_t *pre = NULL;
+	if (first->kind == STAGE_GREP && !first->u.grep.invert)
+		pre = grep_prefilter(first);
+
+	size_t body = in_len;
+	if (at_eof) {
+		while (body > 0 && in[body - 1] != '\n')
+			body--;
+	} else if (body > 0 && in[body - 1] != '\n') {
+		return AICLI_STAGE_ERROR;
+	}
 
-			line_no++;
-			line_start = i + 1;
+	size_t pos = 0;
+	unsigned long lines = 0;
+	while (pos < body) {
+		if (pre) {
+			const char *hit = aicli_memsearch_find(pre, in + pos, body - pos);
+			size_t start = hit ? (size_t)(hit - in) : body;
+			while (start > pos && in[start - 1] != '\n')
+				start--;
+			// Line numbers of skipped lines only matter for grep -n.
+			if (first->u.grep.with_n) {
+				for (const char *p = in + pos, *end = in + start;
+				     (p = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+					first->line_no++;
+			}
+			first->in_offset += start - pos;
+			pos = start;
+			if (!hit)
+				break;
 		}
-		i++;
+		const char *nl = (const char *)memchr(in + pos, '\n', body - pos);
+		size_t len = (size_t)(nl - (in + pos));
+		aicli_stage_status_t rc = fused_pass(st, 0, in + pos, len, false, true, out);
+		if (rc != AICLI_STAGE_CONTINUE)
+			return rc;
+		pos += len + 1;
+		if (++lines % AICLI_STAGE_CANCEL_LINES == 0 &&
+		    aicli_cancel_requested(aicli_cancel_current()))
+			return AICLI_STAGE_CANCELLED;
 	}
-	return true;
+	if (pre && aicli_cancel_requested(aicli_cancel_current()))
+		return AICLI_STAGE_CANCELLED;
+	if (!at_eof)
+		return AICLI_STAGE_CONTINUE;
+	aicli_stage_status_t rc = fused_pass(st, 0, in + body, in_len - body, true, true, out);
+	return rc == AICLI_STAGE_ERROR ? rc : AICLI_STAGE_DONE;
 }
 
-bool aicli_stage_grep_bre(const char *in, size_t in_len, const char *pattern, bool with_line_numbers,
-			  aicli_buf_t *out)
+static aicli_stage_status_t fused_feed(aicli_stage_t *st, const char *in, size_t in_len,
+                                       bool at_eof, aicli_buf_t *out)
 {
-	if (!pattern || pattern[0] == '\0')
-		return true;
+	st->u.fused.chunk = in;
+	st->u.fused.chunk_len = in_len;
+	st->u.fused.run_len = 0;
+	for (int k = 0; k < st->u.fused.n; k++)
+		st->u.fused.hit[k] = NULL;
+	aicli_stage_status_t rc = fused_scan(st, in, in_len, at_eof, out);
+	if (!fused_flush(st, out))
+		return AICLI_STAGE_ERROR;
+	return rc;
+}
 
-	regex_t rx;
-	memset(&rx, 0, sizeof(rx));
-	int rc = regcomp(&rx, pattern, 0);
-	if (rc != 0) {
-		char errbuf[256];
-		regerror(rc, &rx, errbuf, sizeof(errbuf));
-		aicli_buf_append(out, "grep: ", 6);
-		aicli_buf_append(out, errbuf, strlen(errbuf));
-		aicli_buf_append(out, "\n", 1);
-		regfree(&rx);
-		return false;
+// parts[0, lead] of a fused stage: the leading line mappings and the part after them,
+// i.e. the parts a skip-ahead (or a chunk's start line) applies to.
+static int fused_lead(const aicli_stage_t *st)
+{
+	int j = 0;
+	while (j < st->u.fused.n - 1 && aicli_stage_is_line_mapping(st->u.fused.parts[j]))
+		j++;
+	return j;
+}
+
+aicli_stage_t *aicli_stage_nl_new(void)
+{
+	return stage_alloc(STAGE_NL);
+}
+
+aicli_stage_t *aicli_stage_head_new(size_t nlines)
+{
+	aicli_stage_t *st = stage_alloc(STAGE_HEAD);
+	if (st)
+		st->u.head.nlines = nlines;
+	return st;
+}
+
+aicli_stage_t *aicli_stage_tail_new(size_t nlines)
+{
+	aicli_stage_t *st = stage_alloc(STAGE_TAIL);
+	if (st) {
+		st->u.tail.nlines = nlines;
+		st->u.tail.budget = aicli_stage_memory_budget();
 	}
+	return st;
+}
 
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
+aicli_stage_t *aicli_stage_wc_new(char mode)
+{
+	if (mode != 'l' && mode != 'c' && mode != 'w')
+		return NULL;
+	aicli_stage_t *st = stage_alloc(STAGE_WC);
+	if (st)
+		st->u.wc.mode = mode;
+	return st;
+}
 
-			// NUL-terminate for regexec.
-			char *z = (char *)malloc(line_len + 1);
-			if (!z) {
-				regfree(&rx);
-				return false;
-			}
-			memcpy(z, line, line_len);
-			z[line_len] = '\0';
-
-			int er = regexec(&rx, z, 0, NULL, 0);
-			free(z);
-			bool match = (er == 0);
-			if (er != 0 && er != REG_NOMATCH) {
-				char errbuf[256];
-				regerror(er, &rx, errbuf, sizeof(errbuf));
-				aicli_buf_append(out, "grep: ", 6);
-				aicli_buf_append(out, errbuf, strlen(errbuf));
-				aicli_buf_append(out, "\n", 1);
-				regfree(&rx);
-				return false;
-			}
+aicli_stage_t *aicli_stage_sort_new(const aicli_sort_opts_t *opts)
+{
+	aicli_stage_t *st = stage_alloc(STAGE_SORT);
+	if (!st)
+		return NULL;
+	st->u.sort.engine = aicli_sort_new(opts, aicli_stage_memory_budget());
+	if (!st->u.sort.engine) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
 
-			if (match) {
-				if (with_line_numbers) {
-					char prefix[32];
-					int n = snprintf(prefix, sizeof(prefix), "%lu:", line_no);
-					if (n < 0) {
-						regfree(&rx);
-						return false;
-					}
-					if (!aicli_buf_append(out, prefix, (size_t)n)) {
-						regfree(&rx);
-						return false;
-					}
-				}
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len)) {
-						regfree(&rx);
-						return false;
-					}
-				}
-				if (!aicli_buf_append(out, "\n", 1)) {
-					regfree(&rx);
-					return false;
-				}
-			}
+aicli_stage_t *aicli_stage_grep_new(const char *pattern, bool fixed, bool invert,
+                                    bool with_line_numbers)
+{
+	aicli_stage_t *st = stage_alloc(STAGE_GREP);
+	if (!st)
+		return NULL;
+	st->u.grep.fixed = fixed;
+	st->u.grep.invert = invert;
+	st->u.grep.with_n = with_line_numbers;
+	if (!pattern || pattern[0] == '\0') {
+		st->u.grep.empty = true;
+		return st;
+	}
+	if (fixed) {
+		st->u.grep.needle = strdup(pattern);
+		if (!st->u.grep.needle) {
+			free(st);
+			return NULL;
+		}
+		st->u.grep.needle_len = strlen(pattern);
+		aicli_memsearch_init(&st->u.grep.search, st->u.grep.needle, st->u.grep.needle_len);
+		return st;
+	}
+	// Compiled once per pipeline run, not per line or per chunk.
+	if (aicli_line_regex_compile(&st->u.grep.rx, pattern) != 0) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
 
-			line_no++;
-			line_start = i + 1;
+aicli_stage_t *aicli_stage_sed_n_addr_new(size_t start_addr, size_t end_addr, char cmd)
+{
+	if (start_addr == 0 || end_addr == 0 || start_addr > end_addr)
+		return NULL;
+	if (cmd != 'p' && cmd != 'd')
+		return NULL;
+	aicli_stage_t *st = stage_alloc(STAGE_SED_ADDR);
+	if (!st)
+		return NULL;
+	st->u.sed_addr.start = start_addr;
+	st->u.sed_addr.end = end_addr;
+	st->u.sed_addr.cmd = cmd;
+	return st;
+}
+
+aicli_stage_t *aicli_stage_sed_n_re_addr_new(const char *re1, size_t re1_len, const char *re2,
+                                             size_t re2_len, char cmd)
+{
+	// `re1`/`re2` are decoded + NUL-terminated by the parser.
+	char *re1_z = (char *)re1;
+	char *re2_z = (re2 && re2_len > 0) ? (char *)re2 : NULL;
+	aicli_stage_t *st = NULL;
+	if (!re1_z || re1_len == 0 || (cmd != 'p' && cmd != 'd'))
+		goto done;
+
+	st = stage_alloc(STAGE_SED_RE_ADDR);
+	if (!st)
+		goto done;
+	st->u.sed_re.cmd = cmd;
+	if (aicli_line_regex_compile(&st->u.sed_re.rx1, re1_z) != 0) {
+		free(st);
+		st = NULL;
+		goto done;
+	}
+	if (re2_z) {
+		if (aicli_line_regex_compile(&st->u.sed_re.rx2, re2_z) != 0) {
+			aicli_line_regex_free(&st->u.sed_re.rx1);
+			free(st);
+			st = NULL;
+			goto done;
 		}
-		i++;
+		st->u.sed_re.has_rx2 = true;
 	}
 
-	regfree(&rx);
-	return true;
+done:
+	free(re1_z);
+	free((void *)re2);
+	return st;
 }
 
-bool aicli_stage_grep_bre_invert(const char *in, size_t in_len, const char *pattern,
-				 bool with_line_numbers, aicli_buf_t *out)
+aicli_stage_t *aicli_stage_sed_n_subst_new(const char *pattern, const char *repl, bool global,
+                                           bool print_on_match)
 {
-	if (!pattern || pattern[0] == '\0')
-		return true;
+	// `pattern` and `repl` are already NUL-terminated (allocated) by the parser.
+	if (!pattern || !repl) {
+		free((void *)pattern);
+		free((void *)repl);
+		return NULL;
+	}
+	aicli_stage_t *st = stage_alloc(STAGE_SED_SUBST);
+	if (!st) {
+		free((void *)pattern);
+		free((void *)repl);
+		return NULL;
+	}
+	st->u.subst.pattern = (char *)pattern;
+	st->u.subst.repl = (char *)repl;
+	st->u.subst.repl_len = strlen(repl);
+	st->u.subst.global = global;
+	st->u.subst.print_on_match = print_on_match;
+	// Compile BRE (REG_EXTENDED not set). We need match offsets, so do NOT use REG_NOSUB.
+	if (aicli_line_regex_compile(&st->u.subst.rx, pattern) != 0) {
+		free(st->u.subst.pattern);
+		free(st->u.subst.repl);
+		free(st);
+		return NULL;
+	}
+	return st;
+}
 
-	regex_t rx;
-	memset(&rx, 0, sizeof(rx));
-	int rc = regcomp(&rx, pattern, 0);
-	if (rc != 0) {
-		char errbuf[256];
-		regerror(rc, &rx, errbuf, sizeof(errbuf));
-		aicli_buf_append(out, "grep: ", 6);
-		aicli_buf_append(out, errbuf, strlen(errbuf));
-		aicli_buf_append(out, "\n", 1);
-		regfree(&rx);
+bool aicli_stage_fusable(const aicli_stage_t *st)
+{
+	if (!st)
+		return false;
+	switch (st->kind) {
+	case STAGE_NL:
+	case STAGE_SED_ADDR:
+	case STAGE_SED_RE_ADDR:
+	case STAGE_SED_SUBST:
+		return true;
+	case STAGE_HEAD:
+		// Stages that end the run before reading anything stay on their own.
+		return st->u.head.nlines > 0;
+	case STAGE_GREP:
+		return !st->u.grep.empty;
+	default:
 		return false;
 	}
+}
 
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
+aicli_stage_t *aicli_stage_fused_new(aicli_stage_t *const *parts, int n)
+{
+	bool ok = n >= 2 && n <= AICLI_STAGE_FUSE_MAX;
+	for (int k = 0; ok && k < n; k++)
+		ok = aicli_stage_fusable(parts[k]);
+	aicli_stage_t *st = ok ? stage_alloc(STAGE_FUSED) : NULL;
+	if (!st) {
+		for (int k = 0; k < n; k++)
+			aicli_stage_free(parts[k]);
+		return NULL;
+	}
+	for (int k = 0; k < n; k++) {
+		st->u.fused.parts[k] = parts[k];
+		// fused_scan() already skips to the hits of a leading grep without -v.
+		if (parts[k]->kind == STAGE_GREP && (k > 0 || parts[k]->u.grep.invert))
+			st->u.fused.pre[k] = grep_prefilter(parts[k]);
+	}
+	st->u.fused.n = n;
+	return st;
+}
 
-			char *z = (char *)malloc(line_len + 1);
-			if (!z) {
-				regfree(&rx);
-				return false;
-			}
-			memcpy(z, line, line_len);
-			z[line_len] = '\0';
-
-			int er = regexec(&rx, z, 0, NULL, 0);
-			free(z);
-			bool match = (er == 0);
-			if (er != 0 && er != REG_NOMATCH) {
-				char errbuf[256];
-				regerror(er, &rx, errbuf, sizeof(errbuf));
-				aicli_buf_append(out, "grep: ", 6);
-				aicli_buf_append(out, errbuf, strlen(errbuf));
-				aicli_buf_append(out, "\n", 1);
-				regfree(&rx);
+aicli_stage_status_t aicli_stage_feed(aicli_stage_t *st, const char *in, size_t in_len,
+                                      bool at_eof, aicli_buf_t *out)
+{
+	if (!st || (!in && in_len > 0) || !out)
+		return AICLI_STAGE_ERROR;
+
+	switch (st->kind) {
+	case STAGE_NL:
+		return for_each_line(st, in, in_len, at_eof, out, nl_line);
+	case STAGE_HEAD:
+		if (st->u.head.nlines == 0)
+			return AICLI_STAGE_DONE;
+		return head_feed(st, in, in_len, at_eof, out);
+	case STAGE_TAIL:
+		if (st->u.tail.nlines == 0)
+			return AICLI_STAGE_DONE;
+		return for_each_line(st, in, in_len, at_eof, out, tail_line);
+	case STAGE_WC:
+		return wc_feed(st, in, in_len, at_eof, out);
+	case STAGE_SORT:
+		return sort_feed(st, in, in_len, at_eof, out);
+	case STAGE_GREP:
+		if (st->u.grep.empty)
+			return AICLI_STAGE_DONE;
+		return grep_feed(st, in, in_len, at_eof, out);
+	case STAGE_SED_ADDR:
+		return for_each_line(st, in, in_len, at_eof, out, sed_addr_line);
+	case STAGE_SED_RE_ADDR:
+		return for_each_line(st, in, in_len, at_eof, out, sed_re_line);
+	case STAGE_SED_SUBST:
+		return for_each_line(st, in, in_len, at_eof, out, sed_subst_line);
+	case STAGE_FUSED:
+		return fused_feed(st, in, in_len, at_eof, out);
+	}
+	return AICLI_STAGE_ERROR;
+}
+
+bool aicli_stage_is_line_mapping(const aicli_stage_t *st)
+{
+	if (st && st->kind == STAGE_FUSED) {
+		for (int k = 0; k < st->u.fused.n; k++) {
+			if (!aicli_stage_is_line_mapping(st->u.fused.parts[k]))
 				return false;
-			}
+		}
+		return true;
+	}
+	return st && st->kind == STAGE_NL;
+}
 
-			if (!match) {
-				if (with_line_numbers) {
-					char prefix[32];
-					int n = snprintf(prefix, sizeof(prefix), "%lu:", line_no);
-					if (n < 0) {
-						regfree(&rx);
-						return false;
-					}
-					if (!aicli_buf_append(out, prefix, (size_t)n)) {
-						regfree(&rx);
-						return false;
-					}
-				}
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len)) {
-						regfree(&rx);
-						return false;
-					}
-				}
-				if (!aicli_buf_append(out, "\n", 1)) {
-					regfree(&rx);
-					return false;
-				}
-			}
+bool aicli_stage_line_window(const aicli_stage_t *st, unsigned long *first_line,
+                             size_t *last_lines)
+{
+	if (!st || !first_line || !last_lines)
+		return false;
+	*first_line = 0;
+	*last_lines = 0;
+	if (st->kind == STAGE_FUSED)
+		return !aicli_stage_is_line_mapping(st) &&
+		       aicli_stage_line_window(st->u.fused.parts[fused_lead(st)], first_line, last_lines);
+	if (st->kind == STAGE_SED_ADDR && st->u.sed_addr.cmd == 'p') {
+		*first_line = st->u.sed_addr.start;
+		return true;
+	}
+	if (st->kind == STAGE_TAIL) {
+		*last_lines = st->u.tail.nlines;
+		return true;
+	}
+	return false;
+}
 
-			line_no++;
-			line_start = i + 1;
+void aicli_stage_skip_input(aicli_stage_t *st, unsigned long lines, size_t bytes)
+{
+	if (!st)
+		return;
+	st->line_no += lines;
+	st->in_offset += bytes;
+	if (st->kind == STAGE_FUSED) {
+		for (int k = 0, lead = fused_lead(st); k <= lead; k++)
+			aicli_stage_skip_input(st->u.fused.parts[k], lines, bytes);
+	}
+}
+
+aicli_stage_parallelism_t aicli_stage_parallelism(const aicli_stage_t *st, bool *uses_line_no)
+{
+	if (uses_line_no)
+		*uses_line_no = false;
+	if (!st)
+		return AICLI_STAGE_SEQUENTIAL;
+	switch (st->kind) {
+	case STAGE_NL:
+		if (uses_line_no)
+			*uses_line_no = true;
+		return AICLI_STAGE_PER_LINE;
+	case STAGE_GREP:
+		// An empty pattern ends the run at once; keep that on the sequential path.
+		if (st->u.grep.empty)
+			return AICLI_STAGE_SEQUENTIAL;
+		if (uses_line_no)
+			*uses_line_no = st->u.grep.with_n;
+		return AICLI_STAGE_PER_LINE;
+	case STAGE_SED_RE_ADDR:
+		// A /RE1/,/RE2/ range carries state from line to line.
+		return st->u.sed_re.has_rx2 ? AICLI_STAGE_SEQUENTIAL : AICLI_STAGE_PER_LINE;
+	case STAGE_SED_SUBST:
+		return AICLI_STAGE_PER_LINE;
+	case STAGE_WC:
+		return AICLI_STAGE_COUNTING;
+	case STAGE_FUSED:
+		// Per line as a whole only if every part is, and only the first one numbers lines
+		// (a later one numbers what is left after the filters before it).
+		for (int k = 0; k < st->u.fused.n; k++) {
+			bool numbered = false;
+			if (aicli_stage_parallelism(st->u.fused.parts[k], &numbered) != AICLI_STAGE_PER_LINE ||
+			    (numbered && k > 0))
+				return AICLI_STAGE_SEQUENTIAL;
+			if (numbered && uses_line_no)
+				*uses_line_no = true;
 		}
-		i++;
+		return AICLI_STAGE_PER_LINE;
+	default:
+		return AICLI_STAGE_SEQUENTIAL;
 	}
+}
 
-	regfree(&rx);
+bool aicli_stage_merge(aicli_stage_t *into, const aicli_stage_t *part)
+{
+	if (!into || !part || into->kind != STAGE_WC || part->kind != STAGE_WC ||
+	    into->u.wc.mode != part->u.wc.mode)
+		return false;
+	// Parts other than the last end on a line boundary, so no word straddles two.
+	into->u.wc.count += part->u.wc.count;
+	into->u.wc.in_word = part->u.wc.in_word;
 	return true;
 }
 
+size_t aicli_stage_memory_budget(void)
+{
+	const char *v = getenv("AICLI_EXECUTE_MEMORY");
+	if (!v || !v[0])
+		return AICLI_STAGE_DEFAULT_MEMORY;
+	char *end = NULL;
+	errno = 0;
+	unsigned long long x = strtoull(v, &end, 10);
+	if (errno != 0 || end == v || x == 0)
+		return AICLI_STAGE_DEFAULT_MEMORY;
+	unsigned shift = 0;
+	if (*end == 'K' || *end == 'k')
+		shift = 10;
+	else if (*end == 'M' || *end == 'm')
+		shift = 20;
+	else if (*end == 'G' || *end == 'g')
+		shift = 30;
+	else if (*end != '\0')
+		return AICLI_STAGE_DEFAULT_MEMORY;
+	if (shift && end[1] != '\0')
+		return AICLI_STAGE_DEFAULT_MEMORY;
+	if (x > (SIZE_MAX >> shift))
+		return SIZE_MAX;
+	return (size_t)(x << shift);
+}
+
+const char *aicli_stage_limit_note(const aicli_stage_t *st)
+{
+	if (st && st->kind == STAGE_TAIL && st->u.tail.clipped)
+		return "tail: fewer lines than requested; the window was cut to the newest lines "
+		       "fitting in the execute memory budget (AICLI_EXECUTE_MEMORY)";
+	return NULL;
+}
+
+void aicli_stage_reset(aicli_stage_t *st)
+{
+	if (!st)
+		return;
+	st->line_no = 1;
+	st->in_offset = 0;
+	switch (st->kind) {
+	case STAGE_HEAD:
+		st->u.head.seen = 0;
+		break;
+	case STAGE_TAIL:
+		// Dropped rather than kept: a stage parked in the pipeline cache should not pin
+		// the window of a large run.
+		aicli_buf_free(&st->u.tail.keep);
+		free(st->u.tail.offs);
+		st->u.tail.offs = NULL;
+		st->u.tail.offs_len = 0;
+		st->u.tail.offs_cap = 0;
+		st->u.tail.first = 0;
+		st->u.tail.clipped = false;
+		break;
+	case STAGE_WC:
+		st->u.wc.in_word = false;
+		st->u.wc.count = 0;
+		break;
+	case STAGE_SORT:
+		aicli_sort_reset(st->u.sort.engine);
+		break;
+	case STAGE_SED_RE_ADDR:
+		st->u.sed_re.in_range = false;
+		break;
+	case STAGE_SED_SUBST:
+		st->u.subst.line_out.len = 0;
+		break;
+	case STAGE_FUSED:
+		for (int k = 0; k < st->u.fused.n; k++) {
+			aicli_stage_reset(st->u.fused.parts[k]);
+			st->u.fused.lines[k].len = 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void aicli_stage_free(aicli_stage_t *st)
+{
+	if (!st)
+		return;
+	switch (st->kind) {
+	case STAGE_TAIL:
+		aicli_buf_free(&st->u.tail.keep);
+		free(st->u.tail.offs);
+		break;
+	case STAGE_SORT:
+		aicli_sort_free(st->u.sort.engine);
+		break;
+	case STAGE_GREP:
+		if (!st->u.grep.empty && !st->u.grep.fixed)
+			aicli_line_regex_free(&st->u.grep.rx);
+		free(st->u.grep.needle);
+		break;
+	case STAGE_SED_RE_ADDR:
+		aicli_line_regex_free(&st->u.sed_re.rx1);
+		if (st->u.sed_re.has_rx2)
+			aicli_line_regex_free(&st->u.sed_re.rx2);
+		break;
+	case STAGE_SED_SUBST:
+		aicli_line_regex_free(&st->u.subst.rx);
+		aicli_buf_free(&st->u.subst.line_out);
+		free(st->u.subst.pattern);
+		free(st->u.subst.repl);
+		break;
+	case STAGE_FUSED:
+		for (int k = 0; k < st->u.fused.n; k++) {
+			aicli_stage_free(st->u.fused.parts[k]);
+			aicli_buf_free(&st->u.fused.lines[k]);
+		}
+		break;
+	default:
+		break;
+	}
+	free(st);
+}
+
 static bool parse_sed_n_script(const char *script, size_t *out_start, size_t *out_end, char *out_cmd)
 {
 	// Accept only:
@@ -652,177 +1516,6 @@ bool aicli_parse_sed_re_args(const aicli_dsl_stage_t *st, const char **out_re1,
 	return parse_sed_re_script(a[2], out_re1, out_re1_len, out_re2, out_re2_len, out_cmd);
 }
 
-bool aicli_stage_sed_n_re_addr(const char *in, size_t in_len, const char *re1, size_t re1_len,
-			      const char *re2, size_t re2_len, char cmd, aicli_buf_t *out)
-{
-	if (!in || !out || !re1 || re1_len == 0)
-		return false;
-
-	// `re1`/`re2` are decoded + NUL-terminated by the parser.
-	// Ownership: stage frees them.
-	char *re1_z = (char *)re1;
-	char *re2_z = (re2 && re2_len > 0) ? (char *)re2 : NULL;
-
-	regex_t rx1;
-	memset(&rx1, 0, sizeof(rx1));
-	int rc = regcomp(&rx1, re1_z, 0);
-	if (rc != 0) {
-		free(re1_z);
-		free(re2_z);
-		regfree(&rx1);
-		return false;
-	}
-	regex_t rx2;
-	memset(&rx2, 0, sizeof(rx2));
-	bool has_rx2 = false;
-	if (re2_z) {
-		rc = regcomp(&rx2, re2_z, 0);
-		if (rc != 0) {
-			regfree(&rx1);
-			free(re1_z);
-			free(re2_z);
-			regfree(&rx2);
-			return false;
-		}
-		has_rx2 = true;
-	}
-
-	bool in_range = false;
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
-
-			char *z = (char *)malloc(line_len + 1);
-			if (!z) {
-				regfree(&rx1);
-				if (has_rx2)
-					regfree(&rx2);
-				free(re1_z);
-				free(re2_z);
-				return false;
-			}
-			memcpy(z, line, line_len);
-			z[line_len] = '\0';
-
-			bool m1 = (regexec(&rx1, z, 0, NULL, 0) == 0);
-			bool m2 = false;
-			if (has_rx2)
-				m2 = (regexec(&rx2, z, 0, NULL, 0) == 0);
-			free(z);
-
-			bool selected = false;
-			if (!has_rx2) {
-				selected = m1;
-			} else {
-				if (!in_range) {
-					if (m1)
-						in_range = true;
-				}
-				if (in_range) {
-					selected = true;
-					if (m2)
-						in_range = false;
-				}
-			}
-
-			bool emit = false;
-			if (cmd == 'p')
-				emit = selected;
-			else if (cmd == 'd')
-				emit = !selected;
-			else {
-				regfree(&rx1);
-				if (has_rx2)
-					regfree(&rx2);
-				free(re1_z);
-				free(re2_z);
-				return false;
-			}
-
-			if (emit) {
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len)) {
-						regfree(&rx1);
-						if (has_rx2)
-							regfree(&rx2);
-						free(re1_z);
-						free(re2_z);
-						return false;
-					}
-				}
-				if (!aicli_buf_append(out, "\n", 1)) {
-					regfree(&rx1);
-					if (has_rx2)
-						regfree(&rx2);
-					free(re1_z);
-					free(re2_z);
-					return false;
-				}
-			}
-
-			line_no++;
-			line_start = i + 1;
-		}
-		i++;
-	}
-
-	regfree(&rx1);
-	if (has_rx2)
-		regfree(&rx2);
-	free(re1_z);
-	free(re2_z);
-	(void)line_no;
-	return true;
-}
-
-bool aicli_stage_sed_n_addr(const char *in, size_t in_len, size_t start_addr, size_t end_addr, char cmd,
-                            aicli_buf_t *out)
-{
-	// Implements: sed -n 'Np'/'Nd' and 'N,Mp'/'N,Md'
-	if (start_addr == 0 || end_addr == 0)
-		return false;
-	if (start_addr > end_addr)
-		return false;
-
-	unsigned long line_no = 1;
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
-
-			bool in_range = (line_no >= start_addr && line_no <= end_addr);
-			bool emit = false;
-			if (cmd == 'p') {
-				emit = in_range;
-			} else if (cmd == 'd') {
-				emit = !in_range;
-			} else {
-				return false;
-			}
-
-			if (emit) {
-				if (line_len > 0) {
-					if (!aicli_buf_append(out, line, line_len))
-						return false;
-				}
-				if (!aicli_buf_append(out, "\n", 1))
-					return false;
-			}
-
-			line_no++;
-			line_start = i + 1;
-		}
-		i++;
-	}
-	return true;
-}
-
 size_t aicli_parse_head_n(const aicli_dsl_stage_t *st, bool *ok)
 {
 	*ok = true;
@@ -908,21 +1601,73 @@ bool aicli_parse_wc_mode(const aicli_dsl_stage_t *st, char *out_mode)
 	return false;
 }
 
-bool aicli_parse_sort_reverse(const aicli_dsl_stage_t *st, bool *out_reverse)
+static bool parse_sort_key(const char *v, aicli_sort_opts_t *out)
 {
-	// sort | sort -r
+	// N[,M] followed by modifiers n/r, which apply to the whole sort (there is only
+	// one key). Character positions (N.C) are not supported.
+	char *end = NULL;
+	unsigned long n = strtoul(v, &end, 10);
+	if (end == v || n == 0 || n > 0xffff || out->key_start)
+		return false;
+	unsigned long m = 0;
+	if (*end == ',') {
+		const char *p = end + 1;
+		m = strtoul(p, &end, 10);
+		if (end == p || m == 0 || m > 0xffff)
+			return false;
+	}
+	for (; *end; end++) {
+		if (*end == 'n')
+			out->numeric = true;
+		else if (*end == 'r')
+			out->reverse = true;
+		else
+			return false;
+	}
+	out->key_start = (unsigned)n;
+	out->key_end = (unsigned)m;
+	return true;
+}
+
+bool aicli_parse_sort_args(const aicli_dsl_stage_t *st, aicli_sort_opts_t *out)
+{
+	// sort [-r] [-u] [-n] [-t C] [-k N[,M]]
+	// Flags may be combined (-rn); -t and -k take their value attached or as the next
+	// argument.
 	const char *a[8];
 	int ac = 0;
 	aicli_dsl_strip_double_dash(st, a, &ac);
-	if (ac == 1) {
-		*out_reverse = false;
-		return true;
-	}
-	if (ac == 2 && strcmp(a[1], "-r") == 0) {
-		*out_reverse = true;
-		return true;
+	memset(out, 0, sizeof(*out));
+	for (int i = 1; i < ac; i++) {
+		const char *p = a[i];
+		if (!p || p[0] != '-' || p[1] == '\0')
+			return false;
+		for (p++; *p; p++) {
+			if (*p == 'r') {
+				out->reverse = true;
+			} else if (*p == 'u') {
+				out->unique = true;
+			} else if (*p == 'n') {
+				out->numeric = true;
+			} else if (*p == 't' || *p == 'k') {
+				const char *v = p[1] ? p + 1 : (i + 1 < ac ? a[++i] : NULL);
+				if (!v)
+					return false;
+				if (*p == 'k') {
+					if (!parse_sort_key(v, out))
+						return false;
+				} else {
+					if (v[0] == '\0' || v[1] != '\0' || v[0] == '\n' || out->sep)
+						return false;
+					out->sep = v[0];
+				}
+				break;
+			} else {
+				return false;
+			}
+		}
 	}
-	return false;
+	return true;
 }
 
 bool aicli_parse_grep_args(const aicli_dsl_stage_t *st, const char **out_pattern, bool *out_n, bool *out_fixed,
@@ -1124,214 +1869,3 @@ bool aicli_parse_sed_subst_args(const aicli_dsl_stage_t *st, const char **out_pa
 	*out_repl = rep_z;
 	return true;
 }
-
-bool aicli_stage_sed_n_subst(const char *in, size_t in_len, const char *pattern, const char *repl,
-			     bool global, bool print_on_match, aicli_buf_t *out)
-{
-	if (!in || !pattern || !repl || !out)
-		return false;
-	const char *dbg = getenv("AICLI_DEBUG_FUNCTION_CALL");
-	// `pattern` and `repl` are already NUL-terminated (allocated) by the parser.
-	const char *pat = pattern;
-	const char *rep = repl;
-	size_t repl_len = strlen(rep);
-
-	// Compile BRE (REG_EXTENDED not set). We need match offsets, so do NOT use REG_NOSUB.
-	regex_t rx;
-	memset(&rx, 0, sizeof(rx));
-	int rc = regcomp(&rx, pat, 0);
-	if (rc != 0) {
-		char errbuf[256];
-		regerror(rc, &rx, errbuf, sizeof(errbuf));
-		aicli_buf_append(out, "sed: ", 5);
-		aicli_buf_append(out, errbuf, strlen(errbuf));
-		aicli_buf_append(out, "\n", 1);
-		regfree(&rx);
-		free((void *)pattern);
-		free((void *)repl);
-		return false;
-	}
-
-
-	const size_t k_max_line_len = 64 * 1024;
-	const size_t k_max_out_bytes_per_line = 256 * 1024;
-	const size_t k_max_subst_per_line = 4096;
-
-	size_t i = 0;
-	size_t line_start = 0;
-	while (i <= in_len) {
-		if (i == in_len || in[i] == '\n') {
-			size_t line_len = i - line_start;
-			const char *line = in + line_start;
-			if (line_len > k_max_line_len) {
-				regfree(&rx);
-				free((void *)pattern);
-				free((void *)repl);
-				return false;
-			}
-
-			bool matched_any = false;
-			aicli_buf_t tmp;
-			if (!aicli_buf_init(&tmp, line_len + 32)) {
-				regfree(&rx);
-				free((void *)pattern);
-				free((void *)repl);
-				return false;
-			}
-			// Defensive: ensure empty output for this line.
-			tmp.len = 0;
-
-			size_t cursor = 0;
-			size_t subst_cnt = 0;
-			while (cursor <= line_len) {
-				size_t rem = line_len - cursor;
-				char *z = (char *)malloc(rem + 1);
-				if (!z) {
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-				memcpy(z, line + cursor, rem);
-				z[rem] = '\0';
-
-				regmatch_t m;
-				m.rm_so = -1;
-				m.rm_eo = -1;
-				int er = regexec(&rx, z, 1, &m, 0);
-				if (er == REG_NOMATCH) {
-					free(z);
-					break;
-				}
-				if (er != 0) {
-					char errbuf[256];
-					regerror(er, &rx, errbuf, sizeof(errbuf));
-					aicli_buf_append(out, "sed: ", 5);
-					aicli_buf_append(out, errbuf, strlen(errbuf));
-					aicli_buf_append(out, "\n", 1);
-					free(z);
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-				if (m.rm_so < 0 || m.rm_eo < 0) {
-					free(z);
-					break;
-				}
-				size_t so = (size_t)m.rm_so;
-				size_t eo = (size_t)m.rm_eo;
-				if (eo < so) {
-					free(z);
-					break;
-				}
-
-				matched_any = true;
-				subst_cnt++;
-				if (subst_cnt > k_max_subst_per_line) {
-					free(z);
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-
-				if (so > 0) {
-					if (!aicli_buf_append(&tmp, z, so)) {
-						free(z);
-						aicli_buf_free(&tmp);
-						regfree(&rx);
-						free((void *)pattern);
-						free((void *)repl);
-						return false;
-					}
-				}
-				if (!aicli_buf_append(&tmp, rep, repl_len)) {
-					free(z);
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-				if (tmp.len > k_max_out_bytes_per_line) {
-					free(z);
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-
-				cursor += eo;
-				free(z);
-				if (!global)
-					break;
-
-				if (eo == 0) {
-					if (cursor < line_len) {
-						if (!aicli_buf_append(&tmp, line + cursor, 1)) {
-							aicli_buf_free(&tmp);
-							regfree(&rx);
-							free((void *)pattern);
-							free((void *)repl);
-							return false;
-						}
-						cursor++;
-					} else {
-						break;
-					}
-				}
-			}
-
-			if (matched_any && cursor < line_len) {
-				if (!aicli_buf_append(&tmp, line + cursor, line_len - cursor)) {
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-			}
-
-			if (dbg && dbg[0] != '\0') {
-				fprintf(stderr,
-				        "[debug:sed] pat='%s' rep='%s' line_start=%zu line_len=%zu matched_any=%d global=%d p=%d tmp_len=%zu\n",
-				        pat, rep, line_start, line_len, matched_any ? 1 : 0, global ? 1 : 0,
-				        print_on_match ? 1 : 0, tmp.len);
-				if (matched_any) {
-					fprintf(stderr, "[debug:sed] line='%.*s'\n", (int)line_len, line);
-				}
-			}
-
-			if (print_on_match && matched_any) {
-				if (!aicli_buf_append(out, tmp.data, tmp.len)) {
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-				if (!aicli_buf_append(out, "\n", 1)) {
-					aicli_buf_free(&tmp);
-					regfree(&rx);
-					free((void *)pattern);
-					free((void *)repl);
-					return false;
-				}
-			}
-
-			aicli_buf_free(&tmp);
-			line_start = i + 1;
-		}
-		i++;
-	}
-
-	regfree(&rx);
-	free((void *)pattern);
-	free((void *)repl);
-	return true;
-}
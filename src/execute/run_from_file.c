@@ -1,160 +1,405 @@
 #include "execute/run_from_file.h"
 
 #include "buf.h"
+#include "cancel.h"
 #include "execute/allowlist.h"
 #include "execute/dispatch.h"
 #include "execute/file_reader.h"
+#include "execute/line_index.h"
 #include "execute/paging.h"
-#include "execute/pipeline_stages.h"
+#include "execute/pipeline_cache.h"
+#include "threadpool.h"
+#include "tool_budget.h"
 
 #include <errno.h>
-#include <stdio.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static bool stage_has_file_arg(aicli_cmd_kind_t kind)
+// When the stages up to the first windowed one (sed -n 'N,Mp', tail -n K) only
+// renumber lines (nl), every input line before the window is dead weight. For mapped
+// files the reader jumps straight to the window using the file's line index, and the
+// stages continue numbering from there. Returns the number of lines skipped.
+static unsigned long skip_ahead(aicli_line_reader_t *reader, aicli_stage_t *const *stages,
+                                int stage_count)
+{
+	const char *data = NULL;
+	size_t len = 0;
+	if (!aicli_line_reader_view(reader, &data, &len))
+		return 0;
+	int w = 0;
+	while (w < stage_count && aicli_stage_is_line_mapping(stages[w]))
+		w++;
+	unsigned long first = 0;
+	size_t last = 0;
+	if (w == stage_count || !aicli_stage_line_window(stages[w], &first, &last))
+		return 0;
+	if (first == 1)
+		return 0;
+
+	aicli_line_index_t *ix = aicli_line_index_get(&reader->st);
+	if (!ix)
+		return 0;
+	unsigned long skipped = 0;
+	bool ok = true;
+	if (first == 0) {
+		// tail -n K: the window starts at the K-th complete line from the end.
+		size_t newlines = 0;
+		ok = aicli_line_index_newlines(ix, data, len, &newlines);
+		first = newlines >= last ? (unsigned long)(newlines - last + 1) : 1;
+	}
+	size_t off = 0;
+	if (ok && first > 1 && aicli_line_index_offset(ix, data, len, &first, &off) &&
+	    aicli_line_reader_seek(reader, off)) {
+		for (int si = 0; si <= w; si++)
+			aicli_stage_skip_input(stages[si], first - 1, off);
+		skipped = first - 1;
+	}
+	aicli_line_index_release(ix);
+	return skipped;
+}
+
+// Maps a failed stage status to the tool error. Returns false for CONTINUE/DONE/MORE.
+static bool stage_failed(aicli_stage_status_t rc, aicli_tool_result_t *out)
 {
-	// Commands that can take a source FILE as their last argument.
-	// We normalize them into: cat FILE | <cmd ...without FILE>
-	switch (kind) {
-	case AICLI_CMD_HEAD:
-	case AICLI_CMD_TAIL:
-	case AICLI_CMD_NL:
-	case AICLI_CMD_SED:
+	switch (rc) {
+	case AICLI_STAGE_ERROR:
+		out->stderr_text = "mvp_unsupported_stage";
+		out->exit_code = 2;
+		return true;
+	case AICLI_STAGE_TOO_LARGE:
+		out->stderr_text = "file_too_large";
+		out->exit_code = 4;
+		return true;
+	case AICLI_STAGE_CANCELLED:
+		out->stderr_text = "timeout";
+		out->exit_code = 124;
 		return true;
 	default:
 		return false;
 	}
 }
 
-static bool stage_is_file_sed_n_addr(const aicli_dsl_stage_t *st)
+// Feeds one chunk through stages[from, stage_count) into the sink. Returns 1 once the
+// output is complete or the sink has all it needs (see aicli_paging_sink_full()), 0 to
+// go on, -1 on failure (out is set).
+static int feed_chunk(aicli_stage_t *const *stages, int from, int stage_count, aicli_buf_t *bufs,
+                      const char *cur, size_t cur_len, bool at_eof, aicli_paging_sink_t *sink,
+                      aicli_tool_result_t *out)
 {
-	// We only support a restricted sed form via pipeline stages:
-	//   sed -n '1,200p'   (script token only)
-	//   sed -n '/RE/p'    (script token only)
-	//   sed -n 's/RE/REPL/[gp]'
-	// When used as a file-input command, models often emit:
-	//   sed -n 1,200p FILE
-	// Normalize that shape into: cat FILE | sed -n 1,200p
-	if (!st)
-		return false;
-	if (st->kind != AICLI_CMD_SED)
-		return false;
-	if (st->argc != 4)
-		return false;
-	if (strcmp(st->argv[1], "-n") != 0)
-		return false;
-	// argv[2] is the script, argv[3] is the file
-	if (!st->argv[2] || !st->argv[2][0])
-		return false;
-	if (!st->argv[3] || !st->argv[3][0])
-		return false;
-	// Validate the script is one of the sed scripts we accept beyond numbers,
-	// so we don't accidentally treat unsupported sed forms as file-input shapes.
-	// Note: numeric N,M handling is covered elsewhere; here we only need to
-	// recognize /RE/ and s/RE/...
-	{
-		char cmd = 0;
-		aicli_dsl_stage_t tmp = *st;
-		tmp.argc = 3;
-		const char *re1 = NULL;
-		size_t re1_len = 0;
-		const char *re2 = NULL;
-		size_t re2_len = 0;
-		bool ok = aicli_parse_sed_re_args(&tmp, &re1, &re1_len, &re2, &re2_len, &cmd);
-		if (re1)
-			free((void *)re1);
-		if (re2)
-			free((void *)re2);
-		if (!ok) {
-			const char *pattern = NULL;
-			const char *repl = NULL;
-			bool global = false;
-			bool print_on_match = false;
-			ok = aicli_parse_sed_subst_args(&tmp, &pattern, &repl, &global, &print_on_match);
+	for (int si = from; si < stage_count; si++) {
+		bufs[si].len = 0;
+		aicli_stage_status_t rc = aicli_stage_feed(stages[si], cur, cur_len, at_eof, &bufs[si]);
+		// A stage with more output than one piece (sort) hands it on part by part; the
+		// stages after it may finish early (`sort | head`).
+		while (rc == AICLI_STAGE_MORE) {
+			int r = feed_chunk(stages, si + 1, stage_count, bufs, bufs[si].data, bufs[si].len,
+			                   false, sink, out);
+			if (r != 0)
+				return r;
+			bufs[si].len = 0;
+			rc = aicli_stage_feed(stages[si], "", 0, true, &bufs[si]);
 		}
-		if (!ok)
-			return false;
+		if (stage_failed(rc, out))
+			return -1;
+		if (rc == AICLI_STAGE_DONE)
+			at_eof = true;
+		cur = bufs[si].data;
+		cur_len = bufs[si].len;
 	}
-	return true;
+	if (!aicli_paging_sink_write(sink, cur, cur_len)) {
+		out->stderr_text = "oom";
+		out->exit_code = 1;
+		return -1;
+	}
+	if (!at_eof && aicli_paging_sink_full(sink)) {
+		sink->stopped = true;
+		return 1;
+	}
+	return at_eof ? 1 : 0;
 }
 
-static int normalize_file_input_pipeline(aicli_dsl_pipeline_t *pipe)
+// Chunked parallel execution.
+//
+// The leading stages that handle every line on its own (grep, sed s///, sed -n '/RE/p',
+// nl), optionally followed by one counting stage (wc), run on line-aligned chunks of
+// the mapping in parallel, each chunk on private copies of those stages. Their outputs
+// are then passed on in file order, so the rest of the pipeline and the result are
+// the same as when streaming. Line numbers (nl, grep -n) only work for the first
+// stage: each chunk starts numbering at the file line it begins with, found by
+// counting the newlines of all chunks first (in parallel too) and summing them.
+//
+// Batches start at one chunk and double, so a pipeline that stops early (`| head`)
+// wastes at most about as much work as it used.
+typedef struct {
+	const char *data;
+	size_t len;
+	size_t offset; // in the file
+	bool at_eof;
+	size_t newlines;
+	unsigned long first_line;
+	aicli_stage_t *chain[8]; // private copies of the parallel stages
+	aicli_buf_t bufs[8];
+	aicli_stage_status_t rc;
+	const char *out;
+	size_t out_len;
+} par_chunk_t;
+
+typedef struct {
+	par_chunk_t *chunks;
+	int prefix;    // number of parallel stages
+	bool counting; // the last of them is a counting stage
+} par_batch_t;
+
+// Number of leading stages that may run chunk-parallel.
+static int parallel_prefix(aicli_stage_t *const *stages, int stage_count, bool *numbered,
+                           bool *counting)
 {
-	// Ensures pipelines enter the executor as: cat FILE | ...
-	// Returns 0 on success; non-zero means unsupported shape.
-	if (!pipe || pipe->stage_count <= 0)
-		return -1;
+	int k = 0;
+	*numbered = false;
+	*counting = false;
+	while (k < stage_count) {
+		bool uses_line_no = false;
+		aicli_stage_parallelism_t p = aicli_stage_parallelism(stages[k], &uses_line_no);
+		if (p == AICLI_STAGE_SEQUENTIAL || (uses_line_no && k > 0))
+			break;
+		*numbered = *numbered || uses_line_no;
+		k++;
+		if (p == AICLI_STAGE_COUNTING) {
+			*counting = true;
+			break;
+		}
+	}
+	return k;
+}
 
-	// Already normalized.
-	if (pipe->stages[0].kind == AICLI_CMD_CAT && pipe->stages[0].argc == 2)
+static void par_count_chunk(void *arg, size_t i)
+{
+	par_chunk_t *c = &((par_batch_t *)arg)->chunks[i];
+	size_t n = 0;
+	const char *end = c->data + c->len;
+	for (const char *p = c->data; (p = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL;
+	     p++)
+		n++;
+	c->newlines = n;
+}
+
+static void par_run_chunk(void *arg, size_t i)
+{
+	par_batch_t *b = (par_batch_t *)arg;
+	par_chunk_t *c = &b->chunks[i];
+	const char *cur = c->data;
+	size_t cur_len = c->len;
+	c->rc = AICLI_STAGE_CONTINUE;
+	for (int si = 0; si < b->prefix; si++) {
+		aicli_stage_reset(c->chain[si]);
+		if (si == 0)
+			aicli_stage_skip_input(c->chain[0], c->first_line - 1, c->offset);
+		// A counting copy reports its count through aicli_stage_merge(), never as output.
+		bool eof = c->at_eof && !(b->counting && si == b->prefix - 1);
+		c->bufs[si].len = 0;
+		aicli_stage_status_t rc = aicli_stage_feed(c->chain[si], cur, cur_len, eof, &c->bufs[si]);
+		if (rc != AICLI_STAGE_CONTINUE && rc != AICLI_STAGE_DONE) {
+			c->rc = rc;
+			return;
+		}
+		cur = c->bufs[si].data;
+		cur_len = c->bufs[si].len;
+	}
+	c->out = cur;
+	c->out_len = cur_len;
+}
+
+// Returns 0 without consuming anything when the run does not qualify, otherwise as
+// feed_chunk() for the whole rest of the file.
+static int run_parallel(aicli_line_reader_t *reader, const aicli_dsl_pipeline_t *pipe,
+                        aicli_stage_t *const *stages, int stage_count, unsigned long first_line,
+                        aicli_buf_t *bufs, aicli_paging_sink_t *sink, aicli_tool_result_t *out)
+{
+	const char *data = NULL;
+	size_t len = 0;
+	if (!aicli_line_reader_view(reader, &data, &len) ||
+	    len - reader->map_pos < AICLI_EXECUTE_PARALLEL_MIN_BYTES)
+		return 0;
+	bool numbered = false;
+	bool counting = false;
+	int prefix = parallel_prefix(stages, stage_count, &numbered, &counting);
+	aicli_threadpool_t *pool = aicli_threadpool_compute();
+	if (prefix == 0 || !pool)
 		return 0;
+	size_t batch_max = 2 * (aicli_threadpool_size(pool) + 1);
+	par_batch_t b = {
+	    .chunks = (par_chunk_t *)calloc(batch_max, sizeof(par_chunk_t)),
+	    .prefix = prefix,
+	    .counting = counting,
+	};
+	if (!b.chunks)
+		return 0;
+
+	const aicli_cancel_t *cancel = aicli_cancel_current();
+	size_t pos = reader->map_pos;
+	size_t opened = 0; // chunks[0, opened) have their stage copies
+	int r = 0;
+	for (size_t batch = 1; r == 0; batch = batch * 2 < batch_max ? batch * 2 : batch_max) {
+		if (aicli_cancel_requested(cancel)) {
+			out->stderr_text = "timeout";
+			out->exit_code = 124;
+			r = -1;
+			break;
+		}
+		size_t n = 0;
+		while (n < batch && pos < len) {
+			par_chunk_t *c = &b.chunks[n++];
+			size_t end = len;
+			if (len - pos > AICLI_EXECUTE_PARALLEL_CHUNK) {
+				const char *nl = (const char *)memchr(data + pos + AICLI_EXECUTE_PARALLEL_CHUNK,
+				                                      '\n', len - pos - AICLI_EXECUTE_PARALLEL_CHUNK);
+				if (nl)
+					end = (size_t)(nl - data) + 1;
+			}
+			c->data = data + pos;
+			c->len = end - pos;
+			c->offset = pos;
+			c->at_eof = end == len;
+			pos = end;
+			if (c->at_eof)
+				break;
+		}
+		for (; opened < n; opened++) {
+			// Planned like the pipeline's own stages, so chain[si] matches stages[si].
+			aicli_stage_t *plan[8];
+			int planned = aicli_execute_open_stages(pipe, plan);
+			for (int si = prefix; si < planned; si++)
+				aicli_stage_free(plan[si]);
+			if (planned != stage_count) {
+				for (int si = 0; si < prefix && si < planned; si++)
+					aicli_stage_free(plan[si]);
+				out->stderr_text = "oom";
+				out->exit_code = 1;
+				r = -1;
+				goto done;
+			}
+			memcpy(b.chunks[opened].chain, plan, (size_t)prefix * sizeof(plan[0]));
+		}
 
-	// Also allow a single-stage direct file read: cat FILE
-	// (covered above) and reject other single-stage non-file commands.
+		if (numbered) {
+			aicli_threadpool_parallel_for(pool, n, par_count_chunk, &b);
+			for (size_t i = 0; i < n; i++) {
+				b.chunks[i].first_line = first_line;
+				first_line += (unsigned long)b.chunks[i].newlines;
+			}
+		}
+		aicli_threadpool_parallel_for(pool, n, par_run_chunk, &b);
 
-	// Support: <cmd ... FILE> | ...  ==>  cat FILE | <cmd ...> | ...
-	// Special-case: sed -n ADDR FILE (argc==4)
-	bool is_sed_file_form = stage_is_file_sed_n_addr(&pipe->stages[0]);
-	if (!is_sed_file_form && !stage_has_file_arg(pipe->stages[0].kind))
-		return -1;
-	if (pipe->stages[0].argc < 2)
-		return -1;
+		for (size_t i = 0; i < n && r == 0; i++) {
+			par_chunk_t *c = &b.chunks[i];
+			if (stage_failed(c->rc, out)) {
+				r = -1;
+			} else if (counting) {
+				(void)aicli_stage_merge(stages[prefix - 1], c->chain[prefix - 1]);
+				if (c->at_eof)
+					r = feed_chunk(stages, prefix - 1, stage_count, bufs, "", 0, true, sink, out);
+			} else {
+				r = feed_chunk(stages, prefix, stage_count, bufs, c->out, c->out_len, c->at_eof,
+				               sink, out);
+			}
+		}
+	}
 
-	const char *file = NULL;
-	if (is_sed_file_form)
-		file = pipe->stages[0].argv[3];
-	else
-		file = pipe->stages[0].argv[pipe->stages[0].argc - 1];
-	if (!file || file[0] == '\0')
-		return -1;
+done:
+	for (size_t i = 0; i < opened; i++) {
+		for (int si = 0; si < prefix; si++) {
+			aicli_stage_free(b.chunks[i].chain[si]);
+			aicli_buf_free(&b.chunks[i].bufs[si]);
+		}
+	}
+	free(b.chunks);
+	return r;
+}
 
-	// Shift stages right by 1.
-	if (pipe->stage_count >= 8)
-		return -1;
-	for (int i = pipe->stage_count; i > 0; i--) {
-		pipe->stages[i] = pipe->stages[i - 1];
-	}
-	pipe->stage_count++;
-
-	// New stage 0: cat FILE
-	pipe->stages[0].kind = AICLI_CMD_CAT;
-	pipe->stages[0].argc = 2;
-	pipe->stages[0].argv[0] = "cat";
-	pipe->stages[0].argv[1] = file;
-	for (int i = 2; i < 8; i++)
-		pipe->stages[0].argv[i] = NULL;
-
-	// Remove FILE from the original command stage (now stage 1)
-	if (is_sed_file_form) {
-		// Convert: sed -n ADDR FILE  (argc=4)
-		// into:    sed -n ADDR       (argc=3)
-		pipe->stages[1].argc = 3;
-		pipe->stages[1].argv[3] = NULL;
-	} else {
-		pipe->stages[1].argc -= 1;
-		pipe->stages[1].argv[pipe->stages[1].argc] = NULL;
+static bool key_append_field(aicli_buf_t *b, const char *s)
+{
+	// Length-prefixed so arguments containing separators cannot collide.
+	char len[32];
+	int n = snprintf(len, sizeof(len), "%zu:", strlen(s));
+	return n > 0 && aicli_buf_append(b, len, (size_t)n) && aicli_buf_append_str(b, s);
+}
+
+static char *make_cache_key(const char *realpath, const struct stat *st,
+                            const aicli_dsl_pipeline_t *pipe, const char *idempotency)
+{
+	// The file is identified by what is actually open, not by its name: a rewritten
+	// file changes mtime/size (or inode, for editors that replace it), so stale
+	// output is never served. Stages are keyed by their parsed argv, which makes
+	// quoting variants of the same pipeline share an entry.
+	aicli_buf_t b;
+	if (!aicli_buf_init(&b, 256))
+		return NULL;
+	char ident[160];
+	int n = snprintf(ident, sizeof(ident), "execute|dev=%llu|ino=%llu|size=%lld|mtime=%lld.%09ld|",
+	                 (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+	                 (long long)st->st_size, (long long)st->st_mtim.tv_sec,
+	                 (long)st->st_mtim.tv_nsec);
+	bool ok = n > 0 && (size_t)n < sizeof(ident) && aicli_buf_append(&b, ident, (size_t)n);
+	ok = ok && key_append_field(&b, realpath);
+	for (int si = 1; ok && si < pipe->stage_count; si++) {
+		ok = aicli_buf_append(&b, "|", 1);
+		for (int ai = 0; ok && ai < pipe->stages[si].argc; ai++)
+			ok = key_append_field(&b, pipe->stages[si].argv[ai] ? pipe->stages[si].argv[ai] : "");
 	}
-	return 0;
+	ok = ok && aicli_buf_append(&b, "|idem=", 6);
+	ok = ok && key_append_field(&b, idempotency ? idempotency : "");
+	ok = ok && aicli_buf_append(&b, "", 1);
+	if (!ok) {
+		aicli_buf_free(&b);
+		return NULL;
+	}
+	return b.data;
+}
+
+static bool serve_from_cache(aicli_paging_cache_t *cache, const char *key, size_t start,
+                             size_t size, aicli_tool_result_t *out)
+{
+	char *page = NULL;
+	size_t n = 0;
+	size_t total = 0;
+	if (!aicli_paging_cache_copy_range(cache, key, start, size, &page, &n, &total))
+		return false;
+	if (start > total)
+		start = total;
+	if (start + n < total) {
+		n = aicli_tool_page_trim(page, n);
+		page[n] = '\0';
+	}
+	out->stdout_text = page;
+	out->stdout_len = n;
+	out->exit_code = 0;
+	out->total_bytes = total;
+	out->truncated = (start + n) < total;
+	out->has_next_start = out->truncated;
+	out->next_start = start + n;
+	out->cache_hit = true;
+	return true;
 }
 
 int aicli_execute_run_pipeline_from_file(const aicli_allowlist_t *allow,
-                                        const aicli_dsl_pipeline_t *pipe,
+                                        aicli_paging_cache_t *cache,
+                                        aicli_compiled_pipeline_t *cp,
                                         const aicli_execute_request_t *req,
                                         aicli_tool_result_t *out)
 {
-	if (!pipe || !req || !out)
+	if (!cp || !req || !out)
 		return -1;
 
-	aicli_dsl_pipeline_t local_pipe = *pipe;
-	if (normalize_file_input_pipeline(&local_pipe) != 0) {
+	const aicli_dsl_pipeline_t *pipe = &cp->pipe;
+	if (!cp->file_input) {
 		out->stderr_text = "mvp_requires: cat <FILE> (or head/tail/nl/sed ... <FILE>)";
 		out->exit_code = 2;
 		return 0;
 	}
 
-	const char *path = local_pipe.stages[0].argv[1];
+	const char *path = pipe->stages[0].argv[1];
 	{
 		const char *dbg = getenv("AICLI_DEBUG_FUNCTION_CALL");
 		if (dbg && dbg[0] != '\0')
@@ -176,71 +421,119 @@ int aicli_execute_run_pipeline_from_file(const aicli_allowlist_t *allow,
 		return 0;
 	}
 
-	size_t size = req->size ? req->size : AICLI_MAX_TOOL_BYTES;
-	if (size > AICLI_MAX_TOOL_BYTES)
-		size = AICLI_MAX_TOOL_BYTES;
+	size_t size = aicli_tool_page_size(req->size, req->max_size);
 
-	// Step 1: read whole file (bounded) into memory for now.
-	// Limit: avoid reading huge files (bounded for now).
-	size_t file_total = 0;
-	char *file_buf = NULL;
-	size_t file_len = 0;
-	{
-		size_t max_read = 1024 * 1024; // 1 MiB hard limit
-		if (aicli_read_file_range(rp, 0, max_read, &file_buf, &file_len, &file_total) != 0) {
-			free(rp);
-			out->stderr_text = strerror(errno);
-			out->exit_code = 1;
-			return 0;
-		}
+	// Stream the file through the stages in line-bounded chunks. A stage that is done
+	// early (head, sed -n 'N,Mp') ends the run: nothing more is read from the file and
+	// the stages after it are flushed with EOF. Only the requested page of the final
+	// output is kept.
+	aicli_line_reader_t reader;
+	if (aicli_line_reader_open(&reader, rp) != 0) {
 		free(rp);
-		if (file_total > max_read) {
-			free(file_buf);
-			out->stderr_text = "file_too_large";
-			out->exit_code = 4;
-			return 0;
-		}
+		out->stderr_text = strerror(errno);
+		out->exit_code = 1;
+		return 0;
 	}
 
-	const char *cur = file_buf;
-	size_t cur_len = file_len;
-	aicli_buf_t tmp1, tmp2;
-	bool okbuf = aicli_buf_init(&tmp1, cur_len + 64) && aicli_buf_init(&tmp2, cur_len + 64);
-	if (!okbuf) {
-		free(file_buf);
+	// Until the stages are opened (and fused) this is the number of DSL stages; it is
+	// zero for a bare `cat FILE` either way.
+	int stage_count = cp->stage_count;
+
+	// A bare `cat FILE` over a mapping is already O(page), caching it would only
+	// duplicate the file in memory.
+	char *cache_key = NULL;
+	if (cache && (stage_count > 0 || !reader.map))
+		cache_key = make_cache_key(rp, &reader.st, pipe, req->idempotency);
+	free(rp);
+	if (cache_key && serve_from_cache(cache, cache_key, req->start, size, out)) {
+		free(cache_key);
+		aicli_line_reader_close(&reader);
+		return 0;
+	}
+
+	aicli_stage_t *const *stages = cp->stages;
+	aicli_buf_t bufs[8];
+	memset(bufs, 0, sizeof(bufs));
+	aicli_paging_sink_t sink;
+	if (!aicli_paging_sink_init(&sink, req->start, size)) {
+		free(cache_key);
+		aicli_line_reader_close(&reader);
 		out->stderr_text = "oom";
 		out->exit_code = 1;
 		return 0;
 	}
+	if (cache_key)
+		aicli_paging_sink_capture(&sink, AICLI_EXECUTE_CACHE_MAX_BYTES);
 
-	for (int si = 1; si < local_pipe.stage_count; si++) {
-		const aicli_dsl_stage_t *stg = &local_pipe.stages[si];
-		tmp1.len = 0;
-		bool ok = aicli_execute_apply_stage(stg, cur, cur_len, &tmp1);
+	// Stages come compiled from an earlier run of the same command when the pipeline
+	// cache has it; only new ones are opened (argument parsing, regcomp) here.
+	if (!aicli_compiled_pipeline_open_stages(cp)) {
+		out->stderr_text = "mvp_unsupported_stage";
+		out->exit_code = 2;
+		goto done;
+	}
+	stage_count = cp->stage_count;
 
-		if (!ok) {
-			aicli_buf_free(&tmp1);
-			aicli_buf_free(&tmp2);
-			free(file_buf);
-			out->stderr_text = "mvp_unsupported_stage";
-			out->exit_code = 2;
-			return 0;
+	// Plain `cat FILE`: hand the whole mapping to the sink, which copies only the
+	// requested window, so pages outside it are never faulted in.
+	const char *view = NULL;
+	size_t view_len = 0;
+	if (stage_count == 0 && aicli_line_reader_view(&reader, &view, &view_len)) {
+		if (!aicli_paging_sink_write(&sink, view, view_len)) {
+			out->stderr_text = "oom";
+			out->exit_code = 1;
+			goto done;
 		}
+		aicli_paging_sink_finish(&sink, out);
+		goto done;
+	}
 
+	unsigned long skipped = skip_ahead(&reader, stages, stage_count);
+	int r = run_parallel(&reader, pipe, stages, stage_count, skipped + 1, bufs, &sink, out);
 
-		// Next stage should read the freshly-produced buffer. Swap the buffers
-		// to avoid tmp1/tmp2 aliasing issues (tmp2 may point to tmp1.data).
-		aicli_buf_t swap = tmp2;
-		tmp2 = tmp1;
-		tmp1 = swap;
-		cur = tmp2.data;
-		cur_len = tmp2.len;
+	const aicli_cancel_t *cancel = aicli_cancel_current();
+	while (r == 0) {
+		const char *cur = NULL;
+		size_t cur_len = 0;
+		bool at_eof = false;
+		if (aicli_cancel_requested(cancel)) {
+			out->stderr_text = "timeout";
+			out->exit_code = 124;
+			goto done;
+		}
+		if (aicli_line_reader_next(&reader, &cur, &cur_len, &at_eof) != 0) {
+			out->stderr_text = strerror(errno);
+			out->exit_code = 1;
+			goto done;
+		}
+		r = feed_chunk(stages, 0, stage_count, bufs, cur, cur_len, at_eof, &sink, out);
 	}
+	if (r < 0)
+		goto done;
 
-	aicli_apply_paging(cur, cur_len, req->start, size, out);
+	aicli_paging_sink_finish(&sink, out);
+	// A stage that cut its output to stay within the memory budget says so alongside
+	// the output; such a result is not cached, so later pages still carry the note.
+	for (int si = 0; si < stage_count && !out->stderr_text; si++)
+		out->stderr_text = aicli_stage_limit_note(stages[si]);
+	if (cache_key && out->exit_code == 0 && !out->stderr_text) {
+		const char *full = NULL;
+		size_t full_len = 0;
+		if (aicli_paging_sink_captured(&sink, &full, &full_len)) {
+			aicli_paging_cache_value_t v = {
+			    .data = (char *)full,
+			    .len = full_len,
+			    .total_bytes = full_len,
+			};
+			(void)aicli_paging_cache_put(cache, cache_key, &v);
+		}
+	}
 
-	aicli_buf_free(&tmp1);
-	aicli_buf_free(&tmp2);
-	free(file_buf);
+done:
+	for (int si = 0; si < stage_count; si++)
+		aicli_buf_free(&bufs[si]);
+	aicli_paging_sink_free(&sink);
+	aicli_line_reader_close(&reader);
+	free(cache_key);
 	return 0;
 }
@@ -0,0 +1,665 @@
+#include "execute/sort_engine.h"
+
+#include "threadpool.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Buffers below this many lines are sorted on the calling thread alone.
+#define SORT_PARALLEL_MIN_LINES 16384
+#define RUN_IO_BYTES (256 * 1024)
+
+// One line of the buffer being sorted. Offsets are 32-bit to keep records small, which
+// is why the buffer is limited to UINT32_MAX bytes.
+typedef struct {
+	uint64_t prefix;  // see line_make()
+	uint32_t off;     // line start in the buffer
+	uint32_t len;     // without '\n'
+	uint32_t key_off; // relative to the line
+	uint32_t key_len;
+} rec_t;
+
+// Every buffered line costs its record and the radix scratch slot for it.
+#define REC_COST (2 * sizeof(rec_t))
+
+// A line and its key, as compared.
+typedef struct {
+	const char *s;
+	size_t len;
+	const char *key;
+	size_t key_len;
+	uint64_t prefix;
+} line_t;
+
+// A sorted source for the merge: a slice of records or a run file.
+typedef struct {
+	const char *base; // slice: the buffer the records point into
+	const rec_t *rec;
+	const rec_t *rec_end;
+	int fd; // run: -1 for a slice
+	char *buf;
+	size_t pos, end, cap;
+	bool eof;
+	line_t head;
+} cursor_t;
+
+struct aicli_sort {
+	aicli_sort_opts_t opts;
+	size_t budget;
+	aicli_buf_t acc; // input since the last run, every line '\n'-terminated
+	size_t acc_lines;
+	int runs[AICLI_SORT_MERGE_MAX]; // sorted runs in input order
+	size_t run_count;
+
+	// Merge state, for spilling a run and for the final output.
+	bool emitting;
+	rec_t *recs;
+	cursor_t *cur;
+	size_t cur_count;
+	size_t *heap; // cursor indices, heap[0] holds the smallest head
+	size_t heap_len;
+	aicli_buf_t last; // -u: the line most recently written
+	line_t last_line;
+	bool have_last;
+};
+
+static bool is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Start of the 1-based field n.
+static size_t field_start(const aicli_sort_opts_t *o, const char *s, size_t len, unsigned n)
+{
+	size_t p = 0;
+	for (unsigned i = 1; i < n && p < len; i++) {
+		if (o->sep) {
+			const char *q = (const char *)memchr(s + p, o->sep, len - p);
+			p = q ? (size_t)(q - s) + 1 : len;
+		} else {
+			while (p < len && is_blank(s[p]))
+				p++;
+			while (p < len && !is_blank(s[p]))
+				p++;
+		}
+	}
+	return p;
+}
+
+static size_t field_end(const aicli_sort_opts_t *o, const char *s, size_t len, unsigned n)
+{
+	size_t p = field_start(o, s, len, n);
+	if (o->sep) {
+		const char *q = (const char *)memchr(s + p, o->sep, len - p);
+		return q ? (size_t)(q - s) : len;
+	}
+	while (p < len && is_blank(s[p]))
+		p++;
+	while (p < len && !is_blank(s[p]))
+		p++;
+	return p;
+}
+
+typedef struct {
+	bool neg;
+	const char *ip; // integer digits without leading zeros
+	size_t il;
+	const char *fp; // fraction digits without trailing zeros
+	size_t fl;
+} num_t;
+
+static num_t num_parse(const char *s, size_t len)
+{
+	num_t n = { false, s, 0, s, 0 };
+	size_t p = 0;
+	while (p < len && is_blank(s[p]))
+		p++;
+	if (p < len && s[p] == '-') {
+		n.neg = true;
+		p++;
+	}
+	while (p < len && s[p] == '0')
+		p++;
+	n.ip = s + p;
+	while (p < len && is_digit(s[p]))
+		p++;
+	n.il = (size_t)(s + p - n.ip);
+	if (p < len && s[p] == '.') {
+		p++;
+		n.fp = s + p;
+		while (p < len && is_digit(s[p]))
+			p++;
+		n.fl = (size_t)(s + p - n.fp);
+		while (n.fl > 0 && n.fp[n.fl - 1] == '0')
+			n.fl--;
+	}
+	if (n.il == 0 && n.fl == 0)
+		n.neg = false; // -0 and non-numbers are 0
+	return n;
+}
+
+static int num_cmp(const num_t *a, const num_t *b)
+{
+	if (a->neg != b->neg)
+		return a->neg ? -1 : 1;
+	int c = 0;
+	if (a->il != b->il)
+		c = a->il < b->il ? -1 : 1;
+	else if ((c = memcmp(a->ip, b->ip, a->il)) == 0)
+		c = memcmp(a->fp, b->fp, a->fl < b->fl ? a->fl : b->fl);
+	if (c == 0)
+		c = (a->fl > b->fl) - (a->fl < b->fl);
+	return a->neg ? -c : c;
+}
+
+// Order-preserving 62-bit image of a number's magnitude: its integer digit count, then
+// its first ten digits. Counts that do not fit are all mapped to the same value (with
+// no digits), so equal prefixes are the only ones that need a full comparison.
+static uint64_t num_prefix(const num_t *n)
+{
+	const uint64_t k_classes = (uint64_t)1 << 62;
+	if (n->il == 0 && n->fl == 0)
+		return k_classes;
+	uint64_t v = 0;
+	if (n->il >= 0xfffff) {
+		v = (uint64_t)0xfffff << 40;
+	} else {
+		v = (uint64_t)n->il << 40;
+		for (size_t k = 0; k < 10; k++) {
+			unsigned d = 0;
+			if (k < n->il)
+				d = (unsigned)(n->ip[k] - '0');
+			else if (k - n->il < n->fl)
+				d = (unsigned)(n->fp[k - n->il] - '0');
+			v |= (uint64_t)d << (4 * (9 - k));
+		}
+	}
+	return n->neg ? ~v & (k_classes - 1) : 2 * k_classes + v;
+}
+
+static line_t line_make(const aicli_sort_opts_t *o, const char *s, size_t len)
+{
+	line_t l = { s, len, s, len, 0 };
+	if (o->key_start) {
+		size_t from = field_start(o, s, len, o->key_start);
+		size_t to = o->key_end ? field_end(o, s, len, o->key_end) : len;
+		l.key = s + from;
+		l.key_len = to > from ? to - from : 0;
+	}
+	if (o->numeric) {
+		num_t n = num_parse(l.key, l.key_len);
+		l.prefix = num_prefix(&n);
+	} else {
+		// The first eight key bytes, big-endian and zero-padded.
+		for (size_t i = 0; i < 8; i++)
+			l.prefix = (l.prefix << 8) | (i < l.key_len ? (unsigned char)l.key[i] : 0);
+	}
+	// Sorted ascending either way, so -r stores the complement.
+	if (o->reverse)
+		l.prefix = ~l.prefix;
+	return l;
+}
+
+static int bytes_cmp(const char *a, size_t al, const char *b, size_t bl)
+{
+	int c = memcmp(a, b, al < bl ? al : bl);
+	if (c != 0)
+		return c;
+	return (al > bl) - (al < bl);
+}
+
+// Output order of two lines. With -u, lines with equal keys compare equal.
+static int line_cmp(const aicli_sort_opts_t *o, const line_t *a, const line_t *b)
+{
+	if (a->prefix != b->prefix)
+		return a->prefix < b->prefix ? -1 : 1;
+	int c = 0;
+	if (o->numeric) {
+		num_t x = num_parse(a->key, a->key_len);
+		num_t y = num_parse(b->key, b->key_len);
+		c = num_cmp(&x, &y);
+	} else {
+		c = bytes_cmp(a->key, a->key_len, b->key, b->key_len);
+	}
+	if (c == 0 && !o->unique && (o->numeric || o->key_start))
+		c = bytes_cmp(a->s, a->len, b->s, b->len);
+	return o->reverse ? -c : c;
+}
+
+static line_t rec_line(const char *base, const rec_t *r)
+{
+	line_t l = { base + r->off, r->len, base + r->off + r->key_off, r->key_len, r->prefix };
+	return l;
+}
+
+// qsort() has no context argument; each sorting thread sets its own.
+static _Thread_local struct {
+	const aicli_sort_opts_t *opts;
+	const char *base;
+} tls_cmp;
+
+static int rec_cmp(const void *pa, const void *pb)
+{
+	const rec_t *ra = (const rec_t *)pa;
+	const rec_t *rb = (const rec_t *)pb;
+	line_t a = rec_line(tls_cmp.base, ra);
+	line_t b = rec_line(tls_cmp.base, rb);
+	int c = line_cmp(tls_cmp.opts, &a, &b);
+	if (c != 0)
+		return c;
+	// Earlier input first, so -u keeps the first of equal lines.
+	return (ra->off > rb->off) - (ra->off < rb->off);
+}
+
+// Stable LSD radix sort on the prefix (bytes that are the same in every record are
+// skipped), then a comparison sort of each group of equal prefixes. Result in a.
+static void radix_sort(rec_t *a, rec_t *tmp, size_t n)
+{
+	size_t count[8][256];
+	memset(count, 0, sizeof(count));
+	for (size_t i = 0; i < n; i++)
+		for (int b = 0; b < 8; b++)
+			count[b][(a[i].prefix >> (8 * b)) & 0xff]++;
+
+	rec_t *src = a;
+	rec_t *dst = tmp;
+	for (int b = 0; b < 8 && n > 0; b++) {
+		if (count[b][(src[0].prefix >> (8 * b)) & 0xff] == n)
+			continue;
+		size_t pos = 0;
+		for (int v = 0; v < 256; v++) {
+			size_t c = count[b][v];
+			count[b][v] = pos;
+			pos += c;
+		}
+		for (size_t i = 0; i < n; i++)
+			dst[count[b][(src[i].prefix >> (8 * b)) & 0xff]++] = src[i];
+		rec_t *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != a)
+		memcpy(a, src, n * sizeof(*a));
+
+	for (size_t i = 0; i < n;) {
+		size_t j = i + 1;
+		while (j < n && a[j].prefix == a[i].prefix)
+			j++;
+		if (j - i > 1)
+			qsort(a + i, j - i, sizeof(*a), rec_cmp);
+		i = j;
+	}
+}
+
+typedef struct {
+	aicli_sort_t *s;
+	rec_t *scratch;
+	size_t n;
+	size_t slices;
+} sort_job_t;
+
+static void sort_slice(void *arg, size_t i)
+{
+	sort_job_t *job = (sort_job_t *)arg;
+	aicli_sort_t *s = job->s;
+	size_t lo = job->n * i / job->slices;
+	size_t hi = job->n * (i + 1) / job->slices;
+	for (size_t k = lo; k < hi; k++) {
+		rec_t *r = &s->recs[k];
+		line_t l = line_make(&s->opts, s->acc.data + r->off, r->len);
+		r->prefix = l.prefix;
+		r->key_off = (uint32_t)(l.key - l.s);
+		r->key_len = (uint32_t)l.key_len;
+	}
+	tls_cmp.opts = &s->opts;
+	tls_cmp.base = s->acc.data;
+	radix_sort(s->recs + lo, job->scratch + lo, hi - lo);
+}
+
+// Sorts the buffered lines into one slice per compute thread and makes each slice a
+// merge cursor, appended after the cursors already set up.
+static bool sort_buffer(aicli_sort_t *s)
+{
+	size_t n = s->acc_lines;
+	if (n == 0)
+		return true;
+	s->recs = (rec_t *)malloc(n * sizeof(rec_t));
+	rec_t *scratch = (rec_t *)malloc(n * sizeof(rec_t));
+	if (!s->recs || !scratch) {
+		free(scratch);
+		return false;
+	}
+	const char *data = s->acc.data;
+	size_t off = 0;
+	for (size_t i = 0; i < n; i++) {
+		const char *nl = (const char *)memchr(data + off, '\n', s->acc.len - off);
+		s->recs[i].off = (uint32_t)off;
+		s->recs[i].len = (uint32_t)(nl - (data + off));
+		off = (size_t)(nl - data) + 1;
+	}
+
+	aicli_threadpool_t *pool = n >= SORT_PARALLEL_MIN_LINES ? aicli_threadpool_compute() : NULL;
+	sort_job_t job = { s, scratch, n, aicli_threadpool_size(pool) + 1 };
+	aicli_threadpool_parallel_for(pool, job.slices, sort_slice, &job);
+	free(scratch);
+
+	for (size_t i = 0; i < job.slices; i++) {
+		cursor_t *c = &s->cur[s->cur_count++];
+		memset(c, 0, sizeof(*c));
+		c->fd = -1;
+		c->base = data;
+		c->rec = s->recs + n * i / job.slices;
+		c->rec_end = s->recs + n * (i + 1) / job.slices;
+	}
+	return true;
+}
+
+static bool write_all(int fd, const char *p, size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		p += w;
+		n -= (size_t)w;
+	}
+	return true;
+}
+
+// An unlinked temp file; it goes away with its descriptor.
+static int run_create(void)
+{
+	const char *dir = getenv("TMPDIR");
+	if (!dir || !dir[0])
+		dir = "/tmp";
+	char path[4096];
+	int n = snprintf(path, sizeof(path), "%s/aicli-sort-XXXXXX", dir);
+	if (n < 0 || (size_t)n >= sizeof(path))
+		return -1;
+	int fd = mkstemp(path); // 0600
+	if (fd >= 0)
+		unlink(path);
+	return fd;
+}
+
+// Next line of a run (every line of a run ends with '\n'). 1: *l is set, 0: end of
+// the run, -1: read failure. *l stays valid until the next call.
+static int run_read_line(const aicli_sort_opts_t *o, cursor_t *c, line_t *l)
+{
+	for (;;) {
+		const char *p = c->buf + c->pos;
+		const char *nl = (const char *)memchr(p, '\n', c->end - c->pos);
+		if (nl) {
+			*l = line_make(o, p, (size_t)(nl - p));
+			c->pos = (size_t)(nl - c->buf) + 1;
+			return 1;
+		}
+		if (c->eof)
+			return 0;
+		size_t rest = c->end - c->pos;
+		memmove(c->buf, p, rest);
+		c->pos = 0;
+		c->end = rest;
+		if (c->end == c->cap) {
+			size_t cap = c->cap ? c->cap * 2 : RUN_IO_BYTES;
+			char *b = (char *)realloc(c->buf, cap);
+			if (!b)
+				return -1;
+			c->buf = b;
+			c->cap = cap;
+		}
+		ssize_t r = read(c->fd, c->buf + c->end, c->cap - c->end);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		if (r == 0)
+			c->eof = true;
+		c->end += (size_t)r;
+	}
+}
+
+// Loads the cursor's next line into head. 1: loaded, 0: exhausted, -1: failure.
+static int cursor_next(const aicli_sort_opts_t *o, cursor_t *c)
+{
+	if (c->fd < 0) {
+		if (c->rec == c->rec_end)
+			return 0;
+		c->head = rec_line(c->base, c->rec++);
+		return 1;
+	}
+	return run_read_line(o, c, &c->head);
+}
+
+// Heads that compare equal come out in cursor order, which is input order.
+static bool heap_less(const aicli_sort_t *s, size_t a, size_t b)
+{
+	int c = line_cmp(&s->opts, &s->cur[a].head, &s->cur[b].head);
+	return c < 0 || (c == 0 && a < b);
+}
+
+static void heap_down(aicli_sort_t *s, size_t i)
+{
+	for (;;) {
+		size_t m = i;
+		size_t l = 2 * i + 1;
+		if (l < s->heap_len && heap_less(s, s->heap[l], s->heap[m]))
+			m = l;
+		if (l + 1 < s->heap_len && heap_less(s, s->heap[l + 1], s->heap[m]))
+			m = l + 1;
+		if (m == i)
+			return;
+		size_t t = s->heap[i];
+		s->heap[i] = s->heap[m];
+		s->heap[m] = t;
+		i = m;
+	}
+}
+
+static void merge_end(aicli_sort_t *s)
+{
+	for (size_t i = 0; i < s->cur_count; i++)
+		free(s->cur[i].buf);
+	free(s->cur);
+	free(s->heap);
+	free(s->recs);
+	s->cur = NULL;
+	s->heap = NULL;
+	s->recs = NULL;
+	s->cur_count = 0;
+	s->heap_len = 0;
+}
+
+// Sets up a merge of runs[0, nruns) followed by the sorted buffer, if with_buffer.
+static bool merge_begin(aicli_sort_t *s, size_t nruns, bool with_buffer)
+{
+	size_t max = nruns + (with_buffer ? AICLI_THREADPOOL_COMPUTE_MAX + 1 : 0);
+	s->cur = (cursor_t *)calloc(max, sizeof(cursor_t));
+	s->heap = (size_t *)calloc(max, sizeof(size_t));
+	if (!s->cur || !s->heap)
+		return false;
+	for (size_t i = 0; i < nruns; i++) {
+		cursor_t *c = &s->cur[s->cur_count++];
+		c->fd = s->runs[i];
+		if (lseek(c->fd, 0, SEEK_SET) != 0)
+			return false;
+	}
+	if (with_buffer && !sort_buffer(s))
+		return false;
+	for (size_t i = 0; i < s->cur_count; i++) {
+		int r = cursor_next(&s->opts, &s->cur[i]);
+		if (r < 0)
+			return false;
+		if (r > 0)
+			s->heap[s->heap_len++] = i;
+	}
+	for (size_t i = s->heap_len / 2; i-- > 0;)
+		heap_down(s, i);
+	s->have_last = false;
+	return true;
+}
+
+// Appends merged lines to out until it holds at least `until` bytes or the merge is
+// complete (*done).
+static bool merge_step(aicli_sort_t *s, aicli_buf_t *out, size_t until, bool *done)
+{
+	while (s->heap_len > 0 && out->len < until) {
+		cursor_t *c = &s->cur[s->heap[0]];
+		const line_t *l = &c->head;
+		bool dup = s->opts.unique && s->have_last && line_cmp(&s->opts, l, &s->last_line) == 0;
+		if (!dup) {
+			if (!aicli_buf_append(out, l->s, l->len) || !aicli_buf_append(out, "\n", 1))
+				return false;
+			if (s->opts.unique) {
+				// The line may be gone once its cursor moves on. Copied with the '\n'
+				// that follows it in either source, so even an empty line has data.
+				s->last.len = 0;
+				if (!aicli_buf_append(&s->last, l->s, l->len + 1))
+					return false;
+				s->last_line = *l;
+				s->last_line.s = s->last.data;
+				s->last_line.key = s->last.data + (l->key - l->s);
+				s->have_last = true;
+			}
+		}
+		int r = cursor_next(&s->opts, c);
+		if (r < 0)
+			return false;
+		if (r == 0)
+			s->heap[0] = s->heap[--s->heap_len];
+		heap_down(s, 0);
+	}
+	*done = s->heap_len == 0;
+	return true;
+}
+
+// Merges runs[0, nruns) and, if with_buffer, the buffered input into a new run.
+static int merge_to_run(aicli_sort_t *s, size_t nruns, bool with_buffer)
+{
+	int fd = run_create();
+	aicli_buf_t tmp = { 0 };
+	bool ok = fd >= 0 && merge_begin(s, nruns, with_buffer);
+	for (bool done = false; ok && !done;) {
+		tmp.len = 0;
+		ok = merge_step(s, &tmp, RUN_IO_BYTES, &done) && write_all(fd, tmp.data, tmp.len);
+	}
+	merge_end(s);
+	aicli_buf_free(&tmp);
+	if (!ok && fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Writes the buffer out as a sorted run, first collapsing the runs so far into one
+// if there are AICLI_SORT_MERGE_MAX of them.
+static bool spill(aicli_sort_t *s)
+{
+	if (s->run_count == AICLI_SORT_MERGE_MAX) {
+		int fd = merge_to_run(s, s->run_count, false);
+		if (fd < 0)
+			return false;
+		for (size_t i = 0; i < s->run_count; i++)
+			close(s->runs[i]);
+		s->runs[0] = fd;
+		s->run_count = 1;
+	}
+	int fd = merge_to_run(s, 0, true);
+	if (fd < 0)
+		return false;
+	s->runs[s->run_count++] = fd;
+	s->acc.len = 0;
+	s->acc_lines = 0;
+	return true;
+}
+
+aicli_sort_t *aicli_sort_new(const aicli_sort_opts_t *opts, size_t memory)
+{
+	aicli_sort_t *s = (aicli_sort_t *)calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	if (opts)
+		s->opts = *opts;
+	if (memory < AICLI_SORT_MIN_MEMORY)
+		memory = AICLI_SORT_MIN_MEMORY;
+	s->budget = memory < UINT32_MAX ? memory : UINT32_MAX;
+	return s;
+}
+
+bool aicli_sort_add(aicli_sort_t *s, const char *in, size_t in_len)
+{
+	if (!s)
+		return false;
+	if (in_len == 0)
+		return true;
+	if (s->emitting)
+		return false;
+	size_t lines = 0;
+	for (const char *p = in, *end = in + in_len;
+	     (p = (const char *)memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+		lines++;
+	bool partial = in[in_len - 1] != '\n';
+	if (partial)
+		lines++;
+
+	size_t used = s->acc.len + s->acc_lines * REC_COST;
+	if (s->acc.len > 0 && used + in_len + 1 + lines * REC_COST > s->budget && !spill(s))
+		return false;
+	if (s->acc.len + in_len + 1 > UINT32_MAX)
+		return false;
+	if (!aicli_buf_append(&s->acc, in, in_len) || (partial && !aicli_buf_append(&s->acc, "\n", 1)))
+		return false;
+	s->acc_lines += lines;
+	return true;
+}
+
+bool aicli_sort_emit(aicli_sort_t *s, aicli_buf_t *out, bool *done)
+{
+	if (!s || !out || !done)
+		return false;
+	if (!s->emitting) {
+		s->emitting = true;
+		if (!merge_begin(s, s->run_count, true))
+			return false;
+	}
+	if (!merge_step(s, out, out->len + AICLI_SORT_EMIT_BYTES, done))
+		return false;
+	if (*done)
+		aicli_sort_reset(s);
+	return true;
+}
+
+void aicli_sort_reset(aicli_sort_t *s)
+{
+	if (!s)
+		return;
+	merge_end(s);
+	for (size_t i = 0; i < s->run_count; i++)
+		close(s->runs[i]);
+	s->run_count = 0;
+	aicli_buf_free(&s->acc);
+	s->acc_lines = 0;
+	aicli_buf_free(&s->last);
+	s->have_last = false;
+	s->emitting = false;
+}
+
+void aicli_sort_free(aicli_sort_t *s)
+{
+	if (!s)
+		return;
+	aicli_sort_reset(s);
+	free(s);
+}
@@ -214,3 +214,19 @@ aicli_dsl_status_t aicli_dsl_parse_pipeline(const char *command, aicli_dsl_pipel
 		return AICLI_DSL_ERR_EMPTY;
 	return AICLI_DSL_OK;
 }
+
+void aicli_dsl_pipeline_free(aicli_dsl_pipeline_t *p)
+{
+	if (!p)
+		return;
+	// A failed parse can leave arguments in the stage after the last counted one, so
+	// every slot is visited.
+	for (int si = 0; si < 8; si++) {
+		for (int ai = 0; ai < 8; ai++) {
+			free((void *)p->stages[si].argv[ai]);
+			p->stages[si].argv[ai] = NULL;
+		}
+		p->stages[si].argc = 0;
+	}
+	p->stage_count = 0;
+}
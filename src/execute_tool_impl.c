@@ -7,19 +7,17 @@
 #include <stdlib.h>
 #include <string.h>
 
-int aicli_execute_run(const aicli_allowlist_t *allow, const aicli_execute_request_t *req,
-                      aicli_tool_result_t *out)
+int aicli_execute_run(const aicli_allowlist_t *allow, aicli_paging_cache_t *cache,
+                      const aicli_execute_request_t *req, aicli_tool_result_t *out)
 {
 	if (!req || !out)
 		return -1;
 	memset(out, 0, sizeof(*out));
 
-	size_t size = req->size ? req->size : AICLI_MAX_TOOL_BYTES;
-	if (size > AICLI_MAX_TOOL_BYTES)
-		size = AICLI_MAX_TOOL_BYTES;
-
-	aicli_dsl_pipeline_t pipe;
-	aicli_dsl_status_t st = aicli_dsl_parse_pipeline(req->command, &pipe);
+	// Repeated commands (typically the same pipeline with another `start`) reuse the
+	// parsed and compiled pipeline of an earlier call.
+	aicli_compiled_pipeline_t *cp = NULL;
+	aicli_dsl_status_t st = aicli_pipeline_cache_acquire(req->command, &cp);
 	if (st != AICLI_DSL_OK) {
 		// Keep debug output opt-in via CLI --debug-function-call.
 		const char *dbg = getenv("AICLI_DEBUG_FUNCTION_CALL");
@@ -32,5 +30,7 @@ int aicli_execute_run(const aicli_allowlist_t *allow, const aicli_execute_reques
 		return 0;
 	}
 
-	return aicli_execute_run_pipeline_from_file(allow, &pipe, req, out);
+	int rc = aicli_execute_run_pipeline_from_file(allow, cache, cp, req, out);
+	aicli_pipeline_cache_release(cp);
+	return rc;
 }
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "http_client.h"
+
 typedef struct {
 	char *buf;
 	size_t len;
@@ -88,7 +90,7 @@ int aicli_google_cse_search(const char *api_key,
 	if (num > 10)
 		num = 10;
 
-	CURL *curl = curl_easy_init();
+	CURL *curl = aicli_http_easy_acquire();
 	if (!curl) {
 		set_err(out->error, "curl_easy_init failed");
 		return 3;
@@ -108,7 +110,6 @@ int aicli_google_cse_search(const char *api_key,
 		curl_free(k);
 		curl_free(cx);
 		curl_free(lr_esc);
-		curl_easy_cleanup(curl);
 		return 3;
 	}
 
@@ -129,14 +130,13 @@ int aicli_google_cse_search(const char *api_key,
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &mem);
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "aicli/1.0");
 
-	CURLcode rc = curl_easy_perform(curl);
+	CURLcode rc = aicli_http_perform(curl);
 	if (rc != CURLE_OK) {
 		set_err(out->error, "curl_easy_perform: %s", curl_easy_strerror(rc));
 		curl_free(q);
 		curl_free(k);
 		curl_free(cx);
 		curl_free(lr_esc);
-		curl_easy_cleanup(curl);
 		free(mem.buf);
 		return 4;
 	}
@@ -151,6 +151,5 @@ int aicli_google_cse_search(const char *api_key,
 	curl_free(k);
 	curl_free(cx);
 	curl_free(lr_esc);
-	curl_easy_cleanup(curl);
 	return 0;
 }
@@ -0,0 +1,146 @@
+#include "http_client.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cancel.h"
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static bool g_ready = false;
+static CURLSH *g_share = NULL;
+static pthread_key_t g_easy_key;
+static pthread_mutex_t g_share_locks[CURL_LOCK_DATA_LAST];
+
+// Set while the thread's handle is inside curl_easy_perform().
+static _Thread_local bool tls_busy;
+
+static atomic_ulong g_requests;
+static atomic_ulong g_connections_opened;
+static atomic_ulong g_connections_reused;
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	(void)handle;
+	(void)access;
+	(void)userptr;
+	if ((int)data >= 0 && data < CURL_LOCK_DATA_LAST)
+		pthread_mutex_lock(&g_share_locks[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	(void)handle;
+	(void)userptr;
+	if ((int)data >= 0 && data < CURL_LOCK_DATA_LAST)
+		pthread_mutex_unlock(&g_share_locks[data]);
+}
+
+static void easy_key_destroy(void *p)
+{
+	if (p)
+		curl_easy_cleanup((CURL *)p);
+}
+
+static void http_global_init(void)
+{
+	if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+		return;
+	if (pthread_key_create(&g_easy_key, easy_key_destroy) != 0)
+		return;
+	for (size_t i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&g_share_locks[i], NULL);
+
+	g_share = curl_share_init();
+	if (g_share) {
+		curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+		curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+		curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
+	g_ready = true;
+}
+
+CURL *aicli_http_easy_acquire(void)
+{
+	pthread_once(&g_once, http_global_init);
+	if (!g_ready || tls_busy)
+		return NULL;
+
+	CURL *curl = (CURL *)pthread_getspecific(g_easy_key);
+	if (curl) {
+		// Drops per-request options but keeps the live connections and caches.
+		curl_easy_reset(curl);
+	} else {
+		curl = curl_easy_init();
+		if (!curl)
+			return NULL;
+		if (pthread_setspecific(g_easy_key, curl) != 0) {
+			curl_easy_cleanup(curl);
+			return NULL;
+		}
+	}
+	if (g_share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	return curl;
+}
+
+static int cancel_xferinfo(void *userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                           curl_off_t ulnow)
+{
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+	return aicli_cancel_requested((const aicli_cancel_t *)userp) ? 1 : 0;
+}
+
+CURLcode aicli_http_perform(CURL *curl)
+{
+	// Inside a pool job with a token: let a cancel or the job's deadline abort the
+	// transfer (CURLE_ABORTED_BY_CALLBACK) instead of running into the curl timeout.
+	const aicli_cancel_t *cancel = aicli_cancel_current();
+	if (cancel) {
+		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_xferinfo);
+		curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)cancel);
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	}
+	tls_busy = true;
+	CURLcode cc = curl_easy_perform(curl);
+	tls_busy = false;
+	atomic_fetch_add(&g_requests, 1);
+	long opened = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &opened) == CURLE_OK) {
+		if (opened > 0)
+			atomic_fetch_add(&g_connections_opened, (unsigned long)opened);
+		else if (cc == CURLE_OK)
+			atomic_fetch_add(&g_connections_reused, 1);
+	}
+	return cc;
+}
+
+void aicli_http_stats_get(aicli_http_stats_t *out)
+{
+	if (!out)
+		return;
+	out->requests = atomic_load(&g_requests);
+	out->connections_opened = atomic_load(&g_connections_opened);
+	out->connections_reused = atomic_load(&g_connections_reused);
+}
+
+void aicli_http_global_cleanup(void)
+{
+	if (!g_ready)
+		return;
+	CURL *curl = (CURL *)pthread_getspecific(g_easy_key);
+	if (curl) {
+		pthread_setspecific(g_easy_key, NULL);
+		curl_easy_cleanup(curl);
+	}
+	if (g_share) {
+		if (curl_share_cleanup(g_share) == CURLSHE_OK)
+			g_share = NULL;
+	}
+}
@@ -0,0 +1,173 @@
+#include "json_writer.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Length of the valid UTF-8 sequence at s[0, n) starting with a byte >= 0x80, or 0.
+static size_t utf8_seq_len(const unsigned char *s, size_t n)
+{
+	unsigned char c = s[0];
+	size_t len;
+	unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+	if (c >= 0xC2 && c <= 0xDF) {
+		len = 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		len = 3;
+		if (c == 0xE0)
+			lo = 0xA0; // overlong
+		else if (c == 0xED)
+			hi = 0x9F; // surrogates
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		len = 4;
+		if (c == 0xF0)
+			lo = 0x90; // overlong
+		else if (c == 0xF4)
+			hi = 0x8F; // past U+10FFFF
+	} else {
+		return 0;
+	}
+	if (n < len || s[1] < lo || s[1] > hi)
+		return 0;
+	for (size_t i = 2; i < len; i++) {
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+	}
+	return len;
+}
+
+// Number of leading bytes of s[0, n) that are ASCII and need no escaping. With SSE2
+// 16 bytes are classified per step: a signed compare against 0x20 catches control
+// characters and bytes >= 0x80 (negative) at once.
+static size_t plain_ascii_len(const unsigned char *s, size_t n)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i stop = _mm_or_si128(_mm_cmplt_epi8(v, space),
+		                            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+		int mask = _mm_movemask_epi8(stop);
+		if (mask != 0)
+			return i + (size_t)__builtin_ctz((unsigned)mask);
+	}
+#endif
+	while (i < n && s[i] >= 0x20 && s[i] < 0x80 && s[i] != '"' && s[i] != '\\')
+		i++;
+	return i;
+}
+
+// The escape of ASCII byte c (a control character, '"' or '\\'), escaped `depth` times.
+static size_t escape_ascii(char *out, unsigned char c, int depth)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char a[32], b[32];
+	size_t n = 2;
+	a[0] = '\\';
+	switch (c) {
+	case '"':
+	case '\\':
+		a[1] = (char)c;
+		break;
+	case '\b':
+		a[1] = 'b';
+		break;
+	case '\f':
+		a[1] = 'f';
+		break;
+	case '\n':
+		a[1] = 'n';
+		break;
+	case '\r':
+		a[1] = 'r';
+		break;
+	case '\t':
+		a[1] = 't';
+		break;
+	default:
+		memcpy(a + 1, "u00", 3);
+		a[4] = hex[c >> 4];
+		a[5] = hex[c & 0xF];
+		n = 6;
+		break;
+	}
+	// Each further level escapes the backslashes and quotes of the previous one.
+	for (int d = 1; d < depth; d++) {
+		size_t m = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (a[i] == '\\' || a[i] == '"')
+				b[m++] = '\\';
+			b[m++] = a[i];
+		}
+		memcpy(a, b, m);
+		n = m;
+	}
+	memcpy(out, a, n);
+	return n;
+}
+
+// Escapes s[0, n) `depth` times. Runs that need no escaping (ASCII and valid UTF-8) are
+// copied in one piece. Invalid UTF-8 fails when `strict`, else becomes U+FFFD.
+static bool append_escaped(aicli_buf_t *b, const unsigned char *s, size_t n, int depth,
+                           bool strict)
+{
+	if (depth < 1 || depth > 3)
+		return false;
+	size_t run = 0; // s[run, i) not copied yet
+	size_t i = 0;
+	while (i < n) {
+		i += plain_ascii_len(s + i, n - i);
+		if (i == n)
+			break;
+		if (s[i] >= 0x80) {
+			size_t len = utf8_seq_len(s + i, n - i);
+			if (len > 0) {
+				i += len;
+				continue;
+			}
+			if (strict)
+				return false;
+		}
+		if (i > run && !aicli_buf_append(b, s + run, i - run))
+			return false;
+		char esc[32];
+		size_t esc_len = 3;
+		if (s[i] >= 0x80)
+			memcpy(esc, "\xEF\xBF\xBD", 3);
+		else
+			esc_len = escape_ascii(esc, s[i], depth);
+		if (!aicli_buf_append(b, esc, esc_len))
+			return false;
+		run = ++i;
+	}
+	return i == run || aicli_buf_append(b, s + run, i - run);
+}
+
+bool aicli_json_append_str(aicli_buf_t *b, const char *s, size_t n)
+{
+	return aicli_buf_append(b, "\"", 1) &&
+	       append_escaped(b, (const unsigned char *)s, n, 1, true) && aicli_buf_append(b, "\"", 1);
+}
+
+bool aicli_json_append_escaped(aicli_buf_t *b, const char *s, size_t n, int depth)
+{
+	return append_escaped(b, (const unsigned char *)s, n, depth, false);
+}
+
+bool aicli_json_append_cstr(aicli_buf_t *b, const char *s)
+{
+	return aicli_json_append_str(b, s ? s : "", s ? strlen(s) : 0);
+}
+
+bool aicli_json_append_member_str(aicli_buf_t *b, bool first, const char *key, const char *value)
+{
+	if (!first && !aicli_buf_append(b, ",", 1))
+		return false;
+	return aicli_json_append_cstr(b, key) && aicli_buf_append(b, ":", 1) &&
+	       aicli_json_append_cstr(b, value);
+}
@@ -2,8 +2,11 @@
 #include <string.h>
 
 #include "cli.h"
+#include "http_client.h"
 
 int main(int argc, char **argv)
 {
-	return aicli_cli_main(argc, argv);
+	int rc = aicli_cli_main(argc, argv);
+	aicli_http_global_cleanup();
+	return rc;
 }
@@ -12,6 +12,9 @@
 
 #include <yyjson.h>
 
+#include "http_client.h"
+#include "json_writer.h"
+
 typedef struct {
 	char *data;
 	size_t len;
@@ -199,104 +202,225 @@ static char *join_url_path(const char *base_url, const char *path)
 	return out;
 }
 
+// Written in one pass; tools_json is spliced in as it is (see json_writer.h).
+static bool append_input_message(aicli_buf_t *b, const char *role, const char *text)
+{
+	// {role:"...",content:[{type:"input_text",text:"..."}]}
+	return aicli_buf_append_str(b, "{") && aicli_json_append_member_str(b, true, "role", role) &&
+	       aicli_buf_append_str(b, ",\"content\":[{") &&
+	       aicli_json_append_member_str(b, true, "type", "input_text") &&
+	       aicli_json_append_member_str(b, false, "text", text) && aicli_buf_append_str(b, "}]}");
+}
+
 static char *build_request_json(const aicli_openai_request_t *req,
 			      const char *tools_json, const char *tool_choice)
 {
 	if (!req || !req->model || !req->model[0] || !req->input_text)
 		return NULL;
 
-	yyjson_mut_doc *doc = yyjson_mut_doc_new(NULL);
-	yyjson_mut_val *root = yyjson_mut_obj(doc);
-	yyjson_mut_doc_set_root(doc, root);
+	size_t need = 256 + strlen(req->model) + strlen(req->input_text) +
+	              (req->system_text ? strlen(req->system_text) : 0) +
+	              (tools_json ? strlen(tools_json) : 0);
+	aicli_buf_t b;
+	if (!aicli_buf_init(&b, need))
+		return NULL;
 
-	yyjson_mut_obj_add_str(doc, root, "model", req->model);
+	bool ok = aicli_buf_append_str(&b, "{");
+	ok = ok && aicli_json_append_member_str(&b, true, "model", req->model);
 
 	// input: [{role:"system",content:[{type:"input_text",text:"..."}]}, {role:"user",...}]
-	yyjson_mut_val *input = yyjson_mut_arr(doc);
-	yyjson_mut_obj_add_val(doc, root, "input", input);
-
+	ok = ok && aicli_buf_append_str(&b, ",\"input\":[");
 	if (req->system_text && req->system_text[0]) {
-		yyjson_mut_val *m = yyjson_mut_obj(doc);
-		yyjson_mut_arr_add_val(input, m);
-		yyjson_mut_obj_add_str(doc, m, "role", "system");
-		yyjson_mut_val *content = yyjson_mut_arr(doc);
-		yyjson_mut_obj_add_val(doc, m, "content", content);
-		yyjson_mut_val *c0 = yyjson_mut_obj(doc);
-		yyjson_mut_arr_add_val(content, c0);
-		yyjson_mut_obj_add_str(doc, c0, "type", "input_text");
-		yyjson_mut_obj_add_str(doc, c0, "text", req->system_text);
-	}
-
-	{
-		yyjson_mut_val *m = yyjson_mut_obj(doc);
-		yyjson_mut_arr_add_val(input, m);
-		yyjson_mut_obj_add_str(doc, m, "role", "user");
-		yyjson_mut_val *content = yyjson_mut_arr(doc);
-		yyjson_mut_obj_add_val(doc, m, "content", content);
-		yyjson_mut_val *c0 = yyjson_mut_obj(doc);
-		yyjson_mut_arr_add_val(content, c0);
-		yyjson_mut_obj_add_str(doc, c0, "type", "input_text");
-		yyjson_mut_obj_add_str(doc, c0, "text", req->input_text);
+		ok = ok && append_input_message(&b, "system", req->system_text);
+		ok = ok && aicli_buf_append_str(&b, ",");
 	}
+	ok = ok && append_input_message(&b, "user", req->input_text);
+	ok = ok && aicli_buf_append_str(&b, "]");
 
 	if (tools_json && tools_json[0]) {
-		yyjson_doc *tools_doc = yyjson_read(tools_json, strlen(tools_json), 0);
-		if (tools_doc) {
-			yyjson_val *tools_root = yyjson_doc_get_root(tools_doc);
-			yyjson_mut_val *tools_mut = yyjson_val_mut_copy(doc, tools_root);
-			if (tools_mut)
-				yyjson_mut_obj_add_val(doc, root, "tools", tools_mut);
-			yyjson_doc_free(tools_doc);
-		}
+		ok = ok && aicli_buf_append_str(&b, ",\"tools\":");
+		ok = ok && aicli_buf_append_str(&b, tools_json);
 	}
 
 	if (tool_choice && tool_choice[0])
-		yyjson_mut_obj_add_str(doc, root, "tool_choice", tool_choice);
+		ok = ok && aicli_json_append_member_str(&b, false, "tool_choice", tool_choice);
 
-	char *json = yyjson_mut_write(doc, 0, NULL);
-	yyjson_mut_doc_free(doc);
-	return json;
+	ok = ok && aicli_buf_append(&b, "}", 2); // with the NUL
+	if (!ok) {
+		aicli_buf_free(&b);
+		return NULL;
+	}
+	return b.data;
 }
 
-int aicli_openai_responses_post(const char *api_key, const char *base_url,
-			      const aicli_openai_request_t *req,
-			      const char *tools_json, const char *tool_choice,
-			      aicli_openai_http_response_t *out)
+// Server-sent events (stream=true) decoding.
+// Events are delivered to the caller as soon as their blank-line terminator arrives.
+typedef struct {
+	aicli_openai_stream_event_fn on_event;
+	void *user;
+	CURL *curl;
+	long status;       // 0 until the first body byte arrives
+	mem_buf_t line;    // pending, not yet newline-terminated line
+	mem_buf_t data;    // data: lines of the current event
+	char event[128];   // event: name of the current event
+	mem_buf_t raw;     // body of a non-200 response (not SSE)
+	char *final_body;  // response object of response.completed/incomplete/failed
+	size_t final_len;
+} sse_stream_t;
+
+static int is_terminal_event(const char *type)
 {
-	if (!out)
-		return 2;
-	memset(out, 0, sizeof(*out));
-	out->retry_after_seconds = -1;
+	return type && (strcmp(type, "response.completed") == 0 ||
+			strcmp(type, "response.incomplete") == 0 ||
+			strcmp(type, "response.failed") == 0);
+}
 
-	if (!api_key || !api_key[0]) {
-		set_err(out->error, "OPENAI_API_KEY is not set");
-		return 2;
+static void sse_capture_final_response(sse_stream_t *st, const char *type)
+{
+	yyjson_doc *doc = yyjson_read(st->data.data, st->data.len, 0);
+	if (!doc)
+		return;
+	yyjson_val *root = yyjson_doc_get_root(doc);
+	if (!type || !type[0]) {
+		yyjson_val *t = yyjson_obj_get(root, "type");
+		type = (t && yyjson_is_str(t)) ? yyjson_get_str(t) : NULL;
 	}
-	if (!base_url || !base_url[0])
-		base_url = "https://api.openai.com/v1";
+	if (is_terminal_event(type)) {
+		yyjson_val *resp = yyjson_obj_get(root, "response");
+		if (resp && yyjson_is_obj(resp)) {
+			size_t len = 0;
+			char *json = yyjson_val_write(resp, 0, &len);
+			if (json) {
+				free(st->final_body);
+				st->final_body = json;
+				st->final_len = len;
+			}
+		}
+	}
+	yyjson_doc_free(doc);
+}
 
-	char *url = join_url_path(base_url, "/responses");
-	if (!url) {
-		set_err(out->error, "failed to build url");
-		return 2;
+static void sse_dispatch_event(sse_stream_t *st)
+{
+	if (st->data.len > 0) {
+		st->data.data[st->data.len] = '\0';
+		// Only terminal events carry the full response; skip parsing everything else.
+		if (!st->event[0] || is_terminal_event(st->event))
+			sse_capture_final_response(st, st->event);
+		if (st->on_event)
+			st->on_event(st->event, st->data.data, st->data.len, st->user);
 	}
+	st->data.len = 0;
+	st->event[0] = '\0';
+}
 
-	char *payload = build_request_json(req, tools_json, tool_choice);
-	if (!payload) {
-		free(url);
-		set_err(out->error, "failed to build request json");
-		return 2;
+static int sse_process_line(sse_stream_t *st, const char *line, size_t len)
+{
+	if (len > 0 && line[len - 1] == '\r')
+		len--;
+	if (len == 0) {
+		sse_dispatch_event(st);
+		return 1;
+	}
+	if (line[0] == ':')
+		return 1; // comment / keep-alive
+
+	const char *colon = memchr(line, ':', len);
+	size_t name_len = colon ? (size_t)(colon - line) : len;
+	const char *value = colon ? colon + 1 : line + len;
+	size_t value_len = (size_t)(line + len - value);
+	if (value_len > 0 && value[0] == ' ') {
+		value++;
+		value_len--;
 	}
 
-	int rc = 0;
+	if (name_len == 4 && memcmp(line, "data", 4) == 0) {
+		if (st->data.len > 0 && !mem_buf_reserve(&st->data, st->data.len + 2))
+			return 0;
+		if (st->data.len > 0)
+			st->data.data[st->data.len++] = '\n';
+		if (!mem_buf_reserve(&st->data, st->data.len + value_len + 1))
+			return 0;
+		memcpy(st->data.data + st->data.len, value, value_len);
+		st->data.len += value_len;
+		return 1;
+	}
+	if (name_len == 5 && memcmp(line, "event", 5) == 0) {
+		if (value_len >= sizeof(st->event))
+			value_len = sizeof(st->event) - 1;
+		memcpy(st->event, value, value_len);
+		st->event[value_len] = '\0';
+	}
+	return 1;
+}
 
-	// Retry strategy:
-	// - 429: honor Retry-After if present, else backoff
-	// - 503: backoff a few times
-	// Other HTTP statuses are returned to caller without retry.
+static size_t sse_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	sse_stream_t *st = (sse_stream_t *)userdata;
+	size_t n = size * nmemb;
+	if (n == 0)
+		return 0;
+	if (st->status == 0)
+		(void)curl_easy_getinfo(st->curl, CURLINFO_RESPONSE_CODE, &st->status);
+	if (st->status != 200)
+		return write_cb(ptr, size, nmemb, &st->raw);
+
+	const char *p = ptr;
+	size_t left = n;
+	while (left > 0) {
+		const char *nl = memchr(p, '\n', left);
+		if (!nl) {
+			if (!mem_buf_reserve(&st->line, st->line.len + left + 1))
+				return 0;
+			memcpy(st->line.data + st->line.len, p, left);
+			st->line.len += left;
+			break;
+		}
+		size_t seg = (size_t)(nl - p);
+		int ok;
+		if (st->line.len > 0) {
+			if (!mem_buf_reserve(&st->line, st->line.len + seg + 1))
+				return 0;
+			memcpy(st->line.data + st->line.len, p, seg);
+			st->line.len += seg;
+			ok = sse_process_line(st, st->line.data, st->line.len);
+			st->line.len = 0;
+		} else {
+			ok = sse_process_line(st, p, seg);
+		}
+		if (!ok)
+			return 0;
+		p = nl + 1;
+		left -= seg + 1;
+	}
+	return n;
+}
+
+static void sse_stream_reset(sse_stream_t *st)
+{
+	mem_buf_free(&st->line);
+	mem_buf_free(&st->data);
+	mem_buf_free(&st->raw);
+	free(st->final_body);
+	st->final_body = NULL;
+	st->final_len = 0;
+	st->status = 0;
+	st->event[0] = '\0';
+}
+
+// Shared retry loop for POST /responses.
+// Retry strategy:
+// - 429: honor Retry-After if present, else backoff
+// - 503: backoff a few times
+// Other HTTP statuses are returned to caller without retry.
+// When `st` is non-NULL the response is decoded as a server-sent event stream.
+static int post_json_with_retry(const char *api_key, const char *url, const char *payload,
+				sse_stream_t *st, aicli_openai_http_response_t *out)
+{
+	int rc = 0;
 	const unsigned max_attempts = 4; // total attempts including first
 	for (unsigned attempt = 0; attempt < max_attempts; attempt++) {
-		CURL *curl = curl_easy_init();
+		CURL *curl = aicli_http_easy_acquire();
 		if (!curl) {
 			set_err(out->error, "curl_easy_init failed");
 			rc = 2;
@@ -311,30 +435,43 @@ int aicli_openai_responses_post(const char *api_key, const char *base_url,
 		snprintf(auth, sizeof(auth), "Authorization: Bearer %s", api_key);
 		headers = curl_slist_append(headers, auth);
 		headers = curl_slist_append(headers, "Content-Type: application/json");
-		headers = curl_slist_append(headers, "Accept: application/json");
+		headers = curl_slist_append(headers, st ? "Accept: text/event-stream"
+						       : "Accept: application/json");
 
 		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 		curl_easy_setopt(curl, CURLOPT_URL, url);
 		curl_easy_setopt(curl, CURLOPT_POST, 1L);
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(payload));
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+		if (st) {
+			sse_stream_reset(st);
+			st->curl = curl;
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sse_write_cb);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, st);
+		} else {
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+		}
 		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
 		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &rh);
 		curl_easy_setopt(curl, CURLOPT_USERAGENT, "aicli/0.0.0");
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+		// A stream stays open for the whole generation; only bound the idle time.
+		if (st) {
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
+		} else {
+			curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+		}
 		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
 		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
 
-		CURLcode cc = curl_easy_perform(curl);
+		CURLcode cc = aicli_http_perform(curl);
+		if (headers)
+			curl_slist_free_all(headers);
 		if (cc != CURLE_OK) {
 			set_err(out->error, curl_easy_strerror(cc));
 			rc = 2;
 			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
 			break;
 		}
 
@@ -342,51 +479,71 @@ int aicli_openai_responses_post(const char *api_key, const char *base_url,
 		(void)curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
 		out->http_status = (int)status;
 		out->retry_after_seconds = rh.retry_after_seconds;
-
-		// Success or non-retryable status: move body to out and return.
-		if (out->http_status != 429 && out->http_status != 503)
-		{
-			out->body = buf.data;
-			out->body_len = buf.len;
-			buf.data = NULL;
-			buf.len = 0;
-			buf.cap = 0;
+		if (st) {
+			// Hand over the final response object (or the raw error body) as if the
+			// response had not been streamed.
 			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
-			rc = 0;
-			break;
+			if (out->http_status == 200) {
+				buf.data = st->final_body;
+				buf.len = st->final_len;
+				st->final_body = NULL;
+			} else {
+				buf = st->raw;
+				memset(&st->raw, 0, sizeof(st->raw));
+			}
 		}
 
-		// Retryable status.
+		// Success, non-retryable status, or out of attempts: move body to out and return.
 		int last = (attempt + 1 >= max_attempts);
-		if (last) {
+		if ((out->http_status != 429 && out->http_status != 503) || last) {
 			out->body = buf.data;
 			out->body_len = buf.len;
-			buf.data = NULL;
-			buf.len = 0;
-			buf.cap = 0;
-			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
 			rc = 0;
 			break;
 		}
 
 		// Drop current body before retry.
 		mem_buf_free(&buf);
-		if (headers)
-			curl_slist_free_all(headers);
-		curl_easy_cleanup(curl);
 
 		double wait_s = backoff_seconds(attempt);
 		if (out->http_status == 429 && out->retry_after_seconds >= 0)
 			wait_s = (double)out->retry_after_seconds;
 		sleep_seconds(wait_s);
-		// continue
 	}
+	return rc;
+}
+
+int aicli_openai_responses_post(const char *api_key, const char *base_url,
+			      const aicli_openai_request_t *req,
+			      const char *tools_json, const char *tool_choice,
+			      aicli_openai_http_response_t *out)
+{
+	if (!out)
+		return 2;
+	memset(out, 0, sizeof(*out));
+	out->retry_after_seconds = -1;
+
+	if (!api_key || !api_key[0]) {
+		set_err(out->error, "OPENAI_API_KEY is not set");
+		return 2;
+	}
+	if (!base_url || !base_url[0])
+		base_url = "https://api.openai.com/v1";
+
+	char *url = join_url_path(base_url, "/responses");
+	if (!url) {
+		set_err(out->error, "failed to build url");
+		return 2;
+	}
+
+	char *payload = build_request_json(req, tools_json, tool_choice);
+	if (!payload) {
+		free(url);
+		set_err(out->error, "failed to build request json");
+		return 2;
+	}
+
+	int rc = post_json_with_retry(api_key, url, payload, NULL, out);
 
 	free(payload);
 	free(url);
@@ -419,97 +576,46 @@ int aicli_openai_responses_post_raw_json(const char *api_key, const char *base_u
 		return 2;
 	}
 
-	int rc = 0;
-
-	const unsigned max_attempts = 4;
-	for (unsigned attempt = 0; attempt < max_attempts; attempt++) {
-		CURL *curl = curl_easy_init();
-		if (!curl) {
-			set_err(out->error, "curl_easy_init failed");
-			rc = 2;
-			break;
-		}
-
-		mem_buf_t buf = {0};
-		resp_headers_t rh = {.retry_after_seconds = -1};
+	int rc = post_json_with_retry(api_key, url, json_payload, NULL, out);
 
-		struct curl_slist *headers = NULL;
-		char auth[512];
-		snprintf(auth, sizeof(auth), "Authorization: Bearer %s", api_key);
-		headers = curl_slist_append(headers, auth);
-		headers = curl_slist_append(headers, "Content-Type: application/json");
-		headers = curl_slist_append(headers, "Accept: application/json");
-
-		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-		curl_easy_setopt(curl, CURLOPT_URL, url);
-		curl_easy_setopt(curl, CURLOPT_POST, 1L);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_payload);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(json_payload));
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
-		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
-		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &rh);
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, "aicli/0.0.0");
-		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
-		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
-		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
-
-		CURLcode cc = curl_easy_perform(curl);
-		if (cc != CURLE_OK) {
-			set_err(out->error, curl_easy_strerror(cc));
-			rc = 2;
-			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
-			break;
-		}
-
-		long status = 0;
-		(void)curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-		out->http_status = (int)status;
-		out->retry_after_seconds = rh.retry_after_seconds;
-
-		if (out->http_status != 429 && out->http_status != 503) {
-			out->body = buf.data;
-			out->body_len = buf.len;
-			buf.data = NULL;
-			buf.len = 0;
-			buf.cap = 0;
-			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
-			rc = 0;
-			break;
-		}
+	free(url);
+	return rc;
+}
 
-		int last = (attempt + 1 >= max_attempts);
-		if (last) {
-			out->body = buf.data;
-			out->body_len = buf.len;
-			buf.data = NULL;
-			buf.len = 0;
-			buf.cap = 0;
-			mem_buf_free(&buf);
-			if (headers)
-				curl_slist_free_all(headers);
-			curl_easy_cleanup(curl);
-			rc = 0;
-			break;
-		}
+int aicli_openai_responses_stream_raw_json(const char *api_key, const char *base_url,
+					const char *json_payload,
+					aicli_openai_stream_event_fn on_event, void *user,
+					aicli_openai_http_response_t *out)
+{
+	if (!out)
+		return 2;
+	memset(out, 0, sizeof(*out));
+	out->retry_after_seconds = -1;
 
-		mem_buf_free(&buf);
-		if (headers)
-			curl_slist_free_all(headers);
-		curl_easy_cleanup(curl);
+	if (!api_key || !api_key[0]) {
+		set_err(out->error, "OPENAI_API_KEY is not set");
+		return 2;
+	}
+	if (!base_url || !base_url[0])
+		base_url = "https://api.openai.com/v1";
+	if (!json_payload || !json_payload[0]) {
+		set_err(out->error, "missing json_payload");
+		return 2;
+	}
 
-		double wait_s = backoff_seconds(attempt);
-		if (out->http_status == 429 && out->retry_after_seconds >= 0)
-			wait_s = (double)out->retry_after_seconds;
-		sleep_seconds(wait_s);
+	char *url = join_url_path(base_url, "/responses");
+	if (!url) {
+		set_err(out->error, "failed to build url");
+		return 2;
 	}
 
+	sse_stream_t st;
+	memset(&st, 0, sizeof(st));
+	st.on_event = on_event;
+	st.user = user;
+	int rc = post_json_with_retry(api_key, url, json_payload, &st, out);
+	sse_stream_reset(&st);
+
 	free(url);
 	return rc;
 }
@@ -1,6 +1,7 @@
 #include "openai_tool_loop.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,7 +11,10 @@
 
 #include "openai_responses.h"
 #include "threadpool.h"
+#include "tool_budget.h"
 #include "buf.h"
+#include "json_writer.h"
+#include "cancel.h"
 
 #include "allowlist_list_tool.h"
 #include "cli.h"
@@ -67,73 +71,6 @@ static char *dup_cstr(const char *s)
 	return p;
 }
 
-static bool buf_append_json_hex2(aicli_buf_t *b, unsigned char v)
-{
-	static const char hex[] = "0123456789abcdef";
-	char tmp[2];
-	tmp[0] = hex[(v >> 4) & 0xF];
-	tmp[1] = hex[v & 0xF];
-	return aicli_buf_append(b, tmp, sizeof(tmp));
-}
-
-static bool buf_append_json_string_escaped_bytes(aicli_buf_t *b, const unsigned char *s, size_t n)
-{
-	// Appends JSON string content (WITHOUT surrounding quotes).
-	// Escapes control chars and forces non-ASCII bytes to \u00XX to avoid UTF-8 concerns.
-	for (size_t i = 0; i < n; i++) {
-		unsigned char c = s[i];
-		switch (c) {
-		case '"':
-			if (!aicli_buf_append_str(b, "\\\""))
-				return false;
-			break;
-		case '\\':
-			if (!aicli_buf_append_str(b, "\\\\"))
-				return false;
-			break;
-		case '\b':
-			if (!aicli_buf_append_str(b, "\\b"))
-				return false;
-			break;
-		case '\f':
-			if (!aicli_buf_append_str(b, "\\f"))
-				return false;
-			break;
-		case '\n':
-			if (!aicli_buf_append_str(b, "\\n"))
-				return false;
-			break;
-		case '\r':
-			if (!aicli_buf_append_str(b, "\\r"))
-				return false;
-			break;
-		case '\t':
-			if (!aicli_buf_append_str(b, "\\t"))
-				return false;
-			break;
-		default:
-			if (c < 0x20 || c >= 0x80) {
-				if (!aicli_buf_append_str(b, "\\u00"))
-					return false;
-				if (!buf_append_json_hex2(b, c))
-					return false;
-			} else {
-				if (!aicli_buf_append(b, &c, 1))
-					return false;
-			}
-			break;
-		}
-	}
-	return true;
-}
-
-static bool buf_append_json_string_escaped_cstr(aicli_buf_t *b, const char *s)
-{
-	if (!s)
-		return true;
-	return buf_append_json_string_escaped_bytes(b, (const unsigned char *)s, strlen(s));
-}
-
 static char *build_function_call_output_item_json_manual(const char *call_id, const aicli_tool_result_t *r)
 {
 	// Build:
@@ -143,12 +80,12 @@ static char *build_function_call_output_item_json_manual(const char *call_id, co
 		return NULL;
 
 	aicli_buf_t b;
-	if (!aicli_buf_init(&b, 512))
+	if (!aicli_buf_init(&b, 512 + (r && r->stdout_text ? r->stdout_len : 0)))
 		return NULL;
 
 	bool ok = true;
 	ok = ok && aicli_buf_append_str(&b, "{\"type\":\"function_call_output\",\"call_id\":\"");
-	ok = ok && buf_append_json_string_escaped_cstr(&b, call_id);
+	ok = ok && aicli_json_append_escaped(&b, call_id, strlen(call_id), 1);
 	ok = ok && aicli_buf_append_str(&b, "\",\"output\":\"");
 
 	// Begin inner JSON (as a string):
@@ -159,89 +96,22 @@ static char *build_function_call_output_item_json_manual(const char *call_id, co
 	snprintf(tmp, sizeof(tmp), ",\\\"exit_code\\\":%d", r ? r->exit_code : 2);
 	ok = ok && aicli_buf_append_str(&b, tmp);
 
-	// stdout_text (bytes -> \u00XX-safe)
+	// stdout_text and stderr_text are escaped twice: as strings of the inner JSON, which
+	// is itself the content of the outer "output" string.
 	ok = ok && aicli_buf_append_str(&b, ",\\\"stdout_text\\\":\\\"");
-	if (r && r->stdout_text && r->stdout_len) {
-		// Escape stdout bytes into JSON string content, then escape again for outer string.
-		// We do this by emitting \u00XX etc already containing backslashes; so we must escape
-		// backslash for the OUTER string: each '\\' becomes '\\\\'.
-		// Simplest: escape bytes as JSON for inner, but with '\\' doubled.
-		for (size_t i = 0; ok && i < r->stdout_len; i++) {
-			unsigned char c = (unsigned char)r->stdout_text[i];
-			switch (c) {
-			case '"':
-				ok = ok && aicli_buf_append_str(&b, "\\\\\\\"");
-				break;
-			case '\\':
-				ok = ok && aicli_buf_append_str(&b, "\\\\\\\\");
-				break;
-			case '\b':
-				ok = ok && aicli_buf_append_str(&b, "\\\\b");
-				break;
-			case '\f':
-				ok = ok && aicli_buf_append_str(&b, "\\\\f");
-				break;
-			case '\n':
-				ok = ok && aicli_buf_append_str(&b, "\\\\n");
-				break;
-			case '\r':
-				ok = ok && aicli_buf_append_str(&b, "\\\\r");
-				break;
-			case '\t':
-				ok = ok && aicli_buf_append_str(&b, "\\\\t");
-				break;
-			default:
-				if (c < 0x20 || c >= 0x80) {
-					ok = ok && aicli_buf_append_str(&b, "\\\\u00");
-					ok = ok && buf_append_json_hex2(&b, c);
-				} else {
-					ok = ok && aicli_buf_append(&b, &c, 1);
-				}
-				break;
-			}
-		}
-	}
+	if (r && r->stdout_text && r->stdout_len)
+		ok = ok && aicli_json_append_escaped(&b, r->stdout_text, r->stdout_len, 2);
 	ok = ok && aicli_buf_append_str(&b, "\\\"");
 
-	// stderr_text (cstr)
 	ok = ok && aicli_buf_append_str(&b, ",\\\"stderr_text\\\":\\\"");
-	if (r && r->stderr_text && r->stderr_text[0]) {
-		// Same doubling rule as above: escape for inner, but keep backslashes doubled.
-		const unsigned char *sp = (const unsigned char *)r->stderr_text;
-		size_t sn = strlen(r->stderr_text);
-		for (size_t i = 0; ok && i < sn; i++) {
-			unsigned char c = sp[i];
-			switch (c) {
-			case '"':
-				ok = ok && aicli_buf_append_str(&b, "\\\\\\\"");
-				break;
-			case '\\':
-				ok = ok && aicli_buf_append_str(&b, "\\\\\\\\");
-				break;
-			case '\n':
-				ok = ok && aicli_buf_append_str(&b, "\\\\n");
-				break;
-			case '\r':
-				ok = ok && aicli_buf_append_str(&b, "\\\\r");
-				break;
-			case '\t':
-				ok = ok && aicli_buf_append_str(&b, "\\\\t");
-				break;
-			default:
-				if (c < 0x20 || c >= 0x80) {
-					ok = ok && aicli_buf_append_str(&b, "\\\\u00");
-					ok = ok && buf_append_json_hex2(&b, c);
-				} else {
-					ok = ok && aicli_buf_append(&b, &c, 1);
-				}
-				break;
-			}
-		}
-	}
+	if (r && r->stderr_text && r->stderr_text[0])
+		ok = ok && aicli_json_append_escaped(&b, r->stderr_text, strlen(r->stderr_text), 2);
 	ok = ok && aicli_buf_append_str(&b, "\\\"");
 
 	snprintf(tmp, sizeof(tmp), ",\\\"total_bytes\\\":%zu", r ? r->total_bytes : (size_t)0);
 	ok = ok && aicli_buf_append_str(&b, tmp);
+	if (r && r->total_bytes_lower_bound)
+		ok = ok && aicli_buf_append_str(&b, ",\\\"total_bytes_lower_bound\\\":true");
 	ok = ok && aicli_buf_append_str(&b, ",\\\"truncated\\\":");
 	ok = ok && aicli_buf_append_str(&b, (r && r->truncated) ? "true" : "false");
 	ok = ok && aicli_buf_append_str(&b, ",\\\"cache_hit\\\":");
@@ -274,6 +144,11 @@ static char *build_function_call_output_item_json_manual(const char *call_id, co
 	return out;
 }
 
+// Pages are sized by the run's output budget (tool_budget.h); a larger `size` is cut to it.
+#define TOOL_PAGE_SIZE_DESCRIPTION                                                                 \
+	"Max bytes to return. Omit it to get the largest page the output budget allows "             \
+	"(at least 4096 bytes; more when few calls share the turn)."
+
 static char *build_execute_tool_json(void)
 {
 	// JSON array of tool definitions for Responses API.
@@ -326,8 +201,8 @@ static char *build_execute_tool_json(void)
 	yyjson_mut_val *p_size = yyjson_mut_obj(doc);
 	yyjson_mut_obj_add_str(doc, p_size, "type", "integer");
 	yyjson_mut_obj_add_int(doc, p_size, "minimum", 1);
-	yyjson_mut_obj_add_int(doc, p_size, "maximum", 4096);
-	yyjson_mut_obj_add_str(doc, p_size, "description", "Max bytes to return (<=4096).");
+	yyjson_mut_obj_add_int(doc, p_size, "maximum", AICLI_MAX_TOOL_PAGE_BYTES);
+	yyjson_mut_obj_add_str(doc, p_size, "description", TOOL_PAGE_SIZE_DESCRIPTION);
 	yyjson_mut_obj_add_val(doc, props, "size", p_size);
 
 	yyjson_mut_val *required = yyjson_mut_arr(doc);
@@ -429,8 +304,8 @@ static char *build_execute_tool_json(void)
 	yyjson_mut_val *p_size3 = yyjson_mut_obj(doc);
 	yyjson_mut_obj_add_str(doc, p_size3, "type", "integer");
 	yyjson_mut_obj_add_int(doc, p_size3, "minimum", 1);
-	yyjson_mut_obj_add_int(doc, p_size3, "maximum", 4096);
-	yyjson_mut_obj_add_str(doc, p_size3, "description", "Max bytes to return (<=4096).");
+	yyjson_mut_obj_add_int(doc, p_size3, "maximum", AICLI_MAX_TOOL_PAGE_BYTES);
+	yyjson_mut_obj_add_str(doc, p_size3, "description", TOOL_PAGE_SIZE_DESCRIPTION);
 	yyjson_mut_obj_add_val(doc, props3, "size", p_size3);
 
 	yyjson_mut_val *p_idem3 = yyjson_mut_obj(doc);
@@ -473,8 +348,8 @@ static char *build_execute_tool_json(void)
 	yyjson_mut_val *p_size4 = yyjson_mut_obj(doc);
 	yyjson_mut_obj_add_str(doc, p_size4, "type", "integer");
 	yyjson_mut_obj_add_int(doc, p_size4, "minimum", 1);
-	yyjson_mut_obj_add_int(doc, p_size4, "maximum", 4096);
-	yyjson_mut_obj_add_str(doc, p_size4, "description", "Max bytes to return (<=4096).");
+	yyjson_mut_obj_add_int(doc, p_size4, "maximum", AICLI_MAX_TOOL_PAGE_BYTES);
+	yyjson_mut_obj_add_str(doc, p_size4, "description", TOOL_PAGE_SIZE_DESCRIPTION);
 	yyjson_mut_obj_add_val(doc, props4, "size", p_size4);
 
 	yyjson_mut_val *p_idem4 = yyjson_mut_obj(doc);
@@ -530,8 +405,25 @@ static char *build_execute_tool_json(void)
 	return json;
 }
 
+// The definitions never change, so a process builds them once, however many runs it
+// serves (aicli serve). The string is never freed.
+static pthread_once_t g_tools_json_once = PTHREAD_ONCE_INIT;
+static char *g_tools_json;
+
+static void tools_json_init(void)
+{
+	g_tools_json = build_execute_tool_json();
+}
+
+static const char *tools_json_shared(void)
+{
+	pthread_once(&g_tools_json_once, tools_json_init);
+	return g_tools_json;
+}
+
 typedef struct {
 	const aicli_allowlist_t *allow;
+	aicli_paging_cache_t *cache;
 	aicli_execute_request_t req;
 	aicli_tool_result_t res;
 	bool done;
@@ -600,7 +492,7 @@ static void cli_help_job_main(void *arg)
 		size = 4096;
 	size_t n = total - start;
 	if (n > size)
-		n = size;
+		n = aicli_tool_page_trim(text + start, size);
 
 	char *out = (char *)malloc(n + 1);
 	if (!out) {
@@ -989,11 +881,11 @@ static char *build_function_call_output_item_json_raw(const char *call_id, const
 
 	bool ok = true;
 	ok = ok && aicli_buf_append_str(&b, "{\"type\":\"function_call_output\",\"call_id\":\"");
-	ok = ok && buf_append_json_string_escaped_cstr(&b, call_id);
+	ok = ok && aicli_json_append_escaped(&b, call_id, strlen(call_id), 1);
 	ok = ok && aicli_buf_append_str(&b, "\",\"output\":\"");
 
 	// Escape raw_json as content for the outer JSON string.
-	ok = ok && buf_append_json_string_escaped_cstr(&b, raw_json);
+	ok = ok && aicli_json_append_escaped(&b, raw_json, strlen(raw_json), 1);
 
 	ok = ok && aicli_buf_append_str(&b, "\"}");
 	if (!ok) {
@@ -1078,7 +970,7 @@ static void exec_job_main(void *arg)
 			}
 		}
 	}
-	(void)aicli_execute_run(j->allow, &j->req, &j->res);
+	(void)aicli_execute_run(j->allow, j->cache, &j->req, &j->res);
 	j->done = true;
 }
 
@@ -1264,107 +1156,6 @@ static char *extract_first_output_text(yyjson_val *root)
 	return NULL;
 }
 
-static int collect_execute_calls(yyjson_val *root,
-                                exec_job_t *jobs,
-                                const char **call_ids,
-                                size_t cap,
-                                size_t *out_count)
-{
-	if (out_count)
-		*out_count = 0;
-	if (!root || !jobs || !call_ids || cap == 0)
-		return 2;
-
-	yyjson_val *out = find_output_array(root);
-	if (!out)
-		return 0;
-
-	size_t idx, max = yyjson_arr_size(out);
-	size_t n = 0;
-	for (idx = 0; idx < max && n < cap; idx++) {
-		yyjson_val *item = yyjson_arr_get(out, idx);
-		if (!item || !yyjson_is_obj(item))
-			continue;
-		yyjson_val *type = yyjson_obj_get(item, "type");
-		if (!type || !yyjson_is_str(type))
-			continue;
-		const char *t = yyjson_get_str(type);
-		if (!t || strcmp(t, "function_call") != 0)
-			continue;
-
-		yyjson_val *name = yyjson_obj_get(item, "name");
-		if (!name || !yyjson_is_str(name))
-			continue;
-		if (strcmp(yyjson_get_str(name), "execute") != 0)
-			continue;
-
-		yyjson_val *call_id = yyjson_obj_get(item, "call_id");
-		if (!call_id || !yyjson_is_str(call_id))
-			continue;
-
-		yyjson_val *args = yyjson_obj_get(item, "arguments");
-		if (!args)
-			continue;
-
-		jobs[n].req = (aicli_execute_request_t){0};
-		jobs[n].allow = NULL;
-		jobs[n].done = false;
-		memset(&jobs[n].res, 0, sizeof(jobs[n].res));
-
-		// IMPORTANT: "arguments" is nested under the response yyjson_doc.
-		// We must not keep pointers into that doc after it is freed.
-		// Deep-copy the args payload into its own doc so strings remain valid
-		// long enough to duplicate them for worker threads.
-		yyjson_doc *adoc = NULL;
-		if (yyjson_is_str(args)) {
-			// Common shape: arguments is a JSON string.
-			const char *s = yyjson_get_str(args);
-			if (s && s[0])
-				adoc = yyjson_read(s, strlen(s), 0);
-		} else if (yyjson_is_obj(args)) {
-			// Less common shape: arguments is an object.
-			// yyjson_write() takes a doc, not a val; wrap via a temporary doc.
-			yyjson_mut_doc *md = yyjson_mut_doc_new(NULL);
-			if (md) {
-				yyjson_mut_val *rootv = yyjson_val_mut_copy(md, args);
-				if (rootv) {
-					yyjson_mut_doc_set_root(md, rootv);
-					char *astr = yyjson_mut_write(md, 0, NULL);
-					if (astr && astr[0])
-						adoc = yyjson_read(astr, strlen(astr), 0);
-					free(astr);
-				}
-				yyjson_mut_doc_free(md);
-			}
-		}
-		if (!adoc)
-			continue;
-		yyjson_val *aroot = yyjson_doc_get_root(adoc);
-		if (parse_execute_arguments(aroot, &jobs[n].req) != 0) {
-			yyjson_doc_free(adoc);
-			continue;
-		}
-		if (!jobs[n].req.command || !jobs[n].req.command[0])
-			continue;
-		// The parsed strings point into the yyjson_doc; copy them so they stay valid
-		// after we free the response document and while worker threads run.
-		if (dup_execute_request_strings(&jobs[n].req) != 0) {
-			yyjson_doc_free(adoc);
-			free_execute_request_owned(&jobs[n].req);
-			continue;
-		}
-		// args doc no longer needed once we've duplicated strings.
-		yyjson_doc_free(adoc);
-		// Keep a stable copy beyond the yyjson_doc lifetime.
-		call_ids[n] = dup_cstr(yyjson_get_str(call_id));
-		n++;
-	}
-
-	if (out_count)
-		*out_count = n;
-	return 0;
-}
-
 static void debug_warn_invalid_execute_calls(const aicli_config_t *cfg, yyjson_val *root)
 {
 	if (!cfg || !debug_level_enabled(cfg->debug_function_call))
@@ -1464,57 +1255,516 @@ static char *build_function_call_output_item_json(const char *call_id, const aic
 	return build_function_call_output_item_json_manual(call_id, r);
 }
 
+// Returns a document owning the call arguments. The Responses API encodes "arguments"
+// either as a JSON string or as an object; both are normalized to an object root that
+// stays valid after the response document is freed.
+static yyjson_doc *read_arguments_doc(yyjson_val *args)
+{
+	if (!args)
+		return NULL;
+	if (yyjson_is_str(args)) {
+		const char *s = yyjson_get_str(args);
+		if (!s || !s[0])
+			return NULL;
+		return yyjson_read(s, strlen(s), 0);
+	}
+	if (!yyjson_is_obj(args))
+		return NULL;
+	size_t len = 0;
+	char *json = yyjson_val_write(args, 0, &len);
+	if (!json)
+		return NULL;
+	yyjson_doc *doc = yyjson_read(json, len, 0);
+	free(json);
+	return doc;
+}
+
+typedef enum {
+	TOOL_CALL_EXECUTE = 0,
+	TOOL_CALL_LIST_ALLOWED_FILES,
+	TOOL_CALL_WEB_SEARCH,
+	TOOL_CALL_WEB_FETCH,
+	TOOL_CALL_CLI_HELP,
+} tool_call_kind_t;
+
+typedef struct {
+	tool_call_kind_t kind;
+	char *call_id;
+	aicli_threadpool_future_t done;
+	aicli_cancel_t cancel;
+	bool timed_out; // answered with a timeout result; the job may still be running
+	// Set while the call waits to be started: the stream callback found no free pool
+	// slot and must not run it on the transfer's thread.
+	aicli_threadpool_job_fn deferred;
+	union {
+		exec_job_t exec;
+		list_job_t list;
+		web_search_job_t web_search;
+		web_fetch_job_t web_fetch;
+		cli_help_job_t cli_help;
+	} u;
+} tool_call_t;
+
+// Tool calls requested by one model response.
+// Each call is started on the pool as soon as its function_call item is complete:
+// either from a streamed response.output_item.done event or from the final response.
+typedef struct {
+	const aicli_config_t *cfg;
+	const aicli_allowlist_t *allow;
+	aicli_paging_cache_t *cache;     // execute pages
+	aicli_paging_cache_t *web_cache; // web_search/web_fetch results, this run only
+	const char **web_fetch_prefixes;
+	size_t web_fetch_prefix_count;
+	aicli_threadpool_t *pool;
+	tool_call_t **calls;
+	size_t count;
+	size_t cap;
+	// Per-turn budget: starts with the first call of the turn; 0 = unbounded.
+	long budget_ms;
+	int64_t deadline_ms;
+	// Output budget of the run; each call's page is taken from it as it is prepared.
+	aicli_tool_budget_t output;
+	size_t expected; // function_call items of the current response, once it is complete
+	// Timed-out calls whose jobs had not returned yet. They own their state until the
+	// job finishes (the pool still writes their future), then get reaped.
+	tool_call_t **orphans;
+	size_t orphan_count;
+	size_t orphan_cap;
+} tool_turn_t;
+
+static bool tool_turn_has_call(const tool_turn_t *t, const char *call_id)
+{
+	for (size_t i = 0; i < t->count; i++) {
+		if (t->calls[i]->call_id && strcmp(t->calls[i]->call_id, call_id) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Page for the call being prepared (call number t->count of the turn). A streamed call
+// starts before the rest of the response is known; it leaves half of what is left of
+// the turn to the calls that may follow.
+static size_t tool_turn_page(tool_turn_t *t)
+{
+	size_t calls = t->expected > t->count ? t->expected - t->count : 2;
+	return aicli_tool_budget_page(&t->output, calls);
+}
+
+// Prepares the job for one call from its arguments. Returns the job entry point, or NULL
+// if the call is invalid (nothing is left allocated in that case).
+static aicli_threadpool_job_fn tool_call_prepare(tool_turn_t *t, tool_call_t *c, const char *name,
+						  yyjson_val *aroot)
+{
+	if (strcmp(name, "execute") == 0) {
+		exec_job_t *j = &c->u.exec;
+		c->kind = TOOL_CALL_EXECUTE;
+		j->allow = t->allow;
+		j->cache = t->cache;
+		if (!aroot || parse_execute_arguments(aroot, &j->req) != 0 || !j->req.command ||
+		    !j->req.command[0] || dup_execute_request_strings(&j->req) != 0) {
+			j->req = (aicli_execute_request_t){0};
+			return NULL;
+		}
+		j->req.max_size = tool_turn_page(t);
+		return exec_job_main;
+	}
+	if (strcmp(name, "list_allowed_files") == 0) {
+		list_job_t *j = &c->u.list;
+		c->kind = TOOL_CALL_LIST_ALLOWED_FILES;
+		j->allow = t->allow;
+		(void)parse_list_allowed_files_arguments(aroot, &j->req);
+		(void)dup_list_request_strings(&j->req);
+		return list_job_main;
+	}
+	if (strcmp(name, "web_search") == 0) {
+		web_search_job_t *j = &c->u.web_search;
+		c->kind = TOOL_CALL_WEB_SEARCH;
+		j->cfg = t->cfg;
+		j->cache = t->web_cache;
+		if (parse_web_search_arguments(aroot, &j->req) != 0 ||
+		    dup_web_search_request_strings(&j->req) != 0) {
+			j->req = (aicli_web_search_tool_request_t){0};
+			return NULL;
+		}
+		j->req.max_size = tool_turn_page(t);
+		return web_search_job_main;
+	}
+	if (strcmp(name, "web_fetch") == 0) {
+		web_fetch_job_t *j = &c->u.web_fetch;
+		c->kind = TOOL_CALL_WEB_FETCH;
+		j->cfg = t->cfg;
+		j->cache = t->web_cache;
+		if (parse_web_fetch_arguments(aroot, &j->req) != 0 ||
+		    dup_web_fetch_request_strings(&j->req) != 0) {
+			j->req = (aicli_web_fetch_tool_request_t){0};
+			return NULL;
+		}
+		// apply prefix allowlist from env
+		j->req.allowed_prefixes = t->web_fetch_prefixes;
+		j->req.allowed_prefix_count = t->web_fetch_prefix_count;
+		j->req.max_body_bytes = 1024 * 1024;
+		j->req.timeout_seconds = 15L;
+		j->req.connect_timeout_seconds = 10L;
+		j->req.max_redirects = 0;
+		j->req.max_size = tool_turn_page(t);
+		return web_fetch_job_main;
+	}
+	if (strcmp(name, "cli_help") == 0) {
+		cli_help_job_t *j = &c->u.cli_help;
+		c->kind = TOOL_CALL_CLI_HELP;
+		(void)parse_cli_help_arguments(aroot, &j->topic, &j->start, &j->size);
+		return cli_help_job_main;
+	}
+	return NULL;
+}
+
+// Adds a function_call output item as the next call if it is valid, supported and not
+// started yet. Returns the job entry point to run, or NULL if nothing was added.
+static aicli_threadpool_job_fn tool_turn_add_item(tool_turn_t *t, yyjson_val *item)
+{
+	if (!t || !item || !yyjson_is_obj(item) || t->count >= t->cap)
+		return NULL;
+	yyjson_val *type = yyjson_obj_get(item, "type");
+	const char *ty = (type && yyjson_is_str(type)) ? yyjson_get_str(type) : NULL;
+	if (!ty || strcmp(ty, "function_call") != 0)
+		return NULL;
+	yyjson_val *name = yyjson_obj_get(item, "name");
+	const char *nstr = (name && yyjson_is_str(name)) ? yyjson_get_str(name) : NULL;
+	yyjson_val *call_id = yyjson_obj_get(item, "call_id");
+	const char *cid = (call_id && yyjson_is_str(call_id)) ? yyjson_get_str(call_id) : NULL;
+	if (!nstr || !cid || !cid[0] || tool_turn_has_call(t, cid))
+		return NULL;
+
+	tool_call_t *c = (tool_call_t *)calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->call_id = dup_cstr(cid);
+	if (!c->call_id) {
+		free(c);
+		return NULL;
+	}
+
+	// Argument strings are duplicated into the job, so the doc can go right away.
+	yyjson_doc *adoc = read_arguments_doc(yyjson_obj_get(item, "arguments"));
+	yyjson_val *aroot = adoc ? yyjson_doc_get_root(adoc) : NULL;
+	if (aroot && !yyjson_is_obj(aroot))
+		aroot = NULL;
+	if (t->count == 0)
+		aicli_tool_budget_begin_turn(&t->output);
+	aicli_threadpool_job_fn fn = tool_call_prepare(t, c, nstr, aroot);
+	yyjson_doc_free(adoc);
+	if (!fn) {
+		free(c->call_id);
+		free(c);
+		return NULL;
+	}
+	if (t->count == 0)
+		t->deadline_ms = t->budget_ms > 0 ? aicli_monotonic_ms() + t->budget_ms : 0;
+	aicli_cancel_init(&c->cancel, t->deadline_ms);
+	t->calls[t->count++] = c;
+	return fn;
+}
+
+// Streaming: starts one call as soon as its item is complete. This runs inside the
+// transfer's write callback, on the thread (and curl handle) of the API request, so a
+// call that cannot be queued is left for tool_turn_start_all() rather than run here.
+static void tool_turn_start_item(tool_turn_t *t, yyjson_val *item)
+{
+	aicli_threadpool_job_fn fn = tool_turn_add_item(t, item);
+	if (fn) {
+		tool_call_t *c = t->calls[t->count - 1];
+		aicli_threadpool_task_t task = { fn, &c->u, &c->done, &c->cancel };
+		if (aicli_threadpool_try_submit(t->pool, &task) != 0)
+			c->deferred = fn;
+	}
+}
+
+// Starts every call of a complete response that is not running yet, in one batch,
+// together with the calls the stream callback had to defer.
+static void tool_turn_start_all(tool_turn_t *t, yyjson_val *root)
+{
+	aicli_threadpool_task_t *tasks =
+	    (aicli_threadpool_task_t *)calloc(t->cap, sizeof(aicli_threadpool_task_t));
+	size_t ntasks = 0;
+	for (size_t i = 0; i < t->count; i++) {
+		tool_call_t *c = t->calls[i];
+		if (!c->deferred)
+			continue;
+		aicli_threadpool_task_t task = { c->deferred, &c->u, &c->done, &c->cancel };
+		c->deferred = NULL;
+		if (tasks)
+			tasks[ntasks++] = task;
+		else
+			(void)aicli_threadpool_submit_batch(t->pool, &task, 1);
+	}
+	yyjson_val *outarr = find_output_array(root);
+	size_t idx, max = yyjson_arr_size(outarr);
+	t->expected = 0;
+	for (idx = 0; idx < max; idx++) {
+		yyjson_val *type = yyjson_obj_get(yyjson_arr_get(outarr, idx), "type");
+		if (type && yyjson_is_str(type) && strcmp(yyjson_get_str(type), "function_call") == 0)
+			t->expected++;
+	}
+	for (idx = 0; idx < max && t->count < t->cap; idx++) {
+		aicli_threadpool_job_fn fn = tool_turn_add_item(t, yyjson_arr_get(outarr, idx));
+		if (!fn)
+			continue;
+		tool_call_t *c = t->calls[t->count - 1];
+		aicli_threadpool_task_t task = { fn, &c->u, &c->done, &c->cancel };
+		if (tasks)
+			tasks[ntasks++] = task;
+		else
+			(void)aicli_threadpool_submit_batch(t->pool, &task, 1);
+	}
+	(void)aicli_threadpool_submit_batch(t->pool, tasks, ntasks);
+	free(tasks);
+}
+
+// Result of a finished call, or NULL for tools that return raw JSON.
+static const aicli_tool_result_t *tool_call_result(const tool_call_t *c)
+{
+	switch (c->kind) {
+	case TOOL_CALL_EXECUTE:
+		return &c->u.exec.res;
+	case TOOL_CALL_WEB_SEARCH:
+		return &c->u.web_search.res;
+	case TOOL_CALL_WEB_FETCH:
+		return &c->u.web_fetch.res;
+	case TOOL_CALL_CLI_HELP:
+		return &c->u.cli_help.res;
+	case TOOL_CALL_LIST_ALLOWED_FILES:
+		break;
+	}
+	return NULL;
+}
+
+static const aicli_tool_result_t k_timeout_result = {
+    .stdout_text = "",
+    .stderr_text = "timeout: tool call exceeded the per-turn time budget",
+    .exit_code = 124,
+};
+
+// False once the call's future is ready if the pool skipped the job: its cancel token
+// (the turn's deadline) had fired before a worker got to it, so it has no result.
+static bool tool_call_ran(const tool_call_t *c)
+{
+	switch (c->kind) {
+	case TOOL_CALL_EXECUTE:
+		return c->u.exec.done;
+	case TOOL_CALL_LIST_ALLOWED_FILES:
+		return c->u.list.done;
+	case TOOL_CALL_WEB_SEARCH:
+		return c->u.web_search.done;
+	case TOOL_CALL_WEB_FETCH:
+		return c->u.web_fetch.done;
+	case TOOL_CALL_CLI_HELP:
+		return c->u.cli_help.done;
+	}
+	return false;
+}
+
+static char *tool_call_output_item_json(const tool_call_t *c)
+{
+	if (c->timed_out)
+		return build_function_call_output_item_json(c->call_id, &k_timeout_result);
+	if (c->kind == TOOL_CALL_LIST_ALLOWED_FILES)
+		return build_function_call_output_item_json_raw(c->call_id, c->u.list.res.json);
+	return build_function_call_output_item_json(c->call_id, tool_call_result(c));
+}
+
+static void tool_call_free(tool_call_t *c)
+{
+	switch (c->kind) {
+	case TOOL_CALL_EXECUTE:
+		free((void *)c->u.exec.res.stdout_text);
+		free_execute_request_owned(&c->u.exec.req);
+		break;
+	case TOOL_CALL_LIST_ALLOWED_FILES:
+		aicli_list_allowed_files_result_free(&c->u.list.res);
+		free_list_request_owned(&c->u.list.req);
+		break;
+	case TOOL_CALL_WEB_SEARCH:
+		free((void *)c->u.web_search.res.stdout_text);
+		free_web_search_request_owned(&c->u.web_search.req);
+		break;
+	case TOOL_CALL_WEB_FETCH:
+		free((void *)c->u.web_fetch.res.stdout_text);
+		free_web_fetch_request_owned(&c->u.web_fetch.req);
+		break;
+	case TOOL_CALL_CLI_HELP:
+		free((void *)c->u.cli_help.res.stdout_text);
+		free(c->u.cli_help.topic);
+		break;
+	}
+	free(c->call_id);
+	free(c);
+}
+
+// Frees orphans whose jobs have returned; with wait, first waits for all of them.
+static void tool_turn_reap_orphans(tool_turn_t *t, bool wait)
+{
+	size_t keep = 0;
+	for (size_t i = 0; i < t->orphan_count; i++) {
+		tool_call_t *c = t->orphans[i];
+		if (wait)
+			aicli_threadpool_future_wait(t->pool, &c->done);
+		if (aicli_threadpool_future_ready(&c->done))
+			tool_call_free(c);
+		else
+			t->orphans[keep++] = c;
+	}
+	t->orphan_count = keep;
+}
+
+static bool tool_turn_adopt_orphan(tool_turn_t *t, tool_call_t *c)
+{
+	if (t->orphan_count == t->orphan_cap) {
+		size_t ncap = t->orphan_cap ? t->orphan_cap * 2 : 8;
+		tool_call_t **n = (tool_call_t **)realloc(t->orphans, ncap * sizeof(*n));
+		if (!n)
+			return false;
+		t->orphans = n;
+		t->orphan_cap = ncap;
+	}
+	t->orphans[t->orphan_count++] = c;
+	return true;
+}
+
+// Forgets the turn's calls. The pool is shared across turns (and runs), so this waits
+// on the calls' own futures rather than draining it; timed-out calls that are still
+// running are not waited for but parked as orphans.
+static void tool_turn_reset(tool_turn_t *t)
+{
+	for (size_t i = 0; i < t->count; i++) {
+		tool_call_t *c = t->calls[i];
+		if (c->timed_out && !aicli_threadpool_future_ready(&c->done) &&
+		    tool_turn_adopt_orphan(t, c))
+			continue;
+		// A deferred call (the stream ended before it was started) never ran.
+		if (!c->deferred)
+			aicli_threadpool_future_wait(t->pool, &c->done);
+		tool_call_free(c);
+	}
+	t->count = 0;
+	t->expected = 0;
+	t->deadline_ms = 0;
+	tool_turn_reap_orphans(t, false);
+}
+
+static void debug_log_tool_results(const aicli_config_t *cfg, const tool_turn_t *t)
+{
+	if (!cfg || !debug_level_enabled(cfg->debug_function_call) || cfg->debug_function_call < 2)
+		return;
+	size_t maxb = debug_max_bytes_for_level(cfg->debug_function_call);
+	for (size_t i = 0; i < t->count; i++) {
+		const tool_call_t *c = t->calls[i];
+		// A timed-out job may still be writing its own result.
+		const aicli_tool_result_t *r = c->timed_out ? &k_timeout_result : tool_call_result(c);
+		if (!r)
+			continue;
+		fprintf(stderr, "[debug:function_call] execute result call_id=%s exit_code=%d truncated=%d total_bytes=%zu\n",
+		        safe_str(c->call_id), r->exit_code, r->truncated ? 1 : 0, r->total_bytes);
+		if (r->stderr_text && r->stderr_text[0])
+			debug_print_trunc(stderr, "[debug:function_call] execute stderr", r->stderr_text, maxb);
+		if (cfg->debug_function_call >= 3 && r->stdout_text && r->stdout_text[0])
+			debug_print_trunc(stderr, "[debug:function_call] execute stdout", r->stdout_text, maxb);
+	}
+}
+
+typedef struct {
+	tool_turn_t *turn;
+	bool printed_text;
+} stream_ctx_t;
+
+// Streaming: print text deltas immediately and start tool calls as soon as each
+// function_call item is done, while the rest of the response is still arriving.
+static void stream_on_event(const char *event, const char *data, size_t data_len, void *user)
+{
+	stream_ctx_t *sc = (stream_ctx_t *)user;
+	if (!sc || !data || data_len == 0)
+		return;
+	if (event && event[0] && strcmp(event, "response.output_text.delta") != 0 &&
+	    strcmp(event, "response.output_item.done") != 0)
+		return;
+
+	yyjson_doc *doc = yyjson_read(data, data_len, 0);
+	if (!doc)
+		return;
+	yyjson_val *root = yyjson_doc_get_root(doc);
+	yyjson_val *type = yyjson_obj_get(root, "type");
+	const char *t = (type && yyjson_is_str(type)) ? yyjson_get_str(type) : "";
+
+	if (strcmp(t, "response.output_text.delta") == 0) {
+		yyjson_val *delta = yyjson_obj_get(root, "delta");
+		if (delta && yyjson_is_str(delta) && yyjson_get_len(delta) > 0) {
+			fwrite(yyjson_get_str(delta), 1, yyjson_get_len(delta), stdout);
+			fflush(stdout);
+			sc->printed_text = true;
+		}
+	} else if (strcmp(t, "response.output_item.done") == 0) {
+		(void)tool_turn_start_item(sc->turn, yyjson_obj_get(root, "item"));
+	}
+	yyjson_doc_free(doc);
+}
+
+// Request bodies are written in one pass: the tools array (built once per run) and the
+// function_call_output items (built by their tool calls) are already serialized JSON
+// and are spliced in as they are.
+static char *request_json_finish(aicli_buf_t *b, bool ok, const char *tools_json)
+{
+	if (ok && tools_json && tools_json[0]) {
+		ok = aicli_buf_append_str(b, ",\"tools\":");
+		ok = ok && aicli_buf_append_str(b, tools_json);
+	}
+	ok = ok && aicli_buf_append(b, "}", 2); // with the NUL
+	if (!ok) {
+		aicli_buf_free(b);
+		return NULL;
+	}
+	return b->data;
+}
+
 static char *build_next_request_json(const char *model,
 				    const char *previous_response_id,
 				    const char *tools_json,
 				    const char **items_json,
-				    size_t item_count)
+				    size_t item_count,
+				    bool stream)
 {
 	if (!model || !model[0] || !previous_response_id || !previous_response_id[0])
 		return NULL;
 	if (!items_json || item_count == 0)
 		return NULL;
 
-	yyjson_mut_doc *doc = yyjson_mut_doc_new(NULL);
-	yyjson_mut_val *root = yyjson_mut_obj(doc);
-	yyjson_mut_doc_set_root(doc, root);
+	size_t need = 256 + strlen(model) + strlen(previous_response_id) +
+	              (tools_json ? strlen(tools_json) : 0);
+	for (size_t i = 0; i < item_count; i++)
+		need += items_json[i] ? strlen(items_json[i]) + 1 : 0;
+	aicli_buf_t b;
+	if (!aicli_buf_init(&b, need))
+		return NULL;
 
-	yyjson_mut_obj_add_str(doc, root, "model", model);
-	yyjson_mut_obj_add_str(doc, root, "previous_response_id", previous_response_id);
+	bool ok = aicli_buf_append_str(&b, "{");
+	ok = ok && aicli_json_append_member_str(&b, true, "model", model);
+	ok = ok && aicli_json_append_member_str(&b, false, "previous_response_id", previous_response_id);
+	if (stream)
+		ok = ok && aicli_buf_append_str(&b, ",\"stream\":true");
 
 	// Per the function calling guide, follow-ups append tool outputs directly
 	// to the running input list (not wrapped as message content items).
-	yyjson_mut_val *input = yyjson_mut_arr(doc);
-	yyjson_mut_obj_add_val(doc, root, "input", input);
-
+	ok = ok && aicli_buf_append_str(&b, ",\"input\":[");
+	bool first = true;
 	for (size_t i = 0; i < item_count; i++) {
 		const char *s = items_json[i];
 		if (!s || !s[0])
 			continue;
-		yyjson_doc *idoc = yyjson_read(s, strlen(s), 0);
-		if (!idoc)
-			continue;
-		yyjson_val *iroot = yyjson_doc_get_root(idoc);
-		yyjson_mut_val *imut = yyjson_val_mut_copy(doc, iroot);
-		if (imut)
-			yyjson_mut_arr_add_val(input, imut);
-		yyjson_doc_free(idoc);
-	}
-
-	if (tools_json && tools_json[0]) {
-		yyjson_doc *tdoc = yyjson_read(tools_json, strlen(tools_json), 0);
-		if (tdoc) {
-			yyjson_val *troot = yyjson_doc_get_root(tdoc);
-			yyjson_mut_val *tmut = yyjson_val_mut_copy(doc, troot);
-			if (tmut)
-				yyjson_mut_obj_add_val(doc, root, "tools", tmut);
-			yyjson_doc_free(tdoc);
-		}
+		if (!first)
+			ok = ok && aicli_buf_append(&b, ",", 1);
+		ok = ok && aicli_buf_append_str(&b, s);
+		first = false;
 	}
-
-	char *json = yyjson_mut_write(doc, 0, NULL);
-	yyjson_mut_doc_free(doc);
-	return json;
+	ok = ok && aicli_buf_append(&b, "]", 1);
+	return request_json_finish(&b, ok, tools_json);
 }
 
 static char *build_initial_request_json(const char *model,
@@ -1522,56 +1772,58 @@ static char *build_initial_request_json(const char *model,
 				      const char *system_text,
 				      const char *previous_response_id,
 				      const char *tools_json,
-				      const char *tool_choice)
+				      const char *tool_choice,
+				      bool stream)
 {
 	if (!model || !model[0] || !input_text || !input_text[0])
 		return NULL;
 
-	yyjson_mut_doc *doc = yyjson_mut_doc_new(NULL);
-	yyjson_mut_val *root = yyjson_mut_obj(doc);
-	yyjson_mut_doc_set_root(doc, root);
+	size_t need = 256 + strlen(model) + strlen(input_text) +
+	              (system_text ? strlen(system_text) : 0) + (tools_json ? strlen(tools_json) : 0);
+	aicli_buf_t b;
+	if (!aicli_buf_init(&b, need))
+		return NULL;
 
-	yyjson_mut_obj_add_str(doc, root, "model", model);
+	bool ok = aicli_buf_append_str(&b, "{");
+	ok = ok && aicli_json_append_member_str(&b, true, "model", model);
 	if (previous_response_id && previous_response_id[0])
-		yyjson_mut_obj_add_str(doc, root, "previous_response_id", previous_response_id);
+		ok = ok && aicli_json_append_member_str(&b, false, "previous_response_id",
+		                                        previous_response_id);
+	if (stream)
+		ok = ok && aicli_buf_append_str(&b, ",\"stream\":true");
 
 	// input: single text item
-	yyjson_mut_val *input = yyjson_mut_arr(doc);
-	yyjson_mut_obj_add_val(doc, root, "input", input);
-	{
-		yyjson_mut_val *msg = yyjson_mut_obj(doc);
-		yyjson_mut_obj_add_str(doc, msg, "role", "user");
-		yyjson_mut_val *content = yyjson_mut_arr(doc);
-		yyjson_mut_obj_add_val(doc, msg, "content", content);
-		yyjson_mut_val *c0 = yyjson_mut_obj(doc);
-		yyjson_mut_obj_add_str(doc, c0, "type", "input_text");
-		yyjson_mut_obj_add_str(doc, c0, "text", input_text);
-		yyjson_mut_arr_add_val(content, c0);
-		yyjson_mut_arr_add_val(input, msg);
-	}
+	ok = ok && aicli_buf_append_str(&b, ",\"input\":[{\"role\":\"user\",\"content\":[{");
+	ok = ok && aicli_json_append_member_str(&b, true, "type", "input_text");
+	ok = ok && aicli_json_append_member_str(&b, false, "text", input_text);
+	ok = ok && aicli_buf_append_str(&b, "}]}]");
 
 	if (system_text && system_text[0])
-		yyjson_mut_obj_add_str(doc, root, "instructions", system_text);
+		ok = ok && aicli_json_append_member_str(&b, false, "instructions", system_text);
 
 	if (tool_choice && tool_choice[0]) {
 		// Existing CLI uses tool_choice values like none/auto/required or a tool name.
-		yyjson_mut_obj_add_str(doc, root, "tool_choice", tool_choice);
+		ok = ok && aicli_json_append_member_str(&b, false, "tool_choice", tool_choice);
 	}
 
-	if (tools_json && tools_json[0]) {
-		yyjson_doc *tdoc = yyjson_read(tools_json, strlen(tools_json), 0);
-		if (tdoc) {
-			yyjson_val *troot = yyjson_doc_get_root(tdoc);
-			yyjson_mut_val *tmut = yyjson_val_mut_copy(doc, troot);
-			if (tmut)
-				yyjson_mut_obj_add_val(doc, root, "tools", tmut);
-			yyjson_doc_free(tdoc);
-		}
-	}
+	return request_json_finish(&b, ok, tools_json);
+}
 
-	char *json = yyjson_mut_write(doc, 0, NULL);
-	yyjson_mut_doc_free(doc);
-	return json;
+static void print_http_error_body(const aicli_config_t *cfg, const aicli_openai_http_response_t *http)
+{
+	fprintf(stderr, "openai http_status=%d\n", http->http_status);
+	if (http->body && http->body_len) {
+		size_t n = http->body_len;
+		size_t maxb = debug_max_bytes_for_level(cfg ? cfg->debug_api : 0);
+		if (maxb == 0)
+			maxb = 2048;
+		if (n > maxb)
+			n = maxb;
+		fwrite(http->body, 1, n, stderr);
+		fputc('\n', stderr);
+		if (n < http->body_len)
+			fprintf(stderr, "... (truncated, %zu bytes total)\n", http->body_len);
+	}
 }
 
 int aicli_openai_run_with_tools(const aicli_config_t *cfg,
@@ -1598,13 +1850,16 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 	if (tool_threads == 0)
 		tool_threads = 1;
 
-	char *tools_json = build_execute_tool_json();
+	const char *tools_json = tools_json_shared();
 	if (!tools_json)
 		return 2;
 
-	// Shared in-memory paging cache for tools (execute/web_search/web_fetch).
-	// Kept per-run (process memory only).
-	aicli_paging_cache_t *tool_cache = aicli_paging_cache_create(64);
+	// In-memory paging caches for tools. execute pages are keyed by the file's identity,
+	// so they are shared for the daemon's lifetime under aicli serve. Web results are
+	// kept for this run only: the disk cache decides (TTL, revalidation) whether a later
+	// run may reuse them.
+	aicli_paging_cache_t *tool_cache = aicli_paging_cache_open();
+	aicli_paging_cache_t *web_cache = aicli_paging_cache_create(0, 0);
 
 	// URL allowlist for web_fetch (prefix-based). Default: disabled unless explicitly set.
 	// Prefer env var for secrets/config.
@@ -1639,23 +1894,46 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 
 	const char *model = (cfg->model && cfg->model[0]) ? cfg->model : "gpt-5-mini";
 
+	// The pool is process-wide and reused by every turn and run: with --stream, calls
+	// start while the response that requested them is still arriving.
+	tool_turn_t turn = {
+	    .cfg = cfg,
+	    .allow = allow,
+	    .cache = tool_cache,
+	    .web_cache = web_cache,
+	    .web_fetch_prefixes = web_fetch_prefixes,
+	    .web_fetch_prefix_count = web_fetch_prefix_count,
+	    .pool = aicli_threadpool_shared(tool_threads),
+	    .calls = (tool_call_t **)calloc(max_tool_calls_per_turn, sizeof(tool_call_t *)),
+	    .count = 0,
+	    .cap = max_tool_calls_per_turn,
+	    .budget_ms = cfg->tool_timeout_ms,
+	};
+	aicli_tool_budget_init(&turn.output, cfg->tool_output_turn_bytes, cfg->tool_output_run_bytes);
+	stream_ctx_t sctx = {.turn = &turn, .printed_text = false};
+
 	aicli_openai_http_response_t http = {0};
+	int rc = 2;
+	if (!turn.pool || !turn.calls)
+		goto done;
+
 	if (cfg && debug_level_enabled(cfg->debug_api)) {
-		fprintf(stderr, "[debug:api] POST /v1/responses model=%s tool_choice=%s tools=execute\n",
-		        safe_str(model), safe_str(tool_choice));
+		fprintf(stderr, "[debug:api] POST /v1/responses model=%s tool_choice=%s tools=execute%s\n",
+		        safe_str(model), safe_str(tool_choice), cfg->stream ? " stream=1" : "");
 	}
-	int rc = 0;
-	if (previous_response_id && previous_response_id[0]) {
+	int prc = 0;
+	if (cfg->stream || (previous_response_id && previous_response_id[0])) {
 		char *payload = build_initial_request_json(model, user_prompt, NULL,
-		                                        previous_response_id, tools_json, tool_choice);
-		if (!payload) {
-			free(tools_json);
-			free(web_fetch_prefixes_buf);
-			aicli_paging_cache_destroy(tool_cache);
-			return 2;
-		}
-		rc = aicli_openai_responses_post_raw_json(cfg->openai_api_key, cfg->openai_base_url,
-		                                       payload, &http);
+		                                        previous_response_id, tools_json, tool_choice,
+		                                        cfg->stream);
+		if (!payload)
+			goto done;
+		if (cfg->stream)
+			prc = aicli_openai_responses_stream_raw_json(cfg->openai_api_key, cfg->openai_base_url,
+			                                          payload, stream_on_event, &sctx, &http);
+		else
+			prc = aicli_openai_responses_post_raw_json(cfg->openai_api_key, cfg->openai_base_url,
+			                                        payload, &http);
 		free(payload);
 	} else {
 		aicli_openai_request_t req0 = {
@@ -1663,14 +1941,12 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 		    .input_text = user_prompt,
 		    .system_text = NULL,
 		};
-		rc = aicli_openai_responses_post(cfg->openai_api_key, cfg->openai_base_url,
-		                               &req0, tools_json, tool_choice, &http);
+		prc = aicli_openai_responses_post(cfg->openai_api_key, cfg->openai_base_url,
+		                                &req0, tools_json, tool_choice, &http);
 	}
-	if (rc != 0) {
-		free(tools_json);
-		free(web_fetch_prefixes_buf);
-		aicli_paging_cache_destroy(tool_cache);
-		return rc;
+	if (prc != 0) {
+		rc = prc;
+		goto done;
 	}
 	if (cfg && debug_level_enabled(cfg->debug_api))
 		fprintf(stderr, "[debug:api] response http_status=%d body_len=%zu\n", http.http_status, http.body_len);
@@ -1681,27 +1957,13 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 		debug_print_trunc(stderr, "[debug:api] response body", http.body, maxb);
 	}
 	if (http.http_status != 200 || !http.body || http.body_len == 0) {
-		fprintf(stderr, "openai http_status=%d\n", http.http_status);
-		if (http.body && http.body_len) {
-			size_t n = http.body_len;
-			size_t maxb = debug_max_bytes_for_level(cfg ? cfg->debug_api : 0);
-			if (maxb == 0)
-				maxb = 2048;
-			if (n > maxb)
-				n = maxb;
-			fwrite(http.body, 1, n, stderr);
-			fputc('\n', stderr);
-			if (n < http.body_len)
-				fprintf(stderr, "... (truncated, %zu bytes total)\n", http.body_len);
-		}
-		aicli_openai_http_response_free(&http);
-		free(tools_json);
-		return 2;
+		print_http_error_body(cfg, &http);
+		goto done;
 	}
 
 	// Fail fast on invalid tool arguments.
 
-	for (size_t turn = 0; turn < max_turns; turn++) {
+	for (size_t t = 0; t < max_turns; t++) {
 		yyjson_doc *doc = yyjson_read(http.body, http.body_len, 0);
 		if (!doc)
 			break;
@@ -1711,17 +1973,22 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 
 		char *final = extract_first_output_text(root);
 		if (final) {
+			// Streamed text is already on stdout; only print it here if no deltas came in.
+			if (cfg->stream && !sctx.printed_text) {
+				fputs(final, stdout);
+				fflush(stdout);
+			}
 			if (out_final_response_json) {
+				free(*out_final_response_json);
 				*out_final_response_json = dup_cstr(http.body);
 			}
 			yyjson_doc_free(doc);
 			if (out_final_text)
 				*out_final_text = final;
-			aicli_openai_http_response_free(&http);
-			free(tools_json);
-			free(web_fetch_prefixes_buf);
-			aicli_paging_cache_destroy(tool_cache);
-			return 0;
+			else
+				free(final);
+			rc = 0;
+			goto done;
 		}
 
 		const char *resp_id = extract_response_id(root);
@@ -1736,292 +2003,99 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 			*out_final_response_json = dup_cstr(http.body);
 		}
 
-		exec_job_t *jobs = (exec_job_t *)calloc(max_tool_calls_per_turn, sizeof(exec_job_t));
-		list_job_t *ljobs = (list_job_t *)calloc(max_tool_calls_per_turn, sizeof(list_job_t));
-		web_search_job_t *sjobs = (web_search_job_t *)calloc(max_tool_calls_per_turn, sizeof(web_search_job_t));
-		web_fetch_job_t *fjobs = (web_fetch_job_t *)calloc(max_tool_calls_per_turn, sizeof(web_fetch_job_t));
-		cli_help_job_t *hjobs = (cli_help_job_t *)calloc(max_tool_calls_per_turn, sizeof(cli_help_job_t));
-		char **call_ids = (char **)calloc(max_tool_calls_per_turn, sizeof(char *));
-		char **items_json = (char **)calloc(max_tool_calls_per_turn, sizeof(char *));
-		if (!jobs || !ljobs || !sjobs || !fjobs || !hjobs || !call_ids || !items_json) {
-			free(jobs);
-			free(ljobs);
-			free(sjobs);
-			free(fjobs);
-			free(hjobs);
-			free(call_ids);
-			free(items_json);
-			yyjson_doc_free(doc);
-			break;
-		}
-
-		size_t exec_count = 0;
-		(void)collect_execute_calls(root, jobs, (const char **)call_ids, max_tool_calls_per_turn, &exec_count);
-
-		size_t list_count = 0;
-		size_t web_search_count = 0;
-		size_t web_fetch_count = 0;
-		size_t cli_help_count = 0;
-		{
-			yyjson_val *outarr = find_output_array(root);
-			if (outarr) {
-				size_t idx, max = yyjson_arr_size(outarr);
-				for (idx = 0; idx < max && (exec_count + list_count + web_search_count + web_fetch_count + cli_help_count) < max_tool_calls_per_turn; idx++) {
-					yyjson_val *item = yyjson_arr_get(outarr, idx);
-					if (!item || !yyjson_is_obj(item))
-						continue;
-					yyjson_val *type = yyjson_obj_get(item, "type");
-					const char *t = (type && yyjson_is_str(type)) ? yyjson_get_str(type) : NULL;
-					if (!t || strcmp(t, "function_call") != 0)
-						continue;
-					yyjson_val *name = yyjson_obj_get(item, "name");
-					const char *nstr = (name && yyjson_is_str(name)) ? yyjson_get_str(name) : NULL;
-					yyjson_val *call_id = yyjson_obj_get(item, "call_id");
-					const char *cid = (call_id && yyjson_is_str(call_id)) ? yyjson_get_str(call_id) : NULL;
-					if (!cid || !cid[0])
-						continue;
-					yyjson_val *args = yyjson_obj_get(item, "arguments");
-
-					if (nstr && strcmp(nstr, "list_allowed_files") == 0) {
-
-					ljobs[list_count].allow = allow;
-					ljobs[list_count].done = false;
-					ljobs[list_count].req = (aicli_list_allowed_files_request_t){0};
-					(void)parse_list_allowed_files_arguments(args, &ljobs[list_count].req);
-					(void)dup_list_request_strings(&ljobs[list_count].req);
-
-						call_ids[exec_count + list_count] = dup_cstr(cid);
-					list_count++;
-						continue;
-					}
-
-					if (nstr && strcmp(nstr, "web_search") == 0) {
-						sjobs[web_search_count].cfg = cfg;
-						sjobs[web_search_count].cache = tool_cache;
-						sjobs[web_search_count].done = false;
-						sjobs[web_search_count].req = (aicli_web_search_tool_request_t){0};
-						if (parse_web_search_arguments(args, &sjobs[web_search_count].req) == 0 &&
-						    dup_web_search_request_strings(&sjobs[web_search_count].req) == 0) {
-							call_ids[exec_count + list_count + web_search_count] = dup_cstr(cid);
-							web_search_count++;
-						} else {
-							free_web_search_request_owned(&sjobs[web_search_count].req);
-						}
-						continue;
-					}
+		// Streamed calls were started by stream_on_event; this picks up the rest
+		// (and everything in non-streaming mode).
+		tool_turn_start_all(&turn, root);
 
-					if (nstr && strcmp(nstr, "web_fetch") == 0) {
-						fjobs[web_fetch_count].cfg = cfg;
-						fjobs[web_fetch_count].cache = tool_cache;
-						fjobs[web_fetch_count].done = false;
-						fjobs[web_fetch_count].req = (aicli_web_fetch_tool_request_t){0};
-						if (parse_web_fetch_arguments(args, &fjobs[web_fetch_count].req) == 0 &&
-						    dup_web_fetch_request_strings(&fjobs[web_fetch_count].req) == 0) {
-							// apply prefix allowlist from env
-							fjobs[web_fetch_count].req.allowed_prefixes = web_fetch_prefixes;
-							fjobs[web_fetch_count].req.allowed_prefix_count = web_fetch_prefix_count;
-							fjobs[web_fetch_count].req.max_body_bytes = 1024 * 1024;
-							fjobs[web_fetch_count].req.timeout_seconds = 15L;
-							fjobs[web_fetch_count].req.connect_timeout_seconds = 10L;
-							fjobs[web_fetch_count].req.max_redirects = 0;
-
-							call_ids[exec_count + list_count + web_search_count + web_fetch_count] = dup_cstr(cid);
-							web_fetch_count++;
-						} else {
-							free_web_fetch_request_owned(&fjobs[web_fetch_count].req);
-						}
-						continue;
-					}
-
-					if (nstr && strcmp(nstr, "cli_help") == 0) {
-						hjobs[cli_help_count].done = false;
-						hjobs[cli_help_count].topic = NULL;
-						hjobs[cli_help_count].start = 0;
-						hjobs[cli_help_count].size = 0;
-						(void)parse_cli_help_arguments(args, &hjobs[cli_help_count].topic,
-						                             &hjobs[cli_help_count].start,
-						                             &hjobs[cli_help_count].size);
-						call_ids[exec_count + list_count + web_search_count + web_fetch_count + cli_help_count] = dup_cstr(cid);
-						cli_help_count++;
-						continue;
-					}
-				}
-			}
-		}
-
-		size_t call_count = exec_count + list_count + web_search_count + web_fetch_count + cli_help_count;
-		if (call_count == 0) {
+		if (turn.count == 0) {
 			const char *bad_call_id = find_first_execute_call_id(root);
 			if (bad_call_id && bad_call_id[0]) {
 				fprintf(stderr,
 				        "openai tool call invalid: execute arguments missing required 'command' (call_id=%s)\n",
 				        safe_str(bad_call_id));
 			}
-			free(jobs);
-			free(ljobs);
-			free(sjobs);
-			free(fjobs);
-			free(hjobs);
-			for (size_t k = 0; k < max_tool_calls_per_turn; k++)
-				free(call_ids[k]);
-			free(call_ids);
-			free(items_json);
 			yyjson_doc_free(doc);
-			aicli_openai_http_response_free(&http);
-			free(tools_json);
-			free(web_fetch_prefixes_buf);
-			aicli_paging_cache_destroy(tool_cache);
-			return 2;
+			goto done;
 		}
 
-		aicli_threadpool_t *tp = aicli_threadpool_create(tool_threads);
-		if (!tp) {
-			free(jobs);
-			free(call_ids);
+		char **items_json = (char **)calloc(turn.count, sizeof(char *));
+		aicli_threadpool_future_t **waiting =
+		    (aicli_threadpool_future_t **)calloc(turn.count, sizeof(*waiting));
+		if (!items_json || !waiting) {
 			free(items_json);
+			free(waiting);
 			yyjson_doc_free(doc);
 			break;
 		}
-
-		for (size_t i = 0; i < exec_count; i++) {
-			jobs[i].allow = allow;
-			(void)aicli_threadpool_submit(tp, exec_job_main, &jobs[i]);
-		}
-		for (size_t i = 0; i < list_count; i++) {
-			(void)aicli_threadpool_submit(tp, list_job_main, &ljobs[i]);
-		}
-		for (size_t i = 0; i < web_search_count; i++) {
-			(void)aicli_threadpool_submit(tp, web_search_job_main, &sjobs[i]);
-		}
-		for (size_t i = 0; i < web_fetch_count; i++) {
-			(void)aicli_threadpool_submit(tp, web_fetch_job_main, &fjobs[i]);
-		}
-		for (size_t i = 0; i < cli_help_count; i++) {
-			(void)aicli_threadpool_submit(tp, cli_help_job_main, &hjobs[i]);
-		}
-		aicli_threadpool_drain(tp);
-		aicli_threadpool_destroy(tp);
-
-		if (cfg && debug_level_enabled(cfg->debug_function_call) && cfg->debug_function_call >= 2) {
-			size_t maxb = debug_max_bytes_for_level(cfg->debug_function_call);
-			for (size_t i = 0; i < call_count; i++) {
-				fprintf(stderr, "[debug:function_call] execute result call_id=%s exit_code=%d truncated=%d total_bytes=%zu\n",
-				        safe_str(call_ids[i]), jobs[i].res.exit_code, jobs[i].res.truncated ? 1 : 0,
-				        jobs[i].res.total_bytes);
-				if (jobs[i].res.stderr_text && jobs[i].res.stderr_text[0])
-					debug_print_trunc(stderr, "[debug:function_call] execute stderr", jobs[i].res.stderr_text, maxb);
-				if (cfg->debug_function_call >= 3 && jobs[i].res.stdout_text && jobs[i].res.stdout_text[0])
-					debug_print_trunc(stderr, "[debug:function_call] execute stdout", jobs[i].res.stdout_text, maxb);
-			}
-		}
-
-		for (size_t i = 0; i < exec_count; i++) {
-			items_json[i] = build_function_call_output_item_json(call_ids[i], &jobs[i].res);
-		}
-		for (size_t i = 0; i < list_count; i++) {
-			items_json[exec_count + i] = build_function_call_output_item_json_raw(call_ids[exec_count + i],
-			                                                                   ljobs[i].res.json);
-		}
-		for (size_t i = 0; i < web_search_count; i++) {
-			items_json[exec_count + list_count + i] =
-			    build_function_call_output_item_json(call_ids[exec_count + list_count + i], &sjobs[i].res);
-		}
-		for (size_t i = 0; i < web_fetch_count; i++) {
-			items_json[exec_count + list_count + web_search_count + i] =
-			    build_function_call_output_item_json(call_ids[exec_count + list_count + web_search_count + i],
-			                                        &fjobs[i].res);
-		}
-		for (size_t i = 0; i < cli_help_count; i++) {
-			items_json[exec_count + list_count + web_search_count + web_fetch_count + i] =
-			    build_function_call_output_item_json(
-			        call_ids[exec_count + list_count + web_search_count + web_fetch_count + i],
-			        &hjobs[i].res);
-		}
-		for (size_t i = 0; i < call_count; i++) {
-			if (!items_json[i] || !items_json[i][0]) {
-				fprintf(stderr,
-				        "openai tool call failed: could not serialize tool output (call_id=%s)\n",
-				        safe_str(call_ids[i]));
-				for (size_t k = 0; k < call_count; k++) {
-					if (k < exec_count) {
-						if (jobs[k].res.stdout_text)
-							free((void *)jobs[k].res.stdout_text);
-						free_execute_request_owned(&jobs[k].req);
-					}
-					if (k >= exec_count && k < (exec_count + list_count)) {
-						size_t li = k - exec_count;
-						aicli_list_allowed_files_result_free(&ljobs[li].res);
-						free_list_request_owned(&ljobs[li].req);
-					}
-					free(items_json[k]);
-					free(call_ids[k]);
+		size_t item_count = turn.count;
+		bool items_ok = true;
+		// Serialize outputs in completion order while slower calls are still running;
+		// items_json keeps the request order. Calls still running when the turn's
+		// budget runs out are cancelled and answered with a timeout result.
+		size_t remaining = item_count;
+		while (items_ok && remaining > 0) {
+			size_t nwaiting = 0;
+			for (size_t i = 0; i < item_count; i++) {
+				tool_call_t *c = turn.calls[i];
+				if (items_json[i])
+					continue;
+				if (!c->timed_out && !aicli_threadpool_future_ready(&c->done)) {
+					waiting[nwaiting++] = &c->done;
+					continue;
 				}
-				free(items_json);
-				free(jobs);
-				free(ljobs);
-				free(sjobs);
-				free(fjobs);
-				free(call_ids);
-				yyjson_doc_free(doc);
-				aicli_openai_http_response_free(&http);
-				free(tools_json);
-				free(web_fetch_prefixes_buf);
-				aicli_paging_cache_destroy(tool_cache);
-				return 2;
-			}
-		}
-		if (cfg && cfg->debug_api >= 3) {
-			for (size_t i = 0; i < call_count; i++) {
+				// Skipped by the pool after the deadline: answer it as the timeout it is.
+				if (!c->timed_out && !tool_call_ran(c))
+					c->timed_out = true;
+				items_json[i] = tool_call_output_item_json(c);
 				if (!items_json[i] || !items_json[i][0]) {
-					fprintf(stderr, "[debug:api] WARN: tool output item NULL/empty for call_id=%s\n", safe_str(call_ids[i]));
-				} else {
+					fprintf(stderr,
+					        "openai tool call failed: could not serialize tool output (call_id=%s)\n",
+					        safe_str(c->call_id));
+					items_ok = false;
+					break;
+				}
+				remaining--;
+				aicli_tool_budget_consume(&turn.output, strlen(items_json[i]));
+				if (cfg && cfg->debug_api >= 3) {
 					size_t maxb = debug_max_bytes_for_level(cfg->debug_api);
 					if (maxb == 0)
 						maxb = 4096;
 					debug_print_trunc(stderr, "[debug:api] tool output item", items_json[i], maxb);
 				}
 			}
+			if (!items_ok || remaining == 0)
+				break;
+			if (aicli_threadpool_future_wait_any_until(turn.pool, waiting, nwaiting,
+			                                           turn.deadline_ms) < nwaiting)
+				continue;
+			for (size_t i = 0; i < item_count; i++) {
+				tool_call_t *c = turn.calls[i];
+				if (items_json[i] || aicli_threadpool_future_ready(&c->done))
+					continue;
+				aicli_cancel_request(&c->cancel);
+				c->timed_out = true;
+				if (cfg && debug_level_enabled(cfg->debug_function_call))
+					fprintf(stderr, "[debug:function_call] timeout call_id=%s budget_ms=%ld\n",
+					        safe_str(c->call_id), turn.budget_ms);
+			}
 		}
-
-		char *next_payload = build_next_request_json(model, resp_id, tools_json,
-		                                           (const char **)items_json, call_count);
-		for (size_t i = 0; i < exec_count; i++) {
-			if (jobs[i].res.stdout_text)
-				free((void *)jobs[i].res.stdout_text);
-			free_execute_request_owned(&jobs[i].req);
-		}
-		for (size_t i = 0; i < list_count; i++) {
-			aicli_list_allowed_files_result_free(&ljobs[i].res);
-			free_list_request_owned(&ljobs[i].req);
-		}
-		for (size_t i = 0; i < web_search_count; i++) {
-			if (sjobs[i].res.stdout_text)
-				free((void *)sjobs[i].res.stdout_text);
-			free_web_search_request_owned(&sjobs[i].req);
-		}
-		for (size_t i = 0; i < web_fetch_count; i++) {
-			if (fjobs[i].res.stdout_text)
-				free((void *)fjobs[i].res.stdout_text);
-			free_web_fetch_request_owned(&fjobs[i].req);
-		}
-		for (size_t i = 0; i < cli_help_count; i++) {
-			if (hjobs[i].res.stdout_text)
-				free((void *)hjobs[i].res.stdout_text);
-			free(hjobs[i].topic);
-		}
-		for (size_t i = 0; i < call_count; i++) {
+		free(waiting);
+		if (items_ok)
+			debug_log_tool_results(cfg, &turn);
+
+		char *next_payload = NULL;
+		if (items_ok)
+			next_payload = build_next_request_json(model, resp_id, tools_json,
+			                                       (const char **)items_json, item_count,
+			                                       cfg->stream);
+		for (size_t i = 0; i < item_count; i++)
 			free(items_json[i]);
-			free(call_ids[i]);
-		}
 		free(items_json);
-		free(jobs);
-		free(call_ids);
-		free(hjobs);
-		free(ljobs);
-		free(sjobs);
-		free(fjobs);
+		tool_turn_reset(&turn);
 		yyjson_doc_free(doc);
 
+		if (!items_ok)
+			goto done;
 		if (!next_payload)
 			break;
 
@@ -2033,13 +2107,18 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 				maxb = 4096;
 			debug_print_trunc(stderr, "[debug:api] follow-up payload", next_payload, maxb);
 		}
-		rc = aicli_openai_responses_post_raw_json(cfg->openai_api_key, cfg->openai_base_url,
-		                                       next_payload, &http);
+		sctx.printed_text = false;
+		if (cfg->stream)
+			prc = aicli_openai_responses_stream_raw_json(cfg->openai_api_key, cfg->openai_base_url,
+			                                          next_payload, stream_on_event, &sctx, &http);
+		else
+			prc = aicli_openai_responses_post_raw_json(cfg->openai_api_key, cfg->openai_base_url,
+			                                        next_payload, &http);
 		free(next_payload);
-		if (rc != 0) {
+		if (prc != 0) {
 			if (cfg && debug_level_enabled(cfg->debug_api)) {
 				fprintf(stderr, "[debug:api] follow-up request failed rc=%d http_status=%d body_len=%zu\n",
-				        rc, http.http_status, http.body_len);
+				        prc, http.http_status, http.body_len);
 				if (http.body && http.body_len) {
 					size_t maxb = debug_max_bytes_for_level(cfg->debug_api);
 					if (maxb == 0)
@@ -2052,29 +2131,32 @@ int aicli_openai_run_with_tools(const aicli_config_t *cfg,
 		if (cfg && debug_level_enabled(cfg->debug_api))
 			fprintf(stderr, "[debug:api] follow-up response http_status=%d body_len=%zu\n", http.http_status, http.body_len);
 		if (http.http_status != 200 || !http.body || http.body_len == 0) {
-			fprintf(stderr, "openai http_status=%d\n", http.http_status);
-			if (http.body && http.body_len) {
-				size_t n = http.body_len;
-				size_t maxb = debug_max_bytes_for_level(cfg ? cfg->debug_api : 0);
-				if (maxb == 0)
-					maxb = 2048;
-				if (n > maxb)
-					n = maxb;
-				fwrite(http.body, 1, n, stderr);
-				fputc('\n', stderr);
-				if (n < http.body_len)
-					fprintf(stderr, "... (truncated, %zu bytes total)\n", http.body_len);
-			}
+			print_http_error_body(cfg, &http);
 			break;
 		}
 	}
+
+done:
+	// Calls started by a stream that ended early may still be running, and the jobs of
+	// timed-out calls use the allowlist and cache owned by this run.
+	tool_turn_reset(&turn);
+	tool_turn_reap_orphans(&turn, true);
+	free(turn.orphans);
+	free(turn.calls);
 	aicli_openai_http_response_free(&http);
-	free(tools_json);
 	free(web_fetch_prefixes_buf);
-	aicli_paging_cache_destroy(tool_cache);
-	if (out_final_response_json) {
+	if (tool_cache && debug_level_enabled(cfg->debug_function_call)) {
+		aicli_paging_cache_stats_t cs;
+		aicli_paging_cache_stats_get(tool_cache, &cs);
+		fprintf(stderr,
+		        "[debug:cache] hits=%lu misses=%lu insertions=%lu evictions=%lu entries=%zu bytes=%zu\n",
+		        cs.hits, cs.misses, cs.insertions, cs.evictions, cs.entries, cs.bytes);
+	}
+	aicli_paging_cache_close(tool_cache);
+	aicli_paging_cache_destroy(web_cache);
+	if (rc != 0 && out_final_response_json) {
 		free(*out_final_response_json);
 		*out_final_response_json = NULL;
 	}
-	return 2;
+	return rc;
 }
@@ -1,22 +1,59 @@
 #include "paging_cache.h"
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define SHARD_COUNT 8
+
 typedef struct aicli_paging_cache_entry {
 	char *key;
+	uint64_t hash;
+	size_t bytes; // accounted size: value + key
 	aicli_paging_cache_value_t v;
-	struct aicli_paging_cache_entry *prev;
+	struct aicli_paging_cache_entry *chain; // next in hash bucket
+	struct aicli_paging_cache_entry *prev;  // LRU list
 	struct aicli_paging_cache_entry *next;
 } aicli_paging_cache_entry_t;
 
-struct aicli_paging_cache {
-	size_t max_entries;
+typedef struct {
+	pthread_mutex_t mu;
+	aicli_paging_cache_entry_t **buckets;
+	size_t bucket_count; // power of two
 	size_t entry_count;
+	size_t bytes;
 	aicli_paging_cache_entry_t *head; // MRU
 	aicli_paging_cache_entry_t *tail; // LRU
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long insertions;
+	unsigned long evictions;
+} cache_shard_t;
+
+struct aicli_paging_cache {
+	size_t max_entries_per_shard;
+	size_t max_bytes_per_shard;
+	cache_shard_t shards[SHARD_COUNT];
 };
 
+static uint64_t hash_key(const char *key)
+{
+	// FNV-1a
+	uint64_t h = 1469598103934665603ULL;
+	for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static cache_shard_t *shard_for(aicli_paging_cache_t *c, uint64_t h)
+{
+	// The low bits pick the bucket inside a shard; use the high bits here.
+	return &c->shards[(h >> 56) % SHARD_COUNT];
+}
+
 static void entry_free(aicli_paging_cache_entry_t *e)
 {
 	if (!e)
@@ -26,54 +63,105 @@ static void entry_free(aicli_paging_cache_entry_t *e)
 	free(e);
 }
 
-static void detach(aicli_paging_cache_t *c, aicli_paging_cache_entry_t *e)
+static void detach(cache_shard_t *s, aicli_paging_cache_entry_t *e)
 {
-	if (!c || !e)
-		return;
 	if (e->prev)
 		e->prev->next = e->next;
 	else
-		c->head = e->next;
+		s->head = e->next;
 	if (e->next)
 		e->next->prev = e->prev;
 	else
-		c->tail = e->prev;
+		s->tail = e->prev;
 	e->prev = NULL;
 	e->next = NULL;
 }
 
-static void attach_front(aicli_paging_cache_t *c, aicli_paging_cache_entry_t *e)
+static void attach_front(cache_shard_t *s, aicli_paging_cache_entry_t *e)
 {
-	if (!c || !e)
-		return;
 	e->prev = NULL;
-	e->next = c->head;
-	if (c->head)
-		c->head->prev = e;
-	c->head = e;
-	if (!c->tail)
-		c->tail = e;
+	e->next = s->head;
+	if (s->head)
+		s->head->prev = e;
+	s->head = e;
+	if (!s->tail)
+		s->tail = e;
 }
 
-static aicli_paging_cache_entry_t *find_entry(aicli_paging_cache_t *c, const char *key)
+static aicli_paging_cache_entry_t **bucket_slot(cache_shard_t *s, const char *key, uint64_t h)
 {
-	if (!c || !key)
-		return NULL;
-	for (aicli_paging_cache_entry_t *e = c->head; e; e = e->next) {
-		if (e->key && strcmp(e->key, key) == 0)
-			return e;
+	aicli_paging_cache_entry_t **pp = &s->buckets[h & (s->bucket_count - 1)];
+	while (*pp && !((*pp)->hash == h && strcmp((*pp)->key, key) == 0))
+		pp = &(*pp)->chain;
+	return pp;
+}
+
+static void bucket_unlink(cache_shard_t *s, aicli_paging_cache_entry_t *e)
+{
+	aicli_paging_cache_entry_t **pp = bucket_slot(s, e->key, e->hash);
+	if (*pp == e)
+		*pp = e->chain;
+	e->chain = NULL;
+}
+
+static void shard_remove(cache_shard_t *s, aicli_paging_cache_entry_t *e)
+{
+	bucket_unlink(s, e);
+	detach(s, e);
+	s->entry_count--;
+	s->bytes -= e->bytes;
+	entry_free(e);
+}
+
+static bool shard_grow(cache_shard_t *s)
+{
+	size_t n = s->bucket_count * 2;
+	aicli_paging_cache_entry_t **nb =
+	    (aicli_paging_cache_entry_t **)calloc(n, sizeof(*nb));
+	if (!nb)
+		return false;
+	for (size_t i = 0; i < s->bucket_count; i++) {
+		aicli_paging_cache_entry_t *e = s->buckets[i];
+		while (e) {
+			aicli_paging_cache_entry_t *next = e->chain;
+			size_t bi = e->hash & (n - 1);
+			e->chain = nb[bi];
+			nb[bi] = e;
+			e = next;
+		}
 	}
-	return NULL;
+	free(s->buckets);
+	s->buckets = nb;
+	s->bucket_count = n;
+	return true;
 }
 
-aicli_paging_cache_t *aicli_paging_cache_create(size_t max_entries)
+aicli_paging_cache_t *aicli_paging_cache_create(size_t max_entries, size_t max_bytes)
 {
 	if (max_entries == 0)
-		max_entries = 64;
+		max_entries = AICLI_PAGING_CACHE_DEFAULT_ENTRIES;
+	if (max_bytes == 0)
+		max_bytes = AICLI_PAGING_CACHE_DEFAULT_BYTES;
 	aicli_paging_cache_t *c = (aicli_paging_cache_t *)calloc(1, sizeof(*c));
 	if (!c)
 		return NULL;
-	c->max_entries = max_entries;
+	// Limits are split evenly across shards (rounded up so small caches still work).
+	c->max_entries_per_shard = (max_entries + SHARD_COUNT - 1) / SHARD_COUNT;
+	c->max_bytes_per_shard = (max_bytes + SHARD_COUNT - 1) / SHARD_COUNT;
+	for (size_t i = 0; i < SHARD_COUNT; i++) {
+		cache_shard_t *s = &c->shards[i];
+		s->bucket_count = 8;
+		s->buckets = (aicli_paging_cache_entry_t **)calloc(s->bucket_count, sizeof(*s->buckets));
+		if (!s->buckets || pthread_mutex_init(&s->mu, NULL) != 0) {
+			free(s->buckets);
+			for (size_t j = 0; j < i; j++) {
+				pthread_mutex_destroy(&c->shards[j].mu);
+				free(c->shards[j].buckets);
+			}
+			free(c);
+			return NULL;
+		}
+	}
 	return c;
 }
 
@@ -81,32 +169,79 @@ void aicli_paging_cache_destroy(aicli_paging_cache_t *c)
 {
 	if (!c)
 		return;
-	aicli_paging_cache_entry_t *e = c->head;
-	while (e) {
-		aicli_paging_cache_entry_t *n = e->next;
-		entry_free(e);
-		e = n;
+	for (size_t i = 0; i < SHARD_COUNT; i++) {
+		cache_shard_t *s = &c->shards[i];
+		aicli_paging_cache_entry_t *e = s->head;
+		while (e) {
+			aicli_paging_cache_entry_t *n = e->next;
+			entry_free(e);
+			e = n;
+		}
+		free(s->buckets);
+		pthread_mutex_destroy(&s->mu);
 	}
 	free(c);
 }
 
-bool aicli_paging_cache_get(const aicli_paging_cache_t *c0, const char *key,
-			   aicli_paging_cache_value_t *out_value)
+static aicli_paging_cache_t *g_process;
+
+void aicli_paging_cache_set_process(aicli_paging_cache_t *c)
+{
+	g_process = c;
+}
+
+aicli_paging_cache_t *aicli_paging_cache_process(void)
+{
+	return g_process;
+}
+
+aicli_paging_cache_t *aicli_paging_cache_open(void)
+{
+	return g_process ? g_process : aicli_paging_cache_create(0, 0);
+}
+
+void aicli_paging_cache_close(aicli_paging_cache_t *c)
+{
+	if (c != g_process)
+		aicli_paging_cache_destroy(c);
+}
+
+bool aicli_paging_cache_copy_range(aicli_paging_cache_t *c, const char *key, size_t start,
+				   size_t size, char **out_buf, size_t *out_len,
+				   size_t *out_total)
 {
-	if (out_value)
-		memset(out_value, 0, sizeof(*out_value));
-	if (!c0 || !key || !key[0])
+	if (!c || !key || !key[0] || !out_buf || !out_len || !out_total)
 		return false;
-	// Cast away const to update LRU order.
-	aicli_paging_cache_t *c = (aicli_paging_cache_t *)c0;
-	aicli_paging_cache_entry_t *e = find_entry(c, key);
-	if (!e)
+	uint64_t h = hash_key(key);
+	cache_shard_t *s = shard_for(c, h);
+	pthread_mutex_lock(&s->mu);
+	aicli_paging_cache_entry_t *e = *bucket_slot(s, key, h);
+	if (!e) {
+		s->misses++;
+		pthread_mutex_unlock(&s->mu);
+		return false;
+	}
+	detach(s, e);
+	attach_front(s, e);
+
+	if (start > e->v.len)
+		start = e->v.len;
+	size_t n = e->v.len - start;
+	if (n > size)
+		n = size;
+	char *buf = (char *)malloc(n + 1);
+	if (!buf) {
+		pthread_mutex_unlock(&s->mu);
 		return false;
-	// Move to front.
-	detach(c, e);
-	attach_front(c, e);
-	if (out_value)
-		*out_value = e->v;
+	}
+	if (n > 0)
+		memcpy(buf, e->v.data + start, n);
+	buf[n] = '\0';
+	s->hits++;
+	*out_buf = buf;
+	*out_len = n;
+	*out_total = e->v.total_bytes;
+	pthread_mutex_unlock(&s->mu);
 	return true;
 }
 
@@ -138,41 +273,65 @@ bool aicli_paging_cache_put(aicli_paging_cache_t *c, const char *key,
 {
 	if (!c || !key || !key[0])
 		return false;
-
-	aicli_paging_cache_entry_t *e = find_entry(c, key);
-	if (e) {
-		// Update existing.
-	free(e->v.data);
-	if (!value_deep_copy(value, &e->v)) {
-		memset(&e->v, 0, sizeof(e->v));
+	size_t key_len = strlen(key);
+	size_t bytes = key_len + 1 + ((value && value->data) ? value->len + 1 : 0);
+	if (bytes > c->max_bytes_per_shard)
 		return false;
-	}
-		detach(c, e);
-		attach_front(c, e);
-		return true;
-	}
-
-	// Evict if needed.
-	while (c->entry_count >= c->max_entries && c->tail) {
-		aicli_paging_cache_entry_t *victim = c->tail;
-		detach(c, victim);
-		entry_free(victim);
-		c->entry_count--;
-	}
 
-	e = (aicli_paging_cache_entry_t *)calloc(1, sizeof(*e));
+	// Copy outside the lock; only list/index updates happen under it.
+	aicli_paging_cache_entry_t *e = (aicli_paging_cache_entry_t *)calloc(1, sizeof(*e));
 	if (!e)
 		return false;
-	e->key = strdup(key);
-	if (!e->key) {
+	e->key = (char *)malloc(key_len + 1);
+	if (!e->key || !value_deep_copy(value, &e->v)) {
 		entry_free(e);
 		return false;
 	}
-	if (!value_deep_copy(value, &e->v)) {
-		entry_free(e);
-		return false;
+	memcpy(e->key, key, key_len + 1);
+	e->hash = hash_key(key);
+	e->bytes = bytes;
+
+	cache_shard_t *s = shard_for(c, e->hash);
+	pthread_mutex_lock(&s->mu);
+	aicli_paging_cache_entry_t *old = *bucket_slot(s, key, e->hash);
+	if (old)
+		shard_remove(s, old);
+
+	while (s->tail && (s->entry_count >= c->max_entries_per_shard ||
+	                   s->bytes + bytes > c->max_bytes_per_shard)) {
+		shard_remove(s, s->tail);
+		s->evictions++;
 	}
-	attach_front(c, e);
-	c->entry_count++;
+
+	if (s->entry_count >= s->bucket_count)
+		(void)shard_grow(s); // a failed grow only makes chains longer
+	aicli_paging_cache_entry_t **slot = &s->buckets[e->hash & (s->bucket_count - 1)];
+	e->chain = *slot;
+	*slot = e;
+	attach_front(s, e);
+	s->entry_count++;
+	s->bytes += bytes;
+	s->insertions++;
+	pthread_mutex_unlock(&s->mu);
 	return true;
 }
+
+void aicli_paging_cache_stats_get(aicli_paging_cache_t *c, aicli_paging_cache_stats_t *out)
+{
+	if (!out)
+		return;
+	memset(out, 0, sizeof(*out));
+	if (!c)
+		return;
+	for (size_t i = 0; i < SHARD_COUNT; i++) {
+		cache_shard_t *s = &c->shards[i];
+		pthread_mutex_lock(&s->mu);
+		out->hits += s->hits;
+		out->misses += s->misses;
+		out->insertions += s->insertions;
+		out->evictions += s->evictions;
+		out->entries += s->entry_count;
+		out->bytes += s->bytes;
+		pthread_mutex_unlock(&s->mu);
+	}
+}
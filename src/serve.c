@@ -0,0 +1,501 @@
+#include "serve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cancel.h"
+
+#define WIRE_MAGIC 0x32434941u // "AIC2"
+
+// Client -> daemon: header (carrying the three descriptors), then `len` bytes of
+// NUL-terminated strings: cwd, argv[0] .. argv[argc-1], env[0] .. env[envc-1].
+// Daemon -> client: int32 exit code.
+typedef struct {
+	uint32_t magic;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t reserved;
+	int64_t sid;
+	uint64_t len;
+} wire_header_t;
+
+extern char **environ;
+
+static volatile sig_atomic_t g_stop;
+
+static void on_stop_signal(int sig)
+{
+	(void)sig;
+	g_stop = 1;
+}
+
+static bool set_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD);
+	return flags >= 0 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0;
+}
+
+static bool socket_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	size_t n = strlen(path);
+	if (n == 0 || n >= sizeof(addr->sun_path))
+		return false;
+	memcpy(addr->sun_path, path, n + 1);
+	return true;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+	while (len > 0) {
+		ssize_t w = send(fd, p, len, MSG_NOSIGNAL);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		p += w;
+		len -= (size_t)w;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t len)
+{
+	char *p = (char *)data;
+	while (len > 0) {
+		ssize_t r = read(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+// ---- daemon ----
+
+typedef struct {
+	int conn;
+	int wake;  // read end of the daemon's wake pipe
+	aicli_cancel_t *cancel;
+} hangup_watch_t;
+
+// The client sends nothing after its request, so the connection only becomes readable
+// once the client is gone.
+static void *hangup_watch_main(void *arg)
+{
+	hangup_watch_t *w = (hangup_watch_t *)arg;
+	struct pollfd fds[2] = {
+	    {.fd = w->conn, .events = POLLIN},
+	    {.fd = w->wake, .events = POLLIN},
+	};
+	for (;;) {
+		int n = poll(fds, 2, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 || fds[1].revents)
+			break;
+		if (fds[0].revents) {
+			aicli_cancel_request(w->cancel);
+			break;
+		}
+	}
+	return NULL;
+}
+
+// Receives the header and the client's descriptors. fds[] is filled with -1 first.
+static bool recv_header(int conn, wire_header_t *h, int fds[3])
+{
+	fds[0] = fds[1] = fds[2] = -1;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct iovec iov = {.iov_base = h, .iov_len = sizeof(*h)};
+	struct msghdr msg = {
+	    .msg_iov = &iov,
+	    .msg_iovlen = 1,
+	    .msg_control = control.buf,
+	    .msg_controllen = sizeof(control.buf),
+	};
+	ssize_t r;
+	do {
+		r = recvmsg(conn, &msg, 0);
+	} while (r < 0 && errno == EINTR);
+	if (r <= 0)
+		return false;
+
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		int got[3];
+		memcpy(got, CMSG_DATA(c), (n < 3 ? n : 3) * sizeof(int));
+		for (size_t i = 0; i < n && i < 3; i++) {
+			fds[i] = got[i];
+			(void)set_cloexec(got[i]);
+		}
+	}
+	bool ok = !(msg.msg_flags & MSG_CTRUNC) && fds[0] >= 0 && fds[1] >= 0 && fds[2] >= 0;
+	// The rest of a short first read belongs to the header too.
+	if (ok && (size_t)r < sizeof(*h))
+		ok = read_all(conn, (char *)h + r, sizeof(*h) - (size_t)r);
+	return ok && h->magic == WIRE_MAGIC && h->argc > 0 && h->len <= AICLI_SERVE_MAX_REQUEST &&
+	       h->envc <= AICLI_SERVE_MAX_REQUEST / 2;
+}
+
+// Splits the payload into cwd, argv and envp. One allocation holds both NULL-terminated
+// vectors (req->argv owns it); their strings point into payload.
+static bool parse_payload(char *payload, size_t len, const wire_header_t *h,
+                          aicli_serve_request_t *req)
+{
+	if (len == 0 || payload[len - 1] != '\0')
+		return false;
+	size_t count = (size_t)h->argc + (size_t)h->envc;
+	char **vec = (char **)calloc(count + 2, sizeof(char *));
+	if (!vec)
+		return false;
+	char *p = payload;
+	char *end = payload + len;
+	req->cwd = p;
+	p += strlen(p) + 1;
+	for (size_t i = 0, out = 0; i < count; i++, out++) {
+		if (p >= end) {
+			free(vec);
+			return false;
+		}
+		if (i == h->argc)
+			out++; // argv's terminator
+		vec[out] = p;
+		p += strlen(p) + 1;
+	}
+	req->argc = (int)h->argc;
+	req->argv = vec;
+	req->envp = vec + h->argc + 1;
+	return p == end;
+}
+
+typedef struct {
+	aicli_serve_handler_fn fn;
+	void *arg;
+	int home_dir;  // the daemon's working directory
+	int saved[3];  // the daemon's own stdin/stdout/stderr
+	int wake[2];
+} server_t;
+
+static int run_request(server_t *sv, const aicli_serve_request_t *req, int conn, const int fds[3])
+{
+	if (chdir(req->cwd) != 0) {
+		dprintf(fds[2], "aicli serve: cannot enter %s: %s\n", req->cwd, strerror(errno));
+		return 2;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < 3; i++)
+		(void)dup2(fds[i], i);
+	// The command sees the client's environment (API keys, AICLI_* settings, HOME), as
+	// it would running in the client. Requests run one at a time and the pool workers
+	// read the environment only on behalf of the running request, so swapping the
+	// vector is safe; nothing calls setenv while it is swapped.
+	char **daemon_env = environ;
+	environ = req->envp;
+
+	aicli_cancel_t cancel;
+	aicli_cancel_init(&cancel, 0);
+	hangup_watch_t w = {.conn = conn, .wake = sv->wake[0], .cancel = &cancel};
+	pthread_t watcher;
+	bool watching = pthread_create(&watcher, NULL, hangup_watch_main, &w) == 0;
+	const aicli_cancel_t *prev = aicli_cancel_set_current(&cancel);
+
+	int rc = sv->fn(req, sv->arg);
+
+	(void)aicli_cancel_set_current(prev);
+	if (watching) {
+		char c = 0;
+		while (write(sv->wake[1], &c, 1) < 0 && errno == EINTR)
+			;
+		pthread_join(watcher, NULL);
+		while (read(sv->wake[0], &c, 1) < 0 && errno == EINTR)
+			;
+	}
+
+	environ = daemon_env;
+	fflush(stdout);
+	fflush(stderr);
+	clearerr(stdout);
+	clearerr(stderr);
+	for (int i = 0; i < 3; i++)
+		(void)dup2(sv->saved[i], i);
+	(void)fchdir(sv->home_dir);
+	return rc;
+}
+
+static void serve_connection(server_t *sv, int conn)
+{
+	wire_header_t h;
+	int fds[3];
+	char *payload = NULL;
+	aicli_serve_request_t req = {0};
+
+	if (!recv_header(conn, &h, fds))
+		goto done;
+	payload = (char *)malloc((size_t)h.len + 1);
+	if (!payload || !read_all(conn, payload, (size_t)h.len))
+		goto done;
+	if (!parse_payload(payload, (size_t)h.len, &h, &req)) {
+		dprintf(fds[2], "aicli serve: malformed request\n");
+		goto done;
+	}
+	req.sid = (long)h.sid;
+
+	int32_t rc = (int32_t)run_request(sv, &req, conn, fds);
+	(void)write_all(conn, &rc, sizeof(rc));
+
+done:
+	free(req.argv);
+	free(payload);
+	for (int i = 0; i < 3; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+}
+
+// Binds a fresh listening socket at path. Refuses to take over a live daemon's socket
+// or to remove anything that is not a socket.
+static int listen_at(const char *path)
+{
+	struct sockaddr_un addr;
+	if (!socket_address(path, &addr)) {
+		fprintf(stderr, "aicli serve: socket path too long: %s\n", path);
+		return -1;
+	}
+
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "aicli serve: %s exists and is not a socket\n", path);
+			return -1;
+		}
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			close(probe);
+			fprintf(stderr, "aicli serve: already serving on %s\n", path);
+			return -1;
+		}
+		if (probe >= 0)
+			close(probe);
+		(void)unlink(path);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || !set_cloexec(fd)) {
+		fprintf(stderr, "aicli serve: socket: %s\n", strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	// Connecting needs write permission on the socket: 0600 keeps other users out.
+	mode_t old_mask = umask(077);
+	int brc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_mask);
+	if (brc != 0 || listen(fd, 64) != 0) {
+		fprintf(stderr, "aicli serve: cannot listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int aicli_serve(const char *socket_path, aicli_serve_handler_fn fn, void *arg)
+{
+	if (!socket_path || !fn)
+		return 2;
+
+	server_t sv = {.fn = fn, .arg = arg, .home_dir = -1, .saved = {-1, -1, -1}, .wake = {-1, -1}};
+	int rc = 2;
+	int lfd = listen_at(socket_path);
+	if (lfd < 0)
+		return 2;
+
+	sv.home_dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	bool ok = sv.home_dir >= 0 && pipe(sv.wake) == 0;
+	for (int i = 0; ok && i < 3; i++) {
+		sv.saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+		ok = sv.saved[i] >= 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "aicli serve: setup failed: %s\n", strerror(errno));
+		goto done;
+	}
+	(void)set_cloexec(sv.wake[0]);
+	(void)set_cloexec(sv.wake[1]);
+
+	// Writes to a client that went away must fail, not kill the daemon. No SA_RESTART:
+	// a stop signal has to interrupt accept().
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!g_stop) {
+		int conn = accept(lfd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "aicli serve: accept: %s\n", strerror(errno));
+			goto done;
+		}
+		(void)set_cloexec(conn);
+		serve_connection(&sv, conn);
+		close(conn);
+	}
+	rc = 0;
+
+done:
+	close(lfd);
+	(void)unlink(socket_path);
+	for (int i = 0; i < 3; i++) {
+		if (sv.saved[i] >= 0)
+			close(sv.saved[i]);
+	}
+	for (int i = 0; i < 2; i++) {
+		if (sv.wake[i] >= 0)
+			close(sv.wake[i]);
+	}
+	if (sv.home_dir >= 0)
+		close(sv.home_dir);
+	return rc;
+}
+
+// ---- client ----
+
+bool aicli_serve_forward(const char *socket_path, int argc, char **argv, int *out_rc)
+{
+	if (!socket_path || !socket_path[0] || argc <= 0 || !argv || !out_rc)
+		return false;
+	struct sockaddr_un addr;
+	if (!socket_address(socket_path, &addr))
+		return false;
+
+	char *cwd = getcwd(NULL, 0);
+	if (!cwd)
+		return false;
+	size_t envc = 0;
+	size_t len = strlen(cwd) + 1;
+	for (int i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	for (char **e = environ; e && *e; e++, envc++)
+		len += strlen(*e) + 1;
+	if (len > AICLI_SERVE_MAX_REQUEST) {
+		free(cwd);
+		return false;
+	}
+	char *payload = (char *)malloc(len);
+	if (!payload) {
+		free(cwd);
+		return false;
+	}
+	char *p = payload;
+	size_t n = strlen(cwd) + 1;
+	memcpy(p, cwd, n);
+	p += n;
+	free(cwd);
+	for (int i = 0; i < argc; i++) {
+		n = strlen(argv[i]) + 1;
+		memcpy(p, argv[i], n);
+		p += n;
+	}
+	for (size_t i = 0; i < envc; i++) {
+		n = strlen(environ[i]) + 1;
+		memcpy(p, environ[i], n);
+		p += n;
+	}
+
+	// A closed standard descriptor cannot be passed; the daemon gets /dev/null instead.
+	int fds[3];
+	int opened[3] = {-1, -1, -1};
+	for (int i = 0; i < 3; i++) {
+		fds[i] = i;
+		if (fcntl(i, F_GETFD) < 0) {
+			opened[i] = open("/dev/null", i == 0 ? O_RDONLY : O_WRONLY);
+			fds[i] = opened[i];
+		}
+	}
+
+	bool taken = false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || fds[0] < 0 ||
+	    fds[1] < 0 || fds[2] < 0)
+		goto done;
+
+	wire_header_t h = {
+	    .magic = WIRE_MAGIC,
+	    .argc = (uint32_t)argc,
+	    .envc = (uint32_t)envc,
+	    .sid = (int64_t)getsid(0),
+	    .len = (uint64_t)len,
+	};
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	struct iovec iov = {.iov_base = &h, .iov_len = sizeof(h)};
+	struct msghdr msg = {
+	    .msg_iov = &iov,
+	    .msg_iovlen = 1,
+	    .msg_control = control.buf,
+	    .msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	ssize_t w;
+	do {
+		w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (w < 0 && errno == EINTR);
+	if (w < 0)
+		goto done;
+
+	// From here on the command may be running: never fall back to running it again.
+	taken = true;
+	int32_t rc = 2;
+	if ((size_t)w < sizeof(h) && !write_all(fd, (char *)&h + w, sizeof(h) - (size_t)w)) {
+		fprintf(stderr, "aicli: lost the connection to the daemon\n");
+	} else if (!write_all(fd, payload, len) || !read_all(fd, &rc, sizeof(rc))) {
+		fprintf(stderr, "aicli: lost the connection to the daemon\n");
+		rc = 2;
+	}
+	*out_rc = (int)rc;
+
+done:
+	if (fd >= 0)
+		close(fd);
+	for (int i = 0; i < 3; i++) {
+		if (opened[i] >= 0)
+			close(opened[i]);
+	}
+	free(payload);
+	return taken;
+}
@@ -1,73 +1,156 @@
 #include "threadpool.h"
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
-typedef struct job {
+typedef struct {
 	aicli_threadpool_job_fn fn;
 	void *arg;
-	struct job *next;
+	aicli_threadpool_future_t *future;
+	const aicli_cancel_t *cancel;
 } job_t;
 
+// Bounded ring: the owner pushes/pops at the tail, thieves take from the head.
+typedef struct {
+	pthread_mutex_t mu;
+	job_t ring[AICLI_THREADPOOL_DEQUE_CAP];
+	size_t head; // oldest job
+	size_t len;
+} deque_t;
+
+typedef struct {
+	aicli_threadpool_t *pool;
+	size_t index;
+	pthread_t thread;
+	deque_t dq;
+} worker_t;
+
 struct aicli_threadpool {
-	pthread_t *threads;
+	worker_t *workers;
 	size_t thread_count;
+	atomic_size_t next_victim; // round-robin target for external submits
 
 	pthread_mutex_t mu;
 	pthread_cond_t cv_has_work;
-	pthread_cond_t cv_drained;
+	pthread_cond_t cv_done; // a job finished (futures, drain); CLOCK_MONOTONIC
 
-	job_t *head;
-	job_t *tail;
-	size_t pending;
-	size_t running;
+	atomic_size_t queued;  // jobs sitting in deques
+	size_t active;         // queued + running; guarded by mu
 	bool stop;
 };
 
-static void job_free_list(job_t *j)
+// Worker the current thread belongs to, if any (nested submits go to its own deque).
+static _Thread_local worker_t *tls_worker;
+
+static bool deque_push(deque_t *d, const job_t *j)
+{
+	pthread_mutex_lock(&d->mu);
+	if (d->len == AICLI_THREADPOOL_DEQUE_CAP) {
+		pthread_mutex_unlock(&d->mu);
+		return false;
+	}
+	d->ring[(d->head + d->len) % AICLI_THREADPOOL_DEQUE_CAP] = *j;
+	d->len++;
+	pthread_mutex_unlock(&d->mu);
+	return true;
+}
+
+static bool deque_pop_tail(deque_t *d, job_t *out)
+{
+	pthread_mutex_lock(&d->mu);
+	if (d->len == 0) {
+		pthread_mutex_unlock(&d->mu);
+		return false;
+	}
+	d->len--;
+	*out = d->ring[(d->head + d->len) % AICLI_THREADPOOL_DEQUE_CAP];
+	pthread_mutex_unlock(&d->mu);
+	return true;
+}
+
+static bool deque_steal_head(deque_t *d, job_t *out)
 {
-	while (j) {
-		job_t *n = j->next;
-		free(j);
-		j = n;
+	pthread_mutex_lock(&d->mu);
+	if (d->len == 0) {
+		pthread_mutex_unlock(&d->mu);
+		return false;
 	}
+	*out = d->ring[d->head];
+	d->head = (d->head + 1) % AICLI_THREADPOOL_DEQUE_CAP;
+	d->len--;
+	pthread_mutex_unlock(&d->mu);
+	return true;
+}
+
+static bool find_job(worker_t *w, job_t *out)
+{
+	aicli_threadpool_t *p = w->pool;
+	if (deque_pop_tail(&w->dq, out))
+		return true;
+	for (size_t k = 1; k < p->thread_count; k++) {
+		worker_t *victim = &p->workers[(w->index + k) % p->thread_count];
+		if (deque_steal_head(&victim->dq, out))
+			return true;
+	}
+	return false;
+}
+
+static void job_finished(aicli_threadpool_t *p, aicli_threadpool_future_t *f)
+{
+	pthread_mutex_lock(&p->mu);
+	if (f)
+		atomic_store_explicit(&f->done, true, memory_order_release);
+	p->active--;
+	pthread_cond_broadcast(&p->cv_done);
+	pthread_mutex_unlock(&p->mu);
 }
 
 static void *worker_main(void *arg)
 {
-	aicli_threadpool_t *p = (aicli_threadpool_t *)arg;
+	worker_t *w = (worker_t *)arg;
+	aicli_threadpool_t *p = w->pool;
+	tls_worker = w;
 
 	for (;;) {
-		pthread_mutex_lock(&p->mu);
-		while (!p->stop && p->head == NULL) {
-			pthread_cond_wait(&p->cv_has_work, &p->mu);
+		job_t j;
+		if (find_job(w, &j)) {
+			atomic_fetch_sub(&p->queued, 1);
+			if (!aicli_cancel_requested(j.cancel)) {
+				const aicli_cancel_t *prev = aicli_cancel_set_current(j.cancel);
+				j.fn(j.arg);
+				(void)aicli_cancel_set_current(prev);
+			}
+			job_finished(p, j.future);
+			continue;
 		}
-		if (p->stop) {
-			pthread_mutex_unlock(&p->mu);
-			break;
-		}
-		job_t *j = p->head;
-		p->head = j->next;
-		if (!p->head)
-			p->tail = NULL;
-		p->pending--;
-		p->running++;
-		pthread_mutex_unlock(&p->mu);
-
-		j->fn(j->arg);
-		free(j);
-
 		pthread_mutex_lock(&p->mu);
-		p->running--;
-		if (p->pending == 0 && p->running == 0) {
-			pthread_cond_broadcast(&p->cv_drained);
-		}
+		while (!p->stop && atomic_load(&p->queued) == 0)
+			pthread_cond_wait(&p->cv_has_work, &p->mu);
+		bool stop = p->stop;
 		pthread_mutex_unlock(&p->mu);
+		if (stop)
+			break;
 	}
 	return NULL;
 }
 
+static void pool_free(aicli_threadpool_t *p, size_t started)
+{
+	for (size_t i = 0; i < started; i++)
+		pthread_join(p->workers[i].thread, NULL);
+	for (size_t i = 0; i < p->thread_count; i++)
+		pthread_mutex_destroy(&p->workers[i].dq.mu);
+	pthread_cond_destroy(&p->cv_has_work);
+	pthread_cond_destroy(&p->cv_done);
+	pthread_mutex_destroy(&p->mu);
+	free(p->workers);
+	free(p);
+}
+
 aicli_threadpool_t *aicli_threadpool_create(size_t threads)
 {
 	if (threads == 0)
@@ -77,8 +160,8 @@ aicli_threadpool_t *aicli_threadpool_create(size_t threads)
 	if (!p)
 		return NULL;
 
-	p->threads = (pthread_t *)calloc(threads, sizeof(pthread_t));
-	if (!p->threads) {
+	p->workers = (worker_t *)calloc(threads, sizeof(worker_t));
+	if (!p->workers) {
 		free(p);
 		return NULL;
 	}
@@ -86,18 +169,24 @@ aicli_threadpool_t *aicli_threadpool_create(size_t threads)
 
 	pthread_mutex_init(&p->mu, NULL);
 	pthread_cond_init(&p->cv_has_work, NULL);
-	pthread_cond_init(&p->cv_drained, NULL);
+	pthread_condattr_t ca;
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&p->cv_done, &ca);
+	pthread_condattr_destroy(&ca);
+	for (size_t i = 0; i < threads; i++) {
+		p->workers[i].pool = p;
+		p->workers[i].index = i;
+		pthread_mutex_init(&p->workers[i].dq.mu, NULL);
+	}
 
 	for (size_t i = 0; i < threads; i++) {
-		if (pthread_create(&p->threads[i], NULL, worker_main, p) != 0) {
+		if (pthread_create(&p->workers[i].thread, NULL, worker_main, &p->workers[i]) != 0) {
+			pthread_mutex_lock(&p->mu);
 			p->stop = true;
-			for (size_t j = 0; j < i; j++)
-				pthread_join(p->threads[j], NULL);
-			pthread_cond_destroy(&p->cv_has_work);
-			pthread_cond_destroy(&p->cv_drained);
-			pthread_mutex_destroy(&p->mu);
-			free(p->threads);
-			free(p);
+			pthread_cond_broadcast(&p->cv_has_work);
+			pthread_mutex_unlock(&p->mu);
+			pool_free(p, i);
 			return NULL;
 		}
 	}
@@ -105,6 +194,79 @@ aicli_threadpool_t *aicli_threadpool_create(size_t threads)
 	return p;
 }
 
+// Shared pools by size. A daemon serves runs with different --tool-threads, and each
+// gets the width it asked for (1 still means one call at a time).
+#define SHARED_POOLS_MAX 16
+
+static pthread_mutex_t g_shared_mu = PTHREAD_MUTEX_INITIALIZER;
+static aicli_threadpool_t *g_shared[SHARED_POOLS_MAX];
+static size_t g_shared_count;
+
+aicli_threadpool_t *aicli_threadpool_shared(size_t threads)
+{
+	if (threads == 0)
+		threads = 1;
+	pthread_mutex_lock(&g_shared_mu);
+	aicli_threadpool_t *p = NULL;
+	for (size_t i = 0; i < g_shared_count && !p; i++) {
+		if (g_shared[i]->thread_count == threads)
+			p = g_shared[i];
+	}
+	if (!p && g_shared_count < SHARED_POOLS_MAX) {
+		p = aicli_threadpool_create(threads);
+		if (p)
+			g_shared[g_shared_count++] = p;
+	}
+	// Out of slots (or threads): the narrowest pool at least as wide, else the widest.
+	if (!p) {
+		for (size_t i = 0; i < g_shared_count; i++) {
+			aicli_threadpool_t *q = g_shared[i];
+			bool q_fits = q->thread_count >= threads;
+			bool p_fits = p && p->thread_count >= threads;
+			if (!p || (q_fits && (!p_fits || q->thread_count < p->thread_count)) ||
+			    (!q_fits && !p_fits && q->thread_count > p->thread_count))
+				p = q;
+		}
+	}
+	pthread_mutex_unlock(&g_shared_mu);
+	return p;
+}
+
+static pthread_once_t g_compute_once = PTHREAD_ONCE_INIT;
+static aicli_threadpool_t *g_compute;
+
+static void compute_create(void)
+{
+	// The thread calling aicli_threadpool_parallel_for() works too, so one worker fewer
+	// than there are CPUs keeps every core busy. AICLI_COMPUTE_THREADS overrides the CPU
+	// count (1 turns data-parallel execution off).
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *v = getenv("AICLI_COMPUTE_THREADS");
+	if (v && v[0]) {
+		char *end = NULL;
+		errno = 0;
+		long x = strtol(v, &end, 10);
+		if (errno == 0 && end && *end == '\0' && x > 0)
+			cpus = x;
+	}
+	if (cpus < 2)
+		return;
+	if (cpus > AICLI_THREADPOOL_COMPUTE_MAX)
+		cpus = AICLI_THREADPOOL_COMPUTE_MAX;
+	g_compute = aicli_threadpool_create((size_t)cpus - 1);
+}
+
+aicli_threadpool_t *aicli_threadpool_compute(void)
+{
+	pthread_once(&g_compute_once, compute_create);
+	return g_compute;
+}
+
+size_t aicli_threadpool_size(const aicli_threadpool_t *p)
+{
+	return p ? p->thread_count : 0;
+}
+
 void aicli_threadpool_destroy(aicli_threadpool_t *p)
 {
 	if (!p)
@@ -115,60 +277,267 @@ void aicli_threadpool_destroy(aicli_threadpool_t *p)
 	pthread_cond_broadcast(&p->cv_has_work);
 	pthread_mutex_unlock(&p->mu);
 
-	for (size_t i = 0; i < p->thread_count; i++)
-		pthread_join(p->threads[i], NULL);
+	pool_free(p, p->thread_count);
+}
+
+// Places one job on a deque without waking anyone. Returns false if all are full.
+static bool enqueue(aicli_threadpool_t *p, const job_t *j)
+{
+	worker_t *self = (tls_worker && tls_worker->pool == p) ? tls_worker : NULL;
+	if (self && deque_push(&self->dq, j))
+		return true;
+	size_t start = atomic_fetch_add(&p->next_victim, 1);
+	for (size_t k = 0; k < p->thread_count; k++) {
+		if (deque_push(&p->workers[(start + k) % p->thread_count].dq, j))
+			return true;
+	}
+	return false;
+}
 
+// Queues tasks[0..n); returns how many were queued (a prefix). Wakes workers once.
+static size_t enqueue_many(aicli_threadpool_t *p, const aicli_threadpool_task_t *tasks, size_t n,
+                           int *err)
+{
+	*err = 0;
 	pthread_mutex_lock(&p->mu);
-	job_free_list(p->head);
-	p->head = NULL;
-	p->tail = NULL;
-	p->pending = 0;
-	p->running = 0;
+	if (p->stop) {
+		pthread_mutex_unlock(&p->mu);
+		*err = 3;
+		return 0;
+	}
+	// Count jobs before they become visible, so a fast worker cannot take the
+	// counters below zero; the ones that do not fit are rolled back below.
+	p->active += n;
+	atomic_fetch_add(&p->queued, n);
 	pthread_mutex_unlock(&p->mu);
 
-	pthread_cond_destroy(&p->cv_has_work);
-	pthread_cond_destroy(&p->cv_drained);
-	pthread_mutex_destroy(&p->mu);
+	size_t queued = 0;
+	for (; queued < n; queued++) {
+		job_t j = { tasks[queued].fn, tasks[queued].arg, tasks[queued].future,
+		            tasks[queued].cancel };
+		if (!enqueue(p, &j)) {
+			*err = 1;
+			break;
+		}
+	}
 
-	free(p->threads);
-	free(p);
+	pthread_mutex_lock(&p->mu);
+	p->active -= n - queued;
+	atomic_fetch_sub(&p->queued, n - queued);
+	if (queued == 1)
+		pthread_cond_signal(&p->cv_has_work);
+	else if (queued > 1)
+		pthread_cond_broadcast(&p->cv_has_work);
+	if (queued < n)
+		pthread_cond_broadcast(&p->cv_done); // drain may be waiting on the rollback
+	pthread_mutex_unlock(&p->mu);
+	return queued;
 }
 
 int aicli_threadpool_submit(aicli_threadpool_t *p, aicli_threadpool_job_fn fn, void *arg)
 {
 	if (!p || !fn)
 		return 2;
+	aicli_threadpool_task_t t = { fn, arg, NULL, NULL };
+	int err = 0;
+	(void)enqueue_many(p, &t, 1, &err);
+	return err;
+}
 
-	job_t *j = (job_t *)calloc(1, sizeof(*j));
-	if (!j)
-		return 1;
-	j->fn = fn;
-	j->arg = arg;
+int aicli_threadpool_try_submit(aicli_threadpool_t *p, const aicli_threadpool_task_t *task)
+{
+	if (!p || !task || !task->fn)
+		return 2;
+	bool was_done = task->future && atomic_load(&task->future->done);
+	if (task->future)
+		atomic_init(&task->future->done, false);
+	int err = 0;
+	if (enqueue_many(p, task, 1, &err) == 1)
+		return 0;
+	if (task->future)
+		atomic_store(&task->future->done, was_done);
+	return err;
+}
 
-	pthread_mutex_lock(&p->mu);
-	if (p->stop) {
-		pthread_mutex_unlock(&p->mu);
-		free(j);
-		return 3;
-	}
-	if (p->tail)
-		p->tail->next = j;
-	else
-		p->head = j;
-	p->tail = j;
-	p->pending++;
-	pthread_cond_signal(&p->cv_has_work);
-	pthread_mutex_unlock(&p->mu);
+static void run_inline(const aicli_threadpool_task_t *t)
+{
+	if (!aicli_cancel_requested(t->cancel)) {
+		const aicli_cancel_t *prev = aicli_cancel_set_current(t->cancel);
+		t->fn(t->arg);
+		(void)aicli_cancel_set_current(prev);
+	}
+	if (t->future)
+		atomic_store_explicit(&t->future->done, true, memory_order_release);
+}
+
+int aicli_threadpool_submit_batch(aicli_threadpool_t *p, const aicli_threadpool_task_t *tasks,
+                                  size_t n)
+{
+	if (!tasks && n)
+		return 2;
+	for (size_t i = 0; i < n; i++) {
+		if (!tasks[i].fn)
+			return 2;
+		if (tasks[i].future)
+			atomic_init(&tasks[i].future->done, false);
+	}
+	size_t queued = 0;
+	if (p) {
+		int err = 0;
+		queued = enqueue_many(p, tasks, n, &err);
+	}
+	for (size_t i = queued; i < n; i++)
+		run_inline(&tasks[i]);
 	return 0;
 }
 
+int aicli_threadpool_submit_future(aicli_threadpool_t *p, aicli_threadpool_job_fn fn, void *arg,
+                                   aicli_threadpool_future_t *f)
+{
+	if (!fn || !f)
+		return 2;
+	aicli_threadpool_task_t t = { fn, arg, f, NULL };
+	return aicli_threadpool_submit_batch(p, &t, 1);
+}
+
+bool aicli_threadpool_future_ready(aicli_threadpool_future_t *f)
+{
+	return f && atomic_load_explicit(&f->done, memory_order_acquire);
+}
+
+size_t aicli_threadpool_future_wait_any_until(aicli_threadpool_t *p,
+                                              aicli_threadpool_future_t *const *fs, size_t n,
+                                              int64_t deadline_ms)
+{
+	if (n == 0)
+		return 0;
+	struct timespec until = { (time_t)(deadline_ms / 1000), (long)(deadline_ms % 1000) * 1000000L };
+	for (;;) {
+		for (size_t i = 0; i < n; i++) {
+			if (aicli_threadpool_future_ready(fs[i]))
+				return i;
+		}
+		if (!p)
+			return n; // nothing can complete them; callers only pass pool futures
+		if (deadline_ms != 0 && aicli_monotonic_ms() >= deadline_ms)
+			return n;
+		// Futures are set under p->mu, so re-checking under it cannot miss a wakeup.
+		pthread_mutex_lock(&p->mu);
+		bool any = false;
+		for (size_t i = 0; i < n && !any; i++)
+			any = aicli_threadpool_future_ready(fs[i]);
+		if (!any) {
+			if (deadline_ms != 0)
+				(void)pthread_cond_timedwait(&p->cv_done, &p->mu, &until);
+			else
+				pthread_cond_wait(&p->cv_done, &p->mu);
+		}
+		pthread_mutex_unlock(&p->mu);
+	}
+}
+
+size_t aicli_threadpool_future_wait_any(aicli_threadpool_t *p, aicli_threadpool_future_t *const *fs,
+                                        size_t n)
+{
+	return aicli_threadpool_future_wait_any_until(p, fs, n, 0);
+}
+
+void aicli_threadpool_future_wait(aicli_threadpool_t *p, aicli_threadpool_future_t *f)
+{
+	if (f)
+		(void)aicli_threadpool_future_wait_any(p, &f, 1);
+}
+
+// Shared by the caller of aicli_threadpool_parallel_for() and its helper jobs. A helper
+// may only start after the caller has returned (its queue was busy), so the context is
+// reference counted and the caller never waits for helpers, only for indices.
+typedef struct {
+	aicli_threadpool_for_fn fn;
+	void *arg; // valid while indices remain; never touched by a helper after that
+	size_t n;
+	const aicli_cancel_t *cancel;
+	atomic_size_t next;
+	atomic_size_t refs;
+	pthread_mutex_t mu;
+	pthread_cond_t cv;
+	size_t done; // guarded by mu
+} for_ctx_t;
+
+static void for_ctx_unref(for_ctx_t *c)
+{
+	if (atomic_fetch_sub(&c->refs, 1) != 1)
+		return;
+	pthread_cond_destroy(&c->cv);
+	pthread_mutex_destroy(&c->mu);
+	free(c);
+}
+
+static void for_run(for_ctx_t *c)
+{
+	for (size_t i; (i = atomic_fetch_add(&c->next, 1)) < c->n;) {
+		c->fn(c->arg, i);
+		pthread_mutex_lock(&c->mu);
+		if (++c->done == c->n)
+			pthread_cond_broadcast(&c->cv);
+		pthread_mutex_unlock(&c->mu);
+	}
+}
+
+static void for_helper(void *arg)
+{
+	for_ctx_t *c = (for_ctx_t *)arg;
+	const aicli_cancel_t *prev = aicli_cancel_set_current(c->cancel);
+	for_run(c);
+	(void)aicli_cancel_set_current(prev);
+	for_ctx_unref(c);
+}
+
+void aicli_threadpool_parallel_for(aicli_threadpool_t *p, size_t n, aicli_threadpool_for_fn fn,
+                                   void *arg)
+{
+	if (!fn || n == 0)
+		return;
+	size_t helpers = aicli_threadpool_size(p);
+	if (helpers > n - 1)
+		helpers = n - 1;
+	if (helpers > AICLI_THREADPOOL_COMPUTE_MAX)
+		helpers = AICLI_THREADPOOL_COMPUTE_MAX;
+	for_ctx_t *c = helpers ? (for_ctx_t *)calloc(1, sizeof(*c)) : NULL;
+	if (!c) {
+		for (size_t i = 0; i < n; i++)
+			fn(arg, i);
+		return;
+	}
+	c->fn = fn;
+	c->arg = arg;
+	c->n = n;
+	c->cancel = aicli_cancel_current();
+	atomic_init(&c->next, 0);
+	atomic_init(&c->refs, helpers + 1);
+	pthread_mutex_init(&c->mu, NULL);
+	pthread_cond_init(&c->cv, NULL);
+
+	// Helpers are not given the cancel token as a task token: a skipped job would
+	// never drop its reference. They install it themselves instead.
+	aicli_threadpool_task_t tasks[AICLI_THREADPOOL_COMPUTE_MAX];
+	for (size_t i = 0; i < helpers; i++)
+		tasks[i] = (aicli_threadpool_task_t){ for_helper, c, NULL, NULL };
+	(void)aicli_threadpool_submit_batch(p, tasks, helpers);
+
+	for_run(c);
+	pthread_mutex_lock(&c->mu);
+	while (c->done < n)
+		pthread_cond_wait(&c->cv, &c->mu);
+	pthread_mutex_unlock(&c->mu);
+	for_ctx_unref(c);
+}
+
 void aicli_threadpool_drain(aicli_threadpool_t *p)
 {
 	if (!p)
 		return;
 	pthread_mutex_lock(&p->mu);
-	while (p->pending != 0 || p->running != 0) {
-		pthread_cond_wait(&p->cv_drained, &p->mu);
-	}
+	while (p->active != 0)
+		pthread_cond_wait(&p->cv_done, &p->mu);
 	pthread_mutex_unlock(&p->mu);
 }
@@ -0,0 +1,54 @@
+#include "tool_budget.h"
+
+#include "aicli.h"
+
+void aicli_tool_budget_init(aicli_tool_budget_t *b, size_t turn_bytes, size_t run_bytes)
+{
+	b->turn_bytes = turn_bytes ? turn_bytes : AICLI_DEFAULT_TOOL_OUTPUT_TURN;
+	b->run_bytes = run_bytes ? run_bytes : AICLI_DEFAULT_TOOL_OUTPUT_RUN;
+	b->used = 0;
+	b->turn_left = 0;
+}
+
+void aicli_tool_budget_begin_turn(aicli_tool_budget_t *b)
+{
+	size_t run_left = b->run_bytes > b->used ? b->run_bytes - b->used : 0;
+	b->turn_left = b->turn_bytes < run_left / 2 ? b->turn_bytes : run_left / 2;
+}
+
+size_t aicli_tool_budget_page(aicli_tool_budget_t *b, size_t calls)
+{
+	size_t page = b->turn_left / (calls ? calls : 1);
+	if (page < AICLI_MAX_TOOL_BYTES)
+		page = AICLI_MAX_TOOL_BYTES;
+	if (page > AICLI_MAX_TOOL_PAGE_BYTES)
+		page = AICLI_MAX_TOOL_PAGE_BYTES;
+	b->turn_left -= page < b->turn_left ? page : b->turn_left;
+	return page;
+}
+
+void aicli_tool_budget_consume(aicli_tool_budget_t *b, size_t bytes)
+{
+	b->used = b->used > (size_t)-1 - bytes ? (size_t)-1 : b->used + bytes;
+}
+
+size_t aicli_tool_page_size(size_t size, size_t max_size)
+{
+	if (max_size == 0)
+		max_size = AICLI_MAX_TOOL_BYTES;
+	return size == 0 || size > max_size ? max_size : size;
+}
+
+size_t aicli_tool_page_trim(const char *page, size_t n)
+{
+	// Back over at most three continuation bytes to the lead byte of the last sequence.
+	size_t lead = n;
+	while (lead > 0 && n - lead < 3 && ((unsigned char)page[lead - 1] & 0xC0) == 0x80)
+		lead--;
+	if (lead <= 1)
+		return n;
+	lead--;
+	unsigned char c = (unsigned char)page[lead];
+	size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+	return need > n - lead ? lead : n;
+}
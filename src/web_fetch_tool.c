@@ -27,6 +27,7 @@ int aicli_web_fetch_tool_run(const aicli_config_t *cfg,
 	r.max_redirects = req->max_redirects;
 	r.start = req->start;
 	r.size = req->size;
+	r.max_size = req->max_size;
 	r.idempotency = req->idempotency;
 
 	aicli_web_fetch_result_t res;
@@ -29,6 +29,7 @@ int aicli_web_search_tool_run(const aicli_config_t *cfg,
 	r.width = 80;
 	r.start = req->start;
 	r.size = req->size;
+	r.max_size = req->max_size;
 	r.idempotency = req->idempotency;
 
 	aicli_web_search_result_t res;
@@ -4,10 +4,15 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "brave_search.h"
 #include "buf.h"
+#include "cancel.h"
+#include "disk_cache.h"
 #include "google_search.h"
+#include "http_client.h"
+#include "tool_budget.h"
 
 static const char *safe_str(const char *s) { return s ? s : ""; }
 
@@ -187,29 +192,21 @@ static char *dup_url_not_allowed_debug(const aicli_web_fetch_request_t *req)
 	return b.data;
 }
 
-static char *make_cache_key2(const char *prefix,
-                            const char *idem,
-                            const char *a,
-                            const char *b,
-                            size_t start,
-                            size_t size)
+static char *make_cache_key(const char *prefix, const char *const *fields, size_t field_count)
 {
-	char tmp[64];
-	snprintf(tmp, sizeof(tmp), "%zu:%zu", start, size);
-
+	// One entry per upstream response: paging (start/size) is applied when serving,
+	// so every page of a result is a slice of the same cached body.
+	// Fields are length-prefixed so values containing '|' cannot collide.
 	aicli_buf_t buf;
 	if (!aicli_buf_init(&buf, 256))
 		return NULL;
-	bool ok = true;
-	ok = ok && aicli_buf_append_str(&buf, prefix);
-	ok = ok && aicli_buf_append_str(&buf, "|");
-	ok = ok && aicli_buf_append_str(&buf, safe_str(idem));
-	ok = ok && aicli_buf_append_str(&buf, "|");
-	ok = ok && aicli_buf_append_str(&buf, safe_str(a));
-	ok = ok && aicli_buf_append_str(&buf, "|");
-	ok = ok && aicli_buf_append_str(&buf, safe_str(b));
-	ok = ok && aicli_buf_append_str(&buf, "|");
-	ok = ok && aicli_buf_append_str(&buf, tmp);
+	bool ok = aicli_buf_append_str(&buf, prefix);
+	for (size_t i = 0; ok && i < field_count; i++) {
+		const char *f = safe_str(fields[i]);
+		char len[32];
+		int n = snprintf(len, sizeof(len), "|%zu:", strlen(f));
+		ok = n > 0 && aicli_buf_append(&buf, len, (size_t)n) && aicli_buf_append_str(&buf, f);
+	}
 	ok = ok && aicli_buf_append(&buf, "\0", 1);
 	if (!ok) {
 		aicli_buf_free(&buf);
@@ -228,6 +225,8 @@ static void apply_paging_from_owned_bytes(const char *data, size_t total, size_t
 		start = total;
 	size_t remain = total - start;
 	size_t n = (remain < size) ? remain : size;
+	if (n < remain)
+		n = aicli_tool_page_trim(data + start, n);
 
 	char *buf = (char *)malloc(n + 1);
 	if (!buf) {
@@ -248,6 +247,61 @@ static void apply_paging_from_owned_bytes(const char *data, size_t total, size_t
 	out->next_start = start + n;
 }
 
+// A transfer aborted because the job's cancel token fired (deadline or explicit cancel).
+static bool set_timeout_if_cancelled(aicli_tool_result_t *out)
+{
+	if (!aicli_cancel_requested(aicli_cancel_current()))
+		return false;
+	out->stderr_text = "timeout";
+	out->exit_code = 124;
+	return true;
+}
+
+static bool apply_paging_from_cache(aicli_paging_cache_t *cache, const char *key, size_t start,
+                                    size_t size, aicli_tool_result_t *out)
+{
+	char *page = NULL;
+	size_t n = 0;
+	size_t total = 0;
+	if (!aicli_paging_cache_copy_range(cache, key, start, size, &page, &n, &total))
+		return false;
+	if (start > total)
+		start = total;
+	if (start + n < total) {
+		n = aicli_tool_page_trim(page, n);
+		page[n] = '\0';
+	}
+	out->stdout_text = page;
+	out->stdout_len = n;
+	out->exit_code = 0;
+	out->total_bytes = total;
+	out->truncated = (start + n) < total;
+	out->has_next_start = out->truncated;
+	out->next_start = start + n;
+	out->cache_hit = true;
+	return true;
+}
+
+// Serves a page from a disk cache entry and promotes its body into the in-memory cache,
+// so the remaining pages of this run do not touch the disk again.
+static void apply_paging_from_disk(aicli_paging_cache_t *cache, const char *key,
+                                   const aicli_disk_cache_entry_t *e, size_t start, size_t size,
+                                   aicli_tool_result_t *out)
+{
+	apply_paging_from_owned_bytes(e->body, e->body_len, start, size, out);
+	if (out->exit_code != 0)
+		return;
+	out->cache_hit = true;
+	if (cache && key) {
+		aicli_paging_cache_value_t v = {
+		    .data = (char *)e->body,
+		    .len = e->body_len,
+		    .total_bytes = e->body_len,
+		};
+		(void)aicli_paging_cache_put(cache, key, &v);
+	}
+}
+
 int aicli_web_search_run(const aicli_config_t *cfg,
                          aicli_paging_cache_t *cache,
                          const aicli_web_search_request_t *req,
@@ -263,9 +317,7 @@ int aicli_web_search_run(const aicli_config_t *cfg,
 		return 0;
 	}
 
-	size_t size = req->size ? req->size : AICLI_MAX_TOOL_BYTES;
-	if (size > AICLI_MAX_TOOL_BYTES)
-		size = AICLI_MAX_TOOL_BYTES;
+	size_t size = aicli_tool_page_size(req->size, req->max_size);
 
 	int provider = (int)req->provider;
 	if (provider == (int)AICLI_WEB_PROVIDER_AUTO)
@@ -278,14 +330,25 @@ int aicli_web_search_run(const aicli_config_t *cfg,
 	char cntbuf[32];
 	snprintf(cntbuf, sizeof(cntbuf), "count_%d", req->count);
 
-	char *key = make_cache_key2("web_search", req->idempotency, provbuf, req->query, req->start, size);
-	if (key && cache) {
-		aicli_paging_cache_value_t cv;
-		if (aicli_paging_cache_get(cache, key, &cv)) {
-			out->tool.cache_hit = true;
-			apply_paging_from_owned_bytes(cv.data, cv.total_bytes, req->start, size, &out->tool);
-			free(key);
-			return 0;
+	const char *key_fields[] = { req->idempotency, provbuf, req->query, cntbuf, req->lang,
+	                             req->freshness };
+	char *key = make_cache_key("web_search", key_fields, sizeof(key_fields) / sizeof(key_fields[0]));
+	if (key && cache && apply_paging_from_cache(cache, key, req->start, size, &out->tool)) {
+		free(key);
+		return 0;
+	}
+	aicli_disk_cache_t *disk = key ? aicli_disk_cache_default() : NULL;
+	if (disk) {
+		aicli_disk_cache_entry_t de;
+		if (aicli_disk_cache_lookup(disk, key, &de)) {
+			bool fresh = de.fresh;
+			if (fresh)
+				apply_paging_from_disk(cache, key, &de, req->start, size, &out->tool);
+			aicli_disk_cache_entry_release(&de);
+			if (fresh) {
+				free(key);
+				return 0;
+			}
 		}
 	}
 
@@ -306,12 +369,13 @@ int aicli_web_search_run(const aicli_config_t *cfg,
 		int rc = aicli_google_cse_search(cfg->google_api_key, cfg->google_cse_cx,
 		                                 req->query, req->count, NULL, &res);
 		if (rc != 0) {
-			if (res.error[0]) {
-				out->tool.stderr_text = dup_cstr(res.error);
-			} else {
-				out->tool.stderr_text = "google_cse search failed: check GOOGLE_API_KEY/GOOGLE_CSE_CX";
+			if (!set_timeout_if_cancelled(&out->tool)) {
+				if (res.error[0])
+					out->tool.stderr_text = dup_cstr(res.error);
+				else
+					out->tool.stderr_text = "google_cse search failed: check GOOGLE_API_KEY/GOOGLE_CSE_CX";
+				out->tool.exit_code = 2;
 			}
-			out->tool.exit_code = 2;
 			aicli_google_response_free(&res);
 			free(key);
 			return 0;
@@ -351,12 +415,13 @@ int aicli_web_search_run(const aicli_config_t *cfg,
 		int rc = aicli_brave_web_search(cfg->brave_api_key, req->query, req->count,
 		                               req->lang, req->freshness, &res);
 		if (rc != 0) {
-			if (res.error[0]) {
-				out->tool.stderr_text = dup_cstr(res.error);
-			} else {
-				out->tool.stderr_text = "brave search failed: check BRAVE_API_KEY";
+			if (!set_timeout_if_cancelled(&out->tool)) {
+				if (res.error[0])
+					out->tool.stderr_text = dup_cstr(res.error);
+				else
+					out->tool.stderr_text = "brave search failed: check BRAVE_API_KEY";
+				out->tool.exit_code = 2;
 			}
-			out->tool.exit_code = 2;
 			aicli_brave_response_free(&res);
 			free(key);
 			return 0;
@@ -394,18 +459,23 @@ int aicli_web_search_run(const aicli_config_t *cfg,
 		    .data = full,
 		    .len = full_len,
 		    .total_bytes = full_len,
-		    .truncated = (req->start + size) < full_len,
-		    .has_next_start = (req->start + size) < full_len,
-		    .next_start = req->start + size,
 		};
 		(void)aicli_paging_cache_put(cache, key, &v);
 	}
+	if (disk) {
+		aicli_disk_cache_meta_t meta = { .http_status = 200, .ttl_seconds = -1 };
+		(void)aicli_disk_cache_store(disk, key, full, full_len, &meta);
+	}
 	free(key);
 	// Note: tool.stdout_text is its own allocation, so we can free full now.
 	free(full);
 	return 0;
 }
 
+// Request headers are part of the web_fetch cache key.
+static const char k_fetch_accept[] =
+    "Accept: text/html,application/xhtml+xml,application/json,text/plain,*/*";
+
 typedef struct {
 	aicli_buf_t b;
 	size_t max_bytes;
@@ -428,6 +498,66 @@ static size_t fetch_write_cb(char *ptr, size_t size, size_t nmemb, void *userdat
 	return n;
 }
 
+// Response headers relevant to the disk cache (final response only).
+typedef struct {
+	char etag[AICLI_DISK_CACHE_VALIDATOR_MAX];
+	char last_modified[AICLI_DISK_CACHE_VALIDATOR_MAX];
+	long max_age; // -1 if absent
+	bool no_store;
+} fetch_headers_t;
+
+static bool header_value(const char *line, size_t len, const char *name, char *out, size_t cap)
+{
+	size_t n = strlen(name);
+	if (len <= n || strncasecmp(line, name, n) != 0 || line[n] != ':')
+		return false;
+	const char *v = line + n + 1;
+	const char *end = line + len;
+	while (v < end && (*v == ' ' || *v == '\t'))
+		v++;
+	while (end > v && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	size_t vlen = (size_t)(end - v);
+	if (vlen >= cap)
+		vlen = 0; // too long to be useful as a validator
+	memcpy(out, v, vlen);
+	out[vlen] = '\0';
+	return true;
+}
+
+static size_t fetch_header_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	fetch_headers_t *fh = (fetch_headers_t *)userdata;
+	size_t n = size * nmemb;
+	if (!fh)
+		return n;
+	if (n >= 5 && strncmp(ptr, "HTTP/", 5) == 0) {
+		// New response (e.g. after a redirect): forget the previous one's headers.
+		memset(fh, 0, sizeof(*fh));
+		fh->max_age = -1;
+		return n;
+	}
+	char cc[AICLI_DISK_CACHE_VALIDATOR_MAX];
+	if (header_value(ptr, n, "ETag", fh->etag, sizeof(fh->etag)) ||
+	    header_value(ptr, n, "Last-Modified", fh->last_modified, sizeof(fh->last_modified)))
+		return n;
+	if (header_value(ptr, n, "Cache-Control", cc, sizeof(cc))) {
+		for (const char *p = cc; *p;) {
+			while (*p == ' ' || *p == ',')
+				p++;
+			if (strncasecmp(p, "no-store", 8) == 0)
+				fh->no_store = true;
+			else if (strncasecmp(p, "no-cache", 8) == 0)
+				fh->max_age = 0;
+			else if (strncasecmp(p, "max-age=", 8) == 0)
+				fh->max_age = strtol(p + 8, NULL, 10);
+			while (*p && *p != ',')
+				p++;
+		}
+	}
+	return n;
+}
+
 int aicli_web_fetch_run(const aicli_config_t *cfg,
                         aicli_paging_cache_t *cache,
                         const aicli_web_fetch_request_t *req,
@@ -456,57 +586,90 @@ int aicli_web_fetch_run(const aicli_config_t *cfg,
 		return 0;
 	}
 
-	size_t size = req->size ? req->size : AICLI_MAX_TOOL_BYTES;
-	if (size > AICLI_MAX_TOOL_BYTES)
-		size = AICLI_MAX_TOOL_BYTES;
+	size_t size = aicli_tool_page_size(req->size, req->max_size);
 
-	char *key = make_cache_key2("web_fetch", req->idempotency, req->url, "", req->start, size);
-	if (key && cache) {
-		aicli_paging_cache_value_t cv;
-		if (aicli_paging_cache_get(cache, key, &cv)) {
-			out->tool.cache_hit = true;
-			apply_paging_from_owned_bytes(cv.data, cv.total_bytes, req->start, size, &out->tool);
-			free(key);
-			return 0;
-		}
+	char redirbuf[32];
+	snprintf(redirbuf, sizeof(redirbuf), "redirects_%d", req->max_redirects > 0 ? req->max_redirects : 0);
+	const char *key_fields[] = { req->idempotency, req->url, k_fetch_accept, redirbuf };
+	char *key = make_cache_key("web_fetch", key_fields, sizeof(key_fields) / sizeof(key_fields[0]));
+	if (key && cache && apply_paging_from_cache(cache, key, req->start, size, &out->tool)) {
+		free(key);
+		return 0;
 	}
 
-	CURL *curl = curl_easy_init();
-	if (!curl) {
-		out->tool.stderr_text = "curl_easy_init_failed";
-		out->tool.exit_code = 2;
+	// Disk cache: a fresh entry is served as is; a stale one with validators is kept
+	// around for a conditional request below.
+	aicli_disk_cache_t *disk = key ? aicli_disk_cache_default() : NULL;
+	aicli_disk_cache_entry_t de;
+	bool have_de = disk && aicli_disk_cache_lookup(disk, key, &de);
+	if (have_de && de.fresh) {
+		apply_paging_from_disk(cache, key, &de, req->start, size, &out->tool);
+		out->http_status = de.http_status;
+		out->content_type = de.content_type[0] ? dup_cstr(de.content_type) : NULL;
+		aicli_disk_cache_entry_release(&de);
 		free(key);
 		return 0;
 	}
+	if (have_de && !de.etag[0] && !de.last_modified[0]) {
+		aicli_disk_cache_entry_release(&de);
+		have_de = false;
+	}
 
+	CURL *curl = NULL;
+	struct curl_slist *headers = NULL;
 	fetch_buf_t fb;
 	memset(&fb, 0, sizeof(fb));
+	fetch_headers_t fh;
+	memset(&fh, 0, sizeof(fh));
+	fh.max_age = -1;
+
+	curl = aicli_http_easy_acquire();
+	if (!curl) {
+		out->tool.stderr_text = "curl_easy_init_failed";
+		out->tool.exit_code = 2;
+		goto done;
+	}
+
 	fb.max_bytes = req->max_body_bytes ? req->max_body_bytes : (1024 * 1024);
 	if (!aicli_buf_init(&fb.b, 8192)) {
-		curl_easy_cleanup(curl);
 		out->tool.stderr_text = "oom";
 		out->tool.exit_code = 1;
-		free(key);
-		return 0;
+		goto done;
 	}
 
-	struct curl_slist *headers = NULL;
-	headers = curl_slist_append(headers, "Accept: text/html,application/xhtml+xml,application/json,text/plain,*/*");
+	headers = curl_slist_append(headers, k_fetch_accept);
+	if (have_de) {
+		char cond[AICLI_DISK_CACHE_VALIDATOR_MAX + 32];
+		if (de.etag[0]) {
+			snprintf(cond, sizeof(cond), "If-None-Match: %s", de.etag);
+			headers = curl_slist_append(headers, cond);
+		}
+		if (de.last_modified[0]) {
+			snprintf(cond, sizeof(cond), "If-Modified-Since: %s", de.last_modified);
+			headers = curl_slist_append(headers, cond);
+		}
+	}
 
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 	curl_easy_setopt(curl, CURLOPT_URL, req->url);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fetch_write_cb);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &fb);
+	if (disk) {
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, fetch_header_cb);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &fh);
+	}
 	curl_easy_setopt(curl, CURLOPT_USERAGENT, "aicli/0.0.0");
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, req->timeout_seconds ? req->timeout_seconds : 15L);
 	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, req->connect_timeout_seconds ? req->connect_timeout_seconds : 10L);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, (req->max_redirects > 0) ? 1L : 0L);
 	curl_easy_setopt(curl, CURLOPT_MAXREDIRS, (long)((req->max_redirects > 0) ? req->max_redirects : 0));
 
-	CURLcode cc = curl_easy_perform(curl);
+	CURLcode cc = aicli_http_perform(curl);
 	if (cc != CURLE_OK) {
-		out->tool.stderr_text = dup_cstr(curl_easy_strerror(cc));
-		out->tool.exit_code = 2;
+		if (cc != CURLE_ABORTED_BY_CALLBACK || !set_timeout_if_cancelled(&out->tool)) {
+			out->tool.stderr_text = dup_cstr(curl_easy_strerror(cc));
+			out->tool.exit_code = 2;
+		}
 		goto done;
 	}
 
@@ -515,6 +678,21 @@ int aicli_web_fetch_run(const aicli_config_t *cfg,
 		(void)curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
 		out->http_status = (int)status;
 	}
+	if (have_de && out->http_status == 304) {
+		// Not modified: serve the stored body and restart its freshness lifetime.
+		out->http_status = de.http_status;
+		out->content_type = de.content_type[0] ? dup_cstr(de.content_type) : NULL;
+		apply_paging_from_disk(cache, key, &de, req->start, size, &out->tool);
+		aicli_disk_cache_meta_t meta = {
+		    .http_status = de.http_status,
+		    .content_type = de.content_type,
+		    .etag = fh.etag[0] ? fh.etag : de.etag,
+		    .last_modified = fh.last_modified[0] ? fh.last_modified : de.last_modified,
+		    .ttl_seconds = fh.max_age,
+		};
+		(void)aicli_disk_cache_store(disk, key, de.body, de.body_len, &meta);
+		goto done;
+	}
 	{
 		char *ct = NULL;
 		(void)curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &ct);
@@ -542,19 +720,27 @@ int aicli_web_fetch_run(const aicli_config_t *cfg,
 		    .data = full,
 		    .len = full_len,
 		    .total_bytes = full_len,
-		    .truncated = (req->start + size) < full_len,
-		    .has_next_start = (req->start + size) < full_len,
-		    .next_start = req->start + size,
 		};
 		(void)aicli_paging_cache_put(cache, key, &v);
 	}
+	if (disk && out->http_status == 200 && !fh.no_store) {
+		aicli_disk_cache_meta_t meta = {
+		    .http_status = out->http_status,
+		    .content_type = out->content_type,
+		    .etag = fh.etag,
+		    .last_modified = fh.last_modified,
+		    .ttl_seconds = fh.max_age,
+		};
+		(void)aicli_disk_cache_store(disk, key, full, full_len, &meta);
+	}
 	free(full);
 
 done:
+	if (have_de)
+		aicli_disk_cache_entry_release(&de);
 	free(key);
 	if (headers)
 		curl_slist_free_all(headers);
 	aicli_buf_free(&fb.b);
-	curl_easy_cleanup(curl);
 	return 0;
 }
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Minimal offline stand-in for POST /v1/responses used by run_tests.sh.
+
+Turn 1 asks for one `execute` call (COMMAND from argv); turn 2 answers with
+"TOOL:<first line of the tool stdout>". Supports both plain JSON and
+`stream: true` (server-sent events). Prints the bound port on stdout.
+
+With a second argument "paged", turn 1 reads bytes 0-8 of the command output,
+turn 2 reads bytes 8-16 and the answer is "TOOL:cache_hit=<bool> <line>".
+With "fetch" the same two pages are read through web_fetch from GET /doc on this
+server (body: COMMAND), and the answer also reports how many GETs were served.
+GET /doc sends an ETag and answers a matching If-None-Match with 304.
+With "slowfetch" turn 1 is one web_fetch of GET /slow, which takes 3 seconds; the answer
+falls back to the first line of stderr_text when stdout is empty.
+With "pagelen" the answer is "TOOL:bytes=<length of the returned page>".
+With "utf8" two 8-byte pages are read, the second from the first's next_start, and the
+answer is "TOOL:<first line of both pages joined>".
+"""
+import json
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
+
+COMMAND = sys.argv[1]
+MODE = sys.argv[2] if len(sys.argv) > 2 else ""
+PAGED = MODE in ("paged", "fetch", "utf8")
+GETS = 0
+FIRST_PAGE = ""
+
+
+def paged_call(call_id, start):
+    if MODE == "fetch":
+        name = "web_fetch"
+        args = {"url": "http://127.0.0.1:%d/doc" % server.server_address[1]}
+    else:
+        name = "execute"
+        args = {"command": COMMAND}
+    args.update({"start": start, "size": 8})
+    return {"type": "function_call", "name": name, "call_id": call_id, "arguments": json.dumps(args)}
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        global GETS
+        GETS += 1
+        if self.path == "/slow":
+            time.sleep(3)
+        body = COMMAND.encode()
+        etag = '"doc-1"'
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("ETag", etag)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        global FIRST_PAGE
+        n = int(self.headers.get("Content-Length", 0))
+        req = json.loads(self.rfile.read(n))
+        outputs = [i for i in req.get("input", []) if i.get("type") == "function_call_output"]
+        if outputs and PAGED and req.get("previous_response_id") == "resp_1":
+            first = json.loads(outputs[0]["output"])
+            FIRST_PAGE = first["stdout_text"]
+            start = first["next_start"] if MODE == "utf8" else 8
+            resp = {"id": "resp_1b", "output": [paged_call("call_2", start)]}
+            deltas = []
+        elif outputs:
+            result = json.loads(outputs[0]["output"])
+            text = "TOOL:" + (result["stdout_text"] or result["stderr_text"]).splitlines()[0]
+            if PAGED:
+                text = "TOOL:cache_hit=%s %s" % (json.dumps(result["cache_hit"]), result["stdout_text"].splitlines()[0])
+            if MODE == "fetch":
+                text += " gets=%d" % GETS
+            if MODE == "utf8":
+                text = "TOOL:" + (FIRST_PAGE + result["stdout_text"]).splitlines()[0]
+            if MODE == "pagelen":
+                text = "TOOL:bytes=%d" % len(result["stdout_text"])
+            resp = {"id": "resp_2", "output": [{"type": "message", "content": [{"type": "output_text", "text": text}]}]}
+            deltas = [text[:5], text[5:]]
+        else:
+            if PAGED:
+                call = paged_call("call_1", 0)
+            elif MODE == "slowfetch":
+                url = "http://127.0.0.1:%d/slow" % server.server_address[1]
+                call = {"type": "function_call", "name": "web_fetch", "call_id": "call_1",
+                        "arguments": json.dumps({"url": url})}
+            else:
+                call = {"type": "function_call", "name": "execute", "call_id": "call_1",
+                        "arguments": json.dumps({"command": COMMAND})}
+            resp = {"id": "resp_1", "output": [call]}
+            deltas = []
+
+        if not req.get("stream"):
+            body = json.dumps(resp).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+
+        def event(kind, data):
+            data["type"] = kind
+            payload = ("event: %s\ndata: %s\n\n" % (kind, json.dumps(data))).encode()
+            self.wfile.write(b"%x\r\n%s\r\n" % (len(payload), payload))
+            self.wfile.flush()
+
+        event("response.created", {"response": {"id": resp["id"]}})
+        for item in resp["output"]:
+            if item["type"] == "function_call":
+                event("response.output_item.done", {"item": item})
+        for d in deltas:
+            event("response.output_text.delta", {"delta": d})
+        event("response.completed", {"response": resp})
+        self.wfile.write(b"0\r\n\r\n")
+        self.wfile.flush()
+
+
+class Server(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+server = Server(("127.0.0.1", 0), Handler)
+print(server.server_address[1], flush=True)
+server.serve_forever()
@@ -22,7 +22,7 @@ mkdir -p "$tmpdir"
 assert_contains() {
 	local hay="$1"
 	local needle="$2"
-	echo "$hay" | grep -F -q -- "$needle" || {
+	grep -F -q -- "$needle" <<<"$hay" || {
 		echo "assert_contains failed: expected '$needle'" >&2
 		echo "--- output ---" >&2
 		echo "$hay" >&2
@@ -33,7 +33,7 @@ assert_contains() {
 assert_not_contains() {
 	local hay="$1"
 	local needle="$2"
-	if echo "$hay" | grep -F -q -- "$needle"; then
+	if grep -F -q -- "$needle" <<<"$hay"; then
 		echo "assert_not_contains failed: did not expect '$needle'" >&2
 		echo "--- output ---" >&2
 		echo "$hay" >&2
@@ -80,6 +80,11 @@ test -n "$last"
 printf "b\na\nc\n" > "$tmpdir/sort.txt"
 sorted=$("$bin" _exec --file "$tmpdir/sort.txt" "cat $tmpdir/sort.txt | sort" 2>/dev/null | tr -d '\r')
 test "$sorted" = $'a\nb\nc'
+printf "b 10\na 9\nc 10\nb 10\n" > "$tmpdir/sort2.txt"
+sorted2=$("$bin" _exec --file "$tmpdir/sort2.txt" "cat $tmpdir/sort2.txt | sort -u -k2,2n" 2>/dev/null | tr -d '\r')
+test "$sorted2" = $'a 9\nb 10'
+sorted3=$("$bin" _exec --file "$tmpdir/sort2.txt" "cat $tmpdir/sort2.txt | sort -rn -k 2" 2>/dev/null | tr -d '\r')
+test "$sorted3" = $'c 10\nb 10\nb 10\na 9'
 
 # pipe: grep
 printf "foo\nbar\nfoo bar\n" > "$tmpdir/grep.txt"
@@ -90,6 +95,12 @@ test "$g2" = $'2:bar\n3:foo bar'
 
 g3=$("$bin" _exec --file "$tmpdir/grep.txt" "cat $tmpdir/grep.txt | grep -F 'foo bar'" 2>/dev/null | tr -d '\r')
 test "$g3" = $'foo bar'
+# grep -F searches whole chunks; hits at line starts/ends, -n and -v must match per-line results
+printf 'xfoo\nbar\nfoo\n\nbarfoo\nfo' > "$tmpdir/grepf.txt"
+g4=$("$bin" _exec --file "$tmpdir/grepf.txt" "cat $tmpdir/grepf.txt | grep -n -F foo" 2>/dev/null | tr -d '\r')
+test "$g4" = $'1:xfoo\n3:foo\n5:barfoo'
+g5=$("$bin" _exec --file "$tmpdir/grepf.txt" "cat $tmpdir/grepf.txt | grep -n -F -v foo" 2>/dev/null | tr -d '\r')
+test "$g5" = $'2:bar\n4:\n6:fo'
 
 # grep (BRE): '.' should match any char
 printf 'foo\nfoX\nbar\n' > "$tmpdir/grep_re.txt"
@@ -157,6 +168,15 @@ test "$sp1" = $'ZZ\nZZ bar'
 sp2=$("$bin" _exec --file "$tmpdir/sed_subst.txt" "cat $tmpdir/sed_subst.txt | sed -n 's/o/O/gp'" 2>/dev/null | tr -d '\r')
 test "$sp2" = $'fOO\nfOO bar'
 
+# fused line stages give the same output as the chained ones, final partial line included
+printf 'a1\nb2\na3\nxa4\na5' > "$tmpdir/fuse.txt"
+fu1=$("$bin" _exec --file "$tmpdir/fuse.txt" "cat $tmpdir/fuse.txt | sed -n 1,5p | grep a | grep -v x | nl | head -n 2" 2>/dev/null | tr -d '\r')
+test "$fu1" = $'     1\ta1\n     2\ta3'
+fu2=$("$bin" _exec --file "$tmpdir/fuse.txt" "cat $tmpdir/fuse.txt | head -n 10 | grep -v b | sed -n 's/a/A/p' | wc -c" 2>/dev/null | tr -d '\n')
+test "$fu2" = "13"
+fu3=$("$bin" _exec --file "$tmpdir/fuse.txt" "cat $tmpdir/fuse.txt | sed -n 2,9p | nl | grep -n 3" 2>/dev/null | tr -d '\r')
+test "$fu3" = $'2:     2\ta3\n3:     3\txa4'
+
 # pipe: wc
 bytes=$("$bin" _exec --file "$readme" "cat $readme | wc -c" 2>/dev/null | tr -d '\n')
 echo "$bytes" | grep -qE '^[0-9]+$'
@@ -167,6 +187,57 @@ echo "$lines" | grep -qE '^[0-9]+$'
 words=$("$bin" _exec --file "$readme" "cat $readme | wc -w" 2>/dev/null | tr -d '\n')
 echo "$words" | grep -qE '^[0-9]+$'
 
+# streaming engine: files larger than the old 1 MiB whole-file limit
+seq 1 400000 > "$tmpdir/big.txt"
+bg1=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | head -n 2" 2>/dev/null | tr -d '\r')
+test "$bg1" = $'1\n2'
+bg2=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | tail -n 1" 2>/dev/null | tr -d '\r')
+test "$bg2" = "400000"
+bg3=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | grep -n -F 399998" 2>/dev/null | tr -d '\r')
+test "$bg3" = "399998:399998"
+bg6=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | grep -n -F 99999" 2>/dev/null | tr -d '\r')
+test "$bg6" = $'99999:99999\n199999:199999\n299999:299999\n399999:399999'
+bg8=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | grep -n '3999.8' | tail -n 2" 2>/dev/null | tr -d '\r')
+test "$bg8" = $'399988:399988\n399998:399998'
+bg4=$("$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | wc -l" 2>/dev/null | tr -d '\n')
+test "$bg4" = "400000"
+bg5=$("$bin" _exec --file "$tmpdir/big.txt" "sed -n 5,6p $tmpdir/big.txt" 2>/dev/null | tr -d '\r')
+test "$bg5" = $'5\n6'
+# windows deep into a file start from the line index; nl keeps counting from there
+bg9=$("$bin" _exec --file "$tmpdir/big.txt" "nl $tmpdir/big.txt | sed -n 300000,300001p" 2>/dev/null | tr -d '\r')
+test "$bg9" = $'300000\t300000\n300001\t300001'
+bg10=$("$bin" _exec --file "$tmpdir/big.txt" "tail -n 2 $tmpdir/big.txt" 2>/dev/null | tr -d '\r')
+test "$bg10" = $'399999\n400000'
+# per-line stages run on chunks across threads; numbering and order match streaming
+seq 1 1000000 > "$tmpdir/big2.txt"
+bg11=$(AICLI_COMPUTE_THREADS=4 "$bin" _exec --file "$tmpdir/big2.txt" "cat $tmpdir/big2.txt | grep -n 77777 | tail -n 2" 2>/dev/null | tr -d '\r')
+test "$bg11" = $'877777:877777\n977777:977777'
+bg12=$(AICLI_COMPUTE_THREADS=4 "$bin" _exec --file "$tmpdir/big2.txt" "nl $tmpdir/big2.txt | grep -F 999999" 2>/dev/null | tr -d '\r')
+test "$bg12" = $'999999\t999999'
+bg13=$(AICLI_COMPUTE_THREADS=4 "$bin" _exec --file "$tmpdir/big2.txt" "cat $tmpdir/big2.txt | grep 0 | wc -l" 2>/dev/null | tr -d '\n')
+test "$bg13" = "$(grep -c 0 "$tmpdir/big2.txt")"
+# sort spills sorted runs to temp files past its memory budget and merges them
+bg7=$(AICLI_EXECUTE_MEMORY=256K "$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | sort -rn | head -n 2" 2>/dev/null | tr -d '\r')
+test "$bg7" = $'400000\n399999'
+bg14=$(AICLI_EXECUTE_MEMORY=256K "$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | sed -n 's/[0-9]//p' | sort -u | wc -l" 2>/dev/null | tr -d '\n')
+test "$bg14" = "111111"
+# tail keeps only the newest lines that fit in the memory budget and says so
+bg15=$(AICLI_EXECUTE_MEMORY=64K "$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | grep 7 | tail -n 100000" 2>&1 | tr -d '\r')
+assert_contains "$bg15" "AICLI_EXECUTE_MEMORY"
+bg16=$(AICLI_EXECUTE_MEMORY=64K "$bin" _exec --file "$tmpdir/big.txt" "cat $tmpdir/big.txt | grep 7 | tail -n 100000 | tail -n 1" 2>/dev/null | tr -d '\r')
+test "$bg16" = "399997"
+# fused stages after chunk-parallel ones; the fused tail stops at head's limit
+bg17=$(AICLI_COMPUTE_THREADS=4 "$bin" _exec --file "$tmpdir/big2.txt" "cat $tmpdir/big2.txt | grep 7 | grep -v 3 | nl | head -n 100000 | tail -n 1" 2>/dev/null | tr -d '\r')
+test "$bg17" = "$(printf '%6d\t%s' 100000 "$(grep 7 "$tmpdir/big2.txt" | grep -v 3 | sed -n 100000p)")"
+# the run stops once the page is full: the page and next_start are exact, the total a lower bound
+bg18=$("$bin" _exec --start 10 --size 20 --file "$tmpdir/big2.txt" "cat $tmpdir/big2.txt | nl" 2>"$tmpdir/bg18.err" | tr -d '\r')
+test "$bg18" = "$(nl "$tmpdir/big2.txt" | head -c 30 | tail -c 20)"
+assert_contains "$(cat "$tmpdir/bg18.err")" "[total_bytes>="
+assert_contains "$(cat "$tmpdir/bg18.err")" "next_start=30]"
+"$bin" _exec --file "$tmpdir/big2.txt" "cat $tmpdir/big2.txt | grep -F 777777" >/dev/null 2>"$tmpdir/bg18.err"
+assert_contains "$(cat "$tmpdir/bg18.err")" "[total_bytes=7]"
+echo "ok: streaming large file"
+
 # stdin: explicit --stdin and implicit (no --file)
 stdin1=$(printf "z\ny\n" | "$bin" _exec --stdin "cat - | head -n 1" 2>/dev/null | tr -d '\r')
 test "$stdin1" = "z"
@@ -174,6 +245,10 @@ test "$stdin1" = "z"
 stdin2=$(printf "a\nb\n" | "$bin" _exec "cat - | tail -n 1" 2>/dev/null | tr -d '\r')
 test "$stdin2" = "b"
 
+# stdin is spooled to a temp file without a size cap
+stdin3=$(seq 1 400000 | "$bin" _exec --stdin "cat - | tail -n 1" 2>/dev/null | tr -d '\r')
+test "$stdin3" = "400000"
+
 # run + stdin: only a smoke test (requires OPENAI_API_KEY). If missing, skip.
 if [[ -n "${OPENAI_API_KEY:-}" ]]; then
 	run_out=$(printf "HELLO_FROM_STDIN\n" | "$bin" run --stdin --turns 1 --max-tool-calls 1 --tool-threads 1 --force-tool none "Say OK" 2>/dev/null | tr -d '\r')
@@ -181,6 +256,188 @@ if [[ -n "${OPENAI_API_KEY:-}" ]]; then
 	test -n "$run_out"
 fi
 
+# run against a local mock of /v1/responses (offline): tool loop, plain and --stream.
+if command -v python3 >/dev/null 2>&1; then
+	printf "MOCK_LINE_1\nMOCK_LINE_2\n" > "$tmpdir/mock.txt"
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/mock.txt | head -n 1")
+	mock_pid=$!
+	trap 'kill "$mock_pid" 2>/dev/null || true' EXIT
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	m1=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m1" = "TOOL:MOCK_LINE_1"
+	m2=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" run --stream --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m2" = "TOOL:MOCK_LINE_1"
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, plain + stream)"
+
+	# execute paging across turns: the second page comes from the execute cache
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/mock.txt | nl" paged)
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	m3=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" AICLI_DEBUG_FUNCTION_CALL=1 "$bin" run --file "$tmpdir/mock.txt" "q" 2>"$tmpdir/m3.err" | tr -d '\r')
+	test "$m3" = "TOOL:cache_hit=true OCK_LINE"
+	# ...and the second call reuses the compiled pipeline of the first
+	assert_contains "$(cat "$tmpdir/m3.err")" "[debug:pipeline] compiled_hit"
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, execute cache + compiled pipeline)"
+
+	# Pages end on a UTF-8 boundary: a character cut by the page size reaches the model
+	# whole, at the start of the next page (the first page is run, the second comes from
+	# the execute cache).
+	printf 'a\343\201\202\343\201\204\343\201\206\343\201\210\343\201\212\n' > "$tmpdir/utf8.txt"
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/utf8.txt | head -n 1" utf8)
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	for mode in "" --stream; do
+		mu=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" run $mode --file "$tmpdir/utf8.txt" "q" 2>/dev/null | tr -d '\r')
+		test "$mu" = "TOOL:a$(printf '\343\201\202\343\201\204\343\201\206\343\201\210')"
+	done
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, utf-8 page boundaries)"
+
+	# web_fetch paging: both pages come from one GET
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "fetch body: 0123456789abcdef" fetch)
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	m4=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" AICLI_WEB_FETCH_PREFIXES="$mock_url/" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m4" = "TOOL:cache_hit=true dy: 0123 gets=1"
+	echo "ok: run (mock, web_fetch cache)"
+
+	# disk cache: a second process is served from disk; an expired entry is revalidated (304)
+	rm -rf "$tmpdir/xdg"
+	fetch_env=(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" AICLI_WEB_FETCH_PREFIXES="$mock_url/"
+	           AICLI_DISK_CACHE=1 XDG_CACHE_HOME="$tmpdir/xdg")
+	env "${fetch_env[@]}" "$bin" run --file "$tmpdir/mock.txt" "q" >/dev/null 2>&1
+	m5=$(env "${fetch_env[@]}" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m5" = "TOOL:cache_hit=true dy: 0123 gets=2"
+	test "$(find "$tmpdir/xdg/aicli" -name '*.dc' | wc -l)" -eq 1
+	m6=$(env "${fetch_env[@]}" AICLI_DISK_CACHE_TTL=0 "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m6" = "TOOL:cache_hit=true dy: 0123 gets=3"
+	# A daemon does not keep web results in memory past the disk cache's TTL.
+	sock="$tmpdir/aicli-fetch.sock"
+	"$bin" serve --socket "$sock" 2>/dev/null &
+	serve_pid=$!
+	trap 'kill "$mock_pid" "$serve_pid" 2>/dev/null || true' EXIT
+	for _ in $(seq 50); do test -S "$sock" && break; sleep 0.1; done
+	m6=$(env "${fetch_env[@]}" AICLI_DISK_CACHE_TTL=0 AICLI_SOCKET="$sock" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m6" = "TOOL:cache_hit=true dy: 0123 gets=4"
+	m6=$(env "${fetch_env[@]}" AICLI_DISK_CACHE_TTL=0 AICLI_SOCKET="$sock" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m6" = "TOOL:cache_hit=true dy: 0123 gets=5"
+	kill "$serve_pid"
+	wait "$serve_pid"
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, web_fetch disk cache)"
+
+	# per-turn tool budget: a slow web_fetch is answered with a timeout instead of waited for
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "slow body" slowfetch)
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	t0=$SECONDS
+	m7=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" AICLI_WEB_FETCH_PREFIXES="$mock_url/" "$bin" run --tool-timeout 1 --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	assert_contains "$m7" "TOOL:timeout"
+	test $((SECONDS - t0)) -lt 3
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, tool timeout)"
+
+	# Without `size` an execute page is as large as the run's output budget allows.
+	seq 1 100000 > "$tmpdir/pages.txt"
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/pages.txt" pagelen)
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	m8=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" run --file "$tmpdir/pages.txt" "q" 2>/dev/null | tr -d '\r')
+	assert_contains "$m8" "TOOL:bytes=65536"
+	m9=$(OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" AICLI_TOOL_OUTPUT_BUDGET=4K "$bin" run --file "$tmpdir/pages.txt" "q" 2>/dev/null | tr -d '\r')
+	assert_contains "$m9" "TOOL:bytes=4096"
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: run (mock, tool output budget)"
+
+	# aicli serve: the client hands run/_exec to the daemon, which runs them in the client's
+	# directory and environment and on the client's stdin/stdout.
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/mock.txt | head -n 1")
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	sock="$tmpdir/aicli.sock"
+	OPENAI_API_KEY= OPENAI_BASE_URL=http://127.0.0.1:1 "$bin" serve --socket "$sock" 2>/dev/null &
+	serve_pid=$!
+	trap 'kill "$mock_pid" "$serve_pid" 2>/dev/null || true' EXIT
+	for _ in $(seq 50); do test -S "$sock" && break; sleep 0.1; done
+	m10=$(cd "$tmpdir" && AICLI_SOCKET="$sock" OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" run --file mock.txt "q" 2>/dev/null | tr -d '\r')
+	test "$m10" = "TOOL:MOCK_LINE_1"
+	# The next client's environment is its own: without a key the request fails there too.
+	set +e
+	(cd "$tmpdir" && AICLI_SOCKET="$sock" OPENAI_API_KEY= OPENAI_BASE_URL="$mock_url" "$bin" run --file mock.txt "q" >/dev/null 2>&1)
+	m10_rc=$?
+	set -e
+	test "$m10_rc" -ne 0
+	# .aicli.json is found from the client's directory, and read again once it changes.
+	mkdir -p "$tmpdir/home/proj"
+	printf '{"openai_api_key":"test","openai_base_url":"%s"}\n' "$mock_url" > "$tmpdir/home/proj/.aicli.json"
+	chmod 600 "$tmpdir/home/proj/.aicli.json"
+	m10=$(cd "$tmpdir/home/proj" && env -u OPENAI_API_KEY -u OPENAI_BASE_URL HOME="$tmpdir/home" AICLI_SOCKET="$sock" "$bin" run --file "$tmpdir/mock.txt" "q" 2>/dev/null | tr -d '\r')
+	test "$m10" = "TOOL:MOCK_LINE_1"
+	printf '{"openai_api_key":"test","openai_base_url":"http://127.0.0.1:1/v1"}\n' > "$tmpdir/home/proj/.aicli.json"
+	set +e
+	(cd "$tmpdir/home/proj" && env -u OPENAI_API_KEY -u OPENAI_BASE_URL HOME="$tmpdir/home" AICLI_SOCKET="$sock" "$bin" run --file "$tmpdir/mock.txt" "q" >/dev/null 2>&1)
+	m10_rc=$?
+	set -e
+	test "$m10_rc" -ne 0
+	m11=$(printf "A\nB\n" | AICLI_SOCKET="$sock" "$bin" _exec "cat - | head -n 1" 2>/dev/null)
+	test "$m11" = "A"
+	kill "$serve_pid"
+	wait "$serve_pid"
+	test ! -e "$sock"
+	# Without a daemon the command runs here.
+	m12=$(printf "A\nB\n" | AICLI_SOCKET="$sock" "$bin" _exec "cat - | head -n 1" 2>/dev/null)
+	test "$m12" = "A"
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: serve (mock)"
+
+	# aicli batch: one JSONL line per request, each with its own allowlist, answered
+	# concurrently in completion order
+	exec 3< <(exec python3 "$repo_root/tests/mock_openai.py" "cat $tmpdir/mock.txt | head -n 1")
+	mock_pid=$!
+	read -r mock_port <&3
+	mock_url="http://127.0.0.1:$mock_port"
+	{
+		for i in 0 1 2 3 4 5; do
+			printf '{"id":"r%s","prompt":"q","files":["%s"]}\n' "$i" "$tmpdir/mock.txt"
+		done
+		printf '\n{"prompt":"q"}\nnot json\n{"id":7,"files":[]}\n'
+		# a missing file whose name the error message cuts short mid-character
+		printf '{"id":"long","prompt":"q","files":["x%s"]}\n' "$(printf 'あ%.0s' $(seq 200))"
+	} > "$tmpdir/batch.jsonl"
+	set +e
+	OPENAI_API_KEY=test OPENAI_BASE_URL="$mock_url" "$bin" batch --input "$tmpdir/batch.jsonl" --concurrency 3 > "$tmpdir/batch.out" 2>/dev/null
+	rc=$?
+	set -e
+	test $rc -eq 1
+	test "$(wc -l < "$tmpdir/batch.out")" -eq 10
+	python3 -c 'import json, sys; [json.loads(l) for l in open(sys.argv[1], encoding="utf-8")]' "$tmpdir/batch.out"
+	test "$(grep -c '"ok":true,"text":"TOOL:MOCK_LINE_1"' "$tmpdir/batch.out")" -eq 6
+	assert_contains "$(cat "$tmpdir/batch.out")" '{"index":3,"id":"r3","ok":true,'
+	assert_contains "$(cat "$tmpdir/batch.out")" '{"index":7,"ok":true,"text":"TOOL:file_not_allowed"'
+	assert_contains "$(cat "$tmpdir/batch.out")" '{"index":8,"ok":false,"error":"invalid request line:'
+	assert_contains "$(cat "$tmpdir/batch.out")" '{"index":9,"id":7,"ok":false,"error":"missing prompt"}'
+	assert_contains "$(cat "$tmpdir/batch.out")" '{"index":10,"id":"long","ok":false,"error":"invalid file: xあ'
+	kill "$mock_pid" 2>/dev/null || true
+	exec 3<&-
+	echo "ok: batch (mock)"
+fi
+
 # path traversal should be rejected unless it resolves to allowed realpath
 mkdir -p "$tmpdir"
 echo "X" > "$tmpdir/x.txt"